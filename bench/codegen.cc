@@ -0,0 +1,125 @@
+/* Code generation benchmark.
+ *
+ * Compiles a set of compute kernels three ways and times them from the
+ * same harness:
+ *
+ *   gabriel    the gabriel binary with -S, assembled by the system compiler
+ *   gcc_O0     the system compiler at -O0
+ *   gcc_O1     the system compiler at -O1
+ *
+ * The harness itself is always built by the system compiler at -O1, it
+ * calls each kernel many times over a buffer reset before every round and
+ * keeps the best round. Checksums of the three builds must agree. The
+ * results, with speedups of gabriel over each gcc build and their
+ * geometric means, are printed as one JSON object on stdout.
+ *
+ * usage: codegen [scale] [rounds] [kernel...]
+ *
+ * The compiler binary defaults to ./gabriel, override it with GABRIEL,
+ * and the system compiler defaults to cc, override it with CC. */
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "harness.hh"
+#include "kernels.hh"
+
+enum {
+    BUILD_GABRIEL,
+    BUILD_O0,
+    BUILD_O1,
+    BUILD_LAST,
+};
+
+static const char *build_names[] = { "gabriel", "gcc_O0", "gcc_O1" };
+
+static bool build(int which, const std::string& dir, const char *compiler, const char *cc)
+{
+    std::string object = dir + "/" + build_names[which] + ".o";
+
+    if (which == BUILD_GABRIEL) {
+        if (!bench::compile_kernels(compiler, {}, cc, dir, build_names[which]))
+            return false;
+    } else {
+        if (!bench::spawn({ cc, which == BUILD_O0 ? "-O0" : "-O1", "-w", "-include", "stdint.h",
+                            "-include", "stddef.h", "-c", "-o", object, dir + "/kernels.c" }))
+            return false;
+    }
+
+    return bench::link_harness(cc, dir, build_names[which]);
+}
+
+int main(int argc, char **argv)
+{
+    const char *scale    = argc > 1 ? argv[1] : "1";
+    const char *rounds   = argc > 2 ? argv[2] : "5";
+    const char *compiler = getenv("GABRIEL") ? getenv("GABRIEL") : "./gabriel";
+    const char *cc       = getenv("CC") ? getenv("CC") : "cc";
+    std::vector<std::string> args = { scale, rounds };
+    std::map<std::string, bench::timing_t> timings[BUILD_LAST];
+    std::vector<std::string> names;
+    char dir[] = "/tmp/gabriel-codegen-XXXXXX";
+    double log_o0 = 0, log_o1 = 0;
+    bool ok = true;
+
+    for (int i = 3; i < argc; ++i)
+        args.push_back(argv[i]);
+
+    if (!mkdtemp(dir)) {
+        perror("failed to create a directory");
+        return EXIT_FAILURE;
+    }
+
+    if (!bench::write_file(std::string(dir) + "/kernels.c", bench::kernels_source) ||
+        !bench::write_file(std::string(dir) + "/harness.c", bench::harness_source)) {
+        fprintf(stderr, "failed to write the kernels\n");
+        ok = false;
+    }
+
+    for (int b = 0; ok && b < BUILD_LAST; ++b)
+        ok = build(b, dir, compiler, cc) && bench::measure(dir, build_names[b], args, timings[b], &names);
+
+    bench::spawn({ "rm", "-rf", dir });
+
+    if (!ok)
+        return EXIT_FAILURE;
+
+    if (names.empty()) {
+        fprintf(stderr, "no kernel matched\n");
+        return EXIT_FAILURE;
+    }
+
+    printf("{\n  \"scale\": %s,\n  \"rounds\": %s,\n  \"kernels\": [\n", scale, rounds);
+
+    for (size_t i = 0; i < names.size(); ++i) {
+        const bench::timing_t& gab = timings[BUILD_GABRIEL][names[i]];
+        const bench::timing_t& o0  = timings[BUILD_O0][names[i]];
+        const bench::timing_t& o1  = timings[BUILD_O1][names[i]];
+        bool match = gab.checksum == o0.checksum && gab.checksum == o1.checksum;
+
+        log_o0 += std::log(o0.seconds / gab.seconds);
+        log_o1 += std::log(o1.seconds / gab.seconds);
+
+        printf("    {\n"
+               "      \"name\": \"%s\",\n"
+               "      \"checksums_match\": %s,\n"
+               "      \"seconds\": { \"gabriel\": %.6f, \"gcc_O0\": %.6f, \"gcc_O1\": %.6f },\n"
+               "      \"speedup\": { \"vs_O0\": %.3f, \"vs_O1\": %.3f }\n"
+               "    }%s\n",
+               names[i].c_str(), match ? "true" : "false",
+               gab.seconds, o0.seconds, o1.seconds,
+               o0.seconds / gab.seconds, o1.seconds / gab.seconds,
+               i + 1 < names.size() ? "," : "");
+
+        ok &= match;
+    }
+
+    printf("  ],\n  \"geomean_speedup\": { \"vs_O0\": %.3f, \"vs_O1\": %.3f }\n}\n",
+           std::exp(log_o0 / names.size()), std::exp(log_o1 / names.size()));
+
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,237 @@
+#ifndef __CORPUS_HH__
+#define __CORPUS_HH__
+
+/* Deterministic synthetic C corpora for the benchmarks.
+ *
+ * Every shape is generated from a fixed seed so the same size always
+ * produces byte-identical input and numbers stay comparable between
+ * runs and machines. All shapes are accepted by the parser, so the same
+ * corpus drives the tokenizer, the parser and end-to-end benchmarks. */
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+namespace bench {
+
+    typedef enum corpus_shape {
+        CORPUS_CODE,        /* plain functions with loops and conditionals */
+        CORPUS_HEADER,      /* comment-heavy vendor header full of prototypes */
+        CORPUS_EXPRESSIONS, /* few functions returning deeply nested expressions */
+        CORPUS_FUNCTIONS,   /* many tiny functions calling each other */
+        CORPUS_TABLES,      /* huge runs of initialized globals */
+        CORPUS_LAST,
+    } corpus_shape_t;
+
+    static const char *__corpus_str[] = {
+        "code",
+        "header",
+        "expressions",
+        "functions",
+        "tables",
+    };
+
+    static inline const char *corpus_name(bench::corpus_shape_t shape)
+    {
+        return __corpus_str[shape];
+    }
+
+    /* return CORPUS_LAST if name isn't a known shape */
+    static inline bench::corpus_shape_t corpus_shape(const char *name)
+    {
+        for (int i = 0; i < CORPUS_LAST; ++i) {
+            if (!strcmp(__corpus_str[i], name))
+                return (bench::corpus_shape_t)i;
+        }
+
+        return CORPUS_LAST;
+    }
+
+    /* linear congruential generator, identical on every platform */
+    static inline unsigned next(unsigned& seed)
+    {
+        return seed = seed * 1103515245 + 12345;
+    }
+
+    static inline std::string generate_code(size_t size)
+    {
+        static const char *types[] = { "int", "uint32_t", "size_t", "uint8_t", "long" };
+        static const char *ops[]   = { "+", "-", "*", "<<", ">>", "&", "|", "^", "%" };
+        unsigned seed = 12345;
+        std::string out;
+        char buf[512];
+
+        for (int fn = 0; out.size() < size; ++fn) {
+            next(seed);
+
+            snprintf(buf, sizeof(buf),
+                "/* helper number %d */\n"
+                "static %s compute_%d(%s value, %s *buffer, size_t len)\n"
+                "{\n"
+                "    %s result = 0x%x;\n"
+                "\n"
+                "    for (size_t i = 0; i < len; ++i) {\n"
+                "        result %s= buffer[i] %s (value >> %u);\n"
+                "        if (result >= %u && buffer[i] != 0)\n"
+                "            result -= value--;\n"
+                "    }\n"
+                "\n"
+                "    return result;\n"
+                "}\n\n",
+                fn, types[seed % 5], fn, types[(seed >> 3) % 5], types[(seed >> 6) % 5],
+                types[(seed >> 9) % 5], seed & 0xffff, ops[(seed >> 12) % 3], ops[(seed >> 14) % 9],
+                (seed >> 18) % 16, (seed >> 20) % 1000);
+            out += buf;
+        }
+
+        return out;
+    }
+
+    static inline std::string generate_header(size_t size)
+    {
+        unsigned seed = 54321;
+        std::string out;
+        char buf[1024];
+
+        for (int fn = 0; out.size() < size; ++fn) {
+            next(seed);
+
+            snprintf(buf, sizeof(buf),
+                "/**\n"
+                " * vendor_api_call_%d - perform operation %u on the device context\n"
+                " *\n"
+                " * @ctx:    device context returned by vendor_open(), must not be NULL\n"
+                " * @flags:  combination of VENDOR_FLAG_* values, unknown bits are ignored\n"
+                " * @buffer: caller-owned buffer of at least @len bytes\n"
+                " *\n"
+                " * Returns zero on success or a negative error code on failure. The call\n"
+                " * may block if the device queue is full, see vendor_set_timeout().\n"
+                " */\n"
+                "extern int vendor_api_call_%d(void *ctx, uint32_t flags, uint8_t *buffer, size_t len); // %u\n\n",
+                fn, seed % 1000, fn, seed);
+            out += buf;
+        }
+
+        return out;
+    }
+
+    /* random expression nested depth levels deep */
+    static inline void expression(std::string& out, unsigned& seed, int depth)
+    {
+        static const char *ops[]    = { "+", "-", "*", "/", "%", "<<", ">>", "&", "|", "^", "&&", "||", "<", "==" };
+        static const char *leaves[] = { "a", "b", "c", "d" };
+        char buf[32];
+
+        if (depth == 0) {
+            if (next(seed) & 1) {
+                out += leaves[(seed >> 8) % 4];
+            } else {
+                snprintf(buf, sizeof(buf), "%u", (seed >> 8) % 1000);
+                out += buf;
+            }
+            return;
+        }
+
+        switch ((next(seed) >> 8) % 4) {
+            case 0:
+                out += '(';
+                expression(out, seed, depth - 1);
+                out += ") ? ";
+                expression(out, seed, depth - 1);
+                out += " : ";
+                expression(out, seed, depth - 1);
+                break;
+
+            case 1:
+                out += "-(";
+                expression(out, seed, depth - 1);
+                out += ')';
+                break;
+
+            default:
+                out += '(';
+                expression(out, seed, depth - 1);
+                out += ' ';
+                out += ops[(seed >> 12) % 14];
+                out += ' ';
+                expression(out, seed, depth - 1);
+                out += ')';
+                break;
+        }
+    }
+
+    static inline std::string generate_expressions(size_t size)
+    {
+        unsigned seed = 777;
+        std::string out;
+        char buf[128];
+
+        for (int fn = 0; out.size() < size; ++fn) {
+            snprintf(buf, sizeof(buf), "int eval_%d(int a, int b, int c, int d)\n{\n    return ", fn);
+            out += buf;
+            expression(out, seed, 10);
+            out += ";\n}\n\n";
+        }
+
+        return out;
+    }
+
+    static inline std::string generate_functions(size_t size)
+    {
+        unsigned seed = 4242;
+        std::string out;
+        char buf[256];
+
+        for (int fn = 0; out.size() < size; ++fn) {
+            next(seed);
+
+            if (fn == 0) {
+                out += "int f_0(int x) { return x; }\n";
+                continue;
+            }
+
+            snprintf(buf, sizeof(buf),
+                "int f_%d(int x) { int y = f_%u(x + %u); return y * %u; }\n",
+                fn, (seed >> 8) % fn, (seed >> 4) % 16, (seed >> 12) % 7 + 1);
+            out += buf;
+        }
+
+        return out;
+    }
+
+    static inline std::string generate_tables(size_t size)
+    {
+        unsigned seed = 99;
+        std::string out;
+        char buf[64];
+
+        for (int table = 0; out.size() < size; ++table) {
+            snprintf(buf, sizeof(buf), "static const uint32_t table_%d_0 = 0x%x", table, next(seed) & 0xffffff);
+            out += buf;
+
+            for (int i = 1; i < 256; ++i) {
+                snprintf(buf, sizeof(buf), ",\n    table_%d_%d = 0x%x", table, i, next(seed) & 0xffffff);
+                out += buf;
+            }
+
+            out += ";\n\n";
+        }
+
+        return out;
+    }
+
+    /* roughly size bytes (never less) of the given shape */
+    static inline std::string generate(bench::corpus_shape_t shape, size_t size)
+    {
+        switch (shape) {
+            case CORPUS_CODE:        return generate_code(size);
+            case CORPUS_HEADER:      return generate_header(size);
+            case CORPUS_EXPRESSIONS: return generate_expressions(size);
+            case CORPUS_FUNCTIONS:   return generate_functions(size);
+            case CORPUS_TABLES:      return generate_tables(size);
+            default:                 return std::string();
+        }
+    }
+};
+
+#endif /* __CORPUS_HH__ */
@@ -0,0 +1,129 @@
+#ifndef __HARNESS_HH__
+#define __HARNESS_HH__
+
+/* Helpers shared by the benchmarks that build and run other programs.
+ *
+ * Builds work in a scratch directory holding kernels.c and harness.c
+ * from kernels.hh. A build named name is dir/name, linked from the
+ * harness and dir/name.o, and its run prints "name seconds checksum"
+ * per kernel to dir/name.out. */
+
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace bench {
+
+    typedef struct timing {
+        double seconds;
+        std::string checksum;
+    } timing_t;
+
+    static inline double elapsed_since(std::chrono::steady_clock::time_point start)
+    {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    static inline void keep_best(double& best, double t)
+    {
+        if (best == 0 || t < best)
+            best = t;
+    }
+
+    /* run argv with stdout to out (discarded if empty), false if it failed */
+    static inline bool spawn(const std::vector<std::string>& argv, const std::string& out = "")
+    {
+        std::vector<char *> args;
+        int status;
+        pid_t pid;
+
+        for (const std::string& arg : argv)
+            args.push_back(const_cast<char *>(arg.c_str()));
+        args.push_back(nullptr);
+
+        if ((pid = fork()) < 0)
+            return false;
+
+        if (pid == 0) {
+            int fd = open(out.empty() ? "/dev/null" : out.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+            dup2(fd, STDOUT_FILENO);
+            execvp(args[0], args.data());
+            _exit(127);
+        }
+
+        if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            fprintf(stderr, "%s failed\n", argv[0].c_str());
+            return false;
+        }
+
+        return true;
+    }
+
+    static inline bool write_file(const std::string& path, const char *text)
+    {
+        std::ofstream file(path);
+
+        file << text;
+        return file.good();
+    }
+
+    /* gabriel -S with flags over kernels.c, assembled into dir/name.o right
+     * away as kernels.c.s is overwritten by the next build */
+    static inline bool compile_kernels(const char *compiler, const std::vector<std::string>& flags, const char *cc,
+                                       const std::string& dir, const std::string& name)
+    {
+        std::vector<std::string> argv = { compiler };
+        std::string source = dir + "/kernels.c";
+
+        argv.insert(argv.end(), flags.begin(), flags.end());
+        argv.insert(argv.end(), { "-S", source });
+
+        return spawn(argv) && spawn({ cc, "-c", "-o", dir + "/" + name + ".o", source + ".s" });
+    }
+
+    /* link dir/name from the harness, built at -O1, and dir/name.o */
+    static inline bool link_harness(const char *cc, const std::string& dir, const std::string& name)
+    {
+        return spawn({ cc, "-O1", "-o", dir + "/" + name, dir + "/harness.c", dir + "/" + name + ".o" });
+    }
+
+    /* run dir/name with args, its timings by kernel name and, if names
+     * isn't nullptr, the names in the order run */
+    static inline bool measure(const std::string& dir, const std::string& name, const std::vector<std::string>& args,
+                               std::map<std::string, timing_t>& timings, std::vector<std::string> *names = nullptr)
+    {
+        std::vector<std::string> argv = { dir + "/" + name };
+        std::string out = dir + "/" + name + ".out";
+        std::string kernel;
+        timing_t timing;
+
+        argv.insert(argv.end(), args.begin(), args.end());
+
+        if (!spawn(argv, out))
+            return false;
+
+        std::ifstream file(out);
+
+        if (names)
+            names->clear();
+
+        while (file >> kernel >> timing.seconds >> timing.checksum) {
+            timings[kernel] = timing;
+
+            if (names)
+                names->push_back(kernel);
+        }
+
+        return true;
+    }
+};
+
+#endif /* __HARNESS_HH__ */
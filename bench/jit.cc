@@ -0,0 +1,242 @@
+/* JIT latency benchmark.
+ *
+ * Takes the compute kernels of kernels.hh from source to a first call
+ * three ways and reports where the time goes:
+ *
+ *   jit         in process: tokenize and parse, lower and optimize the
+ *               IR, encode the machine code, link it in memory with
+ *               gcc::jit and call sum_u8 once
+ *   toolchain   gabriel -S, the system compiler to assemble it and to
+ *               link it with the harness, then the harness run with no
+ *               kernel work (scale 0)
+ *   object      the same with gabriel -c writing the object itself, no
+ *               assembler
+ *
+ * The harness is compiled to an object once, outside of the timings.
+ * Each step is the best of several rounds, the toolchain routes take
+ * turns. The results are printed as one JSON object on stdout, in
+ * milliseconds, with the speedups over the toolchain route.
+ *
+ * usage: jit [rounds]
+ *
+ * The compiler binary defaults to ./gabriel, override it with GABRIEL,
+ * and the system compiler defaults to cc, override it with CC. */
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "codegen.hh"
+#include "encoder.hh"
+#include "harness.hh"
+#include "jit.hh"
+#include "kernels.hh"
+#include "lower.hh"
+#include "parser.hh"
+#include "pass.hh"
+#include "tokenizer.hh"
+
+enum {
+    JIT_FRONT_END,
+    JIT_IR,
+    JIT_ENCODE,
+    JIT_LINK,
+    JIT_CALL,
+    JIT_LAST,
+};
+
+enum {
+    TOOLCHAIN_COMPILE,
+    TOOLCHAIN_ASSEMBLE,
+    TOOLCHAIN_LINK,
+    TOOLCHAIN_RUN,
+    TOOLCHAIN_LAST,
+};
+
+static const char *jit_names[]       = { "front_end", "ir", "encode", "link", "first_call" };
+static const char *toolchain_names[] = { "compile", "assemble", "link", "run" };
+
+/* one round in process, the time of each step in times */
+static bool run_jit(const std::string& source, double *times)
+{
+    typedef long (*kernel_t)(uint8_t *, size_t);
+
+    static uint8_t buf[64];
+    long expected = 0;
+    gcc::tokenizer tokenizer;
+    gcc::parser parser;
+    gcc::ir::module module;
+    gcc::ir::lowering lowering;
+    gcc::ir::pass_manager passes;
+    gcc::x86::object_t object;
+    gcc::x86::codegen codegen;
+    gcc::jit jit;
+    kernel_t kernel;
+
+    for (size_t i = 0; i < sizeof(buf); ++i)
+        expected += buf[i] = (uint8_t)(i * 131 + 7);
+
+    auto start = std::chrono::steady_clock::now();
+
+    if (tokenizer.tokenize(source.c_str()) != GCC_SUCCESS ||
+        parser.parse(tokenizer.get_token_stream()) != GCC_SUCCESS)
+        return false;
+
+    times[JIT_FRONT_END] = bench::elapsed_since(start);
+    start = std::chrono::steady_clock::now();
+
+    if (lowering.run(*parser.get_prog(), module) != GCC_SUCCESS)
+        return false;
+
+    passes.add_defaults(1);
+
+    if (passes.run(module) != GCC_SUCCESS)
+        return false;
+
+    times[JIT_IR] = bench::elapsed_since(start);
+    start = std::chrono::steady_clock::now();
+
+    {
+        gcc::x86::encoder encoder(object);
+
+        if (codegen.run(module, encoder) != GCC_SUCCESS)
+            return false;
+    }
+
+    times[JIT_ENCODE] = bench::elapsed_since(start);
+    start = std::chrono::steady_clock::now();
+
+    jit.add(std::move(object));
+
+    if (jit.link() != GCC_SUCCESS || !(kernel = (kernel_t)jit.lookup("sum_u8")))
+        return false;
+
+    times[JIT_LINK] = bench::elapsed_since(start);
+    start = std::chrono::steady_clock::now();
+
+    long result = kernel(buf, sizeof(buf));
+
+    times[JIT_CALL] = bench::elapsed_since(start);
+
+    if (result != expected) {
+        fprintf(stderr, "sum_u8 returned %ld instead of %ld\n", result, expected);
+        return false;
+    }
+
+    return true;
+}
+
+/* one round through the system toolchain, the time of each step in
+ * times, with gabriel -c instead of assembling if object is set */
+static bool run_toolchain(const std::string& dir, const char *compiler, const char *cc, bool object, double *times)
+{
+    std::string source = dir + "/kernels.c";
+    auto start = std::chrono::steady_clock::now();
+
+    if (!bench::spawn({ compiler, object ? "-c" : "-S", source }))
+        return false;
+
+    times[TOOLCHAIN_COMPILE] = bench::elapsed_since(start);
+    start = std::chrono::steady_clock::now();
+
+    if (!object && !bench::spawn({ cc, "-c", "-o", source + ".o", source + ".s" }))
+        return false;
+
+    times[TOOLCHAIN_ASSEMBLE] = bench::elapsed_since(start);
+    start = std::chrono::steady_clock::now();
+
+    if (!bench::spawn({ cc, "-o", dir + "/harness", dir + "/harness.o", source + ".o" }))
+        return false;
+
+    times[TOOLCHAIN_LINK] = bench::elapsed_since(start);
+    start = std::chrono::steady_clock::now();
+
+    if (!bench::spawn({ dir + "/harness", "0", "1", "sum_u8" }))
+        return false;
+
+    times[TOOLCHAIN_RUN] = bench::elapsed_since(start);
+
+    return true;
+}
+
+static void print_steps(const char *name, const char **names, const double *best, int count, double total)
+{
+    printf("  \"%s_ms\": {", name);
+
+    for (int i = 0; i < count; ++i)
+        printf(" \"%s\": %.3f,", names[i], best[i] * 1e3);
+
+    printf(" \"total\": %.3f },\n", total * 1e3);
+}
+
+int main(int argc, char **argv)
+{
+    int rounds           = argc > 1 ? atoi(argv[1]) : 10;
+    const char *compiler = getenv("GABRIEL") ? getenv("GABRIEL") : "./gabriel";
+    const char *cc       = getenv("CC") ? getenv("CC") : "cc";
+    double jit_best[JIT_LAST] = { 0 }, toolchain_best[2][TOOLCHAIN_LAST] = { { 0 } };
+    double jit_total = 0, toolchain_total[2] = { 0 };
+    char dir[] = "/tmp/gabriel-jit-XXXXXX";
+    bool ok = true;
+
+    if (!mkdtemp(dir)) {
+        perror("failed to create a directory");
+        return EXIT_FAILURE;
+    }
+
+    if (!bench::write_file(std::string(dir) + "/kernels.c", bench::kernels_source) ||
+        !bench::write_file(std::string(dir) + "/harness.c", bench::harness_source)) {
+        fprintf(stderr, "failed to write the kernels\n");
+        ok = false;
+    }
+
+    ok = ok && bench::spawn({ cc, "-O1", "-c", "-o", std::string(dir) + "/harness.o", std::string(dir) + "/harness.c" });
+
+    for (int r = 0; ok && r < rounds; ++r) {
+        double times[JIT_LAST], sum = 0;
+
+        if (!(ok = run_jit(std::string(dir) + "/kernels.c", times))) {
+            fprintf(stderr, "failed to run the kernels in process\n");
+            break;
+        }
+
+        for (int i = 0; i < JIT_LAST; ++i) {
+            bench::keep_best(jit_best[i], times[i]);
+            sum += times[i];
+        }
+
+        bench::keep_best(jit_total, sum);
+    }
+
+    for (int r = 0; ok && r < rounds * 2; ++r) {
+        double times[TOOLCHAIN_LAST], sum = 0;
+        bool object = r % 2;
+
+        if (!(ok = run_toolchain(dir, compiler, cc, object, times)))
+            break;
+
+        for (int i = 0; i < TOOLCHAIN_LAST; ++i) {
+            bench::keep_best(toolchain_best[object][i], times[i]);
+            sum += times[i];
+        }
+
+        bench::keep_best(toolchain_total[object], sum);
+    }
+
+    bench::spawn({ "rm", "-rf", dir });
+
+    if (!ok)
+        return EXIT_FAILURE;
+
+    printf("{\n  \"rounds\": %d,\n", rounds);
+    print_steps("jit", jit_names, jit_best, JIT_LAST, jit_total);
+    print_steps("toolchain", toolchain_names, toolchain_best[0], TOOLCHAIN_LAST, toolchain_total[0]);
+    print_steps("object", toolchain_names, toolchain_best[1], TOOLCHAIN_LAST, toolchain_total[1]);
+    printf("  \"speedup\": { \"jit\": %.1f, \"object\": %.2f }\n}\n",
+           toolchain_total[0] / jit_total, toolchain_total[0] / toolchain_total[1]);
+
+    return EXIT_SUCCESS;
+}
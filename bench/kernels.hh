@@ -0,0 +1,232 @@
+#ifndef __KERNELS_HH__
+#define __KERNELS_HH__
+
+/* Compute kernels for the code generation benchmarks.
+ *
+ * Every kernel(buf, n) works on a 64 KiB buffer and returns a checksum,
+ * the harness calls each many times over a buffer reset before every
+ * round and prints "name seconds checksum" per kernel. The kernels only
+ * use what gabriel compiles, the harness is built by the system compiler. */
+
+namespace bench {
+
+    static const char *kernels_source = R"(long sum_u8(uint8_t *buf, size_t n)
+{
+    long s = 0;
+
+    for (size_t i = 0; i < n; ++i)
+        s += buf[i];
+
+    return s;
+}
+
+long copy_u8(uint8_t *buf, size_t n)
+{
+    uint8_t *dst = buf + n / 2;
+
+    for (size_t i = 0; i < n / 2; ++i)
+        dst[i] = buf[i];
+
+    return dst[n / 4];
+}
+
+long dot_u32(uint8_t *buf, size_t n)
+{
+    uint32_t *a = (uint32_t *)buf;
+    uint32_t *b = a + n / 8;
+    uint32_t s = 0;
+
+    for (size_t i = 0; i < n / 8; ++i)
+        s += a[i] * b[i];
+
+    return s;
+}
+
+long saxpy_u32(uint8_t *buf, size_t n)
+{
+    uint32_t *x = (uint32_t *)buf;
+    uint32_t *y = x + n / 8;
+
+    for (size_t i = 0; i < n / 8; ++i)
+        y[i] = 3 * x[i] + y[i];
+
+    return y[n / 16];
+}
+
+long crc32(uint8_t *buf, size_t n)
+{
+    uint32_t poly = 0xEDB88320;
+    uint32_t crc = 0;
+
+    crc = ~crc;
+
+    for (size_t i = 0; i < n; ++i) {
+        crc = crc ^ buf[i];
+
+        for (int k = 0; k < 8; ++k)
+            crc = (crc >> 1) ^ (poly & (0 - (crc & 1)));
+    }
+
+    return ~crc;
+}
+
+long collatz(uint8_t *buf, size_t n)
+{
+    long steps = 0;
+
+    for (size_t i = 1; i < n; ++i) {
+        size_t x = i;
+
+        while (x != 1) {
+            if (x & 1)
+                x = 3 * x + 1;
+            else
+                x = x >> 1;
+            steps++;
+        }
+    }
+
+    return steps + buf[0];
+}
+
+long sieve(uint8_t *buf, size_t n)
+{
+    long count = 0;
+
+    for (size_t i = 0; i < n; ++i)
+        buf[i] = 1;
+
+    for (size_t i = 2; i * i < n; ++i) {
+        if (buf[i]) {
+            for (size_t j = i * i; j < n; j += i)
+                buf[j] = 0;
+        }
+    }
+
+    for (size_t i = 2; i < n; ++i)
+        count += buf[i];
+
+    return count;
+}
+
+long matmul(uint8_t *buf, size_t n)
+{
+    uint32_t *a = (uint32_t *)buf;
+    size_t m = 48;
+    uint32_t *b = a + m * m;
+    uint32_t *c = b + m * m;
+
+    for (size_t i = 0; i < m; ++i) {
+        for (size_t j = 0; j < m; ++j) {
+            uint32_t s = 0;
+
+            for (size_t k = 0; k < m; ++k)
+                s += a[i * m + k] * b[k * m + j];
+
+            c[i * m + j] = s;
+        }
+    }
+
+    return c[m * m / 2 + n % 7];
+}
+
+static long fib(long x)
+{
+    if (x < 2)
+        return x;
+    return fib(x - 1) + fib(x - 2);
+}
+
+long fib_rec(uint8_t *buf, size_t n)
+{
+    return fib(n) + buf[0];
+}
+)";
+
+    static const char *harness_source = R"(#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+long sum_u8(uint8_t *, size_t);
+long copy_u8(uint8_t *, size_t);
+long dot_u32(uint8_t *, size_t);
+long saxpy_u32(uint8_t *, size_t);
+long crc32(uint8_t *, size_t);
+long collatz(uint8_t *, size_t);
+long sieve(uint8_t *, size_t);
+long matmul(uint8_t *, size_t);
+long fib_rec(uint8_t *, size_t);
+
+static const struct {
+    const char *name;
+    long (*fn)(uint8_t *, size_t);
+    size_t n;
+    int calls;
+} kernels[] = {
+    { "sum_u8",    sum_u8,    1 << 16, 200 },
+    { "copy_u8",   copy_u8,   1 << 16, 200 },
+    { "dot_u32",   dot_u32,   1 << 16, 400 },
+    { "saxpy_u32", saxpy_u32, 1 << 16, 400 },
+    { "crc32",     crc32,     1 << 12, 100 },
+    { "collatz",   collatz,   1 << 12, 20 },
+    { "sieve",     sieve,     1 << 16, 100 },
+    { "matmul",    matmul,    1 << 16, 20 },
+    { "fib_rec",   fib_rec,   22,      20 },
+};
+
+static uint8_t buf[1 << 16];
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* harness scale rounds [kernel...], prints "name seconds checksum" per kernel */
+int main(int argc, char **argv)
+{
+    int scale = argc > 1 ? atoi(argv[1]) : 1;
+    int rounds = argc > 2 ? atoi(argv[2]) : 5;
+
+    for (size_t k = 0; k < sizeof(kernels) / sizeof(kernels[0]); ++k) {
+        double best = 0;
+        long check = 0;
+        int selected = argc <= 3;
+
+        for (int a = 3; a < argc; ++a)
+            selected |= !strcmp(argv[a], kernels[k].name);
+
+        if (!selected)
+            continue;
+
+        for (int r = 0; r < rounds; ++r) {
+            double start;
+
+            for (size_t i = 0; i < sizeof(buf); ++i)
+                buf[i] = (uint8_t)(i * 131 + 7);
+
+            check = 0;
+            start = now();
+
+            for (int c = 0; c < kernels[k].calls * scale; ++c)
+                check += kernels[k].fn(buf, kernels[k].n);
+
+            start = now() - start;
+
+            if (r == 0 || start < best)
+                best = start;
+        }
+
+        printf("%s %.6f %ld\n", kernels[k].name, best, check);
+    }
+
+    return 0;
+}
+)";
+};
+
+#endif /* __KERNELS_HH__ */
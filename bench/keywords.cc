@@ -0,0 +1,120 @@
+/* Keyword recognition micro-benchmark.
+ *
+ * Compares the linear strncmp() table the tokenizer used to walk for
+ * every word against the perfect hash in keywords.hh on a keyword-heavy
+ * corpus (roughly two thirds of the words are reserved words). */
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "keywords.hh"
+
+static const struct {
+    const char *s;
+    gcc::token_type_t type;
+} linear_keywords[] = {
+    { "break",    gcc::TT_BREAK },    { "case",     gcc::TT_CASE },
+    { "char",     gcc::TT_CHAR },     { "const",    gcc::TT_CONST },
+    { "continue", gcc::TT_CONTINUE }, { "default",  gcc::TT_DEFAULT },
+    { "do",       gcc::TT_DO },       { "double",   gcc::TT_DOUBLE },
+    { "else",     gcc::TT_ELSE },     { "enum",     gcc::TT_ENUM },
+    { "extern",   gcc::TT_EXTERN },   { "float",    gcc::TT_FLOAT },
+    { "for",      gcc::TT_FOR },      { "goto",     gcc::TT_GOTO },
+    { "if",       gcc::TT_IF },       { "inline",   gcc::TT_INLINE },
+    { "int",      gcc::TT_INT },      { "long",     gcc::TT_LONG },
+    { "register", gcc::TT_REGISTER }, { "restrict", gcc::TT_RESTRICT },
+    { "return",   gcc::TT_RETURN },   { "short",    gcc::TT_SHORT },
+    { "signed",   gcc::TT_SIGNED },   { "sizeof",   gcc::TT_SIZEOF },
+    { "static",   gcc::TT_STATIC },   { "struct",   gcc::TT_STRUCT },
+    { "switch",   gcc::TT_SWITCH },   { "typedef",  gcc::TT_TYPEDEF },
+    { "union",    gcc::TT_UNION },    { "unsigned", gcc::TT_UNSIGNED },
+    { "void",     gcc::TT_VOID },     { "volatile", gcc::TT_VOLATILE },
+    { "while",    gcc::TT_WHILE },    { "uint8_t",  gcc::TT_U8 },
+    { "uint16_t", gcc::TT_U16 },      { "uint32_t", gcc::TT_U32 },
+    { "uint64_t", gcc::TT_U64 },      { "int8_t",   gcc::TT_I8 },
+    { "int16_t",  gcc::TT_I16 },      { "int32_t",  gcc::TT_I32 },
+    { "int64_t",  gcc::TT_I64 },      { "size_t",   gcc::TT_SIZET }
+};
+
+static const char *identifiers[] = {
+    "i", "len", "buffer", "ptr", "node", "tokens", "value", "result",
+    "counter", "index", "flags", "data", "iffy", "format", "doit",
+};
+
+/* the old tokenizer::get_keyword() loop */
+static gcc::token_type_t linear_lookup(const char *s)
+{
+    for (int i = 0; i < 42; ++i) {
+        if (!strncmp(s, linear_keywords[i].s, strlen(linear_keywords[i].s))) {
+            if (!isalnum(*(s + strlen(linear_keywords[i].s))) && *(s + strlen(linear_keywords[i].s)) != '_')
+                return linear_keywords[i].type;
+        }
+    }
+
+    return gcc::TT_IDENTIFIER;
+}
+
+static gcc::token_type_t hashed_lookup(const char *s)
+{
+    const char *end = s;
+
+    while (isalnum(*end) || *end == '_')
+        end++;
+
+    return gcc::keyword_lookup(s, end - s);
+}
+
+template <typename F>
+static double run(const char *name, const std::vector<const char *>& words, int rounds, F lookup)
+{
+    auto start = std::chrono::steady_clock::now();
+    unsigned long sum = 0;
+
+    for (int r = 0; r < rounds; ++r) {
+        for (const char *w : words)
+            sum += lookup(w);
+    }
+
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    double rate = (double)words.size() * rounds / elapsed.count();
+
+    printf("%-8s %12.0f identifiers/sec (checksum %lu)\n", name, rate, sum);
+    return rate;
+}
+
+int main(int argc, char **argv)
+{
+    size_t nwords = argc > 1 ? strtoul(argv[1], nullptr, 10) : 1000000;
+    int rounds    = argc > 2 ? atoi(argv[2]) : 5;
+    unsigned seed = 0x9e3779b9;
+    std::string corpus;
+    std::vector<size_t> offsets;
+    std::vector<const char *> words;
+
+    for (size_t i = 0; i < nwords; ++i) {
+        seed = seed * 1103515245 + 12345;
+        unsigned r = seed >> 8;
+
+        offsets.push_back(corpus.size());
+
+        if (r % 3)
+            corpus += linear_keywords[r % 42].s;
+        else
+            corpus += identifiers[r % (sizeof(identifiers) / sizeof(identifiers[0]))];
+        corpus += ' ';
+    }
+
+    for (size_t off : offsets)
+        words.push_back(corpus.c_str() + off);
+
+    printf("%zu words, %d rounds\n", words.size(), rounds);
+
+    double before = run("linear", words, rounds, linear_lookup);
+    double after  = run("hashed", words, rounds, hashed_lookup);
+
+    printf("speedup  %.1fx\n", after / before);
+}
@@ -0,0 +1,187 @@
+/* Front end benchmark suite.
+ *
+ * Generates every corpus shape in corpus.hh, then measures for each:
+ *
+ *   tokenize   gcc::tokenizer::tokenize(), bytes/s and tokens/s
+ *   parse      gcc::parser::parse() over the tokenized stream, nodes/s
+ *   main       the gabriel binary run on the file, end-to-end wall time
+ *
+ * Each measurement is the best of several rounds. The results are
+ * printed as one JSON object on stdout so they can be stored and compared
+ * over time.
+ *
+ * usage: suite [bytes] [rounds] [shape...]
+ *
+ * The compiler binary defaults to ./gabriel, override it with GABRIEL. */
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "corpus.hh"
+#include "harness.hh"
+#include "parser.hh"
+#include "stats.hh"
+#include "tokenizer.hh"
+
+typedef struct result {
+    const char *shape;
+    size_t bytes;
+    size_t tokens;
+    size_t nodes;
+    double tokenize;
+    double parse;
+    double main;
+} result_t;
+
+/* run the compiler on path with output discarded, -1 if it couldn't run */
+static double run_main(const char *compiler, const char *path)
+{
+    auto start = std::chrono::steady_clock::now();
+    int status;
+    pid_t pid;
+
+    if ((pid = fork()) < 0)
+        return -1;
+
+    if (pid == 0) {
+        int fd = open("/dev/null", O_WRONLY);
+
+        dup2(fd, STDOUT_FILENO);
+        dup2(fd, STDERR_FILENO);
+
+        execl(compiler, compiler, path, (char *)nullptr);
+        _exit(127);
+    }
+
+    if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        return -1;
+
+    return bench::elapsed_since(start);
+}
+
+static bool run(bench::corpus_shape_t shape, size_t size, int rounds, const char *compiler, result_t& res)
+{
+    std::string source = bench::generate(shape, size);
+    char path[] = "/tmp/gabriel-bench-XXXXXX";
+    int fd;
+
+    res = result_t();
+    res.shape = bench::corpus_name(shape);
+    res.bytes = source.size();
+
+    if ((fd = mkstemp(path)) < 0 || write(fd, source.data(), source.size()) != (ssize_t)source.size()) {
+        perror("failed to write corpus");
+        return false;
+    }
+    close(fd);
+
+    for (int r = 0; r < rounds; ++r) {
+        gcc::tokenizer tokenizer;
+        gcc::parser parser;
+
+        auto start = std::chrono::steady_clock::now();
+
+        if (tokenizer.tokenize(path) != GCC_SUCCESS) {
+            fprintf(stderr, "failed to tokenize %s corpus\n", res.shape);
+            unlink(path);
+            return false;
+        }
+
+        bench::keep_best(res.tokenize, bench::elapsed_since(start));
+        res.tokens = tokenizer.get_token_stream().size();
+
+        uint64_t nodes = gcc::stats::counters[gcc::COUNTER_NODES].load();
+
+        start = std::chrono::steady_clock::now();
+
+        if (parser.parse(tokenizer.get_token_stream()) != GCC_SUCCESS) {
+            fprintf(stderr, "failed to parse %s corpus\n", res.shape);
+            unlink(path);
+            return false;
+        }
+
+        bench::keep_best(res.parse, bench::elapsed_since(start));
+        res.nodes = gcc::stats::counters[gcc::COUNTER_NODES].load() - nodes;
+    }
+
+    for (int r = 0; r < rounds; ++r) {
+        double t = run_main(compiler, path);
+
+        if (t < 0) {
+            fprintf(stderr, "failed to run %s on the %s corpus\n", compiler, res.shape);
+            unlink(path);
+            return false;
+        }
+
+        bench::keep_best(res.main, t);
+    }
+
+    unlink(path);
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    size_t size          = argc > 1 ? strtoul(argv[1], nullptr, 10) : 4 * 1024 * 1024;
+    int rounds           = argc > 2 ? atoi(argv[2]) : 5;
+    const char *compiler = getenv("GABRIEL") ? getenv("GABRIEL") : "./gabriel";
+    std::vector<bench::corpus_shape_t> shapes;
+    std::vector<result_t> results;
+
+    for (int i = 3; i < argc; ++i) {
+        bench::corpus_shape_t shape = bench::corpus_shape(argv[i]);
+
+        if (shape == bench::CORPUS_LAST) {
+            fprintf(stderr, "unknown corpus shape '%s'\n", argv[i]);
+            return EXIT_FAILURE;
+        }
+        shapes.push_back(shape);
+    }
+
+    if (shapes.empty()) {
+        for (int i = 0; i < bench::CORPUS_LAST; ++i)
+            shapes.push_back((bench::corpus_shape_t)i);
+    }
+
+    /* the parser reports its node count through the stats counters */
+    gcc::stats::enable();
+
+    for (bench::corpus_shape_t shape : shapes) {
+        result_t res;
+
+        if (!run(shape, size, rounds, compiler, res))
+            return EXIT_FAILURE;
+        results.push_back(res);
+    }
+
+    printf("{\n  \"scanner\": \"%s\",\n  \"rounds\": %d,\n  \"corpora\": [\n",
+           gcc::get_scanner()->name, rounds);
+
+    for (size_t i = 0; i < results.size(); ++i) {
+        const result_t& res = results[i];
+
+        printf("    {\n"
+               "      \"shape\": \"%s\",\n"
+               "      \"bytes\": %zu,\n"
+               "      \"tokens\": %zu,\n"
+               "      \"nodes\": %zu,\n"
+               "      \"tokenize\": { \"seconds\": %.6f, \"bytes_per_second\": %.0f, \"tokens_per_second\": %.0f },\n"
+               "      \"parse\": { \"seconds\": %.6f, \"nodes_per_second\": %.0f, \"tokens_per_second\": %.0f },\n"
+               "      \"main\": { \"seconds\": %.6f, \"bytes_per_second\": %.0f }\n"
+               "    }%s\n",
+               res.shape, res.bytes, res.tokens, res.nodes,
+               res.tokenize, res.bytes / res.tokenize, res.tokens / res.tokenize,
+               res.parse, res.nodes / res.parse, res.tokens / res.parse,
+               res.main, res.bytes / res.main,
+               i + 1 < results.size() ? "," : "");
+    }
+
+    printf("  ]\n}\n");
+}
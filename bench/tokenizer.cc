@@ -0,0 +1,71 @@
+/* Tokenizer throughput benchmark.
+ *
+ * Generates a deterministic plain C translation unit, writes it to a
+ * temporary file and tokenizes it repeatedly, reporting MB/s and
+ * tokens/s of gcc::tokenizer::tokenize() on one core.
+ *
+ * usage: tokenizer [bytes] [rounds] [shape]
+ *
+ * shape is one of the corpora in corpus.hh, "header" is a comment-heavy
+ * vendor header. Set GABRIEL_SCAN=scalar|sse2|avx2 to compare the block
+ * scanners. */
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+#include <unistd.h>
+
+#include "corpus.hh"
+#include "tokenizer.hh"
+
+int main(int argc, char **argv)
+{
+    size_t size = argc > 1 ? strtoul(argv[1], nullptr, 10) : 16 * 1024 * 1024;
+    int rounds  = argc > 2 ? atoi(argv[2]) : 5;
+    bench::corpus_shape_t shape = argc > 3 ? bench::corpus_shape(argv[3]) : bench::CORPUS_CODE;
+    char path[] = "/tmp/gabriel-bench-XXXXXX";
+    std::string source;
+    double best = 0;
+    size_t ntokens = 0;
+    int fd;
+
+    if (shape == bench::CORPUS_LAST) {
+        fprintf(stderr, "unknown corpus shape '%s'\n", argv[3]);
+        return EXIT_FAILURE;
+    }
+
+    source = bench::generate(shape, size);
+
+    if ((fd = mkstemp(path)) < 0 || write(fd, source.data(), source.size()) != (ssize_t)source.size()) {
+        perror("failed to write corpus");
+        return EXIT_FAILURE;
+    }
+    close(fd);
+
+    for (int r = 0; r < rounds; ++r) {
+        gcc::tokenizer tokenizer;
+
+        auto start = std::chrono::steady_clock::now();
+
+        if (tokenizer.tokenize(path) != GCC_SUCCESS) {
+            fprintf(stderr, "failed to tokenize corpus\n");
+            unlink(path);
+            return EXIT_FAILURE;
+        }
+
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+        if (!best || elapsed.count() < best)
+            best = elapsed.count();
+        ntokens = tokenizer.get_token_stream().size();
+    }
+
+    unlink(path);
+
+    printf("%s corpus, %s scanner\n", bench::corpus_name(shape), gcc::get_scanner()->name);
+    printf("%zu bytes, %zu tokens, best of %d\n", source.size(), ntokens, rounds);
+    printf("%10.1f MB/s\n", source.size() / best / 1e6);
+    printf("%10.1f Mtokens/s\n", ntokens / best / 1e6);
+}
@@ -0,0 +1,119 @@
+/* Vectorizer benchmark.
+ *
+ * Compiles the loop kernels of kernels.hh, copy_u8 (a memcpy), sum_u8,
+ * dot_u32 and saxpy_u32, once per instruction set and times them from
+ * the same harness:
+ *
+ *   scalar   gabriel -m scalar, the loops as they are
+ *   sse2     gabriel -m sse2, 16-byte vectors (the default)
+ *   avx2     gabriel -m avx2, 32-byte vectors, left out if the CPU
+ *            doesn't have AVX2
+ *
+ * Each build is gabriel -S assembled by the system compiler and linked
+ * with the harness, built at -O1. Checksums must agree with the scalar
+ * build. The results, with speedups over the scalar build and their
+ * geometric means, are printed as one JSON object on stdout.
+ *
+ * usage: vectorize [scale] [rounds]
+ *
+ * The compiler binary defaults to ./gabriel, override it with GABRIEL,
+ * and the system compiler defaults to cc, override it with CC. */
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "harness.hh"
+#include "kernels.hh"
+
+enum {
+    BUILD_SCALAR,
+    BUILD_SSE2,
+    BUILD_AVX2,
+    BUILD_LAST,
+};
+
+static const char *build_names[] = { "scalar", "sse2", "avx2" };
+static const char *kernel_names[] = { "copy_u8", "sum_u8", "dot_u32", "saxpy_u32" };
+
+int main(int argc, char **argv)
+{
+    const char *scale    = argc > 1 ? argv[1] : "1";
+    const char *rounds   = argc > 2 ? argv[2] : "5";
+    const char *compiler = getenv("GABRIEL") ? getenv("GABRIEL") : "./gabriel";
+    const char *cc       = getenv("CC") ? getenv("CC") : "cc";
+    int builds           = __builtin_cpu_supports("avx2") ? BUILD_LAST : BUILD_AVX2;
+    std::vector<std::string> args = { scale, rounds };
+    std::map<std::string, bench::timing_t> timings[BUILD_LAST];
+    char dir[] = "/tmp/gabriel-vectorize-XXXXXX";
+    double logs[BUILD_LAST] = { 0 };
+    size_t count = sizeof(kernel_names) / sizeof(kernel_names[0]);
+    bool ok = true;
+
+    args.insert(args.end(), kernel_names, kernel_names + count);
+
+    if (!mkdtemp(dir)) {
+        perror("failed to create a directory");
+        return EXIT_FAILURE;
+    }
+
+    if (!bench::write_file(std::string(dir) + "/kernels.c", bench::kernels_source) ||
+        !bench::write_file(std::string(dir) + "/harness.c", bench::harness_source)) {
+        fprintf(stderr, "failed to write the kernels\n");
+        ok = false;
+    }
+
+    for (int b = 0; ok && b < builds; ++b) {
+        ok = bench::compile_kernels(compiler, { "-m", build_names[b] }, cc, dir, build_names[b]) &&
+             bench::link_harness(cc, dir, build_names[b]) &&
+             bench::measure(dir, build_names[b], args, timings[b]);
+    }
+
+    bench::spawn({ "rm", "-rf", dir });
+
+    if (!ok)
+        return EXIT_FAILURE;
+
+    printf("{\n  \"scale\": %s,\n  \"rounds\": %s,\n  \"avx2\": %s,\n  \"kernels\": [\n",
+           scale, rounds, builds == BUILD_LAST ? "true" : "false");
+
+    for (size_t i = 0; i < count; ++i) {
+        const bench::timing_t& scalar = timings[BUILD_SCALAR][kernel_names[i]];
+        bool match = true;
+
+        for (int b = 1; b < builds; ++b)
+            match &= timings[b][kernel_names[i]].checksum == scalar.checksum;
+
+        printf("    {\n"
+               "      \"name\": \"%s\",\n"
+               "      \"checksums_match\": %s,\n"
+               "      \"seconds\": {",
+               kernel_names[i], match ? "true" : "false");
+
+        for (int b = 0; b < builds; ++b)
+            printf(" \"%s\": %.6f%s", build_names[b], timings[b][kernel_names[i]].seconds, b + 1 < builds ? "," : " },\n");
+
+        printf("      \"speedup\": {");
+
+        for (int b = 1; b < builds; ++b) {
+            double speedup = scalar.seconds / timings[b][kernel_names[i]].seconds;
+
+            logs[b] += std::log(speedup);
+            printf(" \"%s\": %.3f%s", build_names[b], speedup, b + 1 < builds ? "," : " }\n");
+        }
+
+        printf("    }%s\n", i + 1 < count ? "," : "");
+
+        ok &= match;
+    }
+
+    printf("  ],\n  \"geomean_speedup\": {");
+
+    for (int b = 1; b < builds; ++b)
+        printf(" \"%s\": %.3f%s", build_names[b], std::exp(logs[b] / count), b + 1 < builds ? "," : " }\n}\n");
+
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
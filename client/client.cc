@@ -0,0 +1,103 @@
+/* Thin client for gabriel --daemon.
+ *
+ * Forwards its working directory and command line to the daemon, copies
+ * the daemon's output to stdout and stderr and exits with the status of
+ * the compilation, so it can stand in for gabriel in a build.
+ *
+ * usage: gabriel-client [gabriel options] <input file>...
+ *        gabriel-client --stop
+ *
+ * The socket is $GABRIEL_SOCKET or the per-user default the daemon uses. */
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+#include <limits.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "protocol.hh"
+
+static int connect_daemon(const std::string& path)
+{
+    struct sockaddr_un addr;
+    int fd;
+
+    if (path.size() >= sizeof(addr.sun_path))
+        return -1;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    memcpy(addr.sun_path, path.c_str(), path.size());
+
+    if ((fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0)
+        return -1;
+
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+int main(int argc, char **argv)
+{
+    std::string path = gcc::protocol::default_socket();
+    std::string request;
+    char cwd[PATH_MAX];
+    bool stop = argc == 2 && !strcmp(argv[1], "--stop");
+    int fd;
+
+    if ((fd = connect_daemon(path)) < 0) {
+        fprintf(stderr, "%s: no daemon on %s: %s (start one with gabriel --daemon)\n",
+                argv[0], path.c_str(), strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    if (!getcwd(cwd, sizeof(cwd))) {
+        perror("getcwd");
+        return EXIT_FAILURE;
+    }
+
+    request.append(cwd).push_back('\0');
+
+    /* argv[0] is only used in the daemon's usage messages */
+    request.append("gabriel").push_back('\0');
+
+    for (int i = 1; i < argc; ++i)
+        request.append(argv[i]).push_back('\0');
+
+    bool sent = stop ? gcc::protocol::send(fd, gcc::protocol::MSG_STOP, nullptr, 0)
+                     : gcc::protocol::send(fd, gcc::protocol::MSG_COMPILE, request.data(), request.size());
+
+    if (!sent) {
+        fprintf(stderr, "%s: failed to send request: %s\n", argv[0], strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    std::string data;
+    uint8_t type;
+
+    while (gcc::protocol::recv(fd, type, data)) {
+        switch (type) {
+            case gcc::protocol::MSG_STDOUT:
+                fwrite(data.data(), 1, data.size(), stdout);
+                break;
+
+            case gcc::protocol::MSG_STDERR:
+                fwrite(data.data(), 1, data.size(), stderr);
+                break;
+
+            case gcc::protocol::MSG_EXIT:
+                close(fd);
+                return data.empty() ? EXIT_FAILURE : (unsigned char)data[0];
+        }
+    }
+
+    fprintf(stderr, "%s: daemon closed the connection without a result\n", argv[0]);
+    return EXIT_FAILURE;
+}
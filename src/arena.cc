@@ -0,0 +1,70 @@
+#include <cstdlib>
+
+#include "arena.hh"
+
+#define BLOCK_SIZE_MIN (64 * 1024)
+#define BLOCK_SIZE_MAX (4 * 1024 * 1024)
+
+gcc::arena::arena():
+    blocks_(),
+    ptr_(nullptr),
+    end_(nullptr),
+    block_size_(BLOCK_SIZE_MIN),
+    stats_()
+{
+}
+
+gcc::arena::~arena()
+{
+    for (char *block : blocks_)
+        free(block);
+}
+
+void *gcc::arena::alloc_slow(size_t size, size_t align)
+{
+    size_t needed = size + align;
+    char *block;
+
+    /* large requests get a block of their own so the tail
+     * of the current block isn't wasted */
+    if (needed > block_size_ / 4) {
+        if (!(block = (char *)malloc(needed)))
+            throw std::bad_alloc();
+
+        blocks_.push_back(block);
+        stats_.blocks++;
+        stats_.reserved += needed;
+        stats_.allocations++;
+        stats_.used += size;
+
+        return (void *)(((uintptr_t)block + align - 1) & ~(uintptr_t)(align - 1));
+    }
+
+    if (!(block = (char *)malloc(block_size_)))
+        throw std::bad_alloc();
+
+    blocks_.push_back(block);
+    stats_.blocks++;
+    stats_.reserved += block_size_;
+
+    ptr_ = block;
+    end_ = block + block_size_;
+
+    if (block_size_ < BLOCK_SIZE_MAX)
+        block_size_ *= 2;
+
+    return alloc(size, align);
+}
+
+void gcc::arena::reset()
+{
+    for (char *block : blocks_)
+        free(block);
+
+    blocks_.clear();
+
+    ptr_        = nullptr;
+    end_        = nullptr;
+    block_size_ = BLOCK_SIZE_MIN;
+    stats_      = stats_t();
+}
@@ -0,0 +1,138 @@
+#ifndef __ARENA_HH__
+#define __ARENA_HH__
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <utility>
+#include <vector>
+
+namespace gcc {
+
+    /* Bump-pointer allocator.
+     *
+     * Memory is carved out of large blocks and released all at once when
+     * the arena is reset or destroyed. Destructors of objects created
+     * with make() are never run, so anything placed in an arena must keep
+     * its own storage in the same arena too (see gcc::arena_allocator)
+     * or own nothing at all. */
+    class arena {
+        public:
+            typedef struct stats {
+                size_t allocations; /* number of alloc() calls */
+                size_t used;        /* bytes handed out, including alignment */
+                size_t reserved;    /* bytes of blocks allocated from the system */
+                size_t blocks;
+            } stats_t;
+
+            arena();
+            ~arena();
+
+            /* allocate size bytes aligned to align (a power of two) */
+            void *alloc(size_t size, size_t align = alignof(std::max_align_t))
+            {
+                uintptr_t ptr = ((uintptr_t)ptr_ + align - 1) & ~(uintptr_t)(align - 1);
+
+                if (ptr + size > (uintptr_t)end_)
+                    return alloc_slow(size, align);
+
+                stats_.allocations++;
+                stats_.used += ptr + size - (uintptr_t)ptr_;
+                ptr_ = (char *)(ptr + size);
+
+                return (void *)ptr;
+            }
+
+            /* construct object in the arena, its destructor is never called */
+            template <typename T, typename... Args>
+            T *make(Args&&... args)
+            {
+                return new (alloc(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+            }
+
+            /* allocate an uninitialized array of n objects */
+            template <typename T>
+            T *alloc_array(size_t n)
+            {
+                return n ? (T *)alloc(sizeof(T) * n, alignof(T)) : nullptr;
+            }
+
+            /* release everything allocated so far */
+            void reset();
+
+            const stats_t& get_stats() const { return stats_; }
+
+        private:
+            arena(const arena&);
+            arena& operator=(const arena&);
+
+            void *alloc_slow(size_t size, size_t align);
+
+            std::vector<char *> blocks_;
+            char *ptr_;
+            char *end_;
+            size_t block_size_;
+            stats_t stats_;
+    };
+
+    /* Standard allocator drawing from an arena, deallocation is a no-op.
+     * Lets std containers live inside arena-allocated objects. */
+    template <typename T>
+    struct arena_allocator {
+        typedef T value_type;
+
+        gcc::arena *arena_;
+
+        arena_allocator(gcc::arena& arena):
+            arena_(&arena)
+        {
+        }
+
+        template <typename U>
+        arena_allocator(const arena_allocator<U>& other):
+            arena_(other.arena_)
+        {
+        }
+
+        T *allocate(size_t n)
+        {
+            return arena_->alloc_array<T>(n);
+        }
+
+        void deallocate(T *, size_t)
+        {
+        }
+
+        template <typename U>
+        bool operator==(const arena_allocator<U>& other) const { return arena_ == other.arena_; }
+
+        template <typename U>
+        bool operator!=(const arena_allocator<U>& other) const { return arena_ != other.arena_; }
+    };
+
+    /* fixed-size array living in an arena */
+    template <typename T>
+    struct arena_array {
+        T *data;
+        uint32_t size;
+
+        T *begin() const { return data; }
+        T *end() const { return data + size; }
+
+        T& operator[](size_t i) const { return data[i]; }
+    };
+
+    /* copy [first, last) into the arena */
+    template <typename T, typename It>
+    static inline gcc::arena_array<T> arena_copy(gcc::arena& arena, It first, It last)
+    {
+        gcc::arena_array<T> array = { arena.alloc_array<T>(last - first), (uint32_t)(last - first) };
+
+        for (T *out = array.data; first != last; ++first, ++out)
+            new (out) T(*first);
+
+        return array;
+    }
+};
+
+#endif /* __ARENA_HH__ */
@@ -0,0 +1,304 @@
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "cache.hh"
+#include "stats.hh"
+#include "util/log.hh"
+
+#define CHANNEL "cache"
+
+/* "GBRC", bump the version whenever the payload format changes */
+#define CACHE_MAGIC   0x43524247u
+#define CACHE_VERSION 5u
+
+typedef struct entry {
+    std::string path;
+    uint64_t mtime;
+    uint64_t size;
+} entry_t;
+
+/* create dir and its missing parents */
+static bool make_dirs(const std::string& dir)
+{
+    for (size_t pos = 0; pos != std::string::npos; ) {
+        pos = dir.find('/', pos + 1);
+
+        if (mkdir(dir.substr(0, pos).c_str(), 0755) < 0 && errno != EEXIST)
+            return false;
+    }
+
+    return true;
+}
+
+static bool read_fd(int fd, char *data, size_t len)
+{
+    while (len) {
+        ssize_t n = read(fd, data, len);
+
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+
+        data += n;
+        len  -= n;
+    }
+
+    return true;
+}
+
+static bool write_fd(int fd, const char *data, size_t len)
+{
+    while (len) {
+        ssize_t n = write(fd, data, len);
+
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+
+        data += n;
+        len  -= n;
+    }
+
+    return true;
+}
+
+/* every entry of the cache directory, in the 256 fan-out subdirectories */
+static void list_entries(const std::string& dir, std::vector<entry_t> *entries, uint64_t& bytes)
+{
+    static const char digits[] = "0123456789abcdef";
+
+    bytes = 0;
+
+    for (int i = 0; i < 256; ++i) {
+        std::string sub = dir + "/" + digits[i >> 4] + digits[i & 0xf];
+        DIR *d = opendir(sub.c_str());
+        struct dirent *ent;
+        struct stat st;
+
+        if (!d)
+            continue;
+
+        while ((ent = readdir(d))) {
+            /* entries are plain hex, skip dot files and other writers' temporaries */
+            if (strchr(ent->d_name, '.') || fstatat(dirfd(d), ent->d_name, &st, 0) < 0 || !S_ISREG(st.st_mode))
+                continue;
+
+            bytes += st.st_size;
+
+            if (entries) {
+                entries->push_back({
+                    sub + "/" + ent->d_name,
+                    (uint64_t)st.st_mtim.tv_sec * 1000000000ull + st.st_mtim.tv_nsec,
+                    (uint64_t)st.st_size,
+                });
+            }
+        }
+
+        closedir(d);
+    }
+}
+
+gcc::cache::cache(const std::string& dir, uint64_t max_bytes):
+    dir_(dir),
+    max_bytes_(max_bytes),
+    lock_(),
+    measured_(false),
+    bytes_(0)
+{
+}
+
+gcc::cache::~cache()
+{
+}
+
+std::string gcc::cache::default_dir()
+{
+    const char *env;
+
+    if ((env = getenv("GABRIEL_CACHE_DIR")) && *env)
+        return env;
+
+    if ((env = getenv("XDG_CACHE_HOME")) && *env)
+        return std::string(env) + "/gabriel";
+
+    if ((env = getenv("HOME")) && *env)
+        return std::string(env) + "/.cache/gabriel";
+
+    return "/tmp/gabriel-cache-" + std::to_string(getuid());
+}
+
+gcc::hash128_t gcc::cache::compiler()
+{
+    /* The compiler has no release versions to go by, so it's identified
+     * by its executable: rebuilding it changes the size or the mtime and
+     * starts a fresh set of entries. Computed once per process. */
+    static const gcc::hash128_t self = [] {
+        uint64_t id[4] = { CACHE_VERSION, 0, 0, 0 };
+        struct stat st;
+
+        if (stat("/proc/self/exe", &st) == 0) {
+            id[1] = (uint64_t)st.st_size;
+            id[2] = (uint64_t)st.st_mtim.tv_sec * 1000000000ull + st.st_mtim.tv_nsec;
+            id[3] = (uint64_t)st.st_ino;
+        }
+
+        return gcc::hash128(id, sizeof(id));
+    }();
+
+    return self;
+}
+
+gcc::hash128_t gcc::cache::key(const char *data, size_t size)
+{
+    return gcc::hash128(data, size, compiler());
+}
+
+std::string gcc::cache::path(const gcc::hash128_t& key) const
+{
+    std::string hex = key.hex();
+
+    return dir_ + "/" + hex.substr(0, 2) + "/" + hex.substr(2);
+}
+
+bool gcc::cache::load(const gcc::hash128_t& key, size_t source_size, std::string& out)
+{
+    gcc::scoped_timer timer(gcc::PHASE_CACHE);
+    std::string file = path(key);
+    header_t header;
+    struct stat st;
+    int fd;
+
+    if ((fd = open(file.c_str(), O_RDONLY | O_CLOEXEC)) < 0) {
+        gcc::stats::add(gcc::COUNTER_CACHE_MISSES, 1);
+        return false;
+    }
+
+    bool valid = fstat(fd, &st) == 0 &&
+                 (size_t)st.st_size >= sizeof(header) &&
+                 read_fd(fd, (char *)&header, sizeof(header)) &&
+                 header.magic == CACHE_MAGIC &&
+                 header.version == CACHE_VERSION &&
+                 header.key == key &&
+                 header.source_size == source_size &&
+                 header.payload_size == (uint64_t)st.st_size - sizeof(header);
+
+    if (valid) {
+        out.resize(header.payload_size);
+        valid = read_fd(fd, &out[0], out.size()) && gcc::hash128(out.data(), out.size()) == header.payload_hash;
+    }
+
+    /* the mtime is the entry's last use, see evict() */
+    if (valid)
+        futimens(fd, nullptr);
+
+    close(fd);
+
+    if (!valid) {
+        WARN("removing corrupt cache entry %s\n", file.c_str());
+        unlink(file.c_str());
+        gcc::stats::add(gcc::COUNTER_CACHE_MISSES, 1);
+        return false;
+    }
+
+    gcc::stats::add(gcc::COUNTER_CACHE_HITS, 1);
+    return true;
+}
+
+gcc_error_t gcc::cache::store(const gcc::hash128_t& key, size_t source_size, const std::string& payload)
+{
+    static std::atomic<uint32_t> serial(0);
+
+    gcc::scoped_timer timer(gcc::PHASE_CACHE);
+    std::string file = path(key);
+    std::string tmp  = file + ".tmp." + std::to_string(getpid()) + "." + std::to_string(serial++);
+    header_t header;
+    int fd;
+
+    memset(&header, 0, sizeof(header));
+    header.magic        = CACHE_MAGIC;
+    header.version      = CACHE_VERSION;
+    header.key          = key;
+    header.source_size  = source_size;
+    header.payload_size = payload.size();
+    header.payload_hash = gcc::hash128(payload.data(), payload.size());
+
+    if ((fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644)) < 0) {
+        if (errno != ENOENT || !make_dirs(file.substr(0, file.rfind('/'))) ||
+            (fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644)) < 0) {
+            WARN("can't write to cache %s: %s\n", dir_.c_str(), strerror(errno));
+            return GCC_INVALID_VALUE;
+        }
+    }
+
+    bool written = write_fd(fd, (const char *)&header, sizeof(header)) &&
+                   write_fd(fd, payload.data(), payload.size());
+
+    /* readers only ever see complete entries */
+    if (close(fd) < 0 || !written || rename(tmp.c_str(), file.c_str()) < 0) {
+        WARN("failed to store cache entry %s: %s\n", file.c_str(), strerror(errno));
+        unlink(tmp.c_str());
+        return GCC_INVALID_VALUE;
+    }
+
+    gcc::stats::add(gcc::COUNTER_CACHE_STORES, 1);
+
+    std::lock_guard<std::mutex> guard(lock_);
+
+    /* the first measurement already sees the new entry */
+    if (!measured_)
+        measure();
+    else
+        bytes_ += sizeof(header) + payload.size();
+
+    if (bytes_ > max_bytes_)
+        evict();
+
+    return GCC_SUCCESS;
+}
+
+void gcc::cache::measure()
+{
+    list_entries(dir_, nullptr, bytes_);
+    measured_ = true;
+
+    DEBUG("%s holds %llu bytes\n", dir_.c_str(), (unsigned long long)bytes_);
+}
+
+void gcc::cache::evict()
+{
+    std::vector<entry_t> entries;
+    uint64_t target = max_bytes_ / 100 * LOW_WATERMARK;
+    size_t evicted = 0;
+
+    /* other processes add and remove entries too, start from what's there */
+    list_entries(dir_, &entries, bytes_);
+
+    std::sort(entries.begin(), entries.end(), [](const entry_t& a, const entry_t& b) {
+        return a.mtime < b.mtime;
+    });
+
+    for (const entry_t& entry : entries) {
+        if (bytes_ <= target)
+            break;
+
+        if (unlink(entry.path.c_str()) == 0 || errno == ENOENT) {
+            bytes_ -= entry.size;
+            evicted++;
+        }
+    }
+
+    gcc::stats::add(gcc::COUNTER_CACHE_EVICTIONS, evicted);
+
+    DEBUG("evicted %zu entries, %llu bytes left\n", evicted, (unsigned long long)bytes_);
+}
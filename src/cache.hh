@@ -0,0 +1,86 @@
+#ifndef __CACHE_HH__
+#define __CACHE_HH__
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+
+#include "hash.hh"
+#include "util/error.hh"
+
+namespace gcc {
+
+    /* Content-addressed cache of compilation results on disk.
+     *
+     * Entries are named by the hash of the source bytes and of the
+     * compiler that produced them, so a changed file or a rebuilt
+     * compiler simply looks up a different name and nothing ever has to
+     * be invalidated. Every entry also carries its key, the source size
+     * and a hash of its payload, anything that doesn't match is a miss.
+     *
+     * Entries are written to a temporary file and renamed into place, so
+     * any number of processes can share one directory. Reading an entry
+     * touches its mtime, and once the directory grows past its size limit
+     * the least recently used entries are removed until it's back under
+     * LOW_WATERMARK percent of the limit. */
+    class cache {
+        public:
+            enum { LOW_WATERMARK = 90 };
+
+            /* size limit when none is given */
+            enum { DEFAULT_SIZE_MB = 256 };
+
+            cache(const std::string& dir, uint64_t max_bytes);
+            ~cache();
+
+            /* $GABRIEL_CACHE_DIR, $XDG_CACHE_HOME/gabriel or ~/.cache/gabriel */
+            static std::string default_dir();
+
+            /* identity of this build of the compiler */
+            static gcc::hash128_t compiler();
+
+            /* key of a source file's contents for this build of the compiler */
+            static gcc::hash128_t key(const char *data, size_t size);
+
+            /* read the payload stored for key into out, false on a miss */
+            bool load(const gcc::hash128_t& key, size_t source_size, std::string& out);
+
+            /* store payload for key, evicting old entries if needed */
+            gcc_error_t store(const gcc::hash128_t& key, size_t source_size, const std::string& payload);
+
+            const std::string& dir() const { return dir_; }
+            uint64_t max_bytes() const { return max_bytes_; }
+
+        private:
+            cache(const cache&);
+            cache& operator=(const cache&);
+
+            /* on-disk header of an entry, followed by the payload */
+            typedef struct header {
+                uint32_t magic;
+                uint32_t version;
+                gcc::hash128_t key;
+                uint64_t source_size;
+                uint64_t payload_size;
+                gcc::hash128_t payload_hash;
+            } header_t;
+
+            std::string path(const gcc::hash128_t& key) const;
+
+            /* bytes in the directory, measured on the first store */
+            void measure();
+
+            /* remove least recently used entries until under the low watermark */
+            void evict();
+
+            std::string dir_;
+            uint64_t max_bytes_;
+
+            std::mutex lock_;
+            bool measured_;
+            uint64_t bytes_;
+    };
+};
+
+#endif /* __CACHE_HH__ */
@@ -0,0 +1,67 @@
+#ifndef __CHARCLASS_HH__
+#define __CHARCLASS_HH__
+
+#include <cstdint>
+
+namespace gcc {
+
+    /* Every input byte is classified exactly once through this table,
+     * the tokenizer dispatches on the class of the first byte of a token
+     * and uses the table again to find the end of identifiers and numbers.
+     *
+     * CC_DIGIT and CC_IDENT are adjacent so "can continue an identifier"
+     * is a single unsigned compare, see is_ident_char(). */
+    typedef enum char_class {
+        CC_END,     /* NUL, end of input unless embedded in the file */
+        CC_SPACE,   /* ' ', \t, \n, \v, \f, \r */
+        CC_DIGIT,   /* 0 - 9 */
+        CC_IDENT,   /* a - z, A - Z, _ */
+        CC_PUNCT,   /* operators and punctuators */
+        CC_INVALID, /* anything else */
+    } char_class_t;
+
+#define E_ CC_END
+#define S_ CC_SPACE
+#define D_ CC_DIGIT
+#define I_ CC_IDENT
+#define P_ CC_PUNCT
+#define X_ CC_INVALID
+
+    static const uint8_t __char_class[256] = {
+        E_, X_, X_, X_, X_, X_, X_, X_, X_, S_, S_, S_, S_, S_, X_, X_, /* 0x00 - 0x0f */
+        X_, X_, X_, X_, X_, X_, X_, X_, X_, X_, X_, X_, X_, X_, X_, X_, /* 0x10 - 0x1f */
+        S_, P_, P_, X_, X_, P_, P_, P_, P_, P_, P_, P_, P_, P_, P_, P_, /* 0x20 - 0x2f */
+        D_, D_, D_, D_, D_, D_, D_, D_, D_, D_, P_, P_, P_, P_, P_, P_, /* 0x30 - 0x3f */
+        X_, I_, I_, I_, I_, I_, I_, I_, I_, I_, I_, I_, I_, I_, I_, I_, /* 0x40 - 0x4f */
+        I_, I_, I_, I_, I_, I_, I_, I_, I_, I_, I_, P_, X_, P_, P_, I_, /* 0x50 - 0x5f */
+        X_, I_, I_, I_, I_, I_, I_, I_, I_, I_, I_, I_, I_, I_, I_, I_, /* 0x60 - 0x6f */
+        I_, I_, I_, I_, I_, I_, I_, I_, I_, I_, I_, P_, P_, P_, P_, X_, /* 0x70 - 0x7f */
+        X_, X_, X_, X_, X_, X_, X_, X_, X_, X_, X_, X_, X_, X_, X_, X_, /* 0x80 - 0x8f */
+        X_, X_, X_, X_, X_, X_, X_, X_, X_, X_, X_, X_, X_, X_, X_, X_, /* 0x90 - 0x9f */
+        X_, X_, X_, X_, X_, X_, X_, X_, X_, X_, X_, X_, X_, X_, X_, X_, /* 0xa0 - 0xaf */
+        X_, X_, X_, X_, X_, X_, X_, X_, X_, X_, X_, X_, X_, X_, X_, X_, /* 0xb0 - 0xbf */
+        X_, X_, X_, X_, X_, X_, X_, X_, X_, X_, X_, X_, X_, X_, X_, X_, /* 0xc0 - 0xcf */
+        X_, X_, X_, X_, X_, X_, X_, X_, X_, X_, X_, X_, X_, X_, X_, X_, /* 0xd0 - 0xdf */
+        X_, X_, X_, X_, X_, X_, X_, X_, X_, X_, X_, X_, X_, X_, X_, X_, /* 0xe0 - 0xef */
+        X_, X_, X_, X_, X_, X_, X_, X_, X_, X_, X_, X_, X_, X_, X_, X_, /* 0xf0 - 0xff */
+    };
+
+#undef E_
+#undef S_
+#undef D_
+#undef I_
+#undef P_
+#undef X_
+
+    static inline char_class_t char_class(char c)
+    {
+        return (char_class_t)__char_class[(unsigned char)c];
+    }
+
+    static inline bool is_ident_char(char c)
+    {
+        return (unsigned)(__char_class[(unsigned char)c] - CC_DIGIT) <= CC_IDENT - CC_DIGIT;
+    }
+};
+
+#endif /* __CHARCLASS_HH__ */
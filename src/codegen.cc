@@ -0,0 +1,1250 @@
+#include <algorithm>
+
+#include "codegen.hh"
+#include "stats.hh"
+#include "util/log.hh"
+
+#define CHANNEL "codegen"
+
+using gcc::ir::NONE;
+using gcc::ir::value_t;
+
+/* registers of the integer arguments, see the System V ABI */
+static const uint8_t arg_regs[] = {
+    gcc::x86::RDI, gcc::x86::RSI, gcc::x86::RDX, gcc::x86::RCX, gcc::x86::R8, gcc::x86::R9,
+};
+
+static const uint8_t callee_saved[] = {
+    gcc::x86::RBX, gcc::x86::R12, gcc::x86::R13, gcc::x86::R14, gcc::x86::R15,
+};
+
+/* arithmetic is done in 32 bits at least */
+static inline unsigned op_size(uint8_t type)
+{
+    return std::max(4u, gcc::ir::type_size(type));
+}
+
+/* condition of comparison op, with the operands swapped if swap is set */
+static uint8_t condition(uint8_t op, bool swap)
+{
+    switch (op) {
+        case gcc::ir::OP_EQ:  return gcc::x86::CC_E;
+        case gcc::ir::OP_NE:  return gcc::x86::CC_NE;
+        case gcc::ir::OP_LT:  return swap ? gcc::x86::CC_G : gcc::x86::CC_L;
+        case gcc::ir::OP_LE:  return swap ? gcc::x86::CC_GE : gcc::x86::CC_LE;
+        case gcc::ir::OP_ULT: return swap ? gcc::x86::CC_A : gcc::x86::CC_B;
+        default:              return swap ? gcc::x86::CC_AE : gcc::x86::CC_BE;
+    }
+}
+
+gcc::x86::codegen::codegen():
+    out_(nullptr),
+    fn_(nullptr),
+    spill_base_(0),
+    has_frame_(false),
+    avx_(false),
+    labels_(0),
+    next_label_(0),
+    block_(0)
+{
+}
+
+gcc::x86::codegen::~codegen()
+{
+}
+
+void gcc::x86::codegen::emit(uint8_t op, unsigned size, const gcc::x86::operand_t& dst, const gcc::x86::operand_t& src)
+{
+    gcc::x86::inst_t inst = { op, (uint8_t)size, 0, 0, dst, src };
+
+    out_->emit(inst);
+}
+
+gcc::x86::codegen::location_t gcc::x86::codegen::where(value_t value) const
+{
+    /* aliases of their operand, see classify() */
+    while (kinds_[value] == VALUE_FUSED && (fn_->insts[value].op == gcc::ir::OP_TRUNC ||
+                                             fn_->insts[value].op == gcc::ir::OP_ZEXT))
+        value = fn_->insts[value].arg[0];
+
+    const gcc::ir::inst_t& inst = fn_->insts[value];
+    location_t loc = { LOC_IMM, REG_NONE, false, 0, 0, SYM_NONE, 0 };
+
+    switch (inst.op) {
+        case gcc::ir::OP_CONST:
+            loc.imm = inst.imm;
+            return loc;
+
+        case gcc::ir::OP_UNDEF:
+            return loc;
+
+        case gcc::ir::OP_SLOT:
+            loc.kind   = LOC_FRAME;
+            loc.offset = slots_[value];
+            return loc;
+
+        case gcc::ir::OP_GLOBAL:
+            loc.kind     = LOC_SYMBOL;
+            loc.sym      = (gcc::symbol_t)inst.imm;
+            loc.external = !defined_.count(loc.sym);
+            return loc;
+    }
+
+    if (gcc::ir::is_vector(inst.type))
+        loc.size = gcc::ir::type_size(inst.type);
+
+    if (alloc_.reg(value) != REG_NONE) {
+        loc.kind = LOC_REG;
+        loc.reg  = alloc_.reg(value);
+    } else {
+        /* the lowest of the slots of a vector */
+        loc.kind   = LOC_STACK;
+        loc.offset = spill_base_ - 8 * (int32_t)(alloc_.spill(value) + (loc.size ? loc.size / 8 - 1 : 0));
+    }
+
+    return loc;
+}
+
+void gcc::x86::codegen::move(const location_t& dst, const location_t& src)
+{
+    gcc::x86::operand_t to = dst.kind == LOC_REG ? reg(dst.reg) : mem(RBP, dst.offset);
+
+    if (dst.size || src.size) {
+        unsigned size = std::max(dst.size, src.size);
+
+        if (src.kind == LOC_REG) {
+            if (dst.kind != LOC_REG || dst.reg != src.reg)
+                emit(I_MOVDQU, size, to, reg(src.reg));
+        } else if (dst.kind == LOC_REG) {
+            emit(I_MOVDQU, size, to, mem(RBP, src.offset));
+        } else if (dst.offset != src.offset) {
+            emit(I_MOVDQU, size, reg(XMM15), mem(RBP, src.offset));
+            emit(I_MOVDQU, size, to, reg(XMM15));
+        }
+        return;
+    }
+
+    switch (src.kind) {
+        case LOC_REG:
+            if (dst.kind != LOC_REG || dst.reg != src.reg)
+                emit(I_MOV, 8, to, reg(src.reg));
+            return;
+
+        case LOC_STACK:
+            if (dst.kind == LOC_STACK && dst.offset == src.offset)
+                return;
+
+            if (dst.kind == LOC_REG) {
+                emit(I_MOV, 8, to, mem(RBP, src.offset));
+            } else {
+                emit(I_MOV, 8, reg(RAX), mem(RBP, src.offset));
+                emit(I_MOV, 8, to, reg(RAX));
+            }
+            return;
+
+        case LOC_IMM:
+            if (dst.kind == LOC_REG && src.imm >= 0 && src.imm <= UINT32_MAX)
+                emit(I_MOV, 4, to, imm(src.imm));
+            else if (dst.kind == LOC_REG || is_imm32(src.imm))
+                emit(I_MOV, 8, to, imm(src.imm));
+            else {
+                emit(I_MOV, 8, reg(RAX), imm(src.imm));
+                emit(I_MOV, 8, to, reg(RAX));
+            }
+            return;
+
+        default: {
+            uint8_t r = dst.kind == LOC_REG ? dst.reg : (uint8_t)RAX;
+
+            if (src.kind == LOC_FRAME)
+                emit(I_LEA, 8, reg(r), mem(RBP, src.offset));
+            else if (src.external)
+                emit(I_MOV, 8, reg(r), rip(src.sym, true));
+            else
+                emit(I_LEA, 8, reg(r), rip(src.sym));
+
+            if (dst.kind != LOC_REG)
+                emit(I_MOV, 8, to, reg(RAX));
+            return;
+        }
+    }
+}
+
+void gcc::x86::codegen::parallel(std::vector<move_t>& moves)
+{
+    /* dst is read by a pending move */
+    auto blocked = [&moves](const location_t& dst) {
+        for (const move_t& m : moves) {
+            if (m.src.kind == dst.kind && (dst.kind == LOC_REG ? m.src.reg == dst.reg : m.src.offset == dst.offset))
+                return true;
+        }
+        return false;
+    };
+
+    for (size_t i = 0; i < moves.size();) {
+        const location_t& d = moves[i].dst;
+        const location_t& s = moves[i].src;
+
+        if (s.kind == d.kind && (d.kind == LOC_REG ? s.reg == d.reg : s.offset == d.offset)) {
+            moves[i] = moves.back();
+            moves.pop_back();
+        } else {
+            ++i;
+        }
+    }
+
+    while (!moves.empty()) {
+        bool progress = false;
+
+        for (size_t i = 0; i < moves.size();) {
+            if (blocked(moves[i].dst)) {
+                ++i;
+                continue;
+            }
+
+            move(moves[i].dst, moves[i].src);
+            moves.erase(moves.begin() + i);
+            progress = true;
+        }
+
+        if (progress)
+            continue;
+
+        /* only cycles are left, free a destination by saving it in r11 */
+        location_t dst = moves[0].dst;
+        location_t tmp = { LOC_REG, R11, false, 0, 0, SYM_NONE, 0 };
+
+        if (dst.size) {
+            tmp.reg  = XMM14;
+            tmp.size = dst.size;
+        }
+
+        move(tmp, dst);
+
+        for (move_t& m : moves) {
+            if (m.src.kind == dst.kind && (dst.kind == LOC_REG ? m.src.reg == dst.reg : m.src.offset == dst.offset))
+                m.src = tmp;
+        }
+    }
+}
+
+gcc::x86::operand_t gcc::x86::codegen::source(value_t value, uint8_t scratch)
+{
+    location_t loc = where(value);
+
+    switch (loc.kind) {
+        case LOC_REG:
+            return reg(loc.reg);
+
+        case LOC_STACK:
+            return mem(RBP, loc.offset);
+
+        case LOC_IMM:
+            if (is_imm32(loc.imm))
+                return imm(loc.imm);
+            /* fall through */
+
+        default: {
+            location_t tmp = { LOC_REG, scratch, false, 0, 0, SYM_NONE, 0 };
+
+            move(tmp, loc);
+            return reg(scratch);
+        }
+    }
+}
+
+gcc::x86::operand_t gcc::x86::codegen::address(value_t value)
+{
+    const location_t r11 = { LOC_REG, R11, false, 0, 0, SYM_NONE, 0 };
+    const location_t rdx = { LOC_REG, RDX, false, 0, 0, SYM_NONE, 0 };
+    gcc::x86::operand_t op = mem(REG_NONE, 0);
+    value_t base = value;
+
+    if (kinds_[value] == VALUE_FUSED) {
+        const gcc::ir::inst_t& add = fn_->insts[value];
+        value_t index = add.arg[1];
+
+        base = add.arg[0];
+
+        if (scaled(add.arg[0]))
+            std::swap(base, index);
+
+        const gcc::ir::inst_t& idx = fn_->insts[index];
+
+        if (idx.op == gcc::ir::OP_CONST && is_imm32(idx.imm)) {
+            op.disp = (int32_t)idx.imm;
+        } else {
+            if (scaled(index)) {
+                int64_t factor = fn_->insts[idx.arg[1]].imm;
+
+                op.scale = idx.op == gcc::ir::OP_SHL ? 1 << factor : factor;
+                index    = idx.arg[0];
+            }
+
+            location_t loc = where(index);
+
+            if (loc.kind == LOC_REG) {
+                op.index = loc.reg;
+            } else {
+                move(rdx, loc);
+                op.index = RDX;
+            }
+        }
+    }
+
+    location_t loc = where(base);
+
+    switch (loc.kind) {
+        case LOC_REG:
+            op.reg = loc.reg;
+            return op;
+
+        case LOC_FRAME:
+            op.reg   = RBP;
+            op.disp += loc.offset;
+            return op;
+
+        case LOC_SYMBOL:
+            if (!loc.external && op.index == REG_NONE) {
+                gcc::x86::operand_t sym = rip(loc.sym);
+
+                sym.disp = op.disp;
+                return sym;
+            }
+            /* fall through */
+
+        default:
+            move(r11, loc);
+            op.reg = R11;
+            return op;
+    }
+}
+
+uint8_t gcc::x86::codegen::compare(value_t value)
+{
+    const gcc::ir::inst_t& inst = fn_->insts[value];
+    unsigned size = op_size(fn_->insts[inst.arg[0]].type);
+    value_t a = inst.arg[0];
+    value_t b = inst.arg[1];
+    bool swap = false;
+
+    if (where(a).kind == LOC_IMM && where(b).kind != LOC_IMM) {
+        std::swap(a, b);
+        swap = true;
+    }
+
+    location_t la = where(a);
+    gcc::x86::operand_t left;
+
+    if (la.kind == LOC_REG) {
+        left = reg(la.reg);
+    } else if (la.kind == LOC_STACK && where(b).kind != LOC_STACK) {
+        left = mem(RBP, la.offset);
+    } else {
+        location_t rax = { LOC_REG, RAX, false, 0, 0, SYM_NONE, 0 };
+
+        move(rax, la);
+        left = reg(RAX);
+    }
+
+    gcc::x86::operand_t right = source(b, R11);
+
+    if (right.kind == OPND_IMM && right.imm == 0 && left.kind == OPND_REG)
+        emit(I_TEST, size, left, left);
+    else
+        emit(I_CMP, size, left, right);
+
+    return condition(inst.op, swap);
+}
+
+void gcc::x86::codegen::binary(const gcc::ir::inst_t& inst, value_t value)
+{
+    static const location_t rax = { LOC_REG, RAX, false, 0, 0, SYM_NONE, 0 };
+    unsigned size = op_size(inst.type);
+    uint8_t op;
+    value_t a = inst.arg[0];
+    value_t b = inst.arg[1];
+
+    switch (inst.op) {
+        case gcc::ir::OP_ADD: op = I_ADD;  break;
+        case gcc::ir::OP_SUB: op = I_SUB;  break;
+        case gcc::ir::OP_MUL: op = I_IMUL; break;
+        case gcc::ir::OP_AND: op = I_AND;  break;
+        case gcc::ir::OP_OR:  op = I_OR;   break;
+        default:              op = I_XOR;  break;
+    }
+
+    location_t dst = where(value);
+
+    if (gcc::ir::info(inst.op).flags & gcc::ir::OPF_COMMUTATIVE) {
+        location_t lb = where(b);
+
+        if ((where(a).kind == LOC_IMM && lb.kind != LOC_IMM) ||
+            (dst.kind == LOC_REG && lb.kind == LOC_REG && lb.reg == dst.reg))
+            std::swap(a, b);
+    }
+
+    location_t lb = where(b);
+
+    if (dst.kind == LOC_REG && !(lb.kind == LOC_REG && lb.reg == dst.reg)) {
+        move(dst, where(a));
+        emit(op, size, reg(dst.reg), source(b, R11));
+        return;
+    }
+
+    move(rax, where(a));
+    emit(op, size, reg(RAX), source(b, R11));
+    move(dst, rax);
+}
+
+void gcc::x86::codegen::shift(const gcc::ir::inst_t& inst, value_t value)
+{
+    static const location_t rax = { LOC_REG, RAX, false, 0, 0, SYM_NONE, 0 };
+    static const location_t rcx = { LOC_REG, RCX, false, 0, 0, SYM_NONE, 0 };
+    unsigned size = op_size(inst.type);
+    location_t dst = where(value);
+    location_t count = where(inst.arg[1]);
+    gcc::x86::operand_t by;
+    uint8_t op = inst.op == gcc::ir::OP_SHL ? I_SHL : inst.op == gcc::ir::OP_SHR ? I_SHR : I_SAR;
+
+    if (count.kind == LOC_IMM) {
+        by = imm(count.imm & (size * 8 - 1));
+    } else {
+        move(rcx, count);
+        by = reg(RCX);
+    }
+
+    if (dst.kind == LOC_REG) {
+        move(dst, where(inst.arg[0]));
+        emit(op, size, reg(dst.reg), by);
+    } else {
+        move(rax, where(inst.arg[0]));
+        emit(op, size, reg(RAX), by);
+        move(dst, rax);
+    }
+}
+
+void gcc::x86::codegen::divide(const gcc::ir::inst_t& inst, value_t value)
+{
+    static const location_t rax = { LOC_REG, RAX, false, 0, 0, SYM_NONE, 0 };
+    static const location_t rdx = { LOC_REG, RDX, false, 0, 0, SYM_NONE, 0 };
+    unsigned size = op_size(inst.type);
+    bool sgn = inst.op == gcc::ir::OP_DIV || inst.op == gcc::ir::OP_REM;
+    bool rem = inst.op == gcc::ir::OP_REM || inst.op == gcc::ir::OP_UREM;
+    location_t by = where(inst.arg[1]);
+    uint64_t pow2 = gcc::ir::zext(inst.type, by.imm);
+
+    /* by powers of two, shifts and masks */
+    if (by.kind == LOC_IMM && pow2 > 1 && !(pow2 & (pow2 - 1))) {
+        unsigned k = __builtin_ctzll(pow2);
+        location_t dst = where(value);
+        location_t tmp = dst.kind == LOC_REG ? dst : rax;
+
+        if (!sgn && (!rem || is_imm32(pow2 - 1))) {
+            move(tmp, where(inst.arg[0]));
+            emit(rem ? I_AND : I_SHR, size, reg(tmp.reg), imm(rem ? pow2 - 1 : k));
+            move(dst, tmp);
+            return;
+        }
+
+        if (sgn && !rem && k < size * 8 - 1) {
+            /* round towards zero: add 2^k - 1 to negative dividends */
+            move(rax, where(inst.arg[0]));
+            emit(I_MOV, 8, reg(RCX), reg(RAX));
+            emit(I_SAR, size, reg(RCX), imm(size * 8 - 1));
+            emit(I_SHR, size, reg(RCX), imm(size * 8 - k));
+            emit(I_ADD, size, reg(RAX), reg(RCX));
+            emit(I_SAR, size, reg(RAX), imm(k));
+            move(dst, rax);
+            return;
+        }
+    }
+
+    move(rax, where(inst.arg[0]));
+
+    if (sgn)
+        emit(I_CQO, size, none());
+    else
+        emit(I_XOR, 4, reg(RDX), reg(RDX));
+
+    gcc::x86::operand_t divisor = source(inst.arg[1], RCX);
+
+    if (divisor.kind == OPND_IMM) {
+        emit(I_MOV, 8, reg(RCX), divisor);
+        divisor = reg(RCX);
+    }
+
+    emit(sgn ? I_IDIV : I_DIV, size, divisor);
+    move(where(value), rem ? rdx : rax);
+}
+
+void gcc::x86::codegen::unary(const gcc::ir::inst_t& inst, value_t value)
+{
+    static const location_t rax = { LOC_REG, RAX, false, 0, 0, SYM_NONE, 0 };
+    uint8_t op = inst.op == gcc::ir::OP_NEG ? I_NEG : I_NOT;
+    location_t dst = where(value);
+
+    if (dst.kind == LOC_REG) {
+        move(dst, where(inst.arg[0]));
+        emit(op, op_size(inst.type), reg(dst.reg));
+    } else {
+        move(rax, where(inst.arg[0]));
+        emit(op, op_size(inst.type), reg(RAX));
+        move(dst, rax);
+    }
+}
+
+void gcc::x86::codegen::extend(const gcc::ir::inst_t& inst, value_t value)
+{
+    static const location_t rax = { LOC_REG, RAX, false, 0, 0, SYM_NONE, 0 };
+    uint8_t from = fn_->insts[inst.arg[0]].type;
+    unsigned from_size = gcc::ir::type_size(from);
+    location_t dst = where(value);
+    location_t src = where(inst.arg[0]);
+
+    if (src.kind == LOC_IMM) {
+        if (inst.op == gcc::ir::OP_ZEXT)
+            src.imm = gcc::ir::zext(from, src.imm);
+        else
+            src.imm = gcc::ir::sext(inst.op == gcc::ir::OP_SEXT ? from : inst.type, src.imm);
+
+        move(dst, src);
+        return;
+    }
+
+    /* the low bytes of a value are the truncated value */
+    if (inst.op == gcc::ir::OP_TRUNC || (src.kind != LOC_REG && src.kind != LOC_STACK)) {
+        move(dst, src);
+        return;
+    }
+
+    uint8_t r = dst.kind == LOC_REG ? dst.reg : (uint8_t)RAX;
+    gcc::x86::operand_t from_op = src.kind == LOC_REG ? reg(src.reg) : mem(RBP, src.offset);
+    gcc::x86::inst_t x = { I_MOVSX, (uint8_t)op_size(inst.type), 0, (uint8_t)from_size, reg(r), from_op };
+
+    if (inst.op == gcc::ir::OP_ZEXT) {
+        if (from_size == 4) {
+            /* writing a 32-bit register clears the upper half */
+            x.op   = I_MOV;
+            x.size = 4;
+        } else {
+            x.op   = I_MOVZX;
+            x.size = 4;
+        }
+    }
+
+    out_->emit(x);
+
+    if (r == RAX)
+        move(dst, rax);
+}
+
+void gcc::x86::codegen::load(const gcc::ir::inst_t& inst, value_t value)
+{
+    static const location_t rax = { LOC_REG, RAX, false, 0, 0, SYM_NONE, 0 };
+    unsigned size = gcc::ir::type_size(inst.type);
+    location_t dst = where(value);
+    uint8_t r = dst.kind == LOC_REG ? dst.reg : (uint8_t)RAX;
+    gcc::x86::inst_t x = { I_MOV, (uint8_t)size, 0, 0, reg(r), address(inst.arg[0]) };
+
+    if (size < 4) {
+        x.op       = I_MOVZX;
+        x.size     = 4;
+        x.src_size = size;
+    }
+
+    out_->emit(x);
+
+    if (r == RAX)
+        move(dst, rax);
+}
+
+void gcc::x86::codegen::store(const gcc::ir::inst_t& inst)
+{
+    static const location_t rax = { LOC_REG, RAX, false, 0, 0, SYM_NONE, 0 };
+    unsigned size = gcc::ir::type_size(inst.type);
+    gcc::x86::operand_t to = address(inst.arg[0]);
+    location_t val = where(inst.arg[1]);
+
+    if (val.kind == LOC_REG) {
+        emit(I_MOV, size, to, reg(val.reg));
+    } else if (val.kind == LOC_IMM && is_imm32(val.imm)) {
+        emit(I_MOV, size, to, imm(gcc::ir::sext(inst.type, val.imm)));
+    } else {
+        move(rax, val);
+        emit(I_MOV, size, to, reg(RAX));
+    }
+}
+
+void gcc::x86::codegen::call(const gcc::ir::inst_t& inst, value_t value)
+{
+    static const location_t rax = { LOC_REG, RAX, false, 0, 0, SYM_NONE, 0 };
+    uint32_t n = inst.arg[1];
+    uint32_t stack = n > 6 ? n - 6 : 0;
+    gcc::symbol_t sym = (gcc::symbol_t)inst.imm;
+
+    /* rsp stays aligned to 16 bytes at the call */
+    if (stack % 2)
+        emit(I_SUB, 8, reg(RSP), imm(8));
+
+    for (uint32_t i = n; i-- > 6;) {
+        location_t loc = where(fn_->operand(inst, i));
+
+        if (loc.kind == LOC_REG) {
+            emit(I_PUSH, 8, reg(loc.reg));
+        } else if (loc.kind == LOC_STACK) {
+            emit(I_PUSH, 8, mem(RBP, loc.offset));
+        } else if (loc.kind == LOC_IMM && is_imm32(loc.imm)) {
+            emit(I_PUSH, 8, imm(loc.imm));
+        } else {
+            move(rax, loc);
+            emit(I_PUSH, 8, reg(RAX));
+        }
+    }
+
+    for (uint32_t i = 0; i < n && i < 6; ++i) {
+        location_t dst = { LOC_REG, arg_regs[i], false, 0, 0, SYM_NONE, 0 };
+
+        moves_.push_back({ dst, where(fn_->operand(inst, i)) });
+    }
+
+    parallel(moves_);
+
+    if (avx_)
+        emit(I_VZEROUPPER, 32, none());
+
+    /* no vector registers for variadic callees */
+    emit(I_XOR, 4, reg(RAX), reg(RAX));
+    emit(I_CALL, 8, symbol(sym, !defined_.count(sym)));
+
+    if (stack)
+        emit(I_ADD, 8, reg(RSP), imm(8 * (stack + stack % 2)));
+
+    if (kinds_[value] == VALUE_REG)
+        move(where(value), rax);
+}
+
+gcc::x86::operand_t gcc::x86::codegen::vector_source(value_t value, uint8_t scratch)
+{
+    location_t loc = where(value);
+
+    if (loc.kind == LOC_REG)
+        return reg(loc.reg);
+
+    /* SSE2 memory operands must be aligned, spill slots aren't */
+    emit(I_MOVDQU, loc.size, reg(scratch), mem(RBP, loc.offset));
+    return reg(scratch);
+}
+
+void gcc::x86::codegen::multiply(uint8_t t, const gcc::x86::operand_t& b)
+{
+    /* the even lanes, then the odd ones shifted down, and interleave the low halves */
+    emit(I_MOVDQU, 16, reg(XMM13), reg(t));
+    emit(I_PMULUDQ, 16, reg(t), b);
+
+    if (b.reg != XMM14)
+        emit(I_MOVDQU, 16, reg(XMM14), b);
+
+    emit(I_PSRLQ, 16, reg(XMM13), imm(32));
+    emit(I_PSRLQ, 16, reg(XMM14), imm(32));
+    emit(I_PMULUDQ, 16, reg(XMM13), reg(XMM14));
+    emit(I_PSHUFD, 16, reg(t), imm(0x08));
+    emit(I_PSHUFD, 16, reg(XMM13), imm(0x08));
+    emit(I_PUNPCKLDQ, 16, reg(t), reg(XMM13));
+}
+
+void gcc::x86::codegen::vector(const gcc::ir::inst_t& inst, value_t value)
+{
+    static const location_t rax = { LOC_REG, RAX, false, 0, 0, SYM_NONE, 0 };
+    unsigned size = gcc::ir::type_size(inst.type);
+    unsigned lane = gcc::ir::type_size(gcc::ir::lane_type(inst.type));
+    unsigned log  = __builtin_ctz(lane);
+    value_t a = inst.arg[0];
+    value_t b = inst.arg[1];
+
+    if (inst.op == gcc::ir::OP_STORE) {
+        gcc::x86::operand_t to = address(a);
+
+        emit(I_MOVDQU, size, to, vector_source(b, XMM15));
+        return;
+    }
+
+    if (inst.op == gcc::ir::OP_HSUM) {
+        /* fold the upper half onto the lower one until a lane is left */
+        const gcc::ir::inst_t& src = fn_->insts[a];
+        location_t x15 = { LOC_REG, XMM15, false, 0, 0, SYM_NONE, (uint8_t)gcc::ir::type_size(src.type) };
+        uint8_t add;
+
+        lane = gcc::ir::type_size(gcc::ir::lane_type(src.type));
+        add  = I_PADDB + __builtin_ctz(lane);
+        move(x15, where(a));
+
+        if (x15.size == 32) {
+            emit(I_VEXTRACTI128, 32, reg(XMM14), reg(XMM15));
+            emit(add, 32, reg(XMM15), reg(XMM14));
+        }
+
+        for (unsigned bytes = 8; bytes >= lane; bytes /= 2) {
+            emit(I_MOVDQU, x15.size, reg(XMM14), reg(XMM15));
+            emit(I_PSRLDQ, x15.size, reg(XMM14), imm(bytes));
+            emit(add, x15.size, reg(XMM15), reg(XMM14));
+        }
+
+        emit(I_MOVD, lane == 8 ? 8 : 4, reg(RAX), reg(XMM15));
+        move(where(value), rax);
+        return;
+    }
+
+    if (inst.op == gcc::ir::OP_PHI)
+        return;
+
+    location_t dst = where(value);
+    location_t t   = dst;
+
+    if (gcc::ir::info(inst.op).flags & gcc::ir::OPF_COMMUTATIVE) {
+        location_t lb = where(b);
+
+        if (dst.kind == LOC_REG && lb.kind == LOC_REG && lb.reg == dst.reg)
+            std::swap(a, b);
+    }
+
+    /* in place in the register of the result unless the other operand is there */
+    if (dst.kind != LOC_REG || (gcc::ir::info(inst.op).operands == 2 && where(b).kind == LOC_REG && where(b).reg == dst.reg)) {
+        t.kind = LOC_REG;
+        t.reg  = XMM15;
+    }
+
+    switch (inst.op) {
+        case gcc::ir::OP_LOAD:
+            emit(I_MOVDQU, size, reg(t.reg), address(a));
+            break;
+
+        case gcc::ir::OP_SPLAT: {
+            location_t src = where(a);
+
+            if (src.kind == LOC_IMM && src.imm == 0) {
+                emit(I_PXOR, size, reg(t.reg), reg(t.reg));
+                break;
+            }
+
+            move(rax, src);
+            emit(I_MOVD, lane == 8 ? 8 : 4, reg(t.reg), reg(RAX));
+
+            if (size == 32) {
+                emit(I_VPBROADCASTB + log, 32, reg(t.reg), reg(t.reg));
+                break;
+            }
+
+            if (lane == 8) {
+                emit(I_PUNPCKLQDQ, 16, reg(t.reg), reg(t.reg));
+                break;
+            }
+
+            /* widen the lane to 32 bits and copy that */
+            if (lane == 1)
+                emit(I_PUNPCKLBW, 16, reg(t.reg), reg(t.reg));
+            if (lane <= 2)
+                emit(I_PUNPCKLWD, 16, reg(t.reg), reg(t.reg));
+
+            emit(I_PSHUFD, 16, reg(t.reg), imm(0));
+            break;
+        }
+
+        case gcc::ir::OP_WSUM:
+            move(t, where(a));
+
+            if (gcc::ir::lane_type(fn_->insts[a].type) == gcc::ir::TYPE_I8) {
+                /* sums of absolute differences from zero */
+                emit(I_PXOR, size, reg(XMM14), reg(XMM14));
+                emit(I_PSADBW, size, reg(t.reg), reg(XMM14));
+            } else {
+                /* the upper half of each 64 bits to the lower half */
+                emit(I_MOVDQU, size, reg(XMM14), reg(t.reg));
+                emit(I_PSRLQ, size, reg(XMM14), imm(32));
+                emit(I_PSLLQ, size, reg(t.reg), imm(32));
+                emit(I_PSRLQ, size, reg(t.reg), imm(32));
+                emit(I_PADDQ, size, reg(t.reg), reg(XMM14));
+            }
+            break;
+
+        case gcc::ir::OP_SHL:
+        case gcc::ir::OP_SHR:
+        case gcc::ir::OP_SAR: {
+            uint8_t op = inst.op == gcc::ir::OP_SHL ? I_PSLLW : inst.op == gcc::ir::OP_SHR ? I_PSRLW : I_PSRAW;
+
+            move(t, where(a));
+            emit(op + log - 1, size, reg(t.reg), imm(where(b).imm));
+            break;
+        }
+
+        case gcc::ir::OP_MUL:
+            move(t, where(a));
+
+            if (lane == 2)
+                emit(I_PMULLW, size, reg(t.reg), vector_source(b, XMM14));
+            else if (size == 32)
+                emit(I_PMULLD, size, reg(t.reg), vector_source(b, XMM14));
+            else
+                multiply(t.reg, vector_source(b, XMM14));
+            break;
+
+        default: {
+            uint8_t op;
+
+            switch (inst.op) {
+                case gcc::ir::OP_ADD: op = I_PADDB + log; break;
+                case gcc::ir::OP_SUB: op = I_PSUBB + log; break;
+                case gcc::ir::OP_AND: op = I_PAND;        break;
+                case gcc::ir::OP_OR:  op = I_POR;         break;
+                default:              op = I_PXOR;        break;
+            }
+
+            move(t, where(a));
+            emit(op, size, reg(t.reg), vector_source(b, XMM14));
+            break;
+        }
+    }
+
+    move(dst, t);
+}
+
+void gcc::x86::codegen::jump_to(uint32_t block)
+{
+    if (block != block_ + 1)
+        emit(I_JMP, 8, label(labels_ + block));
+}
+
+void gcc::x86::codegen::edge(uint32_t block, uint32_t succ, std::vector<move_t>& moves)
+{
+    const gcc::ir::block_t& b = fn_->blocks[succ];
+    uint32_t pred = std::find(b.preds.begin(), b.preds.end(), block) - b.preds.begin();
+
+    for (value_t phi : b.code) {
+        if (fn_->insts[phi].op != gcc::ir::OP_PHI)
+            break;
+
+        if (uses_[phi] == 0)
+            continue;
+
+        location_t dst = where(phi);
+        location_t src = where(fn_->operand(fn_->insts[phi], pred));
+
+        /* left out rather than dropped by parallel(), branch() needs to know an edge moves nothing */
+        if (src.kind == dst.kind && (dst.kind == LOC_REG ? src.reg == dst.reg : src.offset == dst.offset))
+            continue;
+
+        moves.push_back({ dst, src });
+    }
+}
+
+void gcc::x86::codegen::jump(uint32_t block)
+{
+    uint32_t succ = fn_->blocks[block].succ[0];
+
+    edge(block, succ, moves_);
+    parallel(moves_);
+    jump_to(succ);
+}
+
+void gcc::x86::codegen::branch(uint32_t block, value_t cond)
+{
+    const gcc::ir::block_t& b = fn_->blocks[block];
+    uint32_t taken = b.succ[0];
+    uint32_t other = b.succ[1];
+    location_t loc = where(cond);
+    uint8_t cc;
+
+    if (taken == other) {
+        jump(block);
+        return;
+    }
+
+    if (kinds_[cond] == VALUE_FUSED) {
+        cc = compare(cond);
+    } else if (loc.kind == LOC_REG) {
+        emit(I_TEST, gcc::ir::type_size(fn_->insts[cond].type), reg(loc.reg), reg(loc.reg));
+        cc = CC_NE;
+    } else if (loc.kind == LOC_STACK) {
+        emit(I_CMP, gcc::ir::type_size(fn_->insts[cond].type), mem(RBP, loc.offset), imm(0));
+        cc = CC_NE;
+    } else {
+        /* a constant or an address, unoptimized code only */
+        uint32_t succ = (loc.kind != LOC_IMM || gcc::ir::zext(fn_->insts[cond].type, loc.imm)) ? taken : other;
+
+        edge(block, succ, moves_);
+        parallel(moves_);
+        jump_to(succ);
+        return;
+    }
+
+    edge(block, taken, moves_);
+    edge(block, other, other_);
+
+    if (moves_.empty() && other_.empty()) {
+        if (taken == block_ + 1) {
+            jcc(negate(cc), labels_ + other);
+        } else {
+            jcc(cc, labels_ + taken);
+            jump_to(other);
+        }
+        return;
+    }
+
+    if (moves_.empty()) {
+        jcc(cc, labels_ + taken);
+        parallel(other_);
+        jump_to(other);
+        return;
+    }
+
+    if (other_.empty()) {
+        jcc(negate(cc), labels_ + other);
+        parallel(moves_);
+        jump_to(taken);
+        return;
+    }
+
+    /* both edges move, the taken one gets a stub */
+    uint32_t stub = next_label_++;
+
+    jcc(negate(cc), stub);
+    parallel(moves_);
+    emit(I_JMP, 8, label(labels_ + taken));
+    out_->label(stub);
+    parallel(other_);
+    jump_to(other);
+}
+
+void gcc::x86::codegen::jcc(uint8_t cc, uint32_t target)
+{
+    gcc::x86::inst_t inst = { I_JCC, 8, cc, 0, label(target), none() };
+
+    out_->emit(inst);
+}
+
+void gcc::x86::codegen::instruction(uint32_t block, value_t value)
+{
+    static const location_t rax = { LOC_REG, RAX, false, 0, 0, SYM_NONE, 0 };
+    const gcc::ir::inst_t& inst = fn_->insts[value];
+
+    if (gcc::ir::is_vector(inst.type) || inst.op == gcc::ir::OP_HSUM) {
+        vector(inst, value);
+        return;
+    }
+
+    switch (inst.op) {
+        case gcc::ir::OP_ADD:
+        case gcc::ir::OP_SUB:
+        case gcc::ir::OP_MUL:
+        case gcc::ir::OP_AND:
+        case gcc::ir::OP_OR:
+        case gcc::ir::OP_XOR:
+            binary(inst, value);
+            break;
+
+        case gcc::ir::OP_DIV:
+        case gcc::ir::OP_UDIV:
+        case gcc::ir::OP_REM:
+        case gcc::ir::OP_UREM:
+            divide(inst, value);
+            break;
+
+        case gcc::ir::OP_SHL:
+        case gcc::ir::OP_SHR:
+        case gcc::ir::OP_SAR:
+            shift(inst, value);
+            break;
+
+        case gcc::ir::OP_NEG:
+        case gcc::ir::OP_NOT:
+            unary(inst, value);
+            break;
+
+        case gcc::ir::OP_EQ:
+        case gcc::ir::OP_NE:
+        case gcc::ir::OP_LT:
+        case gcc::ir::OP_LE:
+        case gcc::ir::OP_ULT:
+        case gcc::ir::OP_ULE: {
+            gcc::x86::inst_t set = { I_SETCC, 1, compare(value), 0, reg(RAX), none() };
+            gcc::x86::inst_t zx  = { I_MOVZX, 4, 0, 1, reg(RAX), reg(RAX) };
+
+            out_->emit(set);
+            out_->emit(zx);
+            move(where(value), rax);
+            break;
+        }
+
+        case gcc::ir::OP_SEXT:
+        case gcc::ir::OP_ZEXT:
+        case gcc::ir::OP_TRUNC:
+            extend(inst, value);
+            break;
+
+        case gcc::ir::OP_LOAD:
+            load(inst, value);
+            break;
+
+        case gcc::ir::OP_STORE:
+            store(inst);
+            break;
+
+        case gcc::ir::OP_CALL:
+            call(inst, value);
+            break;
+
+        case gcc::ir::OP_JMP:
+            jump(block);
+            break;
+
+        case gcc::ir::OP_BR:
+            branch(block, inst.arg[0]);
+            break;
+
+        case gcc::ir::OP_RET:
+            if (inst.arg[0] != NONE)
+                move(rax, where(inst.arg[0]));
+            epilogue();
+            break;
+
+        default:
+            /* phis, parameters and what's rematerialized where it's used */
+            break;
+    }
+}
+
+bool gcc::x86::codegen::scaled(value_t value) const
+{
+    uint8_t op = fn_->insts[value].op;
+
+    return kinds_[value] == VALUE_FUSED && (op == gcc::ir::OP_MUL || op == gcc::ir::OP_SHL);
+}
+
+void gcc::x86::codegen::classify()
+{
+    const gcc::ir::function& fn = *fn_;
+    std::vector<uint32_t> addresses(fn.insts.size(), 0);
+
+    fn.count_uses(uses_);
+    kinds_.assign(fn.insts.size(), VALUE_NONE);
+
+    for (uint32_t b = 0; b < fn.blocks.size(); ++b) {
+        for (value_t v : fn.blocks[b].code) {
+            const gcc::ir::inst_t& inst = fn.insts[v];
+
+            switch (inst.op) {
+                case gcc::ir::OP_CONST:
+                case gcc::ir::OP_UNDEF:
+                case gcc::ir::OP_SLOT:
+                case gcc::ir::OP_GLOBAL:
+                    break;
+
+                case gcc::ir::OP_LOAD:
+                case gcc::ir::OP_STORE: {
+                    const gcc::ir::inst_t& addr = fn.insts[inst.arg[0]];
+
+                    /* only addresses all of whose uses are loads and stores of the block */
+                    if (addr.op == gcc::ir::OP_ADD && addr.block == b && addresses[inst.arg[0]] != NONE)
+                        ++addresses[inst.arg[0]];
+                    else
+                        addresses[inst.arg[0]] = NONE;
+
+                    if (inst.op == gcc::ir::OP_STORE)
+                        addresses[inst.arg[1]] = NONE;
+
+                    kinds_[v] = inst.type == gcc::ir::TYPE_VOID || inst.op == gcc::ir::OP_STORE ? VALUE_NONE : VALUE_REG;
+                    break;
+                }
+
+                case gcc::ir::OP_TRUNC:
+                case gcc::ir::OP_ZEXT:
+                    /* the low bytes are the truncated value, and loads zero-extend */
+                    if (kinds_[inst.arg[0]] != VALUE_NONE &&
+                        (inst.op == gcc::ir::OP_TRUNC || fn.insts[inst.arg[0]].op == gcc::ir::OP_LOAD))
+                        kinds_[v] = VALUE_FUSED;
+                    else
+                        kinds_[v] = VALUE_REG;
+                    break;
+
+                default:
+                    if (inst.type != gcc::ir::TYPE_VOID)
+                        kinds_[v] = VALUE_REG;
+                    break;
+            }
+        }
+
+        const gcc::ir::block_t& block = fn.blocks[b];
+        const gcc::ir::inst_t& term = fn.insts[block.code.back()];
+
+        if (term.op == gcc::ir::OP_BR && block.succ[0] != block.succ[1]) {
+            value_t cond = term.arg[0];
+            const gcc::ir::inst_t& cmp = fn.insts[cond];
+
+            if ((gcc::ir::info(cmp.op).flags & gcc::ir::OPF_COMPARE) && cmp.block == b && uses_[cond] == 1)
+                kinds_[cond] = VALUE_FUSED;
+        }
+    }
+
+    for (value_t v = 0; v < fn.insts.size(); ++v) {
+        if (addresses[v] == NONE || addresses[v] == 0 || addresses[v] != uses_[v])
+            continue;
+
+        kinds_[v] = VALUE_FUSED;
+
+        /* a scaled index */
+        for (int k = 1; k >= 0; --k) {
+            value_t index = fn.insts[v].arg[k];
+            const gcc::ir::inst_t& idx = fn.insts[index];
+
+            if ((idx.op != gcc::ir::OP_MUL && idx.op != gcc::ir::OP_SHL) || idx.block != fn.insts[v].block ||
+                uses_[index] != 1 || fn.insts[idx.arg[1]].op != gcc::ir::OP_CONST)
+                continue;
+
+            int64_t factor = fn.insts[idx.arg[1]].imm;
+
+            if (idx.op == gcc::ir::OP_MUL ? (factor == 1 || factor == 2 || factor == 4 || factor == 8)
+                                          : (factor >= 0 && factor <= 3)) {
+                kinds_[index] = VALUE_FUSED;
+                break;
+            }
+        }
+    }
+}
+
+void gcc::x86::codegen::frame()
+{
+    const gcc::ir::function& fn = *fn_;
+    int32_t offset;
+
+    saved_.clear();
+
+    for (uint8_t r : callee_saved) {
+        if (alloc_.used() & (1u << r))
+            saved_.push_back(r);
+    }
+
+    offset = -8 * (int32_t)saved_.size();
+    slots_.assign(fn.insts.size(), 0);
+
+    for (value_t v = 0; v < fn.insts.size(); ++v) {
+        if (fn.insts[v].op != gcc::ir::OP_SLOT)
+            continue;
+
+        offset -= (int32_t)((fn.insts[v].imm + 7) & ~7);
+        slots_[v] = offset;
+    }
+
+    spill_base_ = offset - 8;
+    offset -= 8 * (int32_t)alloc_.spills();
+
+    /* what's below the saved registers, rounded so rsp stays aligned */
+    int32_t size = -offset - 8 * (int32_t)saved_.size();
+
+    if ((-offset) % 16)
+        size += 8;
+
+    emit(I_PUSH, 8, reg(RBP));
+    emit(I_MOV, 8, reg(RBP), reg(RSP));
+
+    for (uint8_t r : saved_)
+        emit(I_PUSH, 8, reg(r));
+
+    if (size)
+        emit(I_SUB, 8, reg(RSP), imm(size));
+
+    has_frame_ = size != 0;
+
+    /* parameters to where they were allocated */
+    for (size_t i = 0; i < fn.params.size(); ++i) {
+        value_t param = fn.params[i];
+        location_t src = { LOC_REG, REG_NONE, false, 0, 0, SYM_NONE, 0 };
+
+        if (uses_[param] == 0)
+            continue;
+
+        if (i < 6) {
+            src.reg = arg_regs[fn.insts[param].imm];
+        } else {
+            src.kind   = LOC_STACK;
+            src.offset = 16 + 8 * (int32_t)(fn.insts[param].imm - 6);
+        }
+
+        moves_.push_back({ where(param), src });
+    }
+
+    parallel(moves_);
+}
+
+void gcc::x86::codegen::epilogue()
+{
+    if (avx_)
+        emit(I_VZEROUPPER, 32, none());
+
+    if (has_frame_)
+        emit(I_LEA, 8, reg(RSP), mem(RBP, -8 * (int32_t)saved_.size()));
+
+    for (size_t i = saved_.size(); i-- > 0;)
+        emit(I_POP, 8, reg(saved_[i]));
+
+    emit(I_POP, 8, reg(RBP));
+    emit(I_RET, 8, none());
+}
+
+void gcc::x86::codegen::function(const gcc::ir::function& fn)
+{
+    fn_  = &fn;
+    avx_ = std::any_of(fn.insts.begin(), fn.insts.end(), [](const gcc::ir::inst_t& inst) {
+        return inst.op != gcc::ir::OP_NOP && gcc::ir::type_size(inst.type) == 32;
+    });
+
+    classify();
+    alloc_.run(fn, kinds_);
+    gcc::stats::add(gcc::COUNTER_SPILLS, alloc_.spills());
+
+    labels_ = next_label_;
+    next_label_ += fn.blocks.size();
+
+    out_->begin_function(fn.name, fn.local);
+    frame();
+
+    for (block_ = 0; block_ < fn.blocks.size(); ++block_) {
+        out_->label(labels_ + block_);
+
+        for (value_t v : fn.blocks[block_].code) {
+            if (kinds_[v] != VALUE_FUSED)
+                instruction(block_, v);
+        }
+    }
+
+    out_->end_function();
+}
+
+gcc_error_t gcc::x86::codegen::run(const gcc::ir::module& module, gcc::x86::sink& out)
+{
+    gcc::scoped_timer timer(gcc::PHASE_CODEGEN);
+
+    out_ = &out;
+    defined_.clear();
+
+    for (const gcc::ir::function *fn : module.functions)
+        defined_.insert(fn->name);
+
+    for (const gcc::ir::global_t& global : module.globals) {
+        if (global.defined)
+            defined_.insert(global.name);
+    }
+
+    for (const gcc::ir::global_t& global : module.globals)
+        out.global(global);
+
+    for (const gcc::ir::function *fn : module.functions) {
+        if (fn->blocks.empty()) {
+            ERROR("%s(): no code to generate\n", gcc::symbol_str(fn->name));
+            return GCC_INVALID_VALUE;
+        }
+
+        function(*fn);
+    }
+
+    return GCC_SUCCESS;
+}
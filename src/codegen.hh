@@ -0,0 +1,165 @@
+#ifndef __CODEGEN_HH__
+#define __CODEGEN_HH__
+
+#include <cstdint>
+#include <unordered_set>
+#include <vector>
+
+#include "ir.hh"
+#include "regalloc.hh"
+#include "util/error.hh"
+#include "x86.hh"
+
+namespace gcc {
+
+    namespace x86 {
+
+        /* Generates x86-64 code for the System V ABI from optimized IR.
+         *
+         * Instructions are selected one IR instruction at a time on top of
+         * the allocation of gcc::x86::allocator. Constants, stack slots and
+         * addresses of globals get no register, they're immediates or
+         * memory operands where they're used. A comparison only used by
+         * the branch after it becomes a cmp and a conditional jump, and an
+         * address computed for loads and stores of its block only is
+         * folded into their memory operands (base + index * scale + disp).
+         * Truncations and zero extensions of loads are aliases of their
+         * operand, whose register already holds the right bits.
+         *
+         * Phis are moved into on the edges into their block: at the end of
+         * a predecessor that only jumps there, else in a stub the branch
+         * jumps to. Those moves and the ones putting arguments in place
+         * are parallel, cycles are broken with r11 (xmm14 for vectors).
+         *
+         * Vectors are SSE2 at 16 bytes and AVX2 at 32, with xmm13 to xmm15
+         * for scratch. A function using ymm registers clears their upper
+         * halves with vzeroupper before it calls or returns, so SSE code
+         * elsewhere doesn't pay for the transition.
+         *
+         * The frame is rbp-based: callee-saved registers in use are pushed
+         * after rbp, then come the stack slots and the spill slots, and rsp
+         * stays 16-byte aligned between the prologue and the epilogue.
+         * Functions and globals not defined in the module are reached
+         * through the PLT and the GOT, so the output links into position
+         * independent executables. */
+        class codegen {
+            public:
+                codegen();
+                ~codegen();
+
+                /* emit the globals and then the functions of module to out */
+                gcc_error_t run(const gcc::ir::module& module, gcc::x86::sink& out);
+
+            private:
+                codegen(const codegen&);
+                codegen& operator=(const codegen&);
+
+                enum {
+                    LOC_REG,
+                    LOC_STACK,     /* memory at rbp + offset */
+                    LOC_IMM,
+                    LOC_FRAME,     /* the address rbp + offset */
+                    LOC_SYMBOL,    /* the address of a global */
+                };
+
+                /* where a value is while it's live */
+                typedef struct location {
+                    uint8_t kind;
+                    uint8_t reg;
+                    bool external;       /* LOC_SYMBOL: not defined in the module */
+                    int32_t offset;
+                    int64_t imm;
+                    gcc::symbol_t sym;
+                    uint8_t size;        /* bytes of a vector, 0 for scalars */
+                } location_t;
+
+                typedef struct move {
+                    location_t dst;      /* LOC_REG or LOC_STACK */
+                    location_t src;
+                } move_t;
+
+                void function(const gcc::ir::function& fn);
+
+                /* the VALUE_* of every value of fn_, see allocator::run() */
+                void classify();
+
+                /* value is the index of an address, folded with its scale */
+                bool scaled(gcc::ir::value_t value) const;
+
+                /* offsets of slots and spills, the prologue */
+                void frame();
+                void epilogue();
+
+                void instruction(uint32_t block, gcc::ir::value_t value);
+
+                location_t where(gcc::ir::value_t value) const;
+
+                /* a register, memory or 32-bit immediate operand holding value, scratch if it needs one */
+                gcc::x86::operand_t source(gcc::ir::value_t value, uint8_t scratch);
+
+                /* the memory at address value, may use r11 and rdx */
+                gcc::x86::operand_t address(gcc::ir::value_t value);
+
+                /* compare the operands of comparison value, the condition code of its result */
+                uint8_t compare(gcc::ir::value_t value);
+
+                void binary(const gcc::ir::inst_t& inst, gcc::ir::value_t value);
+                void shift(const gcc::ir::inst_t& inst, gcc::ir::value_t value);
+                void divide(const gcc::ir::inst_t& inst, gcc::ir::value_t value);
+                void unary(const gcc::ir::inst_t& inst, gcc::ir::value_t value);
+                void extend(const gcc::ir::inst_t& inst, gcc::ir::value_t value);
+                void load(const gcc::ir::inst_t& inst, gcc::ir::value_t value);
+                void store(const gcc::ir::inst_t& inst);
+                void call(const gcc::ir::inst_t& inst, gcc::ir::value_t value);
+
+                /* instructions with a vector operand or result */
+                void vector(const gcc::ir::inst_t& inst, gcc::ir::value_t value);
+
+                /* a register holding a vector value, scratch if it's spilled */
+                gcc::x86::operand_t vector_source(gcc::ir::value_t value, uint8_t scratch);
+
+                /* SSE2 has no 32-bit lane multiply, t *= b from 64-bit ones */
+                void multiply(uint8_t t, const gcc::x86::operand_t& b);
+
+                void jump(uint32_t block);
+                void branch(uint32_t block, gcc::ir::value_t cond);
+
+                /* the phi moves of the edge from block to succ */
+                void edge(uint32_t block, uint32_t succ, std::vector<move_t>& moves);
+
+                /* perform moves as if all at once, emptying it */
+                void parallel(std::vector<move_t>& moves);
+
+                void move(const location_t& dst, const location_t& src);
+
+                void emit(uint8_t op, unsigned size, const gcc::x86::operand_t& dst,
+                          const gcc::x86::operand_t& src = gcc::x86::none());
+
+                /* jump to block unless it's next */
+                void jump_to(uint32_t block);
+                void jcc(uint8_t cc, uint32_t target);
+
+                gcc::x86::sink *out_;
+                const gcc::ir::function *fn_;
+                gcc::x86::allocator alloc_;
+
+                std::unordered_set<gcc::symbol_t> defined_;   /* functions and globals of the module */
+
+                std::vector<uint8_t> kinds_;
+                std::vector<uint32_t> uses_;
+                std::vector<int32_t> slots_;       /* frame offsets of OP_SLOT values */
+                std::vector<uint8_t> saved_;       /* callee-saved registers pushed */
+                std::vector<move_t> moves_;
+                std::vector<move_t> other_;
+                int32_t spill_base_;               /* frame offset of spill slot 0 */
+                bool has_frame_;                   /* rsp was moved below the saved registers */
+                bool avx_;                         /* ymm registers are used, cleared before calls and returns */
+
+                uint32_t labels_;                  /* label of block 0 of the current function */
+                uint32_t next_label_;
+                uint32_t block_;                   /* being emitted */
+        };
+    };
+};
+
+#endif /* __CODEGEN_HH__ */
@@ -0,0 +1,833 @@
+#include <cerrno>
+#include <condition_variable>
+#include <cstring>
+
+#include <getopt.h>
+#include <sys/stat.h>
+
+#include "codegen.hh"
+#include "driver.hh"
+#include "elf.hh"
+#include "image.hh"
+#include "lower.hh"
+#include "pass.hh"
+#include "preprocessor.hh"
+#include "serialize.hh"
+#include "stats.hh"
+#include "x86.hh"
+
+#define CHANNEL "main"
+
+/* long options without a short one */
+enum {
+    OPT_CACHE = 256,
+    OPT_CACHE_SIZE,
+    OPT_EMIT_AST,
+    OPT_EMIT_PCH,
+    OPT_INCLUDE_PCH,
+    OPT_EMIT_IR,
+    OPT_JIT,
+};
+
+/* inputs named *.ast are images written by --emit-ast */
+static bool is_image(const char *file)
+{
+    size_t len = strlen(file);
+
+    return len > 4 && !strcmp(file + len - 4, ".ast");
+}
+
+static void print(FILE *err, const gcc::log::diagnostic_t& diag)
+{
+    fprintf(err, "%s:%s:%s: %s", gcc::log::level_str(diag.level), diag.channel, diag.func, diag.message.c_str());
+}
+
+/* the diagnostics of unit, named after its file if there are several units */
+static void report(FILE *err, const gcc::unit_t& unit, bool named)
+{
+    for (const gcc::log::diagnostic_t& diag : unit.diagnostics) {
+        if (named)
+            fprintf(err, "%s: ", unit.file.c_str());
+
+        print(err, diag);
+    }
+}
+
+/* write data to path, replacing what's there */
+static gcc_error_t write_file(const std::string& path, const std::string& data)
+{
+    FILE *fp;
+
+    if (!(fp = fopen(path.c_str(), "wb"))) {
+        ERROR("Failed to open %s: %s\n", path.c_str(), strerror(errno));
+        return GCC_INVALID_VALUE;
+    }
+
+    bool written = fwrite(data.data(), 1, data.size(), fp) == data.size();
+
+    if (fclose(fp) != 0 || !written) {
+        ERROR("Failed to write %s: %s\n", path.c_str(), strerror(errno));
+        return GCC_INVALID_VALUE;
+    }
+
+    return GCC_SUCCESS;
+}
+
+static void usage(const char *prog, FILE *out)
+{
+    fprintf(out,
+        "usage: %s [options] <input file>...\n"
+        "\n"
+        "  -I, --include-dir=DIR       search DIR for #include, before the system directories\n"
+        "  -j, --jobs=N                compile up to N files in parallel, or the functions of\n"
+        "                              a single large file (default: one per core)\n"
+        "  -O LEVEL                    optimize the IR at LEVEL, 0 or 1 (default: 1)\n"
+        "  -m ISA                      vectorize loops for ISA at -O1: sse2 (default), avx2,\n"
+        "                              or scalar not to vectorize\n"
+        "  -S                          write x86-64 assembly of each input to <input>.s\n"
+        "  -c                          write an x86-64 ELF object of each input to <input>.o\n"
+        "  -s, --stream                tokenize on demand while parsing instead of up front\n"
+        "  -t, --time-report[=FORMAT]  print phase times and counters when done,\n"
+        "                              FORMAT is table (default, stderr) or json (stdout)\n"
+        "  -d, --daemon[=SOCKET]       serve compilations on a Unix socket, see gabriel-client\n"
+        "      --cache[=DIR]           reuse token streams and parsed programs of unchanged\n"
+        "                              files across runs, tokenizes eagerly (default DIR:\n"
+        "                              $GABRIEL_CACHE_DIR or ~/.cache/gabriel)\n"
+        "      --cache-size=MB         evict least recently used entries beyond MB (default: %d)\n"
+        "      --emit-ast              write the parsed program of each input to <input>.ast,\n"
+        "                              inputs named *.ast are loaded instead of parsed\n"
+        "      --emit-pch              precompile each input, a header, to <input>.pch\n"
+        "      --include-pch=FILE      start each input from a header precompiled with\n"
+        "                              --emit-pch, as if it included the header first\n"
+        "      --emit-ir               write the optimized IR of each input to <input>.ir\n"
+        "      --jit[=ENTRY]           link the inputs in memory and call ENTRY (default: main),\n"
+        "                              exit with what it returns\n"
+        "  -h, --help                  show this help\n",
+        prog, gcc::cache::DEFAULT_SIZE_MB);
+}
+
+gcc::driver::driver(bool persistent):
+    persistent_(persistent),
+    pool_(),
+    parsers_(),
+    parser_(),
+    cache_lock_(),
+    cache_(),
+    disk_cache_(),
+    use_disk_cache_(false),
+    emit_ast_(false),
+    emit_pch_(false),
+    emit_ir_(false),
+    emit_asm_(false),
+    emit_obj_(false),
+    jit_(),
+    optimize_(1),
+    vector_(16),
+    include_dirs_(),
+    objects_lock_(),
+    objects_(),
+    pch_()
+{
+}
+
+gcc::driver::~driver()
+{
+}
+
+int gcc::driver::parse_options(int argc, char **argv, gcc::options_t& opts, FILE *err)
+{
+    static const struct option options[] = {
+        { "include-dir", required_argument, nullptr, 'I' },
+        { "jobs",        required_argument, nullptr, 'j' },
+        { "stream",      no_argument,       nullptr, 's' },
+        { "time-report", optional_argument, nullptr, 't' },
+        { "daemon",      optional_argument, nullptr, 'd' },
+        { "cache",       optional_argument, nullptr, OPT_CACHE },
+        { "cache-size",  required_argument, nullptr, OPT_CACHE_SIZE },
+        { "emit-ast",    no_argument,       nullptr, OPT_EMIT_AST },
+        { "emit-pch",    no_argument,       nullptr, OPT_EMIT_PCH },
+        { "include-pch", required_argument, nullptr, OPT_INCLUDE_PCH },
+        { "emit-ir",     no_argument,       nullptr, OPT_EMIT_IR },
+        { "jit",         optional_argument, nullptr, OPT_JIT },
+        { "help",        no_argument,       nullptr, 'h' },
+        { nullptr,       0,                 nullptr,  0  },
+    };
+
+    int opt;
+
+    opts.jobs   = 0;
+    opts.stream = false;
+    opts.report = REPORT_NONE;
+    opts.daemon = nullptr;
+    opts.cache  = nullptr;
+    opts.cache_size = (uint64_t)gcc::cache::DEFAULT_SIZE_MB << 20;
+    opts.emit_ast   = false;
+    opts.emit_pch   = false;
+    opts.emit_ir    = false;
+    opts.emit_asm   = false;
+    opts.emit_obj   = false;
+    opts.jit.clear();
+    opts.optimize   = 1;
+    opts.vector     = 16;
+    opts.include_pch.clear();
+    opts.include_dirs.clear();
+    opts.files.clear();
+
+    /* the daemon parses many command lines, 0 makes getopt start over */
+    optind = 0;
+    opterr = 0;
+
+    while ((opt = getopt_long(argc, argv, "I:j:O:m:Scst::d::h", options, nullptr)) != -1) {
+        switch (opt) {
+            case 'I':
+                opts.include_dirs.push_back(optarg);
+                break;
+
+            case 'j':
+                if ((opts.jobs = strtoul(optarg, nullptr, 10)) == 0) {
+                    fprintf(err, "invalid job count '%s'\n", optarg);
+                    usage(argv[0], err);
+                    return EXIT_FAILURE;
+                }
+                break;
+
+            case 'O':
+                if (strcmp(optarg, "0") && strcmp(optarg, "1")) {
+                    fprintf(err, "invalid optimization level '%s'\n", optarg);
+                    usage(argv[0], err);
+                    return EXIT_FAILURE;
+                }
+                opts.optimize = optarg[0] - '0';
+                break;
+
+            case 'm':
+                if (!strcmp(optarg, "sse2")) {
+                    opts.vector = 16;
+                } else if (!strcmp(optarg, "avx2")) {
+                    opts.vector = 32;
+                } else if (!strcmp(optarg, "scalar")) {
+                    opts.vector = 0;
+                } else {
+                    fprintf(err, "invalid instruction set '%s'\n", optarg);
+                    usage(argv[0], err);
+                    return EXIT_FAILURE;
+                }
+                break;
+
+            case 'S':
+                opts.emit_asm = true;
+                break;
+
+            case 'c':
+                opts.emit_obj = true;
+                break;
+
+            case 's':
+                opts.stream = true;
+                break;
+
+            case 't':
+                if (!optarg || !strcmp(optarg, "table")) {
+                    opts.report = REPORT_TABLE;
+                } else if (!strcmp(optarg, "json")) {
+                    opts.report = REPORT_JSON;
+                } else {
+                    fprintf(err, "unknown time report format '%s'\n", optarg);
+                    usage(argv[0], err);
+                    return EXIT_FAILURE;
+                }
+                break;
+
+            case 'd':
+                opts.daemon = optarg ? optarg : "";
+                break;
+
+            case OPT_CACHE:
+                opts.cache = optarg ? optarg : "";
+                break;
+
+            case OPT_CACHE_SIZE:
+                if ((opts.cache_size = strtoull(optarg, nullptr, 10) << 20) == 0) {
+                    fprintf(err, "invalid cache size '%s'\n", optarg);
+                    usage(argv[0], err);
+                    return EXIT_FAILURE;
+                }
+                break;
+
+            case OPT_EMIT_AST:
+                opts.emit_ast = true;
+                break;
+
+            case OPT_EMIT_PCH:
+                opts.emit_pch = true;
+                break;
+
+            case OPT_INCLUDE_PCH:
+                opts.include_pch = optarg;
+                break;
+
+            case OPT_EMIT_IR:
+                opts.emit_ir = true;
+                break;
+
+            case OPT_JIT:
+                opts.jit = optarg && *optarg ? optarg : "main";
+                break;
+
+            case 'h':
+                usage(argv[0], err);
+                return EXIT_SUCCESS;
+
+            default:
+                fprintf(err, "unknown option '%s'\n", argv[optind - 1]);
+                usage(argv[0], err);
+                return EXIT_FAILURE;
+        }
+    }
+
+    for (int i = optind; i < argc; ++i)
+        opts.files.push_back(argv[i]);
+
+    if (opts.files.empty() && !opts.daemon) {
+        usage(argv[0], err);
+        return EXIT_FAILURE;
+    }
+
+    return -1;
+}
+
+/* tokenize and parse one file on the calling thread */
+gcc_error_t gcc::driver::compile(gcc::parser& parser, const char *file, bool stream, bool& preprocessed)
+{
+    size_t symbols = gcc::symbols().size();
+    gcc::tokenizer tokenizer;
+    gcc_error_t ret;
+
+    preprocessed = false;
+
+    if (is_image(file)) {
+        ret = load(parser, file);
+    } else if (use_disk_cache_) {
+        ret = compile(parser, file, *disk_cache_, preprocessed);
+    } else if (stream) {
+        if ((ret = tokenizer.open(file)) != GCC_SUCCESS) {
+            ERROR("Failed to open file %s: %s\n", file, gcc_error(ret));
+            return ret;
+        }
+
+        const gcc::source_buffer& source = tokenizer.get_source();
+
+        /* directives aren't expanded on the fly, a file
+         * that may have some is tokenized up front */
+        if (!must_preprocess() && !memchr(source.data(), '#', source.size())) {
+            if ((ret = parser.parse(tokenizer)) != GCC_SUCCESS)
+                ERROR("Failed to parse tokens!\n");
+        } else if ((ret = tokenizer.tokenize()) != GCC_SUCCESS) {
+            ERROR("Failed to tokenize file %s: %s\n", file, gcc_error(ret));
+            return ret;
+        } else {
+            preprocessed = tokenizer.has_directives() || must_preprocess();
+            ret = parse(parser, file, tokenizer.get_token_stream(), preprocessed);
+        }
+    } else {
+        if ((ret = tokenizer.tokenize(file)) != GCC_SUCCESS) {
+            ERROR("Failed to tokenize file %s: %s\n", file, gcc_error(ret));
+            return ret;
+        }
+
+        preprocessed = tokenizer.has_directives() || must_preprocess();
+        ret = parse(parser, file, tokenizer.get_token_stream(), preprocessed);
+    }
+
+    gcc::stats::add(gcc::COUNTER_SYMBOLS, gcc::symbols().size() - symbols);
+
+    if (ret == GCC_SUCCESS && emit_ast_ && !is_image(file))
+        ret = emit_ast(parser, file);
+
+    if (ret == GCC_SUCCESS && (emit_ir_ || emit_asm_ || emit_obj_ || !jit_.empty())) {
+        gcc::ir::module module;
+
+        if ((ret = lower(parser, file, module)) == GCC_SUCCESS && emit_ir_)
+            ret = emit_ir(module, file);
+
+        if (ret == GCC_SUCCESS && emit_asm_)
+            ret = emit_asm(module, file);
+
+        if (ret == GCC_SUCCESS && (emit_obj_ || !jit_.empty()))
+            ret = encode(module, file);
+    }
+
+    return ret;
+}
+
+gcc_error_t gcc::driver::parse(gcc::parser& parser, const char *file, const gcc::token_stream_t& tokens, bool directives)
+{
+    gcc::token_stream_t expanded;
+    gcc_error_t ret;
+
+    parser.set_prelude(pch_ ? &pch_->prog() : nullptr);
+
+    if (!directives) {
+        if ((ret = parser.parse(tokens)) != GCC_SUCCESS)
+            ERROR("Failed to parse tokens!\n");
+        return ret;
+    }
+
+    gcc::preprocessor preprocessor(include_dirs_);
+
+    if (pch_ && (ret = pch_->restore(preprocessor)) != GCC_SUCCESS)
+        return ret;
+
+    if ((ret = preprocessor.run(file, tokens, expanded)) != GCC_SUCCESS) {
+        ERROR("Failed to preprocess file %s: %s\n", file, gcc_error(ret));
+        return ret;
+    }
+
+    if ((ret = parser.parse(expanded)) != GCC_SUCCESS) {
+        ERROR("Failed to parse tokens!\n");
+        return ret;
+    }
+
+    if (emit_pch_)
+        ret = emit_pch(parser, preprocessor, file);
+
+    return ret;
+}
+
+/* map an image written by --emit-ast and build its program, no parsing */
+gcc_error_t gcc::driver::load(gcc::parser& parser, const char *file)
+{
+    gcc::image image;
+    gcc_error_t ret;
+
+    if ((ret = image.map(file)) != GCC_SUCCESS) {
+        ERROR("Failed to map AST image %s: %s\n", file, gcc_error(ret));
+        return ret;
+    }
+
+    if ((ret = parser.load(image)) != GCC_SUCCESS)
+        ERROR("Invalid AST image %s\n", file);
+
+    return ret;
+}
+
+/* write the image of the program parsed from file to file.ast */
+gcc_error_t gcc::driver::emit_ast(gcc::parser& parser, const char *file)
+{
+    std::string out;
+
+    gcc::image::write(out, *parser.get_prog());
+
+    return write_file(std::string(file) + ".ast", out);
+}
+
+/* write what preprocessing and parsing the header file left behind to file.pch */
+gcc_error_t gcc::driver::emit_pch(gcc::parser& parser, const gcc::preprocessor& preprocessor, const char *file)
+{
+    std::string out;
+
+    gcc::pch::write(out, preprocessor, *parser.get_prog());
+
+    return write_file(std::string(file) + ".pch", out);
+}
+
+gcc_error_t gcc::driver::lower(gcc::parser& parser, const char *file, gcc::ir::module& module)
+{
+    gcc::ir::lowering lowering;
+    gcc::ir::pass_manager passes;
+    gcc_error_t ret;
+
+    if ((ret = lowering.run(*parser.get_prog(), module)) != GCC_SUCCESS) {
+        ERROR("Failed to lower %s\n", file);
+        return ret;
+    }
+
+    passes.add_defaults(optimize_, vector_);
+    passes.set_verify(true);
+
+    return passes.run(module);
+}
+
+/* write the IR of the program parsed from file to file.ir */
+gcc_error_t gcc::driver::emit_ir(const gcc::ir::module& module, const char *file)
+{
+    std::string path = std::string(file) + ".ir";
+    FILE *fp;
+
+    if (!(fp = fopen(path.c_str(), "w"))) {
+        ERROR("Failed to open %s: %s\n", path.c_str(), strerror(errno));
+        return GCC_INVALID_VALUE;
+    }
+
+    gcc::ir::print(fp, module);
+
+    if (fclose(fp) != 0) {
+        ERROR("Failed to write %s: %s\n", path.c_str(), strerror(errno));
+        return GCC_INVALID_VALUE;
+    }
+
+    return GCC_SUCCESS;
+}
+
+/* generate the assembly of the program parsed from file to file.s */
+gcc_error_t gcc::driver::emit_asm(const gcc::ir::module& module, const char *file)
+{
+    gcc::x86::codegen codegen;
+    std::string out;
+    gcc::x86::asm_writer writer(out);
+    gcc_error_t ret;
+
+    if ((ret = codegen.run(module, writer)) != GCC_SUCCESS) {
+        ERROR("Failed to generate code for %s\n", file);
+        return ret;
+    }
+
+    out.append("\t.section\t.note.GNU-stack,\"\",@progbits\n");
+
+    return write_file(std::string(file) + ".s", out);
+}
+
+/* generate the machine code of the program parsed from file, written
+ * to file.o for -c and kept to be linked for --jit */
+gcc_error_t gcc::driver::encode(const gcc::ir::module& module, const char *file)
+{
+    gcc::x86::codegen codegen;
+    gcc::x86::object_t object;
+    gcc::x86::encoder encoder(object);
+    gcc_error_t ret;
+
+    if ((ret = codegen.run(module, encoder)) != GCC_SUCCESS) {
+        ERROR("Failed to generate code for %s\n", file);
+        return ret;
+    }
+
+    if (emit_obj_) {
+        std::string out;
+
+        gcc::elf::write(out, object, file);
+
+        if ((ret = write_file(std::string(file) + ".o", out)) != GCC_SUCCESS || jit_.empty())
+            return ret;
+    }
+
+    std::lock_guard<std::mutex> guard(objects_lock_);
+    objects_[file] = std::move(object);
+
+    return GCC_SUCCESS;
+}
+
+gcc_error_t gcc::driver::use_pch(const std::string& file)
+{
+    gcc_error_t ret;
+
+    if (pch_ && pch_->path() == file && !pch_->stale())
+        return GCC_SUCCESS;
+
+    if (!pch_ && file.empty())
+        return GCC_SUCCESS;
+
+    /* parsers still hold programs built from the old one */
+    parser_.set_prelude(nullptr);
+
+    for (auto& parser : parsers_)
+        parser->set_prelude(nullptr);
+
+    pch_.reset();
+
+    if (file.empty())
+        return GCC_SUCCESS;
+
+    std::unique_ptr<gcc::pch> pch(new gcc::pch());
+
+    if ((ret = pch->map(file.c_str())) != GCC_SUCCESS) {
+        ERROR("Failed to load precompiled header %s: %s\n", file.c_str(), gcc_error(ret));
+        return ret;
+    }
+
+    pch_ = std::move(pch);
+    return GCC_SUCCESS;
+}
+
+/* Tokenize and parse through the on-disk cache, on a hit the file is
+ * only read and hashed. Programs are stored only for files that parsed
+ * without any diagnostics, so a hit never has anything to report. Files
+ * whose parse reported something keep just their tokens and are parsed
+ * again for the diagnostics, anything the tokenizer reported isn't
+ * cached at all. The program of a file with directives depends on its
+ * headers, which aren't part of the key, so only its tokens are kept
+ * and they're preprocessed again on a hit. A PCH is part of the key,
+ * the unit is parsed in the scope of its declarations. */
+gcc_error_t gcc::driver::compile(gcc::parser& parser, const char *file, gcc::cache& cache, bool& preprocessed)
+{
+    std::vector<gcc::log::diagnostic_t> diagnostics;
+    std::vector<gcc::log::diagnostic_t> *sink;
+    gcc::serialize::reader reader;
+    gcc::tokenizer tokenizer;
+    gcc::hash128_t key;
+    std::string entry;
+    gcc_error_t ret;
+    size_t lexed;
+    bool tokenized;
+
+    if ((ret = tokenizer.open(file)) != GCC_SUCCESS) {
+        ERROR("Failed to tokenize file %s: %s\n", file, gcc_error(ret));
+        return ret;
+    }
+
+    const gcc::source_buffer& source = tokenizer.get_source();
+    gcc::token_stream_t& tokens      = tokenizer.get_token_stream();
+
+    key = gcc::cache::key(source.data(), source.size());
+
+    if (pch_)
+        key = gcc::hash128(&pch_->hash(), sizeof(gcc::hash128_t), key);
+
+    if (cache.load(key, source.size(), entry) && reader.open(entry.data(), entry.size()) == GCC_SUCCESS) {
+        /* a parse of stored tokens is timed as parsing, see scoped_timer */
+        gcc::scoped_timer timer(gcc::PHASE_CACHE);
+        gcc::image image;
+
+        if (reader.has_prog() && reader.read_prog(image) == GCC_SUCCESS && parser.load(image) == GCC_SUCCESS)
+            return GCC_SUCCESS;
+
+        if (!reader.has_prog() && reader.read_tokens(tokens) == GCC_SUCCESS) {
+            preprocessed = gcc::preprocessor::has_directives(tokens) || must_preprocess();
+            return parse(parser, file, tokens, preprocessed);
+        }
+    }
+
+    sink      = gcc::log::capture(&diagnostics);
+    tokenized = (ret = tokenizer.tokenize()) == GCC_SUCCESS;
+    lexed     = diagnostics.size();
+
+    if (tokenized) {
+        preprocessed = tokenizer.has_directives() || must_preprocess();
+        ret = parse(parser, file, tokens, preprocessed);
+    }
+
+    gcc::log::capture(sink);
+
+    for (const gcc::log::diagnostic_t& diag : diagnostics)
+        gcc::log::report(diag);
+
+    if (!tokenized) {
+        ERROR("Failed to tokenize file %s: %s\n", file, gcc_error(ret));
+        return ret;
+    }
+
+    /* what the tokenizer reported would be lost on a hit */
+    if (lexed == 0) {
+        gcc::scoped_timer timer(gcc::PHASE_CACHE);
+        bool prog = ret == GCC_SUCCESS && diagnostics.empty() && !preprocessed;
+
+        entry.clear();
+        gcc::serialize::write(entry, tokens, prog ? parser.get_prog() : nullptr);
+        cache.store(key, source.size(), entry);
+    }
+
+    return ret;
+}
+
+/* compile with the diagnostics captured into the unit, a persistent
+ * driver skips files that haven't changed since they were last compiled
+ * unless they include headers, which may have changed */
+void gcc::driver::compile_unit(gcc::parser& parser, gcc::unit_t& unit, bool stream)
+{
+    file_id_t id = { 0, 0, 0, 0 };
+    struct stat st;
+    bool cacheable = false;
+
+    /* an outcome says nothing about the files a run writes, and one
+     * after a PCH depends on the header */
+    if (persistent_ && !writes_output() && !pch_ && stat(unit.file.c_str(), &st) == 0 && S_ISREG(st.st_mode)) {
+        id = {
+            (uint64_t)st.st_dev,
+            (uint64_t)st.st_ino,
+            (uint64_t)st.st_size,
+            (uint64_t)st.st_mtim.tv_sec * 1000000000ull + st.st_mtim.tv_nsec,
+        };
+        cacheable = true;
+
+        std::lock_guard<std::mutex> guard(cache_lock_);
+        auto it = cache_.find(unit.file);
+
+        if (it != cache_.end() && !memcmp(&it->second.id, &id, sizeof(id))) {
+            unit.status      = it->second.status;
+            unit.diagnostics = it->second.diagnostics;
+            return;
+        }
+    }
+
+    std::vector<gcc::log::diagnostic_t> *sink = gcc::log::capture(&unit.diagnostics);
+    bool preprocessed;
+
+    unit.status = compile(parser, unit.file.c_str(), stream, preprocessed);
+    gcc::log::capture(sink);
+
+    if (cacheable && !preprocessed) {
+        std::lock_guard<std::mutex> guard(cache_lock_);
+        cache_[unit.file] = { id, unit.status, unit.diagnostics };
+    }
+}
+
+/* Link what --jit generated for the units in input order, so the
+ * result doesn't depend on scheduling */
+void *gcc::driver::link(gcc::jit& jit, const std::vector<gcc::unit_t>& units, FILE *err)
+{
+    std::vector<gcc::log::diagnostic_t> diagnostics;
+    std::vector<gcc::log::diagnostic_t> *sink = gcc::log::capture(&diagnostics);
+    void *entry = nullptr;
+
+    for (const gcc::unit_t& unit : units)
+        jit.add(std::move(objects_[unit.file]));
+
+    objects_.clear();
+
+    if (jit.link() == GCC_SUCCESS && !(entry = jit.lookup(jit_.c_str())))
+        ERROR("No function %s to run\n", jit_.c_str());
+
+    gcc::log::capture(sink);
+
+    for (const gcc::log::diagnostic_t& diag : diagnostics)
+        print(err, diag);
+
+    return entry;
+}
+
+/* Compile every unit on a work-stealing pool. Each worker keeps one
+ * parser (and so one arena) for all the files it picks up and interns
+ * into its own thread's interner, nothing is shared between files. */
+void gcc::driver::compile_all(std::vector<gcc::unit_t>& units, size_t jobs, bool stream, FILE *err)
+{
+    if (!pool_ || (jobs && jobs != pool_->size())) {
+        parsers_.clear();
+        pool_.reset(new gcc::thread_pool(jobs));
+
+        for (size_t i = 0; i < pool_->size(); ++i)
+            parsers_.emplace_back(new gcc::parser());
+    }
+
+    std::mutex lock;
+    std::condition_variable finished;
+    std::vector<bool> done(units.size(), false);
+
+    for (size_t i = 0; i < units.size(); ++i) {
+        gcc::unit_t *u = &units[i];
+
+        pool_->submit([this, u, stream, i, &lock, &finished, &done] {
+            compile_unit(*parsers_[gcc::thread_pool::worker_id()], *u, stream);
+
+            std::lock_guard<std::mutex> guard(lock);
+            done[i] = true;
+            finished.notify_all();
+        });
+    }
+
+    /* in input order so the output doesn't depend on scheduling */
+    for (size_t i = 0; i < units.size(); ++i) {
+        std::unique_lock<std::mutex> guard(lock);
+
+        finished.wait(guard, [&done, i] { return done[i]; });
+        guard.unlock();
+
+        report(err, units[i], true);
+    }
+
+    pool_->wait();
+}
+
+int gcc::driver::run(const gcc::options_t& opts, FILE *out, FILE *err)
+{
+    std::vector<gcc::unit_t> units;
+    int status = EXIT_SUCCESS;
+
+    if (opts.report != REPORT_NONE)
+        gcc::stats::enable();
+
+    for (const std::string& file : opts.files)
+        units.push_back({ file, GCC_SUCCESS, {} });
+
+    emit_ast_     = opts.emit_ast;
+    emit_pch_     = opts.emit_pch;
+    emit_ir_      = opts.emit_ir;
+    emit_asm_     = opts.emit_asm;
+    emit_obj_     = opts.emit_obj;
+    jit_          = opts.jit;
+    optimize_     = opts.optimize;
+    vector_       = opts.vector;
+    include_dirs_ = opts.include_dirs;
+
+    /* the code would run inside the daemon */
+    if (persistent_ && !jit_.empty()) {
+        fprintf(err, "--jit can't be used with the daemon\n");
+        return EXIT_FAILURE;
+    }
+
+    {
+        std::vector<gcc::log::diagnostic_t> diagnostics;
+        std::vector<gcc::log::diagnostic_t> *sink = gcc::log::capture(&diagnostics);
+        gcc_error_t ret = use_pch(opts.include_pch);
+
+        gcc::log::capture(sink);
+
+        for (const gcc::log::diagnostic_t& diag : diagnostics)
+            print(err, diag);
+
+        if (ret != GCC_SUCCESS)
+            return EXIT_FAILURE;
+    }
+
+    /* a daemon keeps the cache between requests that ask for the same one */
+    if ((use_disk_cache_ = opts.cache != nullptr)) {
+        std::string dir = *opts.cache ? opts.cache : gcc::cache::default_dir();
+
+        if (!disk_cache_ || disk_cache_->dir() != dir || disk_cache_->max_bytes() != opts.cache_size)
+            disk_cache_.reset(new gcc::cache(dir, opts.cache_size));
+    }
+
+    if (units.size() == 1) {
+        parser_.set_jobs(opts.jobs);
+
+        /* a single file from the command line reports as it goes */
+        bool preprocessed;
+
+        if (!persistent_)
+            units[0].status = compile(parser_, units[0].file.c_str(), opts.stream, preprocessed);
+        else
+            compile_unit(parser_, units[0], opts.stream);
+
+        report(err, units[0], false);
+    } else {
+        compile_all(units, opts.jobs, opts.stream, err);
+    }
+
+    for (const gcc::unit_t& unit : units) {
+        if (unit.status != GCC_SUCCESS)
+            status = EXIT_FAILURE;
+    }
+
+    gcc::jit jit;
+    void *entry = nullptr;
+
+    if (!jit_.empty() && status == EXIT_SUCCESS && !(entry = link(jit, units, err)))
+        status = EXIT_FAILURE;
+
+    objects_.clear();
+
+    if (opts.report == REPORT_TABLE)
+        gcc::stats::report_table(err);
+    else if (opts.report == REPORT_JSON)
+        gcc::stats::report_json(out);
+
+    gcc::stats::disable();
+
+    if (entry) {
+        char *argv[] = { const_cast<char *>(jit_.c_str()), nullptr };
+
+        fflush(out);
+        fflush(err);
+        status = reinterpret_cast<int (*)(int, char **)>(entry)(1, argv);
+    }
+
+    return status;
+}
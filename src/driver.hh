@@ -0,0 +1,174 @@
+#ifndef __DRIVER_HH__
+#define __DRIVER_HH__
+
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "cache.hh"
+#include "encoder.hh"
+#include "ir.hh"
+#include "jit.hh"
+#include "parser.hh"
+#include "pch.hh"
+#include "pool.hh"
+#include "util/error.hh"
+#include "util/log.hh"
+
+namespace gcc {
+
+    enum {
+        REPORT_NONE,
+        REPORT_TABLE,
+        REPORT_JSON,
+    };
+
+    /* command line of one compilation */
+    typedef struct options {
+        size_t jobs;             /* 0 means one per core */
+        bool stream;
+        int report;
+        const char *daemon;      /* socket to serve on, nullptr if not a daemon */
+        const char *cache;       /* cache directory, "" for the default, nullptr for none */
+        uint64_t cache_size;     /* bytes */
+        bool emit_ast;
+        bool emit_pch;
+        bool emit_ir;
+        bool emit_asm;           /* -S */
+        bool emit_obj;           /* -c */
+        std::string jit;         /* entry point to run, "" for none */
+        int optimize;            /* level of the IR pipeline, see ir::pass_manager */
+        unsigned vector;         /* bytes of the vectors loops are turned into, 0 for none */
+        std::string include_pch; /* "" for none */
+        std::vector<std::string> include_dirs;
+        std::vector<std::string> files;
+    } options_t;
+
+    /* one input file and what compiling it produced */
+    typedef struct unit {
+        std::string file;
+        gcc_error_t status;
+        std::vector<gcc::log::diagnostic_t> diagnostics;
+    } unit_t;
+
+    /* Runs compilations for the command line and for the daemon.
+     *
+     * The worker pool, the parsers (and so their arenas) and the threads'
+     * interners live as long as the driver, so a daemon reuses all of them
+     * between requests. A persistent driver also remembers the outcome of
+     * every file it compiled and replays it while the file is unchanged.
+     * With --cache, token streams and programs are also kept on disk by
+     * content, see gcc::cache, so they outlive the process. A PCH given
+     * with --include-pch stays mapped while it's up to date. */
+    class driver {
+        public:
+            driver(bool persistent = false);
+            ~driver();
+
+            /* Parse argv into opts, problems and --help go to err.
+             * Returns EXIT_SUCCESS or EXIT_FAILURE if the caller should
+             * exit with that status instead of compiling, -1 otherwise. */
+            static int parse_options(int argc, char **argv, gcc::options_t& opts, FILE *err);
+
+            /* compile opts.files, returns the exit status */
+            int run(const gcc::options_t& opts, FILE *out, FILE *err);
+
+        private:
+            driver(const driver&);
+            driver& operator=(const driver&);
+
+            /* identity of a file's contents as far as the cache is concerned */
+            typedef struct file_id {
+                uint64_t dev;
+                uint64_t ino;
+                uint64_t size;
+                uint64_t mtime;
+            } file_id_t;
+
+            typedef struct cached {
+                file_id_t id;
+                gcc_error_t status;
+                std::vector<gcc::log::diagnostic_t> diagnostics;
+            } cached_t;
+
+            /* preprocessed is set if the result depends on headers */
+            gcc_error_t compile(gcc::parser& parser, const char *file, bool stream, bool& preprocessed);
+
+            /* compile through the on-disk cache */
+            gcc_error_t compile(gcc::parser& parser, const char *file, gcc::cache& cache, bool& preprocessed);
+
+            /* parse the tokens of file, preprocessed first if they have directives */
+            gcc_error_t parse(gcc::parser& parser, const char *file, const gcc::token_stream_t& tokens, bool directives);
+
+            gcc_error_t load(gcc::parser& parser, const char *file);
+            gcc_error_t emit_ast(gcc::parser& parser, const char *file);
+            gcc_error_t emit_pch(gcc::parser& parser, const gcc::preprocessor& preprocessor, const char *file);
+
+            /* build the optimized IR of the program parsed from file */
+            gcc_error_t lower(gcc::parser& parser, const char *file, gcc::ir::module& module);
+
+            gcc_error_t emit_ir(const gcc::ir::module& module, const char *file);
+            gcc_error_t emit_asm(const gcc::ir::module& module, const char *file);
+
+            /* generate the machine code of file for -c and --jit */
+            gcc_error_t encode(const gcc::ir::module& module, const char *file);
+
+            /* link the code of every unit into jit, the entry point or nullptr */
+            void *link(gcc::jit& jit, const std::vector<gcc::unit_t>& units, FILE *err);
+
+            /* map the PCH of the command line unless it's mapped already, "" unmaps it */
+            gcc_error_t use_pch(const std::string& file);
+
+            /* true if a run writes files or runs code besides reporting, a
+             * daemon then can't answer from the outcome of an earlier run,
+             * every option that produces something belongs here */
+            bool writes_output() const
+            {
+                return emit_ast_ || emit_pch_ || emit_ir_ || emit_asm_ || emit_obj_ || !jit_.empty();
+            }
+
+            /* a header to precompile and every unit after a PCH are preprocessed */
+            bool must_preprocess() const { return emit_pch_ || pch_; }
+
+            void compile_unit(gcc::parser& parser, gcc::unit_t& unit, bool stream);
+
+            /* Compile units on the pool. The diagnostics of a unit are
+             * written to err as soon as it and the units before it are
+             * done, in input order but without waiting for the last. */
+            void compile_all(std::vector<gcc::unit_t>& units, size_t jobs, bool stream, FILE *err);
+
+            bool persistent_;
+
+            std::unique_ptr<gcc::thread_pool> pool_;
+            std::vector<std::unique_ptr<gcc::parser>> parsers_;
+            gcc::parser parser_;
+
+            std::mutex cache_lock_;
+            std::unordered_map<std::string, cached_t> cache_;
+
+            /* on-disk cache of this run, nullptr without --cache */
+            std::unique_ptr<gcc::cache> disk_cache_;
+            bool use_disk_cache_;
+            bool emit_ast_;
+            bool emit_pch_;
+            bool emit_ir_;
+            bool emit_asm_;
+            bool emit_obj_;
+            std::string jit_;
+            int optimize_;
+            unsigned vector_;
+            std::vector<std::string> include_dirs_;
+
+            /* machine code of the units of a --jit run */
+            std::mutex objects_lock_;
+            std::unordered_map<std::string, gcc::x86::object_t> objects_;
+
+            /* --include-pch of this run, nullptr without one */
+            std::unique_ptr<gcc::pch> pch_;
+    };
+};
+
+#endif /* __DRIVER_HH__ */
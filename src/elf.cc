@@ -0,0 +1,208 @@
+#include <cstring>
+#include <vector>
+
+#include <elf.h>
+
+#include "elf.hh"
+
+enum {
+    SHDR_NULL,
+    SHDR_TEXT,
+    SHDR_DATA,
+    SHDR_BSS,
+    SHDR_RELA,
+    SHDR_SYMTAB,
+    SHDR_STRTAB,
+    SHDR_SHSTRTAB,
+    SHDR_STACK,      /* .note.GNU-stack, the stack isn't executable */
+    SHDR_LAST,
+};
+
+static const char *section_names[] = {
+    "", ".text", ".data", ".bss", ".rela.text", ".symtab", ".strtab", ".shstrtab", ".note.GNU-stack",
+};
+
+/* section header index of a gcc::x86::SECTION_* */
+static const uint16_t section_index[] = { SHN_UNDEF, SHDR_TEXT, SHDR_DATA, SHDR_BSS };
+
+template <typename T>
+static void append(std::string& out, const T& value)
+{
+    out.append((const char *)&value, sizeof(value));
+}
+
+/* align the end of an object starting at start in out */
+static void pad(std::string& out, size_t start, size_t to)
+{
+    out.resize(start + (out.size() - start + to - 1) / to * to, '\0');
+}
+
+/* offset of s in the string table, which starts with an empty string */
+static uint32_t add_string(std::string& table, const char *s)
+{
+    uint32_t offset = table.size();
+
+    table.append(s, strlen(s) + 1);
+    return offset;
+}
+
+/* The relocation type of a reference. A GOT load of the form the
+ * assembler would mark, mov sym@GOTPCREL(%rip) with a REX prefix, is
+ * marked the same so that the linker may turn it into a lea when the
+ * symbol ends up in the same executable. */
+static uint32_t reloc_type(const std::string& text, const gcc::x86::reloc_t& reloc)
+{
+    switch (reloc.kind) {
+        case gcc::x86::RELOC_PLT32:
+            return R_X86_64_PLT32;
+
+        case gcc::x86::RELOC_GOTPCREL:
+            if (reloc.offset >= 3 && (uint8_t)text[reloc.offset - 2] == 0x8b &&
+                ((uint8_t)text[reloc.offset - 3] & 0xf0) == 0x40)
+                return R_X86_64_REX_GOTPCRELX;
+            return R_X86_64_GOTPCREL;
+    }
+
+    return R_X86_64_PC32;
+}
+
+void gcc::elf::write(std::string& out, const gcc::x86::object_t& object, const char *file)
+{
+    std::vector<Elf64_Sym> symbols;
+    std::vector<uint32_t> indices(object.symbols.size());
+    std::string strtab(1, '\0'), shstrtab(1, '\0');
+    Elf64_Shdr shdrs[SHDR_LAST];
+    const char *base = strrchr(file, '/');
+    size_t start = out.size();
+    uint32_t locals = 0;
+
+    memset(shdrs, 0, sizeof(shdrs));
+
+    for (int i = 1; i < SHDR_LAST; ++i)
+        shdrs[i].sh_name = add_string(shstrtab, section_names[i]);
+
+    /* the null symbol and the source file, then locals before globals */
+    symbols.push_back(Elf64_Sym());
+    symbols.push_back(Elf64_Sym());
+    symbols.back().st_name  = add_string(strtab, base ? base + 1 : file);
+    symbols.back().st_info  = ELF64_ST_INFO(STB_LOCAL, STT_FILE);
+    symbols.back().st_shndx = SHN_ABS;
+
+    for (int pass = 0; pass < 2; ++pass) {
+        for (size_t i = 0; i < object.symbols.size(); ++i) {
+            const gcc::x86::object_symbol_t& sym = object.symbols[i];
+            bool local = sym.local && sym.section != gcc::x86::SECTION_UNDEF;
+            Elf64_Sym entry = Elf64_Sym();
+            unsigned char type = STT_NOTYPE;
+
+            if (local != (pass == 0))
+                continue;
+
+            if (sym.section != gcc::x86::SECTION_UNDEF)
+                type = sym.function ? STT_FUNC : STT_OBJECT;
+
+            entry.st_name  = add_string(strtab, sym.name.c_str());
+            entry.st_info  = ELF64_ST_INFO(local ? STB_LOCAL : STB_GLOBAL, type);
+            entry.st_shndx = section_index[sym.section];
+            entry.st_value = sym.offset;
+            entry.st_size  = sym.size;
+
+            indices[i] = symbols.size();
+            symbols.push_back(entry);
+        }
+
+        if (pass == 0)
+            locals = symbols.size();
+    }
+
+    out.resize(start + sizeof(Elf64_Ehdr), '\0');
+
+    /* the offsets in the headers are from the start of the object */
+    pad(out, start, 16);
+    shdrs[SHDR_TEXT].sh_type      = SHT_PROGBITS;
+    shdrs[SHDR_TEXT].sh_flags     = SHF_ALLOC | SHF_EXECINSTR;
+    shdrs[SHDR_TEXT].sh_offset    = out.size() - start;
+    shdrs[SHDR_TEXT].sh_size      = object.text.size();
+    shdrs[SHDR_TEXT].sh_addralign = 16;
+    out.append(object.text);
+
+    pad(out, start, 8);
+    shdrs[SHDR_DATA].sh_type      = SHT_PROGBITS;
+    shdrs[SHDR_DATA].sh_flags     = SHF_ALLOC | SHF_WRITE;
+    shdrs[SHDR_DATA].sh_offset    = out.size() - start;
+    shdrs[SHDR_DATA].sh_size      = object.data.size();
+    shdrs[SHDR_DATA].sh_addralign = 8;
+    out.append(object.data);
+
+    shdrs[SHDR_BSS].sh_type      = SHT_NOBITS;
+    shdrs[SHDR_BSS].sh_flags     = SHF_ALLOC | SHF_WRITE;
+    shdrs[SHDR_BSS].sh_offset    = out.size() - start;
+    shdrs[SHDR_BSS].sh_size      = object.bss;
+    shdrs[SHDR_BSS].sh_addralign = 8;
+
+    pad(out, start, 8);
+    shdrs[SHDR_RELA].sh_type      = SHT_RELA;
+    shdrs[SHDR_RELA].sh_flags     = SHF_INFO_LINK;
+    shdrs[SHDR_RELA].sh_offset    = out.size() - start;
+    shdrs[SHDR_RELA].sh_size      = object.relocs.size() * sizeof(Elf64_Rela);
+    shdrs[SHDR_RELA].sh_link      = SHDR_SYMTAB;
+    shdrs[SHDR_RELA].sh_info      = SHDR_TEXT;
+    shdrs[SHDR_RELA].sh_addralign = 8;
+    shdrs[SHDR_RELA].sh_entsize   = sizeof(Elf64_Rela);
+
+    for (const gcc::x86::reloc_t& reloc : object.relocs) {
+        Elf64_Rela rela;
+
+        rela.r_offset = reloc.offset;
+        rela.r_info   = ELF64_R_INFO(indices[reloc.symbol], reloc_type(object.text, reloc));
+        rela.r_addend = reloc.addend;
+        append(out, rela);
+    }
+
+    shdrs[SHDR_SYMTAB].sh_type      = SHT_SYMTAB;
+    shdrs[SHDR_SYMTAB].sh_offset    = out.size() - start;
+    shdrs[SHDR_SYMTAB].sh_size      = symbols.size() * sizeof(Elf64_Sym);
+    shdrs[SHDR_SYMTAB].sh_link      = SHDR_STRTAB;
+    shdrs[SHDR_SYMTAB].sh_info      = locals;
+    shdrs[SHDR_SYMTAB].sh_addralign = 8;
+    shdrs[SHDR_SYMTAB].sh_entsize   = sizeof(Elf64_Sym);
+    out.append((const char *)symbols.data(), symbols.size() * sizeof(Elf64_Sym));
+
+    shdrs[SHDR_STRTAB].sh_type      = SHT_STRTAB;
+    shdrs[SHDR_STRTAB].sh_offset    = out.size() - start;
+    shdrs[SHDR_STRTAB].sh_size      = strtab.size();
+    shdrs[SHDR_STRTAB].sh_addralign = 1;
+    out.append(strtab);
+
+    shdrs[SHDR_SHSTRTAB].sh_type      = SHT_STRTAB;
+    shdrs[SHDR_SHSTRTAB].sh_offset    = out.size() - start;
+    shdrs[SHDR_SHSTRTAB].sh_size      = shstrtab.size();
+    shdrs[SHDR_SHSTRTAB].sh_addralign = 1;
+    out.append(shstrtab);
+
+    shdrs[SHDR_STACK].sh_type      = SHT_PROGBITS;
+    shdrs[SHDR_STACK].sh_offset    = out.size() - start;
+    shdrs[SHDR_STACK].sh_addralign = 1;
+
+    pad(out, start, 8);
+
+    Elf64_Ehdr header;
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.e_ident, ELFMAG, SELFMAG);
+    header.e_ident[EI_CLASS]   = ELFCLASS64;
+    header.e_ident[EI_DATA]    = ELFDATA2LSB;
+    header.e_ident[EI_VERSION] = EV_CURRENT;
+    header.e_ident[EI_OSABI]   = ELFOSABI_SYSV;
+    header.e_type      = ET_REL;
+    header.e_machine   = EM_X86_64;
+    header.e_version   = EV_CURRENT;
+    header.e_shoff     = out.size() - start;
+    header.e_ehsize    = sizeof(Elf64_Ehdr);
+    header.e_shentsize = sizeof(Elf64_Shdr);
+    header.e_shnum     = SHDR_LAST;
+    header.e_shstrndx  = SHDR_SHSTRTAB;
+
+    out.append((const char *)shdrs, sizeof(shdrs));
+    memcpy(&out[start], &header, sizeof(header));
+}
@@ -0,0 +1,25 @@
+#ifndef __ELF_HH__
+#define __ELF_HH__
+
+#include <string>
+
+#include "encoder.hh"
+
+namespace gcc {
+
+    /* Relocatable ELF64 objects for x86-64, what -c writes.
+     *
+     * The machine code, data and symbols come from gcc::x86::encoder, so
+     * writing an object is laying out what's already encoded: the
+     * header, .text, .data, .bss, the relocations of .text, the symbol
+     * and string tables and the section headers, appended to one buffer
+     * in file order. Local symbols come first in the symbol table as ELF
+     * requires, relocations are renumbered to match. */
+    namespace elf {
+
+        /* append the object file of object to out, file is the source it was compiled from */
+        void write(std::string& out, const gcc::x86::object_t& object, const char *file);
+    };
+};
+
+#endif /* __ELF_HH__ */
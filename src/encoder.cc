@@ -0,0 +1,561 @@
+#include <climits>
+
+#include "encoder.hh"
+
+/* the two-operand and one-operand forms of a mnemonic, 0 if it has none,
+ * opcodes above 0xff have a 0x0f escape, see emit() for the others */
+static const struct {
+    uint16_t mr;     /* op r/m, reg */
+    uint16_t rm;     /* op reg, r/m */
+    uint16_t mi;     /* op r/m, imm32 (imm16, imm8 for the smaller sizes), ext in reg */
+    uint16_t mi8;    /* op r/m, imm8 sign extended, ext in reg */
+    uint16_t ai;     /* op rax, imm32, shorter than mi */
+    uint16_t m;      /* op r/m, ext in reg */
+    uint8_t ext;
+} forms[] = {
+    { 0x89, 0x8b,   0xc7, 0,    0,    0,    0 },   /* mov */
+    { 0,    0,      0,    0,    0,    0,    0 },   /* movsx */
+    { 0,    0,      0,    0,    0,    0,    0 },   /* movzx */
+    { 0,    0x8d,   0,    0,    0,    0,    0 },   /* lea */
+    { 0x01, 0x03,   0x81, 0x83, 0x05, 0,    0 },   /* add */
+    { 0x29, 0x2b,   0x81, 0x83, 0x2d, 0,    5 },   /* sub */
+    { 0,    0x0faf, 0,    0,    0,    0,    0 },   /* imul */
+    { 0x21, 0x23,   0x81, 0x83, 0x25, 0,    4 },   /* and */
+    { 0x09, 0x0b,   0x81, 0x83, 0x0d, 0,    1 },   /* or */
+    { 0x31, 0x33,   0x81, 0x83, 0x35, 0,    6 },   /* xor */
+    { 0x39, 0x3b,   0x81, 0x83, 0x3d, 0,    7 },   /* cmp */
+    { 0x85, 0,      0xf7, 0,    0xa9, 0,    0 },   /* test */
+    { 0,    0,      0,    0,    0,    0xf7, 3 },   /* neg */
+    { 0,    0,      0,    0,    0,    0xf7, 2 },   /* not */
+    { 0,    0,      0xc1, 0,    0,    0xd3, 4 },   /* shl, by an imm8 or by cl */
+    { 0,    0,      0xc1, 0,    0,    0xd3, 5 },   /* shr */
+    { 0,    0,      0xc1, 0,    0,    0xd3, 7 },   /* sar */
+    { 0,    0,      0,    0,    0,    0,    0 },   /* cqo */
+    { 0,    0,      0,    0,    0,    0xf7, 7 },   /* idiv */
+    { 0,    0,      0,    0,    0,    0xf7, 6 },   /* div */
+    { 0,    0,      0,    0,    0,    0,    0 },   /* setcc */
+    { 0,    0,      0,    0,    0,    0,    0 },   /* jmp */
+    { 0,    0,      0,    0,    0,    0,    0 },   /* jcc */
+    { 0,    0,      0,    0,    0,    0,    0 },   /* call */
+    { 0,    0,      0,    0,    0,    0,    0 },   /* ret */
+    { 0,    0,      0,    0,    0,    0xff, 6 },   /* push */
+    { 0,    0,      0,    0,    0,    0x8f, 0 },   /* pop */
+};
+
+static_assert(sizeof(forms) / sizeof(forms[0]) == gcc::x86::I_MOVD, "form table out of date");
+
+/* The vector instructions from I_MOVD on: mandatory prefix, opcode map
+ * and opcode, the digit in reg of the forms by an immediate (0xff if reg
+ * is the destination), and whether the VEX form has the destination as
+ * its first source in vvvv. See vector() for the irregular ones. */
+static const struct {
+    uint8_t prefix;
+    uint16_t map;
+    uint8_t opcode;
+    uint8_t ext;
+    bool nds;
+} vector_forms[] = {
+    { 0x66, 0x0f,   0x6e, 0xff, false },   /* movd, 0x7e to a general register */
+    { 0xf3, 0x0f,   0x6f, 0xff, false },   /* movdqu, 0x7f to memory */
+    { 0x66, 0x0f,   0xfc, 0xff, true },    /* paddb */
+    { 0x66, 0x0f,   0xfd, 0xff, true },    /* paddw */
+    { 0x66, 0x0f,   0xfe, 0xff, true },    /* paddd */
+    { 0x66, 0x0f,   0xd4, 0xff, true },    /* paddq */
+    { 0x66, 0x0f,   0xf8, 0xff, true },    /* psubb */
+    { 0x66, 0x0f,   0xf9, 0xff, true },    /* psubw */
+    { 0x66, 0x0f,   0xfa, 0xff, true },    /* psubd */
+    { 0x66, 0x0f,   0xfb, 0xff, true },    /* psubq */
+    { 0x66, 0x0f,   0xd5, 0xff, true },    /* pmullw */
+    { 0x66, 0x0f38, 0x40, 0xff, true },    /* pmulld */
+    { 0x66, 0x0f,   0xf4, 0xff, true },    /* pmuludq */
+    { 0x66, 0x0f,   0xdb, 0xff, true },    /* pand */
+    { 0x66, 0x0f,   0xeb, 0xff, true },    /* por */
+    { 0x66, 0x0f,   0xef, 0xff, true },    /* pxor */
+    { 0x66, 0x0f,   0x71, 6,    true },    /* psllw */
+    { 0x66, 0x0f,   0x72, 6,    true },    /* pslld */
+    { 0x66, 0x0f,   0x73, 6,    true },    /* psllq */
+    { 0x66, 0x0f,   0x71, 2,    true },    /* psrlw */
+    { 0x66, 0x0f,   0x72, 2,    true },    /* psrld */
+    { 0x66, 0x0f,   0x73, 2,    true },    /* psrlq */
+    { 0x66, 0x0f,   0x71, 4,    true },    /* psraw */
+    { 0x66, 0x0f,   0x72, 4,    true },    /* psrad */
+    { 0x66, 0x0f,   0x73, 3,    true },    /* psrldq */
+    { 0x66, 0x0f,   0x70, 0xff, false },   /* pshufd */
+    { 0x66, 0x0f,   0x60, 0xff, true },    /* punpcklbw */
+    { 0x66, 0x0f,   0x61, 0xff, true },    /* punpcklwd */
+    { 0x66, 0x0f,   0x62, 0xff, true },    /* punpckldq */
+    { 0x66, 0x0f,   0x6c, 0xff, true },    /* punpcklqdq */
+    { 0x66, 0x0f,   0xf6, 0xff, true },    /* psadbw */
+    { 0x66, 0x0f38, 0x78, 0xff, false },   /* vpbroadcastb */
+    { 0x66, 0x0f38, 0x79, 0xff, false },   /* vpbroadcastw */
+    { 0x66, 0x0f38, 0x58, 0xff, false },   /* vpbroadcastd */
+    { 0x66, 0x0f38, 0x59, 0xff, false },   /* vpbroadcastq */
+    { 0x66, 0x0f3a, 0x39, 0xff, false },   /* vextracti128 */
+    { 0,    0x0f,   0x77, 0xff, false },   /* vzeroupper */
+};
+
+static_assert(sizeof(vector_forms) / sizeof(vector_forms[0]) == gcc::x86::I_LAST - gcc::x86::I_MOVD,
+              "vector form table out of date");
+
+/* spl, bpl, sil and dil, which are ah to bh without a REX prefix */
+static inline bool low_byte(const gcc::x86::operand_t& op)
+{
+    return op.kind == gcc::x86::OPND_REG && op.reg >= gcc::x86::RSP && op.reg <= gcc::x86::RDI;
+}
+
+gcc::x86::encoder::encoder(gcc::x86::object_t& out):
+    out_(out),
+    text_(out.text),
+    symbols_(),
+    labels_(),
+    fixups_(),
+    function_(0)
+{
+    out_.bss = 0;
+}
+
+uint32_t gcc::x86::encoder::symbol(gcc::symbol_t name)
+{
+    auto it = symbols_.find(name);
+
+    if (it != symbols_.end())
+        return it->second;
+
+    out_.symbols.push_back({ gcc::symbol_str(name), SECTION_UNDEF, false, false, 0, 0 });
+    symbols_.emplace(name, out_.symbols.size() - 1);
+
+    return out_.symbols.size() - 1;
+}
+
+void gcc::x86::encoder::put(int64_t value, unsigned bytes)
+{
+    for (unsigned i = 0; i < bytes; ++i)
+        put((uint8_t)(value >> (8 * i)));
+}
+
+void gcc::x86::encoder::begin_function(gcc::symbol_t name, bool local)
+{
+    /* .p2align 4 */
+    while (text_.size() % 16)
+        put((uint8_t)0x90);
+
+    function_ = symbol(name);
+
+    object_symbol_t& sym = out_.symbols[function_];
+
+    sym.section  = SECTION_TEXT;
+    sym.local    = local;
+    sym.function = true;
+    sym.offset   = text_.size();
+}
+
+void gcc::x86::encoder::end_function()
+{
+    for (const fixup_t& fixup : fixups_) {
+        int32_t disp = labels_[fixup.label] - (fixup.offset + 4);
+
+        for (unsigned i = 0; i < 4; ++i)
+            text_[fixup.offset + i] = (char)(disp >> (8 * i));
+    }
+
+    fixups_.clear();
+    out_.symbols[function_].size = text_.size() - out_.symbols[function_].offset;
+}
+
+void gcc::x86::encoder::label(uint32_t id)
+{
+    if (id >= labels_.size())
+        labels_.resize(id + 1, UINT32_MAX);
+
+    labels_[id] = text_.size();
+}
+
+void gcc::x86::encoder::global(const gcc::ir::global_t& global)
+{
+    unsigned size = gcc::ir::type_size(global.type);
+
+    /* references to extern globals add them as undefined */
+    if (!global.defined)
+        return;
+
+    object_symbol_t& sym = out_.symbols[symbol(global.name)];
+
+    sym.local   = global.local;
+    sym.size    = size;
+
+    if (global.init) {
+        while (out_.data.size() % size)
+            out_.data.push_back('\0');
+
+        sym.section = SECTION_DATA;
+        sym.offset  = out_.data.size();
+
+        for (unsigned i = 0; i < size; ++i)
+            out_.data.push_back((char)(global.init >> (8 * i)));
+    } else {
+        out_.bss = (out_.bss + size - 1) / size * size;
+
+        sym.section = SECTION_BSS;
+        sym.offset  = out_.bss;
+        out_.bss   += size;
+    }
+}
+
+void gcc::x86::encoder::encode(uint16_t opcode, unsigned size, uint8_t reg, const gcc::x86::operand_t& rm,
+                               bool low, unsigned imm)
+{
+    uint8_t base = rm.reg;
+    uint8_t rex  = 0x40;
+
+    if (size == 8)
+        rex |= 0x08;
+    if (reg & 8)
+        rex |= 0x04;
+    if (rm.kind == OPND_MEM && rm.index != REG_NONE && (rm.index & 8))
+        rex |= 0x02;
+    if (base != REG_NONE && base != RIP && (base & 8))
+        rex |= 0x01;
+
+    if (size == 2)
+        put((uint8_t)0x66);
+
+    if (rex != 0x40 || low)
+        put(rex);
+
+    if (opcode > 0xff)
+        put((uint8_t)(opcode >> 8));
+
+    put((uint8_t)opcode);
+    modrm(reg, rm, imm);
+}
+
+void gcc::x86::encoder::modrm(uint8_t reg, const gcc::x86::operand_t& rm, unsigned imm)
+{
+    uint8_t base = rm.reg;
+
+    reg &= 7;
+
+    if (rm.kind == OPND_REG) {
+        put((uint8_t)(0xc0 | reg << 3 | (base & 7)));
+        return;
+    }
+
+    if (base == RIP) {
+        uint8_t kind = rm.external ? RELOC_GOTPCREL : RELOC_PC32;
+
+        put((uint8_t)(0x05 | reg << 3));
+        out_.relocs.push_back({ (uint32_t)text_.size(), symbol(rm.sym), kind, rm.disp - 4 - (int32_t)imm });
+        put(0, 4);
+        return;
+    }
+
+    /* rsp and r12 as a base and no base at all need a SIB byte, rbp and
+     * r13 as a base without a displacement need a zero one */
+    bool sib = rm.index != REG_NONE || base == REG_NONE || (base & 7) == RSP;
+    uint8_t mod;
+
+    if (base == REG_NONE || (rm.disp == 0 && (base & 7) != RBP))
+        mod = 0;
+    else if (rm.disp == (int8_t)rm.disp)
+        mod = 1;
+    else
+        mod = 2;
+
+    put((uint8_t)(mod << 6 | reg << 3 | (sib ? 4 : base & 7)));
+
+    if (sib) {
+        uint8_t index = rm.index == REG_NONE ? 4 : rm.index & 7;
+
+        put((uint8_t)(__builtin_ctz(rm.scale) << 6 | index << 3 | (base == REG_NONE ? 5 : base & 7)));
+    }
+
+    if (mod == 1)
+        put(rm.disp, 1);
+    else if (mod == 2 || base == REG_NONE)
+        put(rm.disp, 4);
+}
+
+void gcc::x86::encoder::encode_vector(uint8_t prefix, uint16_t map, uint8_t opcode, unsigned size, bool wide,
+                                      uint8_t reg, uint8_t vvvv, const gcc::x86::operand_t& rm, unsigned imm)
+{
+    uint8_t base = rm.reg;
+    bool r = reg & 8;
+    bool x = rm.kind == OPND_MEM && rm.index != REG_NONE && (rm.index & 8);
+    bool b = base != REG_NONE && base != RIP && (base & 8);
+
+    if (size == 32) {
+        /* VEX.256, the R, X, B and vvvv fields inverted */
+        uint8_t pp    = prefix == 0x66 ? 1 : prefix == 0xf3 ? 2 : 0;
+        uint8_t mmmmm = map == 0x0f ? 1 : map == 0x0f38 ? 2 : 3;
+        uint8_t last  = (uint8_t)((~(vvvv == REG_NONE ? 0 : vvvv) & 15) << 3 | 1 << 2 | pp);
+
+        if (mmmmm == 1 && !wide && !x && !b) {
+            put((uint8_t)0xc5);
+            put((uint8_t)(!r << 7 | last));
+        } else {
+            put((uint8_t)0xc4);
+            put((uint8_t)(!r << 7 | !x << 6 | !b << 5 | mmmmm));
+            put((uint8_t)(wide << 7 | last));
+        }
+    } else {
+        if (prefix)
+            put(prefix);
+
+        if (wide || r || x || b)
+            put((uint8_t)(0x40 | wide << 3 | r << 2 | x << 1 | b));
+
+        put((uint8_t)0x0f);
+
+        if (map != 0x0f)
+            put((uint8_t)map);
+    }
+
+    put(opcode);
+    modrm(reg, rm, imm);
+}
+
+void gcc::x86::encoder::vector(const gcc::x86::inst_t& inst)
+{
+    const operand_t& dst = inst.dst;
+    const operand_t& src = inst.src;
+    unsigned size = inst.size;
+    uint8_t prefix = vector_forms[inst.op - I_MOVD].prefix;
+    uint16_t map   = vector_forms[inst.op - I_MOVD].map;
+    uint8_t opcode = vector_forms[inst.op - I_MOVD].opcode;
+    uint8_t ext    = vector_forms[inst.op - I_MOVD].ext;
+    bool nds       = vector_forms[inst.op - I_MOVD].nds;
+
+    switch (inst.op) {
+        case I_MOVD:
+            /* the vector register is in reg both ways, size is the general one's */
+            if (dst.kind == OPND_REG && is_vector_reg(dst.reg))
+                encode_vector(prefix, map, 0x6e, 16, size == 8, dst.reg, REG_NONE, src);
+            else
+                encode_vector(prefix, map, 0x7e, 16, size == 8, src.reg, REG_NONE, dst);
+            return;
+
+        case I_MOVDQU:
+            /* between registers the store form keeps a VEX prefix short when only src is xmm8 and up */
+            if (dst.kind == OPND_MEM || (size == 32 && src.kind == OPND_REG && (src.reg & 8) && !(dst.reg & 8)))
+                encode_vector(prefix, map, 0x7f, size, false, src.reg, REG_NONE, dst);
+            else
+                encode_vector(prefix, map, opcode, size, false, dst.reg, REG_NONE, src);
+            return;
+
+        case I_VEXTRACTI128:
+            encode_vector(prefix, map, opcode, 32, false, src.reg, REG_NONE, dst, 1);
+            put((uint8_t)1);
+            return;
+
+        case I_VZEROUPPER:
+            put((uint8_t)0xc5);
+            put((uint8_t)0xf8);
+            put(opcode);
+            return;
+    }
+
+    if (src.kind == OPND_IMM) {
+        /* shifts have the digit in reg and the destination in r/m and vvvv, pshufd is in place */
+        if (ext != 0xff)
+            encode_vector(prefix, map, opcode, size, false, ext, dst.reg, dst, 1);
+        else
+            encode_vector(prefix, map, opcode, size, false, dst.reg, REG_NONE, dst, 1);
+
+        put(src.imm, 1);
+        return;
+    }
+
+    encode_vector(prefix, map, opcode, size, false, dst.reg, nds ? dst.reg : (uint8_t)REG_NONE, src);
+}
+
+void gcc::x86::encoder::jump(uint8_t opcode, uint16_t near, const gcc::x86::operand_t& target)
+{
+    uint32_t id = target.imm;
+
+    if (id < labels_.size() && labels_[id] != UINT32_MAX) {
+        int64_t disp = (int64_t)labels_[id] - (int64_t)(text_.size() + 2);
+
+        if (disp == (int8_t)disp) {
+            put(opcode);
+            put(disp, 1);
+            return;
+        }
+    }
+
+    if (near > 0xff)
+        put((uint8_t)(near >> 8));
+
+    put((uint8_t)near);
+
+    if (id < labels_.size() && labels_[id] != UINT32_MAX) {
+        put((int64_t)labels_[id] - (int64_t)(text_.size() + 4), 4);
+        return;
+    }
+
+    fixups_.push_back({ (uint32_t)text_.size(), id });
+    put(0, 4);
+}
+
+void gcc::x86::encoder::emit(const gcc::x86::inst_t& inst)
+{
+    const operand_t& dst = inst.dst;
+    const operand_t& src = inst.src;
+    unsigned size = inst.size;
+    bool byte = size == 1;
+    unsigned bytes = byte ? 1 : size == 2 ? 2 : 4;
+
+    if (is_vector_op(inst.op)) {
+        vector(inst);
+        return;
+    }
+
+    switch (inst.op) {
+        case I_MOV:
+            if (dst.kind != OPND_REG || src.kind != OPND_IMM || (size == 8 && is_imm32(src.imm)))
+                break;
+
+            /* b8+r with an immediate of the full size (movabs), b0+r for bytes */
+            if (size == 2)
+                put((uint8_t)0x66);
+
+            if (size == 8 || (dst.reg & 8) || (byte && low_byte(dst)))
+                put((uint8_t)(0x40 | (size == 8) << 3 | (dst.reg & 8) >> 3));
+
+            put((uint8_t)((byte ? 0xb0 : 0xb8) + (dst.reg & 7)));
+            put(src.imm, size == 8 ? 8 : bytes);
+            return;
+
+        case I_MOVSX:
+        case I_MOVZX:
+            if (inst.src_size == 4) {
+                /* movslq, or a mov clearing the upper half */
+                encode(inst.op == I_MOVSX ? 0x63 : 0x8b, inst.op == I_MOVSX ? size : 4, dst.reg, src, false);
+                return;
+            }
+
+            encode((inst.op == I_MOVSX ? 0x0fbe : 0x0fb6) + (inst.src_size == 2), size, dst.reg, src,
+                   inst.src_size == 1 && low_byte(src));
+            return;
+
+        case I_IMUL:
+            if (src.kind != OPND_IMM) {
+                encode(forms[inst.op].rm, size, dst.reg, src, false);
+                return;
+            }
+
+            /* the three-operand form with dst as both */
+            if (src.imm == (int8_t)src.imm) {
+                encode(0x6b, size, dst.reg, dst, false, 1);
+                put(src.imm, 1);
+            } else {
+                encode(0x69, size, dst.reg, dst, false, 4);
+                put(src.imm, 4);
+            }
+            return;
+
+        case I_TEST:
+            /* test is symmetric, the register goes in reg */
+            if (src.kind == OPND_MEM) {
+                encode(byte ? 0x84 : 0x85, size, dst.reg, src, byte && low_byte(dst));
+                return;
+            }
+            break;
+
+        case I_SHL:
+        case I_SHR:
+        case I_SAR:
+            if (src.kind == OPND_IMM && src.imm == 1) {
+                encode(byte ? 0xd0 : 0xd1, size, forms[inst.op].ext, dst, byte && low_byte(dst));
+            } else if (src.kind == OPND_IMM) {
+                encode(byte ? 0xc0 : 0xc1, size, forms[inst.op].ext, dst, byte && low_byte(dst), 1);
+                put(src.imm, 1);
+            } else {
+                encode(byte ? 0xd2 : 0xd3, size, forms[inst.op].ext, dst, byte && low_byte(dst));
+            }
+            return;
+
+        case I_CQO:
+            if (size == 8)
+                put((uint8_t)0x48);
+            put((uint8_t)0x99);
+            return;
+
+        case I_SETCC:
+            encode(0x0f90 + inst.cc, 1, 0, dst, low_byte(dst));
+            return;
+
+        case I_JMP:
+            jump(0xeb, 0xe9, dst);
+            return;
+
+        case I_JCC:
+            jump(0x70 + inst.cc, 0x0f80 + inst.cc, dst);
+            return;
+
+        case I_CALL:
+            put((uint8_t)0xe8);
+            out_.relocs.push_back({ (uint32_t)text_.size(), symbol(dst.sym), RELOC_PLT32, -4 });
+            put(0, 4);
+            return;
+
+        case I_RET:
+            put((uint8_t)0xc3);
+            return;
+
+        case I_PUSH:
+        case I_POP:
+            if (dst.kind == OPND_REG) {
+                if (dst.reg & 8)
+                    put((uint8_t)0x41);
+                put((uint8_t)((inst.op == I_PUSH ? 0x50 : 0x58) + (dst.reg & 7)));
+                return;
+            }
+
+            if (dst.kind == OPND_IMM) {
+                if (dst.imm == (int8_t)dst.imm) {
+                    put((uint8_t)0x6a);
+                    put(dst.imm, 1);
+                } else {
+                    put((uint8_t)0x68);
+                    put(dst.imm, 4);
+                }
+                return;
+            }
+
+            /* the operand size is 64 bits already */
+            encode(forms[inst.op].m, 4, forms[inst.op].ext, dst, false);
+            return;
+    }
+
+    /* the regular forms, byte ones have opcodes one below */
+    switch (src.kind) {
+        case OPND_NONE:
+            encode(forms[inst.op].m - byte, size, forms[inst.op].ext, dst, byte && low_byte(dst));
+            return;
+
+        case OPND_REG:
+            encode(forms[inst.op].mr - byte, size, src.reg, dst, byte && (low_byte(src) || low_byte(dst)));
+            return;
+
+        case OPND_IMM:
+            if (forms[inst.op].mi8 && !byte && src.imm == (int8_t)src.imm) {
+                encode(forms[inst.op].mi8, size, forms[inst.op].ext, dst, false, 1);
+                put(src.imm, 1);
+            } else if (forms[inst.op].ai && dst.kind == OPND_REG && dst.reg == RAX) {
+                if (size == 2)
+                    put((uint8_t)0x66);
+                if (size == 8)
+                    put((uint8_t)0x48);
+                put((uint8_t)(forms[inst.op].ai - byte));
+                put(src.imm, bytes);
+            } else {
+                encode(forms[inst.op].mi - byte, size, forms[inst.op].ext, dst, byte && low_byte(dst), bytes);
+                put(src.imm, bytes);
+            }
+            return;
+
+        default:
+            encode(forms[inst.op].rm - byte, size, dst.reg, src, byte && low_byte(dst));
+            return;
+    }
+}
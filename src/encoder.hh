@@ -0,0 +1,124 @@
+#ifndef __ENCODER_HH__
+#define __ENCODER_HH__
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "ir.hh"
+#include "x86.hh"
+
+namespace gcc {
+
+    namespace x86 {
+
+        enum {
+            SECTION_UNDEF,   /* referenced, defined elsewhere */
+            SECTION_TEXT,
+            SECTION_DATA,
+            SECTION_BSS,
+        };
+
+        /* what a relocation computes, all are 32-bit and relative to the
+         * place being patched: symbol + addend - place */
+        enum {
+            RELOC_PC32,      /* the symbol */
+            RELOC_PLT32,     /* a function, maybe through a stub jumping to it */
+            RELOC_GOTPCREL,  /* a slot holding the address of the symbol */
+        };
+
+        typedef struct object_symbol {
+            std::string name;    /* symbols of objects cross threads, see gcc::symbols() */
+            uint8_t section;
+            bool local;          /* static, not visible to other objects */
+            bool function;
+            uint32_t offset;     /* in section */
+            uint32_t size;
+        } object_symbol_t;
+
+        typedef struct reloc {
+            uint32_t offset;     /* of the 32-bit field in .text */
+            uint32_t symbol;     /* index in object_t::symbols */
+            uint8_t kind;
+            int32_t addend;
+        } reloc_t;
+
+        /* machine code and data of a module, not yet placed anywhere */
+        typedef struct object {
+            std::string text;
+            std::string data;
+            uint32_t bss;        /* bytes */
+            std::vector<gcc::x86::object_symbol_t> symbols;
+            std::vector<gcc::x86::reloc_t> relocs;
+        } object_t;
+
+        /* Encodes instructions into machine code as they're emitted.
+         *
+         * Every instruction is appended to the .text of the object right
+         * away, opcodes come from a table of forms per mnemonic (reg to
+         * r/m, r/m to reg, immediate) with the few irregular ones handled
+         * on their own. Vector instructions have a table of their own and
+         * take a VEX prefix at 32 bytes. References to labels are patched
+         * when the function ends: a backward jump in range is short, every
+         * other jump takes a 32-bit displacement. References to symbols become
+         * relocations, calls through the PLT and addresses of globals not
+         * in the module through the GOT, as the assembly would have. */
+        class encoder : public sink {
+            public:
+                encoder(gcc::x86::object_t& out);
+
+                void begin_function(gcc::symbol_t name, bool local);
+                void end_function();
+                void label(uint32_t id);
+                void emit(const gcc::x86::inst_t& inst);
+                void global(const gcc::ir::global_t& global);
+
+            private:
+                encoder(const encoder&);
+                encoder& operator=(const encoder&);
+
+                typedef struct fixup {
+                    uint32_t offset;     /* of the rel32 field */
+                    uint32_t label;
+                } fixup_t;
+
+                /* index of name in the symbol table, added undefined if it's new */
+                uint32_t symbol(gcc::symbol_t name);
+
+                void put(uint8_t b) { text_.push_back((char)b); }
+                void put(int64_t value, unsigned bytes);
+
+                /* Prefixes, opcode and ModRM (SIB, displacement) of an
+                 * instruction whose reg field is reg and whose r/m operand
+                 * is rm. low is set for 8-bit register operands, which
+                 * need a REX prefix to mean spl to dil. imm is the size of
+                 * the immediate after the displacement, it moves the end
+                 * of the instruction a RIP-relative operand counts from. */
+                void encode(uint16_t opcode, unsigned size, uint8_t reg, const gcc::x86::operand_t& rm,
+                            bool low, unsigned imm = 0);
+
+                /* the ModRM byte and what follows it, see encode() */
+                void modrm(uint8_t reg, const gcc::x86::operand_t& rm, unsigned imm);
+
+                /* An SSE2 instruction at size 16, REX.W if wide, or its
+                 * VEX.256 form at size 32, with vvvv (REG_NONE for none)
+                 * as the extra source. map is 0x0f, 0x0f38 or 0x0f3a. */
+                void encode_vector(uint8_t prefix, uint16_t map, uint8_t opcode, unsigned size, bool wide,
+                                   uint8_t reg, uint8_t vvvv, const gcc::x86::operand_t& rm, unsigned imm = 0);
+
+                void vector(const gcc::x86::inst_t& inst);
+
+                void jump(uint8_t opcode, uint16_t near, const gcc::x86::operand_t& target);
+
+                gcc::x86::object_t& out_;
+                std::string& text_;
+                std::unordered_map<gcc::symbol_t, uint32_t> symbols_;
+                std::vector<uint32_t> labels_;     /* offsets, UINT32_MAX if not placed */
+                std::vector<fixup_t> fixups_;
+                uint32_t function_;                /* symbol of the function being encoded */
+        };
+    };
+};
+
+#endif /* __ENCODER_HH__ */
@@ -0,0 +1,107 @@
+#ifndef __HASH_HH__
+#define __HASH_HH__
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+namespace gcc {
+
+    /* 128-bit content hash, wide enough to name files by their contents */
+    typedef struct hash128 {
+        uint64_t lo;
+        uint64_t hi;
+
+        bool operator==(const hash128& other) const { return lo == other.lo && hi == other.hi; }
+        bool operator!=(const hash128& other) const { return !(*this == other); }
+
+        /* 32 lowercase hex digits, high half first */
+        std::string hex() const
+        {
+            static const char digits[] = "0123456789abcdef";
+            std::string out(32, '0');
+
+            for (int i = 0; i < 16; ++i) {
+                out[15 - i] = digits[(hi >> (i * 4)) & 0xf];
+                out[31 - i] = digits[(lo >> (i * 4)) & 0xf];
+            }
+
+            return out;
+        }
+    } hash128_t;
+
+    static inline uint64_t __rotl64(uint64_t x, int r)
+    {
+        return (x << r) | (x >> (64 - r));
+    }
+
+    static inline uint64_t __fmix64(uint64_t k)
+    {
+        k ^= k >> 33;
+        k *= 0xff51afd7ed558ccdull;
+        k ^= k >> 33;
+        k *= 0xc4ceb9fe1a85ec53ull;
+        k ^= k >> 33;
+        return k;
+    }
+
+    /* MurmurHash3 x64 128, seeded with both halves of seed so that hashes
+     * can be chained: hash128(b, hash128(a)) identifies a followed by b */
+    static inline gcc::hash128_t hash128(const void *data, size_t len, gcc::hash128_t seed = { 0, 0 })
+    {
+        const uint64_t c1 = 0x87c37b91114253d5ull;
+        const uint64_t c2 = 0x4cf5ad432745937full;
+        const uint8_t *ptr = (const uint8_t *)data;
+        const uint8_t *end = ptr + (len & ~(size_t)15);
+        uint64_t h1 = seed.lo, h2 = seed.hi;
+        uint64_t k1, k2;
+
+        for (; ptr < end; ptr += 16) {
+            memcpy(&k1, ptr, 8);
+            memcpy(&k2, ptr + 8, 8);
+
+            k1 *= c1; k1 = __rotl64(k1, 31); k1 *= c2; h1 ^= k1;
+            h1 = __rotl64(h1, 27); h1 += h2; h1 = h1 * 5 + 0x52dce729;
+
+            k2 *= c2; k2 = __rotl64(k2, 33); k2 *= c1; h2 ^= k2;
+            h2 = __rotl64(h2, 31); h2 += h1; h2 = h2 * 5 + 0x38495ab5;
+        }
+
+        k1 = k2 = 0;
+
+        switch (len & 15) {
+            case 15: k2 ^= (uint64_t)ptr[14] << 48; /* fallthrough */
+            case 14: k2 ^= (uint64_t)ptr[13] << 40; /* fallthrough */
+            case 13: k2 ^= (uint64_t)ptr[12] << 32; /* fallthrough */
+            case 12: k2 ^= (uint64_t)ptr[11] << 24; /* fallthrough */
+            case 11: k2 ^= (uint64_t)ptr[10] << 16; /* fallthrough */
+            case 10: k2 ^= (uint64_t)ptr[9]  << 8;  /* fallthrough */
+            case 9:  k2 ^= (uint64_t)ptr[8];
+                     k2 *= c2; k2 = __rotl64(k2, 33); k2 *= c1; h2 ^= k2;
+                     /* fallthrough */
+            case 8:  k1 ^= (uint64_t)ptr[7] << 56; /* fallthrough */
+            case 7:  k1 ^= (uint64_t)ptr[6] << 48; /* fallthrough */
+            case 6:  k1 ^= (uint64_t)ptr[5] << 40; /* fallthrough */
+            case 5:  k1 ^= (uint64_t)ptr[4] << 32; /* fallthrough */
+            case 4:  k1 ^= (uint64_t)ptr[3] << 24; /* fallthrough */
+            case 3:  k1 ^= (uint64_t)ptr[2] << 16; /* fallthrough */
+            case 2:  k1 ^= (uint64_t)ptr[1] << 8;  /* fallthrough */
+            case 1:  k1 ^= (uint64_t)ptr[0];
+                     k1 *= c1; k1 = __rotl64(k1, 31); k1 *= c2; h1 ^= k1;
+        }
+
+        h1 ^= len;
+        h2 ^= len;
+        h1 += h2;
+        h2 += h1;
+        h1 = __fmix64(h1);
+        h2 = __fmix64(h2);
+        h1 += h2;
+        h2 += h1;
+
+        return { h1, h2 };
+    }
+};
+
+#endif /* __HASH_HH__ */
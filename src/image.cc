@@ -0,0 +1,392 @@
+#include <cstring>
+#include <vector>
+
+#include "image.hh"
+#include "util/log.hh"
+
+#define CHANNEL "image"
+
+/* "GBAI", bump the version whenever a record changes */
+#define IMAGE_MAGIC   0x49414247u
+#define IMAGE_VERSION 3u
+
+/* nodes whose union holds a symbol instead of a value */
+static inline bool has_symbol(uint32_t type)
+{
+    return type == gcc::TT_IDENTIFIER || type == gcc::TT_VAR ||
+           type == gcc::TT_DOT || type == gcc::TT_ARROW;
+}
+
+static size_t element_size(int section)
+{
+    switch (section) {
+        case gcc::IMAGE_STRINGS: return sizeof(gcc::image_string_t);
+        case gcc::IMAGE_CHARS:   return sizeof(char);
+        case gcc::IMAGE_NODES:   return sizeof(gcc::image_node_t);
+        case gcc::IMAGE_LISTS:   return sizeof(uint32_t);
+        case gcc::IMAGE_FUNCS:   return sizeof(gcc::image_func_t);
+        case gcc::IMAGE_PARAMS:  return sizeof(gcc::image_var_t);
+        case gcc::IMAGE_GLOBALS: return sizeof(gcc::image_var_t);
+    }
+
+    return 0;
+}
+
+static gcc::image_type_t make_type(const gcc::type_t& type)
+{
+    gcc::image_type_t out;
+
+    out.type   = (uint8_t)type.type;
+    out.unused = 0;
+    out.flags  = (type.xtrn   ? gcc::IMAGE_TYPE_EXTERN   : 0) | (type.vltl   ? gcc::IMAGE_TYPE_VOLATILE : 0) |
+                 (type.sttc   ? gcc::IMAGE_TYPE_STATIC   : 0) | (type.rgstr  ? gcc::IMAGE_TYPE_REGISTER : 0) |
+                 (type.ptr    ? gcc::IMAGE_TYPE_POINTER  : 0) | (type.cnst   ? gcc::IMAGE_TYPE_CONST    : 0) |
+                 (type.rstrct ? gcc::IMAGE_TYPE_RESTRICT : 0) | (type.unsgnd ? gcc::IMAGE_TYPE_UNSIGNED : 0);
+
+    return out;
+}
+
+static gcc::type_t read_type(const gcc::image_type_t& type)
+{
+    gcc::type_t out;
+
+    out.type   = (gcc::token_type_t)type.type;
+    out.xtrn   = type.flags & gcc::IMAGE_TYPE_EXTERN;
+    out.vltl   = type.flags & gcc::IMAGE_TYPE_VOLATILE;
+    out.sttc   = type.flags & gcc::IMAGE_TYPE_STATIC;
+    out.rgstr  = type.flags & gcc::IMAGE_TYPE_REGISTER;
+    out.ptr    = type.flags & gcc::IMAGE_TYPE_POINTER;
+    out.cnst   = type.flags & gcc::IMAGE_TYPE_CONST;
+    out.rstrct = type.flags & gcc::IMAGE_TYPE_RESTRICT;
+    out.unsgnd = type.flags & gcc::IMAGE_TYPE_UNSIGNED;
+
+    return out;
+}
+
+namespace {
+
+    /* string table being written, symbols are dense so the
+     * mapping to string indices is a plain array */
+    class string_table {
+        public:
+            string_table():
+                index_(gcc::symbols().size() + 1, 0),
+                strings_(1, { 0, 0 }),
+                chars_(1, '\0')
+            {
+            }
+
+            uint32_t add(gcc::symbol_t sym)
+            {
+                if (sym == gcc::SYM_NONE)
+                    return 0;
+
+                if (!index_[sym]) {
+                    size_t len = gcc::symbols().length(sym);
+
+                    index_[sym] = (uint32_t)strings_.size();
+                    strings_.push_back({ (uint32_t)chars_.size(), (uint32_t)len });
+                    chars_.insert(chars_.end(), gcc::symbols().str(sym), gcc::symbols().str(sym) + len + 1);
+                }
+
+                return index_[sym];
+            }
+
+            std::vector<uint32_t> index_;
+            std::vector<gcc::image_string_t> strings_;
+            std::vector<char> chars_;
+    };
+};
+
+gcc::image::image():
+    data_(nullptr),
+    header_(nullptr),
+    file_()
+{
+}
+
+gcc::image::~image()
+{
+}
+
+void gcc::image::write(std::string& out, const gcc::prog_t& prog)
+{
+    std::vector<const gcc::node_t *> queue;
+    std::vector<gcc::image_node_t> nodes;
+    std::vector<gcc::image_func_t> funcs;
+    std::vector<gcc::image_var_t> params;
+    std::vector<gcc::image_var_t> globals;
+    std::vector<uint32_t> lists;
+    gcc::image_header_t header;
+    string_table strings;
+
+    /* Nodes are numbered breadth first when their parent is visited, so
+     * every record is complete when it's written. No recursion, however
+     * deep the expressions are. */
+    auto ref = [&queue](const gcc::node_t *node) -> uint32_t {
+        if (!node)
+            return 0;
+
+        queue.push_back(node);
+        return (uint32_t)queue.size();
+    };
+
+    /* a unit parsed after a precompiled header is written with the
+     * header's declarations it didn't replace, the image stands alone */
+    for (const gcc::prog_t *p = &prog; p; p = p->prelude) {
+        for (auto& entry : p->functions) {
+            const gcc::func_t& func = entry.second;
+
+            if (p != &prog && prog.find_function(func.name) != &func)
+                continue;
+
+            funcs.push_back({
+                strings.add(func.name), make_type(func.ret_type), ref(func.node.body),
+                (uint32_t)params.size(), (uint32_t)func.params.size(),
+            });
+
+            for (gcc::symbol_t param : func.params)
+                params.push_back({ strings.add(param), make_type(func.args.at(param).type), 0 });
+        }
+
+        for (auto& entry : p->globals) {
+            if (p != &prog && prog.find_global(entry.first) != &entry.second)
+                continue;
+
+            globals.push_back({ strings.add(entry.second.name), make_type(entry.second.type), ref(entry.second.init) });
+        }
+    }
+
+    for (size_t i = 0; i < queue.size(); ++i) {
+        const gcc::node_t *node = queue[i];
+        gcc::image_node_t record;
+
+        record.type      = (uint8_t)node->type;
+        record.flags     = node->flags;
+        memset(record.unused, 0, sizeof(record.unused));
+        record.value     = has_symbol(node->type) ? (int64_t)strings.add(node->sym) : node->value;
+        record.l         = ref(node->l);
+        record.r         = ref(node->r);
+        record.body      = ref(node->body);
+        record.cond      = ref(node->cond);
+        record.then      = ref(node->then);
+        record.els       = ref(node->els);
+        record.first     = (uint32_t)lists.size();
+        record.count     = node->statements.size;
+
+        for (gcc::node_t *statement : node->statements)
+            lists.push_back(ref(statement));
+
+        nodes.push_back(record);
+    }
+
+    const void *data[IMAGE_LAST] = {
+        strings.strings_.data(), strings.chars_.data(), nodes.data(), lists.data(),
+        funcs.data(), params.data(), globals.data(),
+    };
+    size_t counts[IMAGE_LAST] = {
+        strings.strings_.size(), strings.chars_.size(), nodes.size(), lists.size(),
+        funcs.size(), params.size(), globals.size(),
+    };
+
+    /* the image starts 8-byte aligned in out, so its offsets hold in memory too */
+    out.resize((out.size() + 7) & ~(size_t)7);
+
+    size_t base   = out.size();
+    size_t offset = sizeof(header);
+
+    memset(&header, 0, sizeof(header));
+    header.magic   = IMAGE_MAGIC;
+    header.version = IMAGE_VERSION;
+
+    for (int i = 0; i < IMAGE_LAST; ++i) {
+        header.sections[i].offset = (uint32_t)offset;
+        header.sections[i].count  = (uint32_t)counts[i];
+        offset = (offset + counts[i] * element_size(i) + 7) & ~(size_t)7;
+    }
+
+    header.size = (uint32_t)offset;
+    out.resize(base + offset);
+    memcpy(&out[base], &header, sizeof(header));
+
+    for (int i = 0; i < IMAGE_LAST; ++i) {
+        if (counts[i])
+            memcpy(&out[base + header.sections[i].offset], data[i], counts[i] * element_size(i));
+    }
+}
+
+gcc_error_t gcc::image::open(const void *data, size_t size)
+{
+    const gcc::image_header_t *header = (const gcc::image_header_t *)data;
+
+    header_ = nullptr;
+    data_   = nullptr;
+
+    if (((uintptr_t)data & 7) || size < sizeof(*header) ||
+        header->magic != IMAGE_MAGIC || header->version != IMAGE_VERSION || header->size > size) {
+        WARN("not an AST image or a different version\n");
+        return GCC_INVALID_VALUE;
+    }
+
+    for (int i = 0; i < IMAGE_LAST; ++i) {
+        const gcc::image_section_t& section = header->sections[i];
+
+        if ((section.offset & 7) || section.offset < sizeof(*header) || section.offset > header->size ||
+            section.count > (header->size - section.offset) / element_size(i)) {
+            WARN("AST image section %d is out of bounds\n", i);
+            return GCC_INVALID_VALUE;
+        }
+    }
+
+    /* strings are NUL-terminated, the last one too */
+    const gcc::image_section_t& chars = header->sections[IMAGE_CHARS];
+
+    if (chars.count && ((const char *)data)[chars.offset + chars.count - 1] != '\0') {
+        WARN("AST image string table isn't terminated\n");
+        return GCC_INVALID_VALUE;
+    }
+
+    data_   = (const char *)data;
+    header_ = header;
+
+    return GCC_SUCCESS;
+}
+
+gcc_error_t gcc::image::map(const char *file)
+{
+    gcc_error_t ret;
+
+    if ((ret = file_.open(file)) != GCC_SUCCESS)
+        return ret;
+
+    return open(file_.data(), file_.size());
+}
+
+gcc::prog_t *gcc::image::load(gcc::arena& arena, size_t& nodes) const
+{
+    uint32_t nnodes = count(IMAGE_NODES);
+    uint32_t nlists = count(IMAGE_LISTS);
+    uint32_t nstrs  = count(IMAGE_STRINGS);
+
+    if (!header_)
+        return nullptr;
+
+    gcc::node_t *table  = arena.alloc_array<gcc::node_t>(nnodes);
+    gcc::node_t **lists = arena.alloc_array<gcc::node_t *>(nlists);
+    std::vector<gcc::symbol_t> symbols(nstrs, gcc::SYM_NONE);
+    std::vector<bool> used(nnodes + 1, false);
+    bool valid = true;
+
+    for (uint32_t i = 1; i < nstrs; ++i) {
+        const gcc::image_string_t& string = array<image_string_t>(IMAGE_STRINGS)[i];
+
+        if (string.offset >= count(IMAGE_CHARS) || string.length > count(IMAGE_CHARS) - string.offset - 1) {
+            valid = false;
+            break;
+        }
+
+        symbols[i] = gcc::symbols().intern(&array<char>(IMAGE_CHARS)[string.offset], string.length);
+    }
+
+    /* write() numbers nodes breadth first and gives every reference its
+     * own node, so a node comes after the one referring to it, parent,
+     * 0 for functions and globals, and is referred to once. Anything
+     * else could be a cycle. */
+    auto node = [table, nnodes, &used, &valid](uint32_t ref, uint32_t parent) -> gcc::node_t * {
+        if (!ref)
+            return nullptr;
+
+        if (ref > nnodes || ref <= parent || used[ref]) {
+            valid = false;
+            return nullptr;
+        }
+
+        used[ref] = true;
+        return &table[ref - 1];
+    };
+
+    auto symbol = [&symbols, &valid](uint64_t index) -> gcc::symbol_t {
+        if (index >= symbols.size())
+            valid = false;
+        return index < symbols.size() ? symbols[index] : (gcc::symbol_t)gcc::SYM_NONE;
+    };
+
+    for (uint32_t i = 0; i < nnodes && valid; ++i) {
+        const gcc::image_node_t& record = array<image_node_t>(IMAGE_NODES)[i];
+        gcc::node_t *out = new (&table[i]) gcc::node_t();
+
+        if (record.type >= TT_LAST || record.first > nlists || record.count > nlists - record.first) {
+            valid = false;
+            break;
+        }
+
+        out->type  = (token_type_t)record.type;
+        out->flags = record.flags;
+
+        if (has_symbol(record.type))
+            out->sym = symbol((uint64_t)record.value);
+        else
+            out->value = record.value;
+
+        out->l    = node(record.l, i + 1);
+        out->r    = node(record.r, i + 1);
+        out->body = node(record.body, i + 1);
+        out->cond = node(record.cond, i + 1);
+        out->then = node(record.then, i + 1);
+        out->els  = node(record.els, i + 1);
+        out->statements = { record.count ? lists + record.first : nullptr, record.count };
+
+        for (uint32_t k = record.first; k < record.first + record.count; ++k)
+            lists[k] = node(array<uint32_t>(IMAGE_LISTS)[k], i + 1);
+    }
+
+    gcc::prog_t *prog = arena.make<gcc::prog_t>(arena);
+
+    for (uint32_t i = 0; i < count(IMAGE_FUNCS) && valid; ++i) {
+        const gcc::image_func_t& record = array<image_func_t>(IMAGE_FUNCS)[i];
+        gcc::func_t func(arena);
+
+        func.name      = symbol(record.name);
+        func.ret_type  = read_type(record.ret_type);
+        func.node.body = node(record.body, 0);
+        func.defined   = func.node.body != nullptr;
+
+        if (record.count > count(IMAGE_PARAMS) || record.first > count(IMAGE_PARAMS) - record.count) {
+            valid = false;
+            break;
+        }
+
+        for (uint32_t k = 0; k < record.count && valid; ++k) {
+            const gcc::image_var_t& param = array<image_var_t>(IMAGE_PARAMS)[record.first + k];
+            gcc::var_t var;
+
+            var.type = read_type(param.type);
+            var.name = symbol(param.name);
+            var.init = nullptr;
+
+            func.args.insert(std::make_pair(var.name, var));
+            func.params.push_back(var.name);
+        }
+
+        prog->functions.insert(std::make_pair(func.name, func));
+    }
+
+    for (uint32_t i = 0; i < count(IMAGE_GLOBALS) && valid; ++i) {
+        const gcc::image_var_t& record = array<image_var_t>(IMAGE_GLOBALS)[i];
+        gcc::var_t var;
+
+        var.type = read_type(record.type);
+        var.name = symbol(record.name);
+        var.init = node(record.init, 0);
+
+        prog->globals.insert(std::make_pair(var.name, var));
+    }
+
+    if (!valid) {
+        WARN("invalid AST image\n");
+        return nullptr;
+    }
+
+    nodes = nnodes;
+    return prog;
+}
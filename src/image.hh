@@ -0,0 +1,151 @@
+#ifndef __IMAGE_HH__
+#define __IMAGE_HH__
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "arena.hh"
+#include "parser.hh"
+#include "source.hh"
+#include "util/error.hh"
+
+namespace gcc {
+
+    /* AST image sections, in file order */
+    enum {
+        IMAGE_STRINGS,  /* image_string_t, index 0 is the empty string */
+        IMAGE_CHARS,    /* NUL-terminated text of the strings */
+        IMAGE_NODES,    /* image_node_t */
+        IMAGE_LISTS,    /* statement lists, node references */
+        IMAGE_FUNCS,    /* image_func_t */
+        IMAGE_PARAMS,   /* image_var_t, parameters of all functions */
+        IMAGE_GLOBALS,  /* image_var_t */
+        IMAGE_LAST,
+    };
+
+    typedef struct image_section {
+        uint32_t offset;  /* from the start of the image, 8-byte aligned */
+        uint32_t count;   /* elements, not bytes */
+    } image_section_t;
+
+    typedef struct image_header {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t size;    /* bytes, header included */
+        uint32_t unused;
+        gcc::image_section_t sections[IMAGE_LAST];
+    } image_header_t;
+
+    typedef struct image_string {
+        uint32_t offset;  /* into IMAGE_CHARS */
+        uint32_t length;
+    } image_string_t;
+
+    typedef struct image_type {
+        uint8_t type;     /* token_type_t */
+        uint8_t flags;    /* IMAGE_TYPE_* */
+        uint16_t unused;
+    } image_type_t;
+
+    enum {
+        IMAGE_TYPE_EXTERN   = 1 << 0,
+        IMAGE_TYPE_VOLATILE = 1 << 1,
+        IMAGE_TYPE_STATIC   = 1 << 2,
+        IMAGE_TYPE_REGISTER = 1 << 3,
+        IMAGE_TYPE_POINTER  = 1 << 4,
+        IMAGE_TYPE_CONST    = 1 << 5,
+        IMAGE_TYPE_RESTRICT = 1 << 6,
+        IMAGE_TYPE_UNSIGNED = 1 << 7,
+    };
+
+    /* node_t with its pointers replaced by node references: the index of
+     * the node in IMAGE_NODES plus one, 0 stands for nullptr */
+    typedef struct image_node {
+        uint8_t type;     /* token_type_t */
+        uint8_t flags;    /* TF_* of a TT_DIGIT */
+        uint8_t unused[6];
+        int64_t value;    /* string index for nodes that hold a symbol */
+        uint32_t l;
+        uint32_t r;
+        uint32_t body;
+        uint32_t cond;
+        uint32_t then;
+        uint32_t els;
+        uint32_t first;   /* statements, IMAGE_LISTS[first, first + count) */
+        uint32_t count;
+    } image_node_t;
+
+    typedef struct image_var {
+        uint32_t name;    /* string index */
+        gcc::image_type_t type;
+        uint32_t init;    /* node reference, globals only */
+    } image_var_t;
+
+    typedef struct image_func {
+        uint32_t name;
+        gcc::image_type_t ret_type;
+        uint32_t body;    /* node reference, 0 for prototypes */
+        uint32_t first;   /* parameters, IMAGE_PARAMS[first, first + count) */
+        uint32_t count;
+    } image_func_t;
+
+    /* Relocatable binary image of a parsed program.
+     *
+     * There are no pointers in an image: nodes refer to each other by
+     * index and symbols are indices into a string table written with the
+     * image, so the bytes can be mapped at any address and in any
+     * process. Nothing reads the nodes in place: load() rebuilds the
+     * program as node_t's, which is what the parser, lowering and the
+     * caches work on. Opening an image only checks its header and load()
+     * checks every index and reference it follows, so a truncated or
+     * corrupt image is refused instead of read past the mapping.
+     *
+     * Images are native-endian and meant for the machine that wrote them
+     * or ones like it (build workers, precompiled headers), not for
+     * exchange in general. */
+    class image {
+        public:
+            image();
+            ~image();
+
+            /* append the image of prog to out, at an 8-byte aligned offset */
+            static void write(std::string& out, const gcc::prog_t& prog);
+
+            /* view an image in memory, data must stay valid while it's used */
+            gcc_error_t open(const void *data, size_t size);
+
+            /* map an image file and view it */
+            gcc_error_t map(const char *file);
+
+            /* size of the image in bytes */
+            size_t size() const { return header_ ? header_->size : 0; }
+
+            /* Build the program as node_t's in arena, a copy of the whole
+             * image. Strings are interned into the calling thread's
+             * interner. nodes is set to the number of nodes built.
+             * Returns nullptr if the image is invalid. */
+            gcc::prog_t *load(gcc::arena& arena, size_t& nodes) const;
+
+        private:
+            image(const image&);
+            image& operator=(const image&);
+
+            uint32_t count(int section) const
+            {
+                return header_ ? header_->sections[section].count : 0;
+            }
+
+            template <typename T>
+            const T *array(int section) const
+            {
+                return (const T *)(data_ + header_->sections[section].offset);
+            }
+
+            const char *data_;
+            const gcc::image_header_t *header_;
+            gcc::source_buffer file_;
+    };
+};
+
+#endif /* __IMAGE_HH__ */
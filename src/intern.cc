@@ -0,0 +1,143 @@
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+#include "intern.hh"
+
+#define BLOCK_SIZE    (64 * 1024)
+#define INITIAL_SLOTS 1024
+
+gcc::interner::interner():
+    entries_(),
+    table_(INITIAL_SLOTS, SYM_NONE),
+    blocks_(),
+    block_ptr_(nullptr),
+    block_left_(0),
+    bytes_(0)
+{
+    /* slot 0 is SYM_NONE, its text is the empty string */
+    entries_.push_back({ "", 0, 0 });
+}
+
+gcc::interner::~interner()
+{
+    for (char *block : blocks_)
+        free(block);
+}
+
+uint32_t gcc::interner::hash(const char *s, size_t len)
+{
+    /* FNV-1a, identifiers are short so this beats anything fancier */
+    uint32_t h = 2166136261u;
+
+    for (size_t i = 0; i < len; ++i)
+        h = (h ^ (unsigned char)s[i]) * 16777619u;
+    return h;
+}
+
+char *gcc::interner::store(const char *s, size_t len)
+{
+    char *ptr;
+
+    if (len + 1 > block_left_) {
+        size_t size = len + 1 > BLOCK_SIZE / 4 ? len + 1 : BLOCK_SIZE;
+
+        if (!(ptr = (char *)malloc(size)))
+            throw std::bad_alloc();
+
+        blocks_.push_back(ptr);
+        bytes_ += size;
+
+        /* oversized strings get a block of their own, keep filling the current one */
+        if (size != BLOCK_SIZE) {
+            memcpy(ptr, s, len);
+            ptr[len] = '\0';
+            return ptr;
+        }
+
+        block_ptr_  = ptr;
+        block_left_ = size;
+    }
+
+    ptr = block_ptr_;
+    memcpy(ptr, s, len);
+    ptr[len] = '\0';
+
+    block_ptr_  += len + 1;
+    block_left_ -= len + 1;
+
+    return ptr;
+}
+
+void gcc::interner::grow()
+{
+    std::vector<gcc::symbol_t> table(table_.size() * 2, SYM_NONE);
+    size_t mask = table.size() - 1;
+
+    for (gcc::symbol_t sym = 1; sym < entries_.size(); ++sym) {
+        size_t i = entries_[sym].hash & mask;
+
+        while (table[i] != SYM_NONE)
+            i = (i + 1) & mask;
+        table[i] = sym;
+    }
+
+    table_.swap(table);
+}
+
+gcc::symbol_t gcc::interner::find(const char *s, size_t len) const
+{
+    uint32_t h  = hash(s, len);
+    size_t mask = table_.size() - 1;
+
+    for (size_t i = h & mask; table_[i] != SYM_NONE; i = (i + 1) & mask) {
+        const entry_t& e = entries_[table_[i]];
+
+        if (e.hash == h && e.len == len && !memcmp(e.str, s, len))
+            return table_[i];
+    }
+
+    return SYM_NONE;
+}
+
+gcc::symbol_t gcc::interner::intern(const char *s, size_t len)
+{
+    uint32_t h  = hash(s, len);
+    size_t mask = table_.size() - 1;
+    size_t i;
+
+    for (i = h & mask; table_[i] != SYM_NONE; i = (i + 1) & mask) {
+        const entry_t& e = entries_[table_[i]];
+
+        if (e.hash == h && e.len == len && !memcmp(e.str, s, len))
+            return table_[i];
+    }
+
+    gcc::symbol_t sym = (gcc::symbol_t)entries_.size();
+
+    entries_.push_back({ store(s, len), (uint32_t)len, h });
+    table_[i] = sym;
+
+    /* keep the load factor at or below 1/2 */
+    if (entries_.size() * 2 > table_.size())
+        grow();
+
+    return sym;
+}
+
+static thread_local gcc::interner *bound_interner;
+
+gcc::interner& gcc::symbols()
+{
+    static thread_local gcc::interner interner;
+
+    return bound_interner ? *bound_interner : interner;
+}
+
+gcc::interner *gcc::bind_symbols(gcc::interner *interner)
+{
+    gcc::interner *prev = bound_interner;
+
+    bound_interner = interner;
+    return prev;
+}
@@ -0,0 +1,85 @@
+#ifndef __INTERN_HH__
+#define __INTERN_HH__
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace gcc {
+
+    /* interned string handle, 0 is never a valid symbol */
+    typedef uint32_t symbol_t;
+
+    enum { SYM_NONE = 0 };
+
+    /* Hash-consing string table.
+     *
+     * Every distinct string is stored once in arena blocks that are never
+     * moved or freed while the interner lives, so the text of a symbol
+     * is stable and NUL-terminated. Equal strings map to the same id and
+     * ids are dense, which lets callers key maps and side tables on them
+     * without ever hashing the text again. */
+    class interner {
+        public:
+            interner();
+            ~interner();
+
+            /* return symbol for s[0..len), adding it if it's new */
+            gcc::symbol_t intern(const char *s, size_t len);
+
+            /* return symbol for s[0..len) or SYM_NONE if it's not interned */
+            gcc::symbol_t find(const char *s, size_t len) const;
+
+            /* NUL-terminated text of the symbol */
+            const char *str(gcc::symbol_t sym) const { return entries_[sym].str; }
+
+            /* length of the symbol's text */
+            size_t length(gcc::symbol_t sym) const { return entries_[sym].len; }
+
+            /* number of interned symbols */
+            size_t size() const { return entries_.size() - 1; }
+
+            /* bytes of string storage allocated */
+            size_t bytes() const { return bytes_; }
+
+        private:
+            interner(const interner&);
+            interner& operator=(const interner&);
+
+            typedef struct entry {
+                const char *str;
+                uint32_t len;
+                uint32_t hash;
+            } entry_t;
+
+            static uint32_t hash(const char *s, size_t len);
+
+            char *store(const char *s, size_t len);
+            void grow();
+
+            std::vector<entry_t> entries_;
+            std::vector<gcc::symbol_t> table_;
+            std::vector<char *> blocks_;
+            char *block_ptr_;
+            size_t block_left_;
+            size_t bytes_;
+    };
+
+    /* The interner shared by the tokenizer and the parser of the calling
+     * thread. Every thread has its own, so symbols must not cross threads:
+     * a translation unit is tokenized on one thread. */
+    gcc::interner& symbols();
+
+    /* Make symbols() return interner on the calling thread, nullptr restores
+     * the thread's own. Used by threads helping to parse another thread's
+     * translation unit, which only read symbols that already exist.
+     * Returns the previous binding. */
+    gcc::interner *bind_symbols(gcc::interner *interner);
+
+    static inline const char *symbol_str(gcc::symbol_t sym)
+    {
+        return gcc::symbols().str(sym);
+    }
+};
+
+#endif /* __INTERN_HH__ */
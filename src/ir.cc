@@ -0,0 +1,565 @@
+#include <algorithm>
+#include <cinttypes>
+
+#include "ir.hh"
+#include "util/log.hh"
+
+#define CHANNEL "ir"
+
+static const gcc::ir::op_info_t op_table[] = {
+    { "nop",    0, 0 },
+    { "const",  0, 0 },
+    { "undef",  0, 0 },
+    { "param",  0, 0 },
+    { "phi",    0, gcc::ir::OPF_VARIADIC },
+    { "add",    2, gcc::ir::OPF_COMMUTATIVE },
+    { "sub",    2, 0 },
+    { "mul",    2, gcc::ir::OPF_COMMUTATIVE },
+    { "div",    2, 0 },
+    { "udiv",   2, 0 },
+    { "rem",    2, 0 },
+    { "urem",   2, 0 },
+    { "and",    2, gcc::ir::OPF_COMMUTATIVE },
+    { "or",     2, gcc::ir::OPF_COMMUTATIVE },
+    { "xor",    2, gcc::ir::OPF_COMMUTATIVE },
+    { "shl",    2, 0 },
+    { "shr",    2, 0 },
+    { "sar",    2, 0 },
+    { "neg",    1, 0 },
+    { "not",    1, 0 },
+    { "eq",     2, gcc::ir::OPF_COMPARE | gcc::ir::OPF_COMMUTATIVE },
+    { "ne",     2, gcc::ir::OPF_COMPARE | gcc::ir::OPF_COMMUTATIVE },
+    { "lt",     2, gcc::ir::OPF_COMPARE },
+    { "le",     2, gcc::ir::OPF_COMPARE },
+    { "ult",    2, gcc::ir::OPF_COMPARE },
+    { "ule",    2, gcc::ir::OPF_COMPARE },
+    { "sext",   1, 0 },
+    { "zext",   1, 0 },
+    { "trunc",  1, 0 },
+    { "splat",  1, 0 },
+    { "wsum",   1, 0 },
+    { "hsum",   1, 0 },
+    { "slot",   0, 0 },
+    { "global", 0, 0 },
+    { "load",   1, 0 },
+    { "store",  2, gcc::ir::OPF_EFFECT },
+    { "call",   0, gcc::ir::OPF_EFFECT | gcc::ir::OPF_VARIADIC },
+    { "jmp",    0, gcc::ir::OPF_EFFECT | gcc::ir::OPF_TERMINATOR },
+    { "br",     1, gcc::ir::OPF_EFFECT | gcc::ir::OPF_TERMINATOR },
+    { "ret",    1, gcc::ir::OPF_EFFECT | gcc::ir::OPF_TERMINATOR },
+};
+
+static_assert(sizeof(op_table) / sizeof(op_table[0]) == gcc::ir::OP_LAST, "opcode info missing");
+
+const gcc::ir::op_info_t& gcc::ir::info(uint8_t op)
+{
+    return op_table[op];
+}
+
+const char *gcc::ir::type_str(uint8_t type)
+{
+    static const char *names[] = {
+        "void", "i8", "i16", "i32", "i64", "v16i8", "v8i16", "v4i32", "v2i64", "v32i8", "v16i16", "v8i32", "v4i64",
+    };
+
+    return type <= TYPE_V4I64 ? names[type] : "?";
+}
+
+gcc::ir::function::function(gcc::arena& arena, gcc::symbol_t name, uint8_t ret):
+    name(name),
+    ret(ret),
+    local(false),
+    noalias(0),
+    insts(arena),
+    operands(arena),
+    blocks(arena),
+    params(arena),
+    arena_(arena)
+{
+}
+
+uint32_t gcc::ir::function::add_block()
+{
+    blocks.emplace_back(arena_);
+    return (uint32_t)blocks.size() - 1;
+}
+
+gcc::ir::value_t gcc::ir::function::add(uint32_t block, uint8_t op, uint8_t type, value_t a, value_t b, int64_t imm)
+{
+    return insert(block, blocks[block].code.size(), op, type, a, b, imm);
+}
+
+gcc::ir::value_t gcc::ir::function::insert(uint32_t block, size_t pos, uint8_t op, uint8_t type,
+                                           value_t a, value_t b, int64_t imm)
+{
+    value_t value = (value_t)insts.size();
+
+    insts.push_back({ op, type, 0, block, { a, b }, imm });
+    blocks[block].code.insert(blocks[block].code.begin() + pos, value);
+
+    return value;
+}
+
+gcc::ir::value_t gcc::ir::function::add_variadic(uint32_t block, uint8_t op, uint8_t type, uint32_t count, int64_t imm)
+{
+    value_t first = (value_t)operands.size();
+
+    operands.resize(operands.size() + count, NONE);
+
+    /* phis stay in front of everything else */
+    size_t pos = blocks[block].code.size();
+
+    if (op == OP_PHI) {
+        pos = 0;
+        while (pos < blocks[block].code.size() && insts[blocks[block].code[pos]].op == OP_PHI)
+            pos++;
+    }
+
+    return insert(block, pos, op, type, first, count, imm);
+}
+
+void gcc::ir::function::jump(uint32_t from, uint32_t to)
+{
+    add(from, OP_JMP, TYPE_VOID);
+
+    blocks[from].succ[0] = to;
+    blocks[to].preds.push_back(from);
+}
+
+void gcc::ir::function::branch(uint32_t from, value_t cond, uint32_t taken, uint32_t other)
+{
+    add(from, OP_BR, TYPE_VOID, cond);
+
+    blocks[from].succ[0] = taken;
+    blocks[from].succ[1] = other;
+    blocks[taken].preds.push_back(from);
+    blocks[other].preds.push_back(from);
+}
+
+void gcc::ir::function::remove_pred(uint32_t block, uint32_t pred)
+{
+    block_t& b = blocks[block];
+    auto it    = std::find(b.preds.begin(), b.preds.end(), pred);
+
+    if (it == b.preds.end())
+        return;
+
+    uint32_t index = (uint32_t)(it - b.preds.begin());
+
+    /* phi operands stay in the order of the remaining predecessors */
+    for (value_t v : b.code) {
+        inst_t& inst = insts[v];
+
+        if (inst.op != OP_PHI)
+            continue;
+
+        for (uint32_t i = index; i + 1 < inst.arg[1]; ++i)
+            operand(inst, i) = operand(inst, i + 1);
+        inst.arg[1]--;
+    }
+
+    b.preds.erase(it);
+}
+
+void gcc::ir::function::remove(value_t value)
+{
+    insts[value].op = OP_NOP;
+}
+
+void gcc::ir::function::replace(std::vector<value_t>& map)
+{
+    auto resolve = [&map](value_t v) {
+        value_t root = v;
+
+        while (root < map.size() && map[root] != NONE)
+            root = map[root];
+
+        /* shorten the chain for the next lookup */
+        while (v < map.size() && map[v] != NONE && map[v] != root) {
+            value_t next = map[v];
+            map[v] = root;
+            v = next;
+        }
+
+        return root;
+    };
+
+    for (inst_t& inst : insts) {
+        if (inst.op == OP_NOP)
+            continue;
+
+        value_t *ops = operands_of(inst);
+
+        for (uint32_t i = 0, n = num_operands(inst); i < n; ++i) {
+            if (ops[i] != NONE)
+                ops[i] = resolve(ops[i]);
+        }
+    }
+}
+
+void gcc::ir::function::count_uses(std::vector<uint32_t>& uses) const
+{
+    uses.assign(insts.size(), 0);
+
+    for (const inst_t& inst : insts) {
+        if (inst.op == OP_NOP)
+            continue;
+
+        const value_t *ops = operands_of(inst);
+
+        for (uint32_t i = 0, n = num_operands(inst); i < n; ++i) {
+            if (ops[i] != NONE)
+                uses[ops[i]]++;
+        }
+    }
+}
+
+void gcc::ir::function::compact()
+{
+    std::vector<uint32_t> order;
+    std::vector<uint32_t> block_map(blocks.size(), NONE);
+    std::vector<std::pair<uint32_t, int>> stack;
+
+    /* Reverse postorder of the reachable blocks, the entry stays first.
+     * The other successor is visited first so that the taken side of a
+     * branch, a loop body or a then-block, follows it and loop exits come
+     * after the loop. */
+    if (!blocks.empty()) {
+        std::vector<uint8_t> seen(blocks.size(), 0);
+
+        stack.push_back({ 0, 0 });
+        seen[0] = 1;
+
+        while (!stack.empty()) {
+            uint32_t b = stack.back().first;
+            int& next  = stack.back().second;
+
+            if (next < 2) {
+                uint32_t succ = blocks[b].succ[1 - next++];
+
+                if (succ != NONE && !seen[succ]) {
+                    seen[succ] = 1;
+                    stack.push_back({ succ, 0 });
+                }
+                continue;
+            }
+
+            order.push_back(b);
+            stack.pop_back();
+        }
+
+        std::reverse(order.begin(), order.end());
+    }
+
+    for (uint32_t i = 0; i < order.size(); ++i)
+        block_map[order[i]] = i;
+
+    /* edges from unreachable blocks go away with their phi operands */
+    for (uint32_t b : order) {
+        block_t& block = blocks[b];
+        uint32_t kept  = 0;
+
+        for (uint32_t i = 0; i < block.preds.size(); ++i) {
+            if (block_map[block.preds[i]] == NONE)
+                continue;
+
+            for (value_t v : block.code) {
+                if (insts[v].op == OP_PHI)
+                    operand(insts[v], kept) = operand(insts[v], i);
+            }
+
+            block.preds[kept++] = block.preds[i];
+        }
+
+        for (value_t v : block.code) {
+            if (insts[v].op == OP_PHI)
+                insts[v].arg[1] = kept;
+        }
+
+        block.preds.resize(kept);
+    }
+
+    std::vector<value_t> value_map(insts.size(), NONE);
+    value_t count = 0;
+
+    for (uint32_t b : order) {
+        for (value_t v : blocks[b].code) {
+            if (insts[v].op != OP_NOP)
+                value_map[v] = count++;
+        }
+    }
+
+    gcc::ir::vector<inst_t> new_insts(arena_);
+    gcc::ir::vector<value_t> new_operands(arena_);
+    gcc::ir::vector<block_t> new_blocks(arena_);
+
+    new_insts.reserve(count);
+    new_operands.reserve(operands.size());
+    new_blocks.reserve(order.size());
+
+    for (uint32_t b : order) {
+        block_t& old = blocks[b];
+
+        new_blocks.emplace_back(arena_);
+        block_t& block = new_blocks.back();
+
+        for (uint32_t pred : old.preds)
+            block.preds.push_back(block_map[pred]);
+
+        for (int i = 0; i < 2; ++i)
+            block.succ[i] = old.succ[i] == NONE ? NONE : block_map[old.succ[i]];
+
+        for (value_t v : old.code) {
+            inst_t inst = insts[v];
+
+            if (inst.op == OP_NOP)
+                continue;
+
+            inst.block = (uint32_t)new_blocks.size() - 1;
+
+            if (info(inst.op).flags & OPF_VARIADIC) {
+                value_t first = (value_t)new_operands.size();
+
+                for (uint32_t i = 0; i < inst.arg[1]; ++i) {
+                    value_t op = operands[inst.arg[0] + i];
+                    new_operands.push_back(op == NONE ? NONE : value_map[op]);
+                }
+
+                inst.arg[0] = first;
+            } else {
+                for (uint32_t i = 0, n = num_operands(inst); i < n; ++i) {
+                    if (inst.arg[i] != NONE)
+                        inst.arg[i] = value_map[inst.arg[i]];
+                }
+            }
+
+            block.code.push_back((value_t)new_insts.size());
+            new_insts.push_back(inst);
+        }
+    }
+
+    for (value_t& param : params)
+        param = value_map[param];
+
+    insts.swap(new_insts);
+    operands.swap(new_operands);
+    blocks.swap(new_blocks);
+}
+
+gcc::ir::module::module():
+    functions(),
+    globals(),
+    arena_()
+{
+}
+
+gcc::ir::module::~module()
+{
+}
+
+void gcc::ir::module::reset()
+{
+    functions.clear();
+    globals.clear();
+    arena_.reset();
+}
+
+gcc::ir::function *gcc::ir::module::add_function(gcc::symbol_t name, uint8_t ret)
+{
+    gcc::ir::function *fn = arena_.make<gcc::ir::function>(arena_, name, ret);
+
+    functions.push_back(fn);
+    return fn;
+}
+
+gcc_error_t gcc::ir::verify(const gcc::ir::function& fn)
+{
+    const char *name = gcc::symbol_str(fn.name);
+
+#define FAIL(fmt, ...) \
+    do { \
+        ERROR("%s(): " fmt, name, ##__VA_ARGS__); \
+        return GCC_INVALID_VALUE; \
+    } while (0)
+
+    if (fn.blocks.empty())
+        FAIL("no entry block\n");
+
+    if (!fn.blocks[0].preds.empty())
+        FAIL("entry block has predecessors\n");
+
+    std::vector<uint8_t> defined(fn.insts.size(), 0);
+
+    for (uint32_t b = 0; b < fn.blocks.size(); ++b) {
+        const block_t& block = fn.blocks[b];
+        bool phis = true;
+
+        if (block.code.empty())
+            FAIL("b%u is empty\n", b);
+
+        for (int i = 0; i < 2; ++i) {
+            uint32_t succ = block.succ[i];
+
+            if (succ == NONE)
+                continue;
+
+            if (succ >= fn.blocks.size() ||
+                std::count(fn.blocks[succ].preds.begin(), fn.blocks[succ].preds.end(), b) == 0)
+                FAIL("b%u -> b%u has no matching predecessor\n", b, succ);
+        }
+
+        for (uint32_t pred : block.preds) {
+            if (pred >= fn.blocks.size() || (fn.blocks[pred].succ[0] != b && fn.blocks[pred].succ[1] != b))
+                FAIL("b%u lists b%u as a predecessor\n", b, pred);
+        }
+
+        for (size_t i = 0; i < block.code.size(); ++i) {
+            value_t v = block.code[i];
+            const inst_t& inst = fn.insts[v];
+            bool last = i + 1 == block.code.size();
+
+            if (inst.op == OP_NOP || inst.op >= OP_LAST)
+                FAIL("v%u has an invalid opcode %u\n", v, inst.op);
+
+            if (inst.block != b)
+                FAIL("v%u is listed in b%u but says b%u\n", v, b, inst.block);
+
+            if (inst.op == OP_PHI) {
+                if (!phis)
+                    FAIL("phi v%u after other instructions of b%u\n", v, b);
+                if (inst.arg[1] != block.preds.size())
+                    FAIL("phi v%u has %u operands for %zu predecessors\n", v, inst.arg[1], block.preds.size());
+            } else {
+                phis = false;
+            }
+
+            if (((info(inst.op).flags & OPF_TERMINATOR) != 0) != last)
+                FAIL("b%u doesn't end in exactly one terminator\n", b);
+
+            uint32_t nsucc = inst.op == OP_BR ? 2 : inst.op == OP_JMP ? 1 : 0;
+
+            if (last && ((block.succ[0] != NONE) + (block.succ[1] != NONE)) != (int)nsucc)
+                FAIL("b%u has successors its terminator doesn't reach\n", b);
+
+            const value_t *ops = fn.operands_of(inst);
+
+            for (uint32_t k = 0, n = fn.num_operands(inst); k < n; ++k) {
+                if (ops[k] >= fn.insts.size())
+                    FAIL("v%u uses an invalid value\n", v);
+
+                /* values come in block order, only phis look back along loops */
+                if (inst.op != OP_PHI && !defined[ops[k]])
+                    FAIL("v%u uses v%u before its definition\n", v, ops[k]);
+            }
+
+            defined[v] = 1;
+        }
+    }
+
+#undef FAIL
+
+    return GCC_SUCCESS;
+}
+
+static void print_value(FILE *out, gcc::ir::value_t v)
+{
+    if (v == gcc::ir::NONE)
+        fprintf(out, "_");
+    else
+        fprintf(out, "v%u", v);
+}
+
+void gcc::ir::print(FILE *out, const gcc::ir::function& fn)
+{
+    fprintf(out, "function %s%s %s(", fn.local ? "static " : "", type_str(fn.ret), gcc::symbol_str(fn.name));
+
+    for (size_t i = 0; i < fn.params.size(); ++i)
+        fprintf(out, "%s%s%s v%u", i ? ", " : "", type_str(fn.insts[fn.params[i]].type),
+                i < 64 && ((fn.noalias >> i) & 1) ? " restrict" : "", fn.params[i]);
+
+    fprintf(out, ") {\n");
+
+    for (uint32_t b = 0; b < fn.blocks.size(); ++b) {
+        const block_t& block = fn.blocks[b];
+
+        fprintf(out, "b%u:", b);
+
+        if (!block.preds.empty()) {
+            fprintf(out, "%*s; preds", b < 10 ? 12 : 11, "");
+
+            for (uint32_t pred : block.preds)
+                fprintf(out, " b%u", pred);
+        }
+
+        fprintf(out, "\n");
+
+        for (value_t v : block.code) {
+            const inst_t& inst = fn.insts[v];
+            const value_t *ops = fn.operands_of(inst);
+            uint32_t n = fn.num_operands(inst);
+
+            fprintf(out, "    ");
+
+            if (inst.type != TYPE_VOID && inst.op != OP_STORE)
+                fprintf(out, "v%u = %s ", v, type_str(inst.type));
+            else if (inst.op == OP_STORE)
+                fprintf(out, "%s ", type_str(inst.type));
+
+            fprintf(out, "%s", info(inst.op).name);
+
+            switch (inst.op) {
+                case OP_CONST:
+                case OP_PARAM:
+                case OP_SLOT:
+                    fprintf(out, " %" PRId64, inst.imm);
+                    break;
+
+                case OP_GLOBAL:
+                case OP_CALL:
+                    fprintf(out, " %s", gcc::symbol_str((gcc::symbol_t)inst.imm));
+                    break;
+            }
+
+            for (uint32_t k = 0; k < n; ++k) {
+                fprintf(out, k || inst.op == OP_CALL || inst.op == OP_GLOBAL ? ", " : " ");
+
+                if (inst.op == OP_PHI) {
+                    fprintf(out, "[");
+                    print_value(out, ops[k]);
+                    fprintf(out, " b%u]", block.preds[k]);
+                } else {
+                    print_value(out, ops[k]);
+                }
+            }
+
+            if (inst.op == OP_JMP)
+                fprintf(out, " b%u", block.succ[0]);
+            else if (inst.op == OP_BR)
+                fprintf(out, ", b%u, b%u", block.succ[0], block.succ[1]);
+
+            fprintf(out, "\n");
+        }
+    }
+
+    fprintf(out, "}\n");
+}
+
+void gcc::ir::print(FILE *out, const gcc::ir::module& module)
+{
+    for (const gcc::ir::global_t& global : module.globals) {
+        fprintf(out, "global %s%s %s%s", global.local ? "static " : "", type_str(global.type), gcc::symbol_str(global.name),
+                global.defined ? "" : " extern");
+
+        if (global.init)
+            fprintf(out, " = %" PRId64, global.init);
+
+        fprintf(out, "\n");
+    }
+
+    for (size_t i = 0; i < module.functions.size(); ++i) {
+        if (i || !module.globals.empty())
+            fprintf(out, "\n");
+
+        print(out, *module.functions[i]);
+    }
+}
@@ -0,0 +1,316 @@
+#ifndef __IR_HH__
+#define __IR_HH__
+
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+#include "arena.hh"
+#include "intern.hh"
+#include "util/error.hh"
+
+namespace gcc {
+
+    /* SSA intermediate representation.
+     *
+     * A function's instructions live in one contiguous array and the
+     * index of an instruction is the number of the value it defines.
+     * Operands are 32-bit value numbers, phis and calls keep theirs in a
+     * second array of the function (first and count in arg[]), so an
+     * instruction is a fixed 24-byte record and a pass walks plain
+     * arrays. Blocks list their instructions in order, phis first and a
+     * terminator last, and phi operands are in the order of the block's
+     * predecessors.
+     *
+     * Passes don't delete in place, they turn instructions into OP_NOP
+     * or forward their uses and leave the rest to function::compact(),
+     * which drops unreachable blocks and dead records and renumbers
+     * blocks in reverse postorder and values in block order. After it
+     * every value is defined before it's used, phis aside, and numbers
+     * are dense again.
+     *
+     * Everything is allocated from the module's arena and released with
+     * it, the vectors below grow in the arena and never free. */
+    namespace ir {
+
+        enum { NONE = 0xffffffffu };
+
+        typedef uint32_t value_t;
+
+        template <typename T>
+        using vector = std::vector<T, gcc::arena_allocator<T>>;
+
+        /* Value types, pointers are TYPE_I64. Vectors are 16 or 32 bytes
+         * (SSE2 or AVX2 registers) of lanes of a scalar type, only the
+         * vectorizer makes them, see make_vectorize(). */
+        typedef enum type {
+            TYPE_VOID,
+            TYPE_I8,
+            TYPE_I16,
+            TYPE_I32,
+            TYPE_I64,
+            TYPE_V16I8,
+            TYPE_V8I16,
+            TYPE_V4I32,
+            TYPE_V2I64,
+            TYPE_V32I8,
+            TYPE_V16I16,
+            TYPE_V8I32,
+            TYPE_V4I64,
+        } type_t;
+
+        typedef enum op {
+            OP_NOP,     /* removed */
+            OP_CONST,   /* imm */
+            OP_UNDEF,
+            OP_PARAM,   /* imm is the parameter's index */
+            OP_PHI,     /* operands in function::operands */
+            OP_ADD,
+            OP_SUB,
+            OP_MUL,
+            OP_DIV,
+            OP_UDIV,
+            OP_REM,
+            OP_UREM,
+            OP_AND,
+            OP_OR,
+            OP_XOR,
+            OP_SHL,
+            OP_SHR,     /* logical */
+            OP_SAR,     /* arithmetic */
+            OP_NEG,
+            OP_NOT,
+            OP_EQ,      /* comparisons are TYPE_I32, 0 or 1 */
+            OP_NE,
+            OP_LT,
+            OP_LE,
+            OP_ULT,
+            OP_ULE,
+            OP_SEXT,
+            OP_ZEXT,
+            OP_TRUNC,
+            OP_SPLAT,   /* vector of arg[0] in every lane */
+            OP_WSUM,    /* sums of adjacent lanes of arg[0] zero extended, in the wider lanes of type */
+            OP_HSUM,    /* sum of the lanes of arg[0] */
+            OP_SLOT,    /* address of imm bytes of the stack frame */
+            OP_GLOBAL,  /* address of the global variable imm (a symbol) */
+            OP_LOAD,    /* type bytes at arg[0], unaligned for vectors */
+            OP_STORE,   /* arg[1] to arg[0], the width of type */
+            OP_CALL,    /* imm (a symbol), arguments in function::operands */
+            OP_JMP,     /* to block::succ[0] */
+            OP_BR,      /* to succ[0] if arg[0] isn't 0, else to succ[1] */
+            OP_RET,     /* arg[0], NONE for void */
+            OP_LAST,
+        } op_t;
+
+        /* properties of opcodes, see info() */
+        enum {
+            OPF_COMMUTATIVE = 1 << 0,
+            OPF_COMPARE     = 1 << 1,
+            OPF_EFFECT      = 1 << 2,  /* can't be removed when unused */
+            OPF_TERMINATOR  = 1 << 3,
+            OPF_VARIADIC    = 1 << 4,  /* operands in function::operands */
+        };
+
+        typedef struct op_info {
+            const char *name;
+            uint8_t operands;          /* in arg[], unless OPF_VARIADIC */
+            uint8_t flags;
+        } op_info_t;
+
+        const gcc::ir::op_info_t& info(uint8_t op);
+
+        const char *type_str(uint8_t type);
+
+        static inline bool is_vector(uint8_t type)
+        {
+            return type >= TYPE_V16I8;
+        }
+
+        /* bytes of a value of type */
+        static inline unsigned type_size(uint8_t type)
+        {
+            if (is_vector(type))
+                return type >= TYPE_V32I8 ? 32 : 16;
+
+            return type == TYPE_VOID ? 0 : 1u << (type - TYPE_I8);
+        }
+
+        /* type of the lanes of a vector type, type itself for scalars */
+        static inline uint8_t lane_type(uint8_t type)
+        {
+            return is_vector(type) ? TYPE_I8 + (type - TYPE_V16I8) % 4 : type;
+        }
+
+        /* the vector type of bytes (16 or 32) with lanes of type lane */
+        static inline uint8_t vector_type(uint8_t lane, unsigned bytes)
+        {
+            return (bytes == 32 ? TYPE_V32I8 : TYPE_V16I8) + (lane - TYPE_I8);
+        }
+
+        /* Constants are kept sign extended from the width of their type,
+         * sext() makes value so and zext() reads it back unsigned. */
+        static inline int64_t sext(uint8_t type, int64_t value)
+        {
+            switch (type) {
+                case TYPE_I8:  return (int8_t)value;
+                case TYPE_I16: return (int16_t)value;
+                case TYPE_I32: return (int32_t)value;
+                default:       return value;
+            }
+        }
+
+        static inline uint64_t zext(uint8_t type, int64_t value)
+        {
+            switch (type) {
+                case TYPE_I8:  return (uint8_t)value;
+                case TYPE_I16: return (uint16_t)value;
+                case TYPE_I32: return (uint32_t)value;
+                default:       return (uint64_t)value;
+            }
+        }
+
+        typedef struct inst {
+            uint8_t op;          /* op_t */
+            uint8_t type;        /* type_t of the result, of the memory for OP_LOAD/OP_STORE */
+            uint16_t unused;
+            uint32_t block;      /* NONE once removed */
+            value_t arg[2];      /* operands, or first and count in function::operands */
+            int64_t imm;
+        } inst_t;
+
+        static_assert(sizeof(inst_t) == 24, "inst_t must stay packed");
+
+        typedef struct block {
+            gcc::ir::vector<value_t> code;     /* phis first, terminator last */
+            gcc::ir::vector<uint32_t> preds;
+            uint32_t succ[2];                  /* NONE if absent */
+
+            block(gcc::arena& arena):
+                code(arena), preds(arena), succ{ NONE, NONE }
+            {
+            }
+        } block_t;
+
+        class function {
+            public:
+                function(gcc::arena& arena, gcc::symbol_t name, uint8_t ret);
+
+                /* new empty block, blocks are numbered in creation order */
+                uint32_t add_block();
+
+                /* append an instruction to block */
+                value_t add(uint32_t block, uint8_t op, uint8_t type, value_t a = NONE, value_t b = NONE, int64_t imm = 0);
+
+                /* insert an instruction into block before position pos of its code */
+                value_t insert(uint32_t block, size_t pos, uint8_t op, uint8_t type,
+                               value_t a = NONE, value_t b = NONE, int64_t imm = 0);
+
+                /* Append a phi or call to block with count operands, the
+                 * operands are filled in through operand(). */
+                value_t add_variadic(uint32_t block, uint8_t op, uint8_t type, uint32_t count, int64_t imm = 0);
+
+                /* end block with a jump or a branch and record the edges */
+                void jump(uint32_t from, uint32_t to);
+                void branch(uint32_t from, value_t cond, uint32_t taken, uint32_t other);
+
+                /* drop the edge from pred to block and its phi operands */
+                void remove_pred(uint32_t block, uint32_t pred);
+
+                /* i-th operand of a phi or call */
+                value_t& operand(const inst_t& inst, uint32_t i) { return operands[inst.arg[0] + i]; }
+                value_t operand(const inst_t& inst, uint32_t i) const { return operands[inst.arg[0] + i]; }
+
+                /* number of operands of inst */
+                uint32_t num_operands(const inst_t& inst) const
+                {
+                    if (info(inst.op).flags & OPF_VARIADIC)
+                        return inst.arg[1];
+                    if (inst.op == OP_RET)
+                        return inst.arg[0] != NONE;
+                    return info(inst.op).operands;
+                }
+
+                /* pointer to the operands of inst, num_operands() of them */
+                value_t *operands_of(inst_t& inst)
+                {
+                    return (info(inst.op).flags & OPF_VARIADIC) ? &operands[inst.arg[0]] : inst.arg;
+                }
+
+                const value_t *operands_of(const inst_t& inst) const
+                {
+                    return (info(inst.op).flags & OPF_VARIADIC) ? &operands[inst.arg[0]] : inst.arg;
+                }
+
+                /* turn value into OP_NOP, it's dropped by compact() */
+                void remove(value_t value);
+
+                /* Rename every operand through map: an operand v becomes
+                 * map[v] unless that's NONE. Chains are followed. */
+                void replace(std::vector<value_t>& map);
+
+                /* Drop removed instructions and unreachable blocks and
+                 * renumber, see the namespace comment. */
+                void compact();
+
+                /* number of uses of every value */
+                void count_uses(std::vector<uint32_t>& uses) const;
+
+                gcc::symbol_t name;
+                uint8_t ret;                              /* type_t of the return value */
+                bool local;                               /* static, not visible to other units */
+                uint64_t noalias;                         /* bit i set if parameter i is a restrict pointer */
+                gcc::ir::vector<inst_t> insts;            /* by value number */
+                gcc::ir::vector<value_t> operands;        /* of phis and calls */
+                gcc::ir::vector<block_t> blocks;          /* entry first */
+                gcc::ir::vector<value_t> params;          /* OP_PARAM values in order */
+
+            private:
+                function(const function&);
+                function& operator=(const function&);
+
+                gcc::arena& arena_;
+        };
+
+        typedef struct global {
+            gcc::symbol_t name;
+            uint8_t type;        /* type_t */
+            bool defined;        /* storage is allocated here, not extern */
+            bool local;          /* static, not visible to other units */
+            int64_t init;        /* constant initializer, 0 if there's none */
+        } global_t;
+
+        /* the IR of a translation unit, lives until reset() */
+        class module {
+            public:
+                module();
+                ~module();
+
+                /* release every function */
+                void reset();
+
+                gcc::ir::function *add_function(gcc::symbol_t name, uint8_t ret);
+
+                gcc::arena& get_arena() { return arena_; }
+
+                std::vector<gcc::ir::function *> functions;  /* sorted by name */
+                std::vector<gcc::ir::global_t> globals;       /* sorted by name */
+
+            private:
+                module(const module&);
+                module& operator=(const module&);
+
+                gcc::arena arena_;
+        };
+
+        /* Check the invariants listed in the namespace comment, reports
+         * the first violation. fn must be compacted. */
+        gcc_error_t verify(const gcc::ir::function& fn);
+
+        /* human readable listing */
+        void print(FILE *out, const gcc::ir::function& fn);
+        void print(FILE *out, const gcc::ir::module& module);
+    };
+};
+
+#endif /* __IR_HH__ */
@@ -0,0 +1,234 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#include <dlfcn.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "jit.hh"
+#include "stats.hh"
+#include "util/log.hh"
+
+#define CHANNEL "jit"
+
+/* jmp *slot(%rip), padded with int3 */
+static const size_t STUB_SIZE = 8;
+
+static inline uintptr_t align(uintptr_t value, uintptr_t to)
+{
+    return (value + to - 1) & ~(to - 1);
+}
+
+gcc::jit::jit():
+    objects_(),
+    placements_(),
+    globals_(),
+    externals_(),
+    slots_(),
+    stubs_(),
+    base_(nullptr),
+    size_(0)
+{
+}
+
+gcc::jit::~jit()
+{
+    if (base_)
+        munmap(base_, size_);
+}
+
+void gcc::jit::add(gcc::x86::object_t&& object)
+{
+    objects_.push_back(std::move(object));
+}
+
+uintptr_t gcc::jit::address(size_t object, uint32_t index) const
+{
+    const gcc::x86::object_symbol_t& sym = objects_[object].symbols[index];
+    const placement_t& at = placements_[object];
+
+    switch (sym.section) {
+        case gcc::x86::SECTION_TEXT: return at.text + sym.offset;
+        case gcc::x86::SECTION_DATA: return at.data + sym.offset;
+        case gcc::x86::SECTION_BSS:  return at.bss + sym.offset;
+    }
+
+    auto it = globals_.find(sym.name);
+
+    if (it != globals_.end())
+        return it->second;
+
+    it = externals_.find(sym.name);
+
+    return it != externals_.end() ? it->second : 0;
+}
+
+void *gcc::jit::lookup(const char *name) const
+{
+    auto it = globals_.find(name);
+
+    return it != globals_.end() ? (void *)it->second : nullptr;
+}
+
+gcc_error_t gcc::jit::link()
+{
+    gcc::scoped_timer timer(gcc::PHASE_LINK);
+    const uintptr_t page = sysconf(_SC_PAGESIZE);
+    std::vector<std::string> slots, stubs;
+    uintptr_t text = 0, data;
+
+    /* the offsets of everything first, from 0 */
+    for (const gcc::x86::object_t& object : objects_) {
+        text = align(text, 16);
+        placements_.push_back({ text, 0, 0 });
+        text += object.text.size();
+    }
+
+    for (const gcc::x86::object_t& object : objects_) {
+        for (const gcc::x86::object_symbol_t& sym : object.symbols) {
+            if (sym.section == gcc::x86::SECTION_UNDEF || sym.local)
+                continue;
+
+            if (!globals_.emplace(sym.name, 0).second) {
+                ERROR("Multiple definitions of %s\n", sym.name.c_str());
+                return GCC_INVALID_VALUE;
+            }
+        }
+    }
+
+    for (const gcc::x86::object_t& object : objects_) {
+        for (const gcc::x86::reloc_t& reloc : object.relocs) {
+            const gcc::x86::object_symbol_t& sym = object.symbols[reloc.symbol];
+            bool library = sym.section == gcc::x86::SECTION_UNDEF && !globals_.count(sym.name);
+
+            if (library && !externals_.count(sym.name)) {
+                void *addr = dlsym(RTLD_DEFAULT, sym.name.c_str());
+
+                if (!addr) {
+                    ERROR("Undefined symbol %s\n", sym.name.c_str());
+                    return GCC_INVALID_VALUE;
+                }
+
+                externals_.emplace(sym.name, (uintptr_t)addr);
+            }
+
+            if ((reloc.kind == gcc::x86::RELOC_GOTPCREL || (reloc.kind == gcc::x86::RELOC_PLT32 && library)) &&
+                slots_.emplace(sym.name, slots.size()).second)
+                slots.push_back(sym.name);
+
+            if (reloc.kind == gcc::x86::RELOC_PLT32 && library && stubs_.emplace(sym.name, stubs.size()).second)
+                stubs.push_back(sym.name);
+        }
+    }
+
+    text = align(text, 16);
+
+    uintptr_t stub_base = text;
+    uintptr_t got_base  = align(text + stubs.size() * STUB_SIZE, page);
+
+    data = got_base + slots.size() * 8;
+
+    for (size_t i = 0; i < objects_.size(); ++i) {
+        data = align(data, 16);
+        placements_[i].data = data;
+        data += objects_[i].data.size();
+    }
+
+    for (size_t i = 0; i < objects_.size(); ++i) {
+        data = align(data, 16);
+        placements_[i].bss = data;
+        data += objects_[i].bss;
+    }
+
+    size_ = align(std::max<uintptr_t>(data, 1), page);
+    base_ = (uint8_t *)mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (base_ == MAP_FAILED) {
+        ERROR("Failed to map %zu bytes: %s\n", size_, strerror(errno));
+        base_ = nullptr;
+        return GCC_INVALID_VALUE;
+    }
+
+    /* now the addresses, the bss is zero already */
+    for (size_t i = 0; i < objects_.size(); ++i) {
+        placement_t& at = placements_[i];
+
+        at.text += (uintptr_t)base_;
+        at.data += (uintptr_t)base_;
+        at.bss  += (uintptr_t)base_;
+
+        memcpy((void *)at.text, objects_[i].text.data(), objects_[i].text.size());
+        memcpy((void *)at.data, objects_[i].data.data(), objects_[i].data.size());
+    }
+
+    for (auto& global : globals_)
+        global.second = 0;
+
+    for (size_t i = 0; i < objects_.size(); ++i) {
+        const gcc::x86::object_t& object = objects_[i];
+
+        for (uint32_t k = 0; k < object.symbols.size(); ++k) {
+            if (object.symbols[k].section != gcc::x86::SECTION_UNDEF && !object.symbols[k].local)
+                globals_[object.symbols[k].name] = address(i, k);
+        }
+    }
+
+    for (auto& slot : slots_) {
+        uintptr_t addr = globals_.count(slot.first) ? globals_[slot.first] : externals_[slot.first];
+
+        slot.second = (uintptr_t)base_ + got_base + slot.second * 8;
+        memcpy((void *)slot.second, &addr, 8);
+    }
+
+    for (auto& stub : stubs_) {
+        uint8_t *at = base_ + stub_base + stub.second * STUB_SIZE;
+        int32_t disp = slots_[stub.first] - (uintptr_t)(at + 6);
+
+        at[0] = 0xff;
+        at[1] = 0x25;
+        memcpy(at + 2, &disp, 4);
+        at[6] = at[7] = 0xcc;
+
+        stub.second = (uintptr_t)at;
+    }
+
+    for (size_t i = 0; i < objects_.size(); ++i) {
+        const gcc::x86::object_t& object = objects_[i];
+
+        for (const gcc::x86::reloc_t& reloc : object.relocs) {
+            const std::string& name = object.symbols[reloc.symbol].name;
+            uintptr_t place = placements_[i].text + reloc.offset;
+            uintptr_t target;
+
+            if (reloc.kind == gcc::x86::RELOC_GOTPCREL)
+                target = slots_[name];
+            else if (reloc.kind == gcc::x86::RELOC_PLT32 && stubs_.count(name) &&
+                     object.symbols[reloc.symbol].section == gcc::x86::SECTION_UNDEF)
+                target = stubs_[name];
+            else
+                target = address(i, reloc.symbol);
+
+            int64_t value = (int64_t)(target + reloc.addend - place);
+
+            if (value != (int32_t)value) {
+                ERROR("Relocation against %s out of range\n", name.c_str());
+                return GCC_INVALID_VALUE;
+            }
+
+            int32_t field = value;
+
+            memcpy((void *)place, &field, 4);
+        }
+    }
+
+    if (mprotect(base_, got_base, PROT_READ | PROT_EXEC) != 0) {
+        ERROR("Failed to make code executable: %s\n", strerror(errno));
+        return GCC_INVALID_VALUE;
+    }
+
+    /* only the addresses are needed from now on */
+    objects_.clear();
+
+    return GCC_SUCCESS;
+}
@@ -0,0 +1,66 @@
+#ifndef __JIT_HH__
+#define __JIT_HH__
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "encoder.hh"
+#include "util/error.hh"
+
+namespace gcc {
+
+    /* Runs generated code in the compiling process.
+     *
+     * Objects of gcc::x86::encoder are placed in one anonymous mapping:
+     * the code of every object, then a stub per function of a library,
+     * then on their own pages the GOT, the data and the bss. References
+     * are resolved as a static linker would: a symbol defined in the same
+     * object first, then a global one of any object, then whatever the
+     * libraries the process has loaded export (libc, through dlsym()).
+     * Calls reach library functions through a stub jumping via the GOT
+     * since they may be out of range of a 32-bit displacement. Once
+     * linked the code is executable and no longer writable, and stays
+     * mapped as long as the jit lives. */
+    class jit {
+        public:
+            jit();
+            ~jit();
+
+            /* take the code and data of object, before link() */
+            void add(gcc::x86::object_t&& object);
+
+            gcc_error_t link();
+
+            /* address of the global symbol name after link(), nullptr if no object defines it */
+            void *lookup(const char *name) const;
+
+        private:
+            jit(const jit&);
+            jit& operator=(const jit&);
+
+            /* where an object's sections went */
+            typedef struct placement {
+                uintptr_t text;
+                uintptr_t data;
+                uintptr_t bss;
+            } placement_t;
+
+            /* address of symbol index of object, 0 if it's from a library not found */
+            uintptr_t address(size_t object, uint32_t index) const;
+
+            std::vector<gcc::x86::object_t> objects_;
+            std::vector<placement_t> placements_;
+            std::unordered_map<std::string, uintptr_t> globals_;    /* defined by the objects */
+            std::unordered_map<std::string, uintptr_t> externals_;  /* from the libraries */
+            std::unordered_map<std::string, uintptr_t> slots_;      /* GOT entries by symbol */
+            std::unordered_map<std::string, uintptr_t> stubs_;      /* by library function */
+
+            uint8_t *base_;
+            size_t size_;
+    };
+};
+
+#endif /* __JIT_HH__ */
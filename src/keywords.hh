@@ -0,0 +1,138 @@
+#ifndef __KEYWORDS_HH__
+#define __KEYWORDS_HH__
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include "token.hh"
+
+namespace gcc {
+
+    /* Perfect hash over the reserved words.
+     *
+     * The slot of a keyword is computed from its length, first, middle
+     * and last character so every identifier costs one hash and at most
+     * one memcmp. The table below was laid out by searching for the
+     * smallest multipliers that give a collision-free mapping into
+     * KEYWORD_SLOTS entries and the layout is verified at compile time,
+     * so adding a keyword without rehashing fails the build. */
+    enum {
+        KEYWORD_SLOTS = 128,
+        KEYWORD_MAX   = 8,
+    };
+
+    typedef struct keyword {
+        const char *s;
+        uint8_t len;
+        token_type_t type;
+    } keyword_t;
+
+    static constexpr unsigned keyword_hash(const char *s, size_t len)
+    {
+        return ((unsigned char)s[0]       * 2  +
+                (unsigned char)s[len / 2] * 2  +
+                (unsigned char)s[len - 1] * 36 +
+                (unsigned)len) & (KEYWORD_SLOTS - 1);
+    }
+
+    static constexpr keyword_t __keywords[KEYWORD_SLOTS] = {
+            { "", 0, TT_IDENTIFIER },                { "int", 3, TT_INT },
+            { "", 0, TT_IDENTIFIER },                { "", 0, TT_IDENTIFIER },
+            { "", 0, TT_IDENTIFIER },                { "", 0, TT_IDENTIFIER },
+            { "size_t", 6, TT_SIZET },               { "", 0, TT_IDENTIFIER },
+            { "", 0, TT_IDENTIFIER },                { "", 0, TT_IDENTIFIER },
+            { "", 0, TT_IDENTIFIER },                { "int16_t", 7, TT_I16 },
+            { "enum", 4, TT_ENUM },                  { "", 0, TT_IDENTIFIER },
+            { "sizeof", 6, TT_SIZEOF },              { "int32_t", 7, TT_I32 },
+            { "volatile", 8, TT_VOLATILE },          { "typedef", 7, TT_TYPEDEF },
+            { "extern", 6, TT_EXTERN },              { "", 0, TT_IDENTIFIER },
+            { "char", 4, TT_CHAR },                  { "int64_t", 7, TT_I64 },
+            { "", 0, TT_IDENTIFIER },                { "", 0, TT_IDENTIFIER },
+            { "int8_t", 6, TT_I8 },                  { "short", 5, TT_SHORT },
+            { "", 0, TT_IDENTIFIER },                { "", 0, TT_IDENTIFIER },
+            { "", 0, TT_IDENTIFIER },                { "", 0, TT_IDENTIFIER },
+            { "", 0, TT_IDENTIFIER },                { "break", 5, TT_BREAK },
+            { "restrict", 8, TT_RESTRICT },          { "", 0, TT_IDENTIFIER },
+            { "", 0, TT_IDENTIFIER },                { "", 0, TT_IDENTIFIER },
+            { "uint16_t", 8, TT_U16 },               { "", 0, TT_IDENTIFIER },
+            { "struct", 6, TT_STRUCT },              { "", 0, TT_IDENTIFIER },
+            { "uint32_t", 8, TT_U32 },               { "uint8_t", 7, TT_U8 },
+            { "", 0, TT_IDENTIFIER },                { "", 0, TT_IDENTIFIER },
+            { "", 0, TT_IDENTIFIER },                { "", 0, TT_IDENTIFIER },
+            { "uint64_t", 8, TT_U64 },               { "", 0, TT_IDENTIFIER },
+            { "", 0, TT_IDENTIFIER },                { "", 0, TT_IDENTIFIER },
+            { "", 0, TT_IDENTIFIER },                { "", 0, TT_IDENTIFIER },
+            { "long", 4, TT_LONG },                  { "for", 3, TT_FOR },
+            { "", 0, TT_IDENTIFIER },                { "", 0, TT_IDENTIFIER },
+            { "", 0, TT_IDENTIFIER },                { "union", 5, TT_UNION },
+            { "", 0, TT_IDENTIFIER },                { "", 0, TT_IDENTIFIER },
+            { "", 0, TT_IDENTIFIER },                { "", 0, TT_IDENTIFIER },
+            { "", 0, TT_IDENTIFIER },                { "", 0, TT_IDENTIFIER },
+            { "static", 6, TT_STATIC },              { "", 0, TT_IDENTIFIER },
+            { "", 0, TT_IDENTIFIER },                { "", 0, TT_IDENTIFIER },
+            { "do", 2, TT_DO },                      { "", 0, TT_IDENTIFIER },
+            { "double", 6, TT_DOUBLE },              { "", 0, TT_IDENTIFIER },
+            { "", 0, TT_IDENTIFIER },                { "", 0, TT_IDENTIFIER },
+            { "", 0, TT_IDENTIFIER },                { "", 0, TT_IDENTIFIER },
+            { "return", 6, TT_RETURN },              { "", 0, TT_IDENTIFIER },
+            { "", 0, TT_IDENTIFIER },                { "", 0, TT_IDENTIFIER },
+            { "unsigned", 8, TT_UNSIGNED },          { "", 0, TT_IDENTIFIER },
+            { "void", 4, TT_VOID },                  { "", 0, TT_IDENTIFIER },
+            { "continue", 8, TT_CONTINUE },          { "", 0, TT_IDENTIFIER },
+            { "goto", 4, TT_GOTO },                  { "", 0, TT_IDENTIFIER },
+            { "signed", 6, TT_SIGNED },              { "", 0, TT_IDENTIFIER },
+            { "register", 8, TT_REGISTER },          { "", 0, TT_IDENTIFIER },
+            { "", 0, TT_IDENTIFIER },                { "", 0, TT_IDENTIFIER },
+            { "inline", 6, TT_INLINE },              { "", 0, TT_IDENTIFIER },
+            { "", 0, TT_IDENTIFIER },                { "default", 7, TT_DEFAULT },
+            { "", 0, TT_IDENTIFIER },                { "", 0, TT_IDENTIFIER },
+            { "case", 4, TT_CASE },                  { "", 0, TT_IDENTIFIER },
+            { "", 0, TT_IDENTIFIER },                { "", 0, TT_IDENTIFIER },
+            { "else", 4, TT_ELSE },                  { "", 0, TT_IDENTIFIER },
+            { "", 0, TT_IDENTIFIER },                { "", 0, TT_IDENTIFIER },
+            { "", 0, TT_IDENTIFIER },                { "", 0, TT_IDENTIFIER },
+            { "", 0, TT_IDENTIFIER },                { "", 0, TT_IDENTIFIER },
+            { "", 0, TT_IDENTIFIER },                { "", 0, TT_IDENTIFIER },
+            { "", 0, TT_IDENTIFIER },                { "", 0, TT_IDENTIFIER },
+            { "switch", 6, TT_SWITCH },              { "", 0, TT_IDENTIFIER },
+            { "", 0, TT_IDENTIFIER },                { "const", 5, TT_CONST },
+            { "if", 2, TT_IF },                      { "while", 5, TT_WHILE },
+            { "", 0, TT_IDENTIFIER },                { "", 0, TT_IDENTIFIER },
+            { "", 0, TT_IDENTIFIER },                { "", 0, TT_IDENTIFIER },
+            { "", 0, TT_IDENTIFIER },                { "float", 5, TT_FLOAT },
+    };
+
+    static constexpr size_t __keyword_count(size_t i)
+    {
+        return i == KEYWORD_SLOTS ? 0 :
+               (__keywords[i].len != 0) + __keyword_count(i + 1);
+    }
+
+    static constexpr bool __keyword_slots_valid(size_t i)
+    {
+        return i == KEYWORD_SLOTS ||
+               ((__keywords[i].len == 0 ||
+                 (__keywords[i].len <= KEYWORD_MAX &&
+                  keyword_hash(__keywords[i].s, __keywords[i].len) == i)) &&
+                __keyword_slots_valid(i + 1));
+    }
+
+    static_assert(__keyword_count(0) == 42, "keyword missing from the hash table");
+    static_assert(__keyword_slots_valid(0), "keyword stored in the wrong hash slot");
+
+    /* return the keyword token type for s[0..len) or TT_IDENTIFIER */
+    static inline token_type_t keyword_lookup(const char *s, size_t len)
+    {
+        if (len < 2 || len > KEYWORD_MAX)
+            return TT_IDENTIFIER;
+
+        const keyword_t& kw = __keywords[keyword_hash(s, len)];
+
+        if (kw.len != len || memcmp(kw.s, s, len))
+            return TT_IDENTIFIER;
+        return kw.type;
+    }
+};
+
+#endif /* __KEYWORDS_HH__ */
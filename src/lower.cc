@@ -0,0 +1,1376 @@
+#include <algorithm>
+#include <cstring>
+
+#include "lower.hh"
+#include "stats.hh"
+#include "util/log.hh"
+
+#define CHANNEL "lower"
+
+/* the parser never leaves out a child a node needs, a loaded .ast might */
+static const char missing[] = "malformed AST, a node is missing a child";
+
+gcc::ir::lowering::lowering():
+    prog_(nullptr),
+    module_(nullptr),
+    fn_(nullptr),
+    ret_(),
+    ok_(true),
+    cur_(0),
+    locals_(),
+    names_(),
+    bindings_(),
+    addressed_(),
+    defs_(),
+    sealed_(),
+    incomplete_(),
+    forward_(),
+    loops_()
+{
+}
+
+gcc::ir::lowering::~lowering()
+{
+}
+
+static bool by_name(gcc::symbol_t a, gcc::symbol_t b)
+{
+    return strcmp(gcc::symbol_str(a), gcc::symbol_str(b)) < 0;
+}
+
+gcc_error_t gcc::ir::lowering::run(const gcc::prog_t& prog, gcc::ir::module& module)
+{
+    gcc::scoped_timer timer(gcc::PHASE_LOWER);
+    std::vector<const gcc::func_t *> functions;
+    std::vector<const gcc::var_t *> globals;
+    gcc_error_t ret = GCC_SUCCESS;
+
+    prog_   = &prog;
+    module_ = &module;
+
+    /* what the unit declares itself shadows the prelude */
+    for (const gcc::prog_t *p = &prog; p; p = p->prelude) {
+        for (const auto& kv : p->functions) {
+            if (kv.second.node.body && prog.find_function(kv.first) == &kv.second)
+                functions.push_back(&kv.second);
+        }
+
+        for (const auto& kv : p->globals) {
+            if (prog.find_global(kv.first) == &kv.second)
+                globals.push_back(&kv.second);
+        }
+    }
+
+    /* hash order isn't stable, names are */
+    std::sort(functions.begin(), functions.end(), [](const gcc::func_t *a, const gcc::func_t *b) {
+        return by_name(a->name, b->name);
+    });
+    std::sort(globals.begin(), globals.end(), [](const gcc::var_t *a, const gcc::var_t *b) {
+        return by_name(a->name, b->name);
+    });
+
+    for (const gcc::var_t *var : globals) {
+        if (lower_global(*var) != GCC_SUCCESS)
+            ret = GCC_INVALID_VALUE;
+    }
+
+    for (const gcc::func_t *func : functions) {
+        if (lower_function(*func) != GCC_SUCCESS)
+            ret = GCC_INVALID_VALUE;
+    }
+
+    return ret;
+}
+
+bool gcc::ir::lowering::make_type(const gcc::type_t& type, ctype_t& out)
+{
+    ctype_t base = { 0, true, false, 0, false };
+
+    switch (type.type) {
+        case TT_VOID:  base.size = 0; break;
+        case TT_CHAR:  base.size = 1; break;
+        case TT_SHORT: base.size = 2; break;
+        case TT_INT:   base.size = 4; break;
+        case TT_LONG:  base.size = 8; break;
+        case TT_I8:    base.size = 1; break;
+        case TT_I16:   base.size = 2; break;
+        case TT_I32:   base.size = 4; break;
+        case TT_I64:   base.size = 8; break;
+        case TT_U8:    base.size = 1; base.sgn = false; break;
+        case TT_U16:   base.size = 2; base.sgn = false; break;
+        case TT_U32:   base.size = 4; base.sgn = false; break;
+        case TT_U64:   base.size = 8; base.sgn = false; break;
+        case TT_SIZET: base.size = 8; base.sgn = false; break;
+
+        default:
+            return false;
+    }
+
+    if (type.unsgnd)
+        base.sgn = false;
+
+    if (type.ptr)
+        out = { 8, false, true, base.size, base.sgn };
+    else
+        out = base;
+
+    return true;
+}
+
+uint8_t gcc::ir::lowering::ir_type(const ctype_t& t)
+{
+    switch (t.size) {
+        case 1:  return TYPE_I8;
+        case 2:  return TYPE_I16;
+        case 4:  return TYPE_I32;
+        case 8:  return TYPE_I64;
+        default: return TYPE_VOID;
+    }
+}
+
+bool gcc::ir::lowering::eval(const gcc::node_t *node, int64_t& out)
+{
+    int64_t l, r;
+
+    if (!node)
+        return false;
+
+    switch (node->type) {
+        case TT_DIGIT:
+            out = node->value;
+            return true;
+
+        case TT_CAST:
+            return eval(node->l, out);
+
+        case TT_QMARK:
+            if (!eval(node->cond, l))
+                return false;
+            return eval(l ? node->then : node->els, out);
+
+        default:
+            break;
+    }
+
+    if (!node->l || !eval(node->l, l))
+        return false;
+
+    if (!node->r) {
+        switch (node->type) {
+            case TT_MINUS:       out = -l;  return true;
+            case TT_PLUS:        out = l;   return true;
+            case TT_ANOT:        out = ~l;  return true;
+            case TT_EXCLAMATION: out = !l;  return true;
+            default:             return false;
+        }
+    }
+
+    if (!eval(node->r, r))
+        return false;
+
+    switch (node->type) {
+        case TT_PLUS:       out = l + r;  return true;
+        case TT_MINUS:      out = l - r;  return true;
+        case TT_STAR:       out = l * r;  return true;
+        case TT_DIV:        out = r ? l / r : 0; return r != 0;
+        case TT_MOD:        out = r ? l % r : 0; return r != 0;
+        case TT_AND:        out = l & r;  return true;
+        case TT_OR:         out = l | r;  return true;
+        case TT_XOR:        out = l ^ r;  return true;
+        case TT_LSHIFT:     out = l << (r & 63); return true;
+        case TT_RSHIFT:     out = l >> (r & 63); return true;
+        case TT_EQUAL:      out = l == r; return true;
+        case TT_NOT_EQUAL:  out = l != r; return true;
+        case TT_LTHAN:      out = l < r;  return true;
+        case TT_GTHAN:      out = l > r;  return true;
+        case TT_EQ_SMALLER: out = l <= r; return true;
+        case TT_EQ_LARGER:  out = l >= r; return true;
+        case TT_AND_EXP:    out = l && r; return true;
+        case TT_OR_EXP:     out = l || r; return true;
+        default:            return false;
+    }
+}
+
+gcc_error_t gcc::ir::lowering::lower_global(const gcc::var_t& var)
+{
+    int64_t init = 0;
+    ctype_t t;
+
+    if (!make_type(var.type, t) || t.size == 0) {
+        ERROR("global %s has a type that can't be lowered\n", gcc::symbol_str(var.name));
+        return GCC_INVALID_VALUE;
+    }
+
+    if (var.init && !eval(var.init, init)) {
+        ERROR("initializer of global %s isn't constant\n", gcc::symbol_str(var.name));
+        return GCC_INVALID_VALUE;
+    }
+
+    module_->globals.push_back({ var.name, ir_type(t), !var.type.xtrn, var.type.sttc, sext(ir_type(t), init) });
+    return GCC_SUCCESS;
+}
+
+void gcc::ir::lowering::find_addressed(const gcc::node_t *node)
+{
+    if (!node)
+        return;
+
+    if (node->type == TT_AND && !node->r && node->l && node->l->type == TT_IDENTIFIER)
+        addressed_.push_back(node->l->sym);
+
+    find_addressed(node->l);
+    find_addressed(node->r);
+    find_addressed(node->body);
+    find_addressed(node->cond);
+    find_addressed(node->then);
+    find_addressed(node->els);
+
+    for (const gcc::node_t *child : node->statements)
+        find_addressed(child);
+}
+
+gcc_error_t gcc::ir::lowering::lower_function(const gcc::func_t& func)
+{
+    ok_ = true;
+    locals_.clear();
+    names_.clear();
+    bindings_.clear();
+    addressed_.clear();
+    defs_.clear();
+    sealed_.clear();
+    incomplete_.clear();
+    forward_.clear();
+    loops_.clear();
+
+    if (!make_type(func.ret_type, ret_)) {
+        ERROR("%s(): return type can't be lowered\n", gcc::symbol_str(func.name));
+        return GCC_INVALID_VALUE;
+    }
+
+    fn_ = module_->add_function(func.name, ir_type(ret_));
+    fn_->local = func.ret_type.sttc;
+    find_addressed(func.node.body);
+
+    cur_ = new_block();
+    seal(cur_);
+
+    for (uint32_t i = 0; i < func.params.size(); ++i) {
+        auto it = func.args.find(func.params[i]);
+        ctype_t t;
+
+        if (!make_type(it->second.type, t) || t.size == 0) {
+            fail("parameter type can't be lowered");
+            break;
+        }
+
+        value_t param = fn_->add(cur_, OP_PARAM, ir_type(t), NONE, NONE, i);
+        uint32_t var  = declare(func.params[i], t);
+
+        fn_->params.push_back(param);
+
+        if (it->second.type.rstrct && i < 64)
+            fn_->noalias |= 1ull << i;
+
+        store({ locals_[var].slot == NONE ? var : (uint32_t)NONE, locals_[var].slot, t }, param);
+    }
+
+    if (ok_ && statement(func.node.body)) {
+        /* falling off the end, main() returns 0 */
+        if (ret_.size == 0)
+            fn_->add(cur_, OP_RET, TYPE_VOID);
+        else
+            fn_->add(cur_, OP_RET, TYPE_VOID, constant(0, ret_).v);
+    }
+
+    if (!ok_)
+        return GCC_INVALID_VALUE;
+
+    finish();
+    fn_->compact();
+
+    return GCC_SUCCESS;
+}
+
+gcc::ir::lowering::rvalue_t gcc::ir::lowering::fail(const char *what)
+{
+    /* only the first problem of a function, the rest may follow from it */
+    if (ok_)
+        ERROR("%s(): %s\n", gcc::symbol_str(fn_->name), what);
+
+    ok_ = false;
+    return { NONE, { 0, false, false, 0, false } };
+}
+
+void gcc::ir::lowering::leave(size_t mark)
+{
+    while (bindings_.size() > mark) {
+        const binding_t& binding = bindings_.back();
+
+        if (binding.prev == NONE)
+            names_.erase(binding.sym);
+        else
+            names_[binding.sym] = binding.prev;
+
+        bindings_.pop_back();
+    }
+}
+
+uint32_t gcc::ir::lowering::declare(gcc::symbol_t sym, const ctype_t& t)
+{
+    uint32_t var = (uint32_t)locals_.size();
+    value_t slot = NONE;
+    auto it      = names_.find(sym);
+
+    /* slots are allocated once, in the entry block */
+    if (std::find(addressed_.begin(), addressed_.end(), sym) != addressed_.end())
+        slot = fn_->insert(0, 0, OP_SLOT, TYPE_I64, NONE, NONE, t.size);
+
+    locals_.push_back({ t, slot });
+    bindings_.push_back({ sym, it == names_.end() ? (uint32_t)NONE : it->second });
+    names_[sym] = var;
+
+    return var;
+}
+
+uint32_t gcc::ir::lowering::new_block()
+{
+    sealed_.push_back(0);
+    incomplete_.emplace_back();
+
+    return fn_->add_block();
+}
+
+void gcc::ir::lowering::seal(uint32_t block)
+{
+    /* completing a phi can create more incomplete phis in other blocks only */
+    for (size_t i = 0; i < incomplete_[block].size(); ++i) {
+        std::pair<uint32_t, value_t> phi = incomplete_[block][i];
+
+        add_phi_operands(phi.first, phi.second);
+        try_remove_trivial(phi.second);
+    }
+
+    incomplete_[block].clear();
+    sealed_[block] = 1;
+}
+
+void gcc::ir::lowering::write_var(uint32_t var, uint32_t block, value_t value)
+{
+    defs_[(uint64_t)var << 32 | block] = value;
+}
+
+gcc::ir::value_t gcc::ir::lowering::read_var(uint32_t var, uint32_t block)
+{
+    auto it = defs_.find((uint64_t)var << 32 | block);
+
+    if (it != defs_.end())
+        return resolve(it->second);
+
+    return read_var_slow(var, block);
+}
+
+gcc::ir::value_t gcc::ir::lowering::read_var_slow(uint32_t var, uint32_t block)
+{
+    const gcc::ir::block_t& b = fn_->blocks[block];
+    uint8_t type = ir_type(locals_[var].t);
+    value_t value;
+
+    if (!sealed_[block]) {
+        value = fn_->add_variadic(block, OP_PHI, type, 0);
+        incomplete_[block].push_back({ var, value });
+    } else if (b.preds.empty()) {
+        /* read before any assignment, or in dead code */
+        value = undef(type);
+    } else if (b.preds.size() == 1) {
+        value = read_var(var, b.preds[0]);
+    } else {
+        /* the phi breaks cycles through loops */
+        value = fn_->add_variadic(block, OP_PHI, type, 0);
+        write_var(var, block, value);
+        add_phi_operands(var, value);
+        value = try_remove_trivial(value);
+    }
+
+    write_var(var, block, value);
+    return value;
+}
+
+void gcc::ir::lowering::add_phi_operands(uint32_t var, value_t phi)
+{
+    uint32_t block = fn_->insts[phi].block;
+    uint32_t count = (uint32_t)fn_->blocks[block].preds.size();
+    value_t first  = (value_t)fn_->operands.size();
+
+    /* reading the predecessors may add instructions and operands */
+    fn_->operands.resize(first + count, NONE);
+    fn_->insts[phi].arg[0] = first;
+    fn_->insts[phi].arg[1] = count;
+
+    for (uint32_t i = 0; i < count; ++i) {
+        value_t value = read_var(var, fn_->blocks[block].preds[i]);
+        fn_->operands[first + i] = value;
+    }
+}
+
+gcc::ir::value_t gcc::ir::lowering::try_remove_trivial(value_t phi)
+{
+    const inst_t& inst = fn_->insts[phi];
+    value_t same = NONE;
+
+    for (uint32_t i = 0; i < inst.arg[1]; ++i) {
+        value_t op = resolve(fn_->operand(inst, i));
+
+        if (op == same || op == phi)
+            continue;
+
+        /* merges at least two values */
+        if (same != NONE)
+            return phi;
+
+        same = op;
+    }
+
+    if (same == NONE)
+        same = undef(fn_->insts[phi].type);
+
+    if (forward_.size() <= phi)
+        forward_.resize(fn_->insts.size(), NONE);
+
+    forward_[phi] = same;
+    fn_->remove(phi);
+
+    return same;
+}
+
+gcc::ir::value_t gcc::ir::lowering::resolve(value_t value)
+{
+    while (value < forward_.size() && forward_[value] != NONE)
+        value = forward_[value];
+
+    return value;
+}
+
+gcc::ir::value_t gcc::ir::lowering::undef(uint8_t type)
+{
+    return fn_->insert(0, 0, OP_UNDEF, type);
+}
+
+/* A phi removed while its users were being built may have left other
+ * phis trivial, they're forwarded here until nothing changes, then every
+ * use is renamed at once. */
+void gcc::ir::lowering::finish()
+{
+    bool changed = true;
+
+    while (changed) {
+        changed = false;
+
+        for (value_t v = 0; v < fn_->insts.size(); ++v) {
+            if (fn_->insts[v].op == OP_PHI && try_remove_trivial(v) != v)
+                changed = true;
+        }
+    }
+
+    forward_.resize(fn_->insts.size(), NONE);
+    fn_->replace(forward_);
+}
+
+void gcc::ir::lowering::unreachable()
+{
+    cur_ = new_block();
+    seal(cur_);
+}
+
+bool gcc::ir::lowering::statement(const gcc::node_t *node)
+{
+    if (!node) {
+        fail(missing);
+        return false;
+    }
+
+    switch (node->type) {
+        case TT_LCURLY:
+        {
+            size_t mark = enter();
+
+            for (const gcc::node_t *stmt : node->statements) {
+                if (!statement(stmt))
+                    return false;
+            }
+
+            leave(mark);
+            return true;
+        }
+
+        case TT_DECL:
+            return declaration(node);
+
+        case TT_IF:
+        {
+            uint32_t then = new_block();
+            uint32_t els  = node->els ? new_block() : NONE;
+            uint32_t join = new_block();
+
+            if (!condition(node->cond, then, node->els ? els : join))
+                return false;
+
+            seal(then);
+            cur_ = then;
+
+            if (!statement(node->then))
+                return false;
+
+            fn_->jump(cur_, join);
+
+            if (node->els) {
+                seal(els);
+                cur_ = els;
+
+                if (!statement(node->els))
+                    return false;
+
+                fn_->jump(cur_, join);
+            }
+
+            seal(join);
+            cur_ = join;
+            return true;
+        }
+
+        case TT_WHILE:
+        case TT_DO:
+        case TT_FOR:
+            return loop(node);
+
+        case TT_RETURN:
+            if (node->l) {
+                rvalue_t value = expr(node->l);
+
+                if (!ok_)
+                    return false;
+
+                if (ret_.size == 0) {
+                    fn_->add(cur_, OP_RET, TYPE_VOID);
+                } else {
+                    value = convert(value, ret_);
+                    fn_->add(cur_, OP_RET, TYPE_VOID, value.v);
+                }
+            } else {
+                fn_->add(cur_, OP_RET, TYPE_VOID, ret_.size ? undef(ir_type(ret_)) : NONE);
+            }
+
+            unreachable();
+            return ok_;
+
+        case TT_BREAK:
+        case TT_CONTINUE:
+            if (loops_.empty()) {
+                fail(node->type == TT_BREAK ? "break outside of a loop" : "continue outside of a loop");
+                return false;
+            }
+
+            fn_->jump(cur_, node->type == TT_BREAK ? loops_.back().first : loops_.back().second);
+            unreachable();
+            return true;
+
+        case TT_SEMICOLON:
+            return true;
+
+        default:
+            expr(node);
+            return ok_;
+    }
+}
+
+bool gcc::ir::lowering::declaration(const gcc::node_t *node)
+{
+    gcc::type_t type = gcc::unpack_type(node->value);
+    ctype_t t;
+
+    if (type.sttc || type.xtrn) {
+        fail("static and extern locals aren't supported");
+        return false;
+    }
+
+    if (!make_type(type, t) || t.size == 0) {
+        fail("type of local can't be lowered");
+        return false;
+    }
+
+    for (const gcc::node_t *var : node->statements) {
+        if (!var) {
+            fail(missing);
+            return false;
+        }
+
+        uint32_t id = declare(var->sym, t);
+        lvalue_t lv = { locals_[id].slot == NONE ? id : (uint32_t)NONE, locals_[id].slot, t };
+
+        if (var->l) {
+            rvalue_t init = expr(var->l);
+
+            if (!ok_)
+                return false;
+
+            store(lv, convert(init, t).v);
+        } else if (lv.var != NONE) {
+            /* a fresh value each time a loop comes back here */
+            write_var(id, cur_, undef(ir_type(t)));
+        }
+    }
+
+    return ok_;
+}
+
+bool gcc::ir::lowering::loop(const gcc::node_t *node)
+{
+    size_t mark = enter();
+
+    if (node->type == TT_DO) {
+        uint32_t body = new_block();
+        uint32_t next = new_block();
+        uint32_t exit = new_block();
+
+        fn_->jump(cur_, body);
+        cur_ = body;
+        loops_.push_back({ exit, next });
+
+        if (!statement(node->body))
+            return false;
+
+        loops_.pop_back();
+        fn_->jump(cur_, next);
+        seal(next);
+        cur_ = next;
+
+        if (!condition(node->cond, body, exit))
+            return false;
+
+        seal(body);
+        seal(exit);
+        cur_ = exit;
+        leave(mark);
+        return true;
+    }
+
+    if (node->type == TT_FOR && node->l) {
+        if (node->l->type == TT_DECL) {
+            if (!declaration(node->l))
+                return false;
+        } else if (expr(node->l), !ok_) {
+            return false;
+        }
+    }
+
+    uint32_t header = new_block();
+    uint32_t body   = new_block();
+    uint32_t step   = node->type == TT_FOR ? new_block() : header;
+    uint32_t exit   = new_block();
+
+    fn_->jump(cur_, header);
+    cur_ = header;
+
+    if (node->cond) {
+        if (!condition(node->cond, body, exit))
+            return false;
+    } else {
+        fn_->jump(cur_, body);
+    }
+
+    seal(body);
+    cur_ = body;
+    loops_.push_back({ exit, step });
+
+    if (!statement(node->body))
+        return false;
+
+    loops_.pop_back();
+    fn_->jump(cur_, step);
+
+    if (step != header) {
+        seal(step);
+        cur_ = step;
+
+        if (node->r && (expr(node->r), !ok_))
+            return false;
+
+        fn_->jump(cur_, header);
+    }
+
+    seal(header);
+    seal(exit);
+    cur_ = exit;
+    leave(mark);
+
+    return true;
+}
+
+bool gcc::ir::lowering::condition(const gcc::node_t *node, uint32_t t, uint32_t f)
+{
+    if (!node) {
+        fail(missing);
+        return false;
+    }
+
+    if ((node->type == TT_AND_EXP || node->type == TT_OR_EXP) && node->r) {
+        uint32_t next = new_block();
+
+        if (node->type == TT_AND_EXP ? !condition(node->l, next, f) : !condition(node->l, t, next))
+            return false;
+
+        seal(next);
+        cur_ = next;
+        return condition(node->r, t, f);
+    }
+
+    if (node->type == TT_EXCLAMATION && !node->r)
+        return condition(node->l, f, t);
+
+    rvalue_t value = expr(node);
+
+    if (ok_ && value.t.size == 0)
+        fail("void value used as a condition");
+
+    if (!ok_)
+        return false;
+
+    fn_->branch(cur_, value.v, t, f);
+    return true;
+}
+
+static const gcc::token_type_t compound_ops[][2] = {
+    { gcc::TT_ADD_ASSIGN,    gcc::TT_PLUS   },
+    { gcc::TT_SUB_ASSIGN,    gcc::TT_MINUS  },
+    { gcc::TT_MUL_ASSIGN,    gcc::TT_STAR   },
+    { gcc::TT_DIV_ASSIGN,    gcc::TT_DIV    },
+    { gcc::TT_MOD_ASSIGN,    gcc::TT_MOD    },
+    { gcc::TT_AND_ASSIGN,    gcc::TT_AND    },
+    { gcc::TT_OR_ASSIGN,     gcc::TT_OR     },
+    { gcc::TT_XOR_ASSIGN,    gcc::TT_XOR    },
+    { gcc::TT_LSHIFT_ASSIGN, gcc::TT_LSHIFT },
+    { gcc::TT_RSHIFT_ASSIGN, gcc::TT_RSHIFT },
+};
+
+gcc::ir::lowering::rvalue_t gcc::ir::lowering::expr(const gcc::node_t *node)
+{
+    static const ctype_t int_type  = { 4, true, false, 0, false };
+    static const ctype_t size_type = { 8, false, false, 0, false };
+
+    if (!ok_)
+        return fail("");
+
+    if (!node)
+        return fail(missing);
+
+    switch (node->type) {
+        case TT_DIGIT: {
+            ctype_t t = int_type;
+
+            t.size = node->flags & TF_LONG ? 8 : 4;
+            t.sgn  = !(node->flags & TF_UNSIGNED);
+            return constant(node->value, t);
+        }
+
+        case TT_IDENTIFIER:
+        case TT_INDEX:
+            return load(lexpr(node));
+
+        case TT_CALL:
+            return call(node);
+
+        case TT_QMARK:
+            return select(node);
+
+        case TT_AND_EXP:
+        case TT_OR_EXP:
+            return logical(node);
+
+        case TT_INCR:
+        case TT_DECR:
+            return increment(node, node->type == TT_INCR, false);
+
+        case TT_POST_INCR:
+        case TT_POST_DECR:
+            return increment(node, node->type == TT_POST_INCR, true);
+
+        case TT_COMMA:
+            expr(node->l);
+            return expr(node->r);
+
+        case TT_CAST:
+        {
+            rvalue_t value = expr(node->l);
+            ctype_t t;
+
+            if (!make_type(gcc::unpack_type(node->value), t))
+                return fail("cast to a type that can't be lowered");
+
+            if (t.size == 0)
+                return { NONE, t };
+
+            return convert(value, t);
+        }
+
+        case TT_SIZEOF:
+        {
+            ctype_t t;
+
+            if (node->l) {
+                /* the operand isn't evaluated, its code goes to a block nothing reaches */
+                uint32_t saved = cur_;
+
+                unreachable();
+                t = expr(node->l).t;
+                cur_ = saved;
+            } else if (!make_type(gcc::unpack_type(node->value), t)) {
+                return fail("sizeof a type that can't be lowered");
+            }
+
+            if (ok_ && t.size == 0)
+                return fail("sizeof void");
+
+            return constant(t.size, size_type);
+        }
+
+        case TT_ASSIGN:
+        {
+            lvalue_t lv    = lexpr(node->l);
+            rvalue_t value = expr(node->r);
+
+            if (!ok_)
+                return fail("");
+
+            value = convert(value, lv.t);
+            store(lv, value.v);
+            return value;
+        }
+
+        case TT_ADD_ASSIGN: case TT_SUB_ASSIGN: case TT_MUL_ASSIGN:
+        case TT_DIV_ASSIGN: case TT_MOD_ASSIGN: case TT_AND_ASSIGN:
+        case TT_OR_ASSIGN:  case TT_XOR_ASSIGN: case TT_LSHIFT_ASSIGN:
+        case TT_RSHIFT_ASSIGN:
+        {
+            token_type_t op = TT_INVALID;
+
+            for (const auto& pair : compound_ops) {
+                if (pair[0] == node->type)
+                    op = pair[1];
+            }
+
+            lvalue_t lv    = lexpr(node->l);
+            rvalue_t value = load(lv);
+            rvalue_t r     = expr(node->r);
+
+            if (!ok_)
+                return fail("");
+
+            value = convert(binary(op, value, r), lv.t);
+            store(lv, value.v);
+            return value;
+        }
+
+        case TT_DOT:
+        case TT_ARROW:
+            return fail("member access isn't supported");
+
+        default:
+            break;
+    }
+
+    /* unary forms of the operators */
+    if (!node->r) {
+        switch (node->type) {
+            case TT_STAR:
+                return load(lexpr(node));
+
+            case TT_AND:
+            {
+                lvalue_t lv = lexpr(node->l);
+
+                if (!ok_)
+                    return fail("");
+
+                if (lv.var != NONE || lv.addr == NONE)
+                    return fail("address of a value that isn't in memory");
+
+                if (lv.t.ptr)
+                    return fail("pointers to pointers aren't supported");
+
+                return { lv.addr, { 8, false, true, lv.t.size, lv.t.sgn } };
+            }
+
+            case TT_MINUS:
+            case TT_ANOT:
+            {
+                rvalue_t value = promote(expr(node->l));
+
+                if (!ok_)
+                    return fail("");
+
+                if (value.t.ptr)
+                    return fail("invalid operand to a unary operator");
+
+                return { fn_->add(cur_, node->type == TT_MINUS ? OP_NEG : OP_NOT, ir_type(value.t), value.v), value.t };
+            }
+
+            case TT_PLUS:
+                return promote(expr(node->l));
+
+            case TT_EXCLAMATION:
+            {
+                rvalue_t value = expr(node->l);
+
+                if (!ok_ || value.t.size == 0)
+                    return fail("void value used as an operand");
+
+                return binary(TT_EQUAL, value, constant(0, value.t));
+            }
+
+            default:
+                return fail("unsupported expression");
+        }
+    }
+
+    rvalue_t a = expr(node->l);
+    rvalue_t b = expr(node->r);
+
+    return binary(node->type, a, b);
+}
+
+gcc::ir::lowering::lvalue_t gcc::ir::lowering::lexpr(const gcc::node_t *node)
+{
+    static const lvalue_t error = { NONE, NONE, { 0, false, false, 0, false } };
+
+    if (!ok_)
+        return error;
+
+    if (!node) {
+        fail(missing);
+        return error;
+    }
+
+    if (node->type == TT_IDENTIFIER) {
+        auto it = names_.find(node->sym);
+
+        if (it != names_.end()) {
+            const local_t& local = locals_[it->second];
+
+            return { local.slot == NONE ? it->second : (uint32_t)NONE, local.slot, local.t };
+        }
+
+        const gcc::var_t *global = prog_->find_global(node->sym);
+        ctype_t t;
+
+        if (!global) {
+            fail(prog_->find_function(node->sym) ? "function designators aren't supported" : "undeclared identifier");
+            return error;
+        }
+
+        if (!make_type(global->type, t) || t.size == 0) {
+            fail("type of global can't be lowered");
+            return error;
+        }
+
+        return { NONE, fn_->add(cur_, OP_GLOBAL, TYPE_I64, NONE, NONE, node->sym), t };
+    }
+
+    rvalue_t ptr;
+
+    if (node->type == TT_STAR && !node->r) {
+        ptr = expr(node->l);
+    } else if (node->type == TT_INDEX) {
+        rvalue_t a = expr(node->l);
+        rvalue_t b = expr(node->r);
+
+        if (b.t.ptr)
+            std::swap(a, b);
+
+        ptr = a.t.ptr ? offset(a, b, false) : a;
+    } else {
+        fail("expression isn't assignable");
+        return error;
+    }
+
+    if (!ok_)
+        return error;
+
+    if (!ptr.t.ptr || ptr.t.elem == 0) {
+        fail(ptr.t.ptr ? "dereferencing a void pointer" : "dereferencing a value that isn't a pointer");
+        return error;
+    }
+
+    return { NONE, ptr.v, { ptr.t.elem, ptr.t.elem_sgn, false, 0, false } };
+}
+
+gcc::ir::lowering::rvalue_t gcc::ir::lowering::load(const lvalue_t& lv)
+{
+    if (!ok_)
+        return fail("");
+
+    if (lv.var != NONE)
+        return { read_var(lv.var, cur_), lv.t };
+
+    return { fn_->add(cur_, OP_LOAD, ir_type(lv.t), lv.addr), lv.t };
+}
+
+void gcc::ir::lowering::store(const lvalue_t& lv, value_t value)
+{
+    if (!ok_)
+        return;
+
+    if (lv.var != NONE)
+        write_var(lv.var, cur_, value);
+    else
+        fn_->add(cur_, OP_STORE, ir_type(lv.t), lv.addr, value);
+}
+
+gcc::ir::lowering::rvalue_t gcc::ir::lowering::call(const gcc::node_t *node)
+{
+    static const ctype_t int_type = { 4, true, false, 0, false };
+
+    if (!node->l)
+        return fail(missing);
+
+    if (node->l->type != TT_IDENTIFIER || names_.count(node->l->sym))
+        return fail("only functions can be called by name");
+
+    const gcc::func_t *func = prog_->find_function(node->l->sym);
+    std::vector<value_t> args;
+    ctype_t ret = int_type;
+
+    if (!func)
+        WARN("%s(): implicit declaration of %s()\n", gcc::symbol_str(fn_->name), gcc::symbol_str(node->l->sym));
+    else if (!make_type(func->ret_type, ret))
+        return fail("return type of callee can't be lowered");
+
+    for (size_t i = 0; i < node->statements.size; ++i) {
+        rvalue_t arg = expr(node->statements.data[i]);
+        ctype_t t;
+
+        if (func && i < func->params.size()) {
+            if (!make_type(func->args.find(func->params[i])->second.type, t))
+                return fail("parameter type of callee can't be lowered");
+            arg = convert(arg, t);
+        } else {
+            arg = promote(arg);
+        }
+
+        if (!ok_)
+            return fail("");
+
+        args.push_back(arg.v);
+    }
+
+    value_t value = fn_->add_variadic(cur_, OP_CALL, ir_type(ret), (uint32_t)args.size(), node->l->sym);
+
+    for (uint32_t i = 0; i < args.size(); ++i)
+        fn_->operand(fn_->insts[value], i) = args[i];
+
+    return { value, ret };
+}
+
+/* c ? a : b, each arm converts to the common type before joining */
+gcc::ir::lowering::rvalue_t gcc::ir::lowering::select(const gcc::node_t *node)
+{
+    uint32_t then = new_block();
+    uint32_t els  = new_block();
+    uint32_t join = new_block();
+
+    if (!condition(node->cond, then, els))
+        return fail("");
+
+    seal(then);
+    seal(els);
+
+    cur_ = then;
+    rvalue_t a = expr(node->then);
+    uint32_t a_end = cur_;
+
+    cur_ = els;
+    rvalue_t b = expr(node->els);
+    uint32_t b_end = cur_;
+
+    if (!ok_)
+        return fail("");
+
+    ctype_t t = a.t;
+
+    if (a.t.size == 0 || b.t.size == 0) {
+        t = { 0, false, false, 0, false };
+    } else if (b.t.ptr && !a.t.ptr) {
+        t = b.t;
+    } else if (!a.t.ptr) {
+        t = usual(a.t, b.t);
+    }
+
+    cur_ = a_end;
+    a = t.size ? convert(a, t) : a;
+    fn_->jump(cur_, join);
+
+    cur_ = b_end;
+    b = t.size ? convert(b, t) : b;
+    fn_->jump(cur_, join);
+
+    seal(join);
+    cur_ = join;
+
+    if (t.size == 0)
+        return { NONE, t };
+
+    value_t phi = fn_->add_variadic(join, OP_PHI, ir_type(t), 2);
+
+    fn_->operand(fn_->insts[phi], 0) = a.v;
+    fn_->operand(fn_->insts[phi], 1) = b.v;
+
+    return { phi, t };
+}
+
+/* && and || as values, 1 or 0 */
+gcc::ir::lowering::rvalue_t gcc::ir::lowering::logical(const gcc::node_t *node)
+{
+    static const ctype_t int_type = { 4, true, false, 0, false };
+
+    /* condition() only splits a node with both operands */
+    if (!node->r)
+        return fail(missing);
+
+    uint32_t t    = new_block();
+    uint32_t f    = new_block();
+    uint32_t join = new_block();
+
+    if (!condition(node, t, f))
+        return fail("");
+
+    seal(t);
+    seal(f);
+
+    cur_ = t;
+    value_t one = constant(1, int_type).v;
+    fn_->jump(t, join);
+
+    cur_ = f;
+    value_t zero = constant(0, int_type).v;
+    fn_->jump(f, join);
+
+    seal(join);
+    cur_ = join;
+
+    value_t phi = fn_->add_variadic(join, OP_PHI, TYPE_I32, 2);
+
+    fn_->operand(fn_->insts[phi], 0) = one;
+    fn_->operand(fn_->insts[phi], 1) = zero;
+
+    return { phi, int_type };
+}
+
+gcc::ir::lowering::rvalue_t gcc::ir::lowering::increment(const gcc::node_t *node, bool incr, bool post)
+{
+    static const ctype_t int_type = { 4, true, false, 0, false };
+
+    lvalue_t lv  = lexpr(node->l);
+    rvalue_t old = load(lv);
+    rvalue_t value;
+
+    if (!ok_)
+        return fail("");
+
+    if (old.t.ptr)
+        value = offset(old, constant(1, int_type), !incr);
+    else
+        value = convert(binary(incr ? TT_PLUS : TT_MINUS, old, constant(1, int_type)), lv.t);
+
+    store(lv, value.v);
+    return post ? old : value;
+}
+
+gcc::ir::lowering::rvalue_t gcc::ir::lowering::binary(int op, rvalue_t a, rvalue_t b)
+{
+    static const ctype_t int_type  = { 4, true, false, 0, false };
+    static const ctype_t long_type = { 8, true, false, 0, false };
+
+    if (!ok_)
+        return fail("");
+
+    if (a.t.size == 0 || b.t.size == 0)
+        return fail("void value used as an operand");
+
+    switch (op) {
+        case TT_PLUS:
+            if (a.t.ptr && b.t.ptr)
+                return fail("adding two pointers");
+            if (a.t.ptr || b.t.ptr)
+                return a.t.ptr ? offset(a, b, false) : offset(b, a, false);
+            break;
+
+        case TT_MINUS:
+            if (a.t.ptr && b.t.ptr) {
+                value_t diff = fn_->add(cur_, OP_SUB, TYPE_I64, a.v, b.v);
+
+                if (a.t.elem > 1)
+                    diff = fn_->add(cur_, OP_DIV, TYPE_I64, diff, constant(a.t.elem, long_type).v);
+
+                return { diff, long_type };
+            }
+            if (a.t.ptr)
+                return offset(a, b, true);
+            if (b.t.ptr)
+                return fail("subtracting a pointer from an integer");
+            break;
+
+        case TT_LSHIFT:
+        case TT_RSHIFT:
+        {
+            if (a.t.ptr || b.t.ptr)
+                return fail("shifting a pointer");
+
+            a = promote(a);
+            b = convert(promote(b), a.t);
+
+            uint8_t shift = op == TT_LSHIFT ? OP_SHL : a.t.sgn ? OP_SAR : OP_SHR;
+            return { fn_->add(cur_, shift, ir_type(a.t), a.v, b.v), a.t };
+        }
+
+        case TT_EQUAL:
+        case TT_NOT_EQUAL:
+        case TT_LTHAN:
+        case TT_GTHAN:
+        case TT_EQ_SMALLER:
+        case TT_EQ_LARGER:
+        {
+            ctype_t t;
+
+            /* pointers compare unsigned, an integer with a pointer as a pointer */
+            if (a.t.ptr || b.t.ptr) {
+                t = a.t.ptr ? a.t : b.t;
+            } else {
+                t = usual(a.t, b.t);
+            }
+
+            a = convert(a, t);
+            b = convert(b, t);
+
+            if (op == TT_GTHAN || op == TT_EQ_LARGER)
+                std::swap(a, b);
+
+            uint8_t cmp;
+
+            switch (op) {
+                case TT_EQUAL:     cmp = OP_EQ; break;
+                case TT_NOT_EQUAL: cmp = OP_NE; break;
+                case TT_LTHAN:
+                case TT_GTHAN:     cmp = t.sgn ? OP_LT : OP_ULT; break;
+                default:           cmp = t.sgn ? OP_LE : OP_ULE; break;
+            }
+
+            return { fn_->add(cur_, cmp, TYPE_I32, a.v, b.v), int_type };
+        }
+
+        case TT_STAR:
+        case TT_DIV:
+        case TT_MOD:
+        case TT_AND:
+        case TT_OR:
+        case TT_XOR:
+            if (a.t.ptr || b.t.ptr)
+                return fail("invalid pointer arithmetic");
+            break;
+
+        default:
+            return fail("unsupported operator");
+    }
+
+    ctype_t t = usual(a.t, b.t);
+
+    a = convert(a, t);
+    b = convert(b, t);
+
+    uint8_t arith;
+
+    switch (op) {
+        case TT_PLUS:  arith = OP_ADD; break;
+        case TT_MINUS: arith = OP_SUB; break;
+        case TT_STAR:  arith = OP_MUL; break;
+        case TT_DIV:   arith = t.sgn ? OP_DIV : OP_UDIV; break;
+        case TT_MOD:   arith = t.sgn ? OP_REM : OP_UREM; break;
+        case TT_AND:   arith = OP_AND; break;
+        case TT_OR:    arith = OP_OR; break;
+        default:       arith = OP_XOR; break;
+    }
+
+    return { fn_->add(cur_, arith, ir_type(t), a.v, b.v), t };
+}
+
+gcc::ir::lowering::rvalue_t gcc::ir::lowering::convert(rvalue_t value, const ctype_t& to)
+{
+    if (!ok_)
+        return fail("");
+
+    if (value.t.size == 0 || to.size == 0)
+        return fail("void value used as an operand");
+
+    if (value.t.size == to.size)
+        return { value.v, to };
+
+    const inst_t& inst = fn_->insts[value.v];
+
+    /* literals are converted right away */
+    if (inst.op == OP_CONST) {
+        int64_t imm = value.t.sgn ? inst.imm : (int64_t)zext(inst.type, inst.imm);
+        return constant(imm, to);
+    }
+
+    uint8_t op = to.size < value.t.size ? OP_TRUNC : value.t.sgn ? OP_SEXT : OP_ZEXT;
+
+    return { fn_->add(cur_, op, ir_type(to), value.v), to };
+}
+
+gcc::ir::lowering::ctype_t gcc::ir::lowering::promoted(const ctype_t& t)
+{
+    static const ctype_t int_type = { 4, true, false, 0, false };
+
+    return t.size && t.size < 4 ? int_type : t;
+}
+
+gcc::ir::lowering::ctype_t gcc::ir::lowering::usual(const ctype_t& a, const ctype_t& b)
+{
+    ctype_t pa = promoted(a);
+    ctype_t pb = promoted(b);
+    ctype_t t  = pa.size > pb.size ? pa : pb;
+
+    if (pa.size == pb.size)
+        t.sgn = pa.sgn && pb.sgn;
+
+    return t;
+}
+
+gcc::ir::lowering::rvalue_t gcc::ir::lowering::promote(rvalue_t value)
+{
+    if (ok_ && value.t.size && value.t.size < 4)
+        return convert(value, promoted(value.t));
+
+    return value;
+}
+
+gcc::ir::lowering::rvalue_t gcc::ir::lowering::constant(int64_t value, const ctype_t& t)
+{
+    return { fn_->add(cur_, OP_CONST, ir_type(t), NONE, NONE, sext(ir_type(t), value)), t };
+}
+
+gcc::ir::lowering::rvalue_t gcc::ir::lowering::offset(rvalue_t ptr, rvalue_t index, bool sub)
+{
+    static const ctype_t long_type = { 8, true, false, 0, false };
+
+    if (!ok_)
+        return fail("");
+
+    if (index.t.ptr)
+        return fail("invalid pointer arithmetic");
+
+    /* void * steps by bytes, like GNU C */
+    index = convert(promote(index), long_type);
+
+    if (ptr.t.elem > 1)
+        index = binary(TT_STAR, index, constant(ptr.t.elem, long_type));
+
+    return { fn_->add(cur_, sub ? OP_SUB : OP_ADD, TYPE_I64, ptr.v, index.v), ptr.t };
+}
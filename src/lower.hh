@@ -0,0 +1,170 @@
+#ifndef __LOWER_HH__
+#define __LOWER_HH__
+
+#include <cstdint>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "ir.hh"
+#include "parser.hh"
+#include "util/error.hh"
+
+namespace gcc {
+
+    namespace ir {
+
+        /* Builds the IR of a program.
+         *
+         * Every function with a body, the prelude's included, is lowered
+         * straight into SSA form while walking its tree, after Braun et al.,
+         * "Simple and Efficient Construction of Static Single Assignment
+         * Form": a local is a definition per block, reading it in a block
+         * without one asks the predecessors and puts a phi in between where
+         * they may disagree. Blocks whose predecessors aren't all known yet
+         * (loop headers) are sealed later and their phis completed then,
+         * phis that turn out to merge a single value are forwarded to it.
+         * Locals whose address is taken live in stack slots instead and
+         * globals are always accessed through memory.
+         *
+         * Only integers and single-level pointers are lowered, anything
+         * else (structs, floating point, member access) is reported as an
+         * error. */
+        class lowering {
+            public:
+                lowering();
+                ~lowering();
+
+                /* append the functions and globals of prog to module */
+                gcc_error_t run(const gcc::prog_t& prog, gcc::ir::module& module);
+
+            private:
+                lowering(const lowering&);
+                lowering& operator=(const lowering&);
+
+                /* C type of a value: integers of size bytes, or pointers
+                 * (size 8, unsigned) to integers of elem bytes */
+                typedef struct ctype {
+                    uint8_t size;      /* 0 for void */
+                    bool sgn;
+                    bool ptr;
+                    uint8_t elem;      /* pointers: size of the pointee, 0 for void */
+                    bool elem_sgn;
+                } ctype_t;
+
+                typedef struct rvalue {
+                    value_t v;
+                    ctype_t t;
+                } rvalue_t;
+
+                /* a local in SSA form (var) or memory at addr */
+                typedef struct lvalue {
+                    uint32_t var;      /* NONE if it's memory */
+                    value_t addr;
+                    ctype_t t;
+                } lvalue_t;
+
+                typedef struct local {
+                    ctype_t t;
+                    value_t slot;      /* OP_SLOT if the address is taken, else NONE */
+                } local_t;
+
+                /* symbol bound by a declaration, see leave() */
+                typedef struct binding {
+                    gcc::symbol_t sym;
+                    uint32_t prev;     /* local it shadowed, NONE if none */
+                } binding_t;
+
+                gcc_error_t lower_function(const gcc::func_t& func);
+                gcc_error_t lower_global(const gcc::var_t& var);
+
+                /* C type of a declaration, false if it isn't supported */
+                bool make_type(const gcc::type_t& type, ctype_t& out);
+
+                /* the IR type of values of t */
+                static uint8_t ir_type(const ctype_t& t);
+
+                /* constant value of a global initializer */
+                bool eval(const gcc::node_t *node, int64_t& out);
+
+                /* collect the locals whose address is taken */
+                void find_addressed(const gcc::node_t *node);
+
+                /* scopes of locals */
+                size_t enter() const { return bindings_.size(); }
+                void leave(size_t mark);
+                uint32_t declare(gcc::symbol_t sym, const ctype_t& t);
+
+                /* SSA construction */
+                uint32_t new_block();
+                void seal(uint32_t block);
+                void write_var(uint32_t var, uint32_t block, value_t value);
+                value_t read_var(uint32_t var, uint32_t block);
+                value_t read_var_slow(uint32_t var, uint32_t block);
+                void add_phi_operands(uint32_t var, value_t phi);
+                value_t try_remove_trivial(value_t phi);
+                value_t resolve(value_t value);
+                value_t undef(uint8_t type);
+                void finish();
+
+                /* statements, false on error */
+                bool statement(const gcc::node_t *node);
+                bool declaration(const gcc::node_t *node);
+                bool loop(const gcc::node_t *node);
+
+                /* continue in a new block without predecessors, after a return, break or continue */
+                void unreachable();
+
+                /* branch to t if node is true, else to f */
+                bool condition(const gcc::node_t *node, uint32_t t, uint32_t f);
+
+                /* expressions, v is NONE on error */
+                rvalue_t expr(const gcc::node_t *node);
+                lvalue_t lexpr(const gcc::node_t *node);
+                rvalue_t load(const lvalue_t& lv);
+                void store(const lvalue_t& lv, value_t value);
+                rvalue_t call(const gcc::node_t *node);
+                rvalue_t select(const gcc::node_t *node);
+                rvalue_t logical(const gcc::node_t *node);
+                rvalue_t increment(const gcc::node_t *node, bool incr, bool post);
+
+                /* operator token op of a binary expression applied to a and b */
+                rvalue_t binary(int op, rvalue_t a, rvalue_t b);
+
+                /* integer promotion and the usual arithmetic conversions */
+                static ctype_t promoted(const ctype_t& t);
+                static ctype_t usual(const ctype_t& a, const ctype_t& b);
+
+                rvalue_t convert(rvalue_t value, const ctype_t& to);
+                rvalue_t promote(rvalue_t value);
+                rvalue_t constant(int64_t value, const ctype_t& t);
+
+                /* pointer plus offset elements, negated if sub */
+                rvalue_t offset(rvalue_t ptr, rvalue_t index, bool sub);
+
+                rvalue_t fail(const char *what);
+
+                const gcc::prog_t *prog_;
+                gcc::ir::module *module_;
+                gcc::ir::function *fn_;
+                ctype_t ret_;
+                bool ok_;
+
+                uint32_t cur_;                                    /* block being appended to */
+                std::vector<local_t> locals_;
+                std::unordered_map<gcc::symbol_t, uint32_t> names_; /* to locals_ */
+                std::vector<binding_t> bindings_;
+                std::vector<gcc::symbol_t> addressed_;
+
+                std::unordered_map<uint64_t, value_t> defs_;     /* (var, block) to value */
+                std::vector<uint8_t> sealed_;
+                std::vector<std::vector<std::pair<uint32_t, value_t>>> incomplete_;
+                std::vector<value_t> forward_;                     /* phis replaced by a value */
+
+                /* break and continue targets of the enclosing loops */
+                std::vector<std::pair<uint32_t, uint32_t>> loops_;
+        };
+    };
+};
+
+#endif /* __LOWER_HH__ */
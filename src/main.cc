@@ -1,25 +1,25 @@
 #include <iostream>
 
-#include "parser.hh"
+#include "driver.hh"
+#include "server.hh"
 
 int main(int argc, char **argv)
 {
-    if (argc != 2) {
-        fprintf(stderr, "usage: %s <input file>\n", __FILE__);
-        exit(EXIT_FAILURE);
-    }
+    gcc::options_t opts;
+    int status;
 
-    gcc_error_t ret;
-    gcc::parser parser;
-    gcc::tokenizer tokenizer;
+    if ((status = gcc::driver::parse_options(argc, argv, opts, stderr)) >= 0)
+        return status;
 
-    if ((ret = tokenizer.tokenize(argv[1])) != GCC_SUCCESS) {
-        fprintf(stderr, "Failed to tokenize file %s: %s\n", argv[1], gcc_error(ret));
-        exit(EXIT_FAILURE);
-    }
+    if (opts.daemon) {
+        gcc::server server;
 
-    if ((ret = parser.parse(tokenizer.get_token_stream())) != GCC_SUCCESS) {
-        fprintf(stderr, "Failed to parse tokens!\n");
-        exit(EXIT_FAILURE);
+        if (server.listen(opts.daemon) != GCC_SUCCESS || server.run() != GCC_SUCCESS)
+            return EXIT_FAILURE;
+        return EXIT_SUCCESS;
     }
+
+    gcc::driver driver;
+
+    return driver.run(opts, stdout, stderr);
 }
@@ -3,12 +3,16 @@
 #include <vector>
 #include <cstring>
 
-#include "ast.hh"
+#include "image.hh"
 #include "parser.hh"
+#include "stats.hh"
 #include "util/log.hh"
 
 #define CHANNEL "parser"
 
+/* smaller inputs are parsed sequentially even if more jobs are allowed */
+#define PARALLEL_MIN_TOKENS (64 * 1024)
+
 #define EXPECT(token, err) \
     do { \
         if (!tokens_.get(token)) { \
@@ -17,9 +21,120 @@
         } \
     } while (0)
 
+/* binding powers of the binary operators, higher binds tighter */
+enum {
+    BP_NONE,
+    BP_COMMA,
+    BP_ASSIGN,
+    BP_TERNARY,
+    BP_LOGICAL_OR,
+    BP_LOGICAL_AND,
+    BP_BITWISE_OR,
+    BP_BITWISE_XOR,
+    BP_BITWISE_AND,
+    BP_EQUALITY,
+    BP_RELATIONAL,
+    BP_SHIFT,
+    BP_ADDITIVE,
+    BP_MULTIPLICATIVE,
+};
+
+static const struct binding_table {
+    uint8_t power[gcc::TT_LAST];
+
+    binding_table():
+        power()
+    {
+        power[gcc::TT_COMMA]         = BP_COMMA;
+
+        power[gcc::TT_ASSIGN]        = BP_ASSIGN;
+        power[gcc::TT_ADD_ASSIGN]    = BP_ASSIGN;
+        power[gcc::TT_SUB_ASSIGN]    = BP_ASSIGN;
+        power[gcc::TT_MUL_ASSIGN]    = BP_ASSIGN;
+        power[gcc::TT_DIV_ASSIGN]    = BP_ASSIGN;
+        power[gcc::TT_MOD_ASSIGN]    = BP_ASSIGN;
+        power[gcc::TT_AND_ASSIGN]    = BP_ASSIGN;
+        power[gcc::TT_OR_ASSIGN]     = BP_ASSIGN;
+        power[gcc::TT_XOR_ASSIGN]    = BP_ASSIGN;
+        power[gcc::TT_LSHIFT_ASSIGN] = BP_ASSIGN;
+        power[gcc::TT_RSHIFT_ASSIGN] = BP_ASSIGN;
+
+        power[gcc::TT_QMARK]         = BP_TERNARY;
+        power[gcc::TT_OR_EXP]        = BP_LOGICAL_OR;
+        power[gcc::TT_AND_EXP]       = BP_LOGICAL_AND;
+        power[gcc::TT_OR]            = BP_BITWISE_OR;
+        power[gcc::TT_XOR]           = BP_BITWISE_XOR;
+        power[gcc::TT_AND]           = BP_BITWISE_AND;
+
+        power[gcc::TT_EQUAL]         = BP_EQUALITY;
+        power[gcc::TT_NOT_EQUAL]     = BP_EQUALITY;
+
+        power[gcc::TT_LTHAN]         = BP_RELATIONAL;
+        power[gcc::TT_GTHAN]         = BP_RELATIONAL;
+        power[gcc::TT_EQ_SMALLER]    = BP_RELATIONAL;
+        power[gcc::TT_EQ_LARGER]     = BP_RELATIONAL;
+
+        power[gcc::TT_LSHIFT]        = BP_SHIFT;
+        power[gcc::TT_RSHIFT]        = BP_SHIFT;
+
+        power[gcc::TT_PLUS]          = BP_ADDITIVE;
+        power[gcc::TT_MINUS]         = BP_ADDITIVE;
+
+        power[gcc::TT_STAR]          = BP_MULTIPLICATIVE;
+        power[gcc::TT_DIV]           = BP_MULTIPLICATIVE;
+        power[gcc::TT_MOD]           = BP_MULTIPLICATIVE;
+    }
+} bindings;
+
+/* can the token start a declaration */
+static bool is_type_token(uint8_t type)
+{
+    switch (type) {
+        case gcc::TT_CHAR:     case gcc::TT_CONST:    case gcc::TT_DOUBLE:
+        case gcc::TT_EXTERN:   case gcc::TT_FLOAT:    case gcc::TT_INLINE:
+        case gcc::TT_INT:      case gcc::TT_LONG:     case gcc::TT_REGISTER:
+        case gcc::TT_RESTRICT: case gcc::TT_SHORT:    case gcc::TT_SIGNED:
+        case gcc::TT_STATIC:   case gcc::TT_STRUCT:   case gcc::TT_UNSIGNED:
+        case gcc::TT_VOID:     case gcc::TT_VOLATILE: case gcc::TT_U8:
+        case gcc::TT_U16:      case gcc::TT_U32:      case gcc::TT_U64:
+        case gcc::TT_I8:       case gcc::TT_I16:      case gcc::TT_I32:
+        case gcc::TT_I64:      case gcc::TT_SIZET:
+            return true;
+
+        default:
+            return false;
+    }
+}
+
+/* number of tokens up to and including the brace closing the block that
+ * starts at pos, 0 if it isn't closed before end */
+static size_t skip_braces(const gcc::token_t *pos, const gcc::token_t *end)
+{
+    size_t depth = 1;
+
+    for (const gcc::token_t *tok = pos; tok < end; ++tok) {
+        if (tok->type == gcc::TT_LCURLY)
+            depth++;
+        else if (tok->type == gcc::TT_RCURLY && --depth == 0)
+            return tok - pos + 1;
+    }
+
+    return 0;
+}
+
 gcc::parser::parser():
-    ast_(nullptr),
-    tokens_()
+    prog_(nullptr),
+    tokens_(),
+    arena_(),
+    statements_(),
+    nodes_(0),
+    jobs_(1),
+    pool_(),
+    workers_(),
+    diagnostics_(nullptr),
+    prelude_image_(nullptr),
+    prelude_(nullptr),
+    prelude_arena_()
 {
 }
 
@@ -32,9 +147,16 @@ gcc::prog_t *gcc::parser::get_prog()
     return prog_;
 }
 
+const gcc::arena::stats_t& gcc::parser::get_stats() const
+{
+    return arena_.get_stats();
+}
+
 gcc::node_t *gcc::parser::make_node(token_type_t type, gcc::node_t *l, gcc::node_t *r)
 {
-    gcc::node_t *node = new gcc::node_t;
+    gcc::node_t *node = arena_.make<gcc::node_t>();
+
+    nodes_++;
 
     node->l    = l;
     node->r    = r;
@@ -43,270 +165,407 @@ gcc::node_t *gcc::parser::make_node(token_type_t type, gcc::node_t *l, gcc::node
     return node;
 }
 
-gcc::node_t *gcc::parser::types()
+gcc::node_t *gcc::parser::primary()
 {
-    if (tokens_.get(TT_IDENTIFIER)) {
-        if (tokens_.get(TT_LPAREN)) {
-            EXPECT(TT_RPAREN, "Invalid token encountered: %d!\n");
-            WARN("function\n");
-        } else {
-            DEBUG("ELSE variable %d\n", tokens_.get_current().type);
-            gcc::node_t *node = new gcc::node_t;
-
-            node->l    = nullptr;
-            node->r    = nullptr;
-            node->type = TT_VAR;
+    const token_t& tok = tokens_.get();
+    gcc::node_t *node;
 
+    switch (tok.type) {
+        case TT_DIGIT:
+            node = make_node(TT_DIGIT, nullptr, nullptr);
+            node->value = (int64_t)tokens_.value(tok);
+            node->flags = tok.flags;
             return node;
-        }
-    }
 
-    ERROR("What else could it be!\n\n");
-}
+        case TT_IDENTIFIER:
+            node = make_node(TT_IDENTIFIER, nullptr, nullptr);
+            node->sym = tok.sym;
+            return node;
 
-gcc::node_t *gcc::parser::postfix()
-{
-    gcc::node_t *node = types();
+        case TT_LPAREN:
+            if (!(node = expression()))
+                return nullptr;
 
-    DEBUG("parse postfix\n");
+            EXPECT(TT_RPAREN, "Missing right parenthesis!\n");
+            return node;
 
-    return nullptr;
+        default:
+            ERROR("Unexpected token %d in expression!\n", tok.type);
+            return nullptr;
+    }
 }
 
-gcc::node_t *gcc::parser::prefix()
+gcc::node_t *gcc::parser::postfix(gcc::node_t *node)
 {
-    gcc::node_t *l = postfix();
-
-    DEBUG("parse prefix\n");
-
-    return l;
-}
+    while (node) {
+        switch (tokens_.peek().type) {
+            case TT_LPAREN:
+            {
+                size_t first = statements_.size();
 
-gcc::node_t *gcc::parser::mul_div()
-{
-    gcc::node_t *l = prefix();
+                tokens_.get();
+                node = make_node(TT_CALL, node, nullptr);
 
-    ERROR("unimplemented!\n");
+                if (!tokens_.get(TT_RPAREN)) {
+                    do {
+                        gcc::node_t *arg = assignment();
 
-    /* TODO: parse mul/div */
+                        if (!arg)
+                            return nullptr;
+                        statements_.push_back(arg);
+                    } while (tokens_.get(TT_COMMA));
 
-    return l;
-}
+                    EXPECT(TT_RPAREN, "Missing right parenthesis after arguments!\n");
+                }
 
-gcc::node_t *gcc::parser::add_sub()
-{
-    gcc::node_t *l = mul_div();
+                node->statements = gcc::arena_copy<gcc::node_t *>(arena_, statements_.begin() + first, statements_.end());
+                statements_.resize(first);
+            }
+            break;
 
-    ERROR("unimplemented!\n");
+            case TT_LSQUARE:
+                tokens_.get();
+                node = make_node(TT_INDEX, node, expression());
 
-    /* TODO: parse add/sub */
+                if (!node->r)
+                    return nullptr;
 
-    return l;
-}
+                EXPECT(TT_RSQUARE, "Missing right bracket!\n");
+                break;
 
-gcc::node_t *gcc::parser::bitwise_shift()
-{
-    gcc::node_t *l = add_sub();
+            case TT_DOT:
+            case TT_ARROW:
+                node = make_node((token_type_t)tokens_.get().type, node, nullptr);
 
-    ERROR("unimplemented!\n");
+                EXPECT(TT_IDENTIFIER, "Expected member name!\n");
+                node->sym = tokens_.get_current().sym;
+                break;
 
-    /* TODO: parse <</>> */
+            case TT_INCR:
+                tokens_.get();
+                node = make_node(TT_POST_INCR, node, nullptr);
+                break;
 
-    return l;
-}
+            case TT_DECR:
+                tokens_.get();
+                node = make_node(TT_POST_DECR, node, nullptr);
+                break;
 
-gcc::node_t *gcc::parser::relational()
-{
-    gcc::node_t *l = bitwise_shift();
-
-    if (tokens_.get(TT_EQ_LARGER)) {
-        /* TODO:  */
-    } else if (tokens_.get(TT_GTHAN)) {
-        /* TODO:  */
-    } else if (tokens_.get(TT_EQ_SMALLER)) {
-        /* TODO:  */
-    } else if (tokens_.get(TT_LTHAN)) {
-        return make_node(TT_LTHAN, l, bitwise_shift());
+            default:
+                return node;
+        }
     }
 
-    return l;
+    return node;
 }
 
-gcc::node_t *gcc::parser::equality()
+gcc::node_t *gcc::parser::unary()
 {
-    gcc::node_t *l = relational();
-
-    if (tokens_.get(TT_EQUAL)) {
-        DEBUG("parse equality\n");
-        return make_node(TT_EQUAL, l, relational());
-    } else if (tokens_.get(TT_NOT_EQUAL)) {
-        DEBUG("parse unequality\n");
-        /* TODO: parse inequality */
-    }
+    token_type_t type = (token_type_t)tokens_.peek().type;
+    gcc::node_t *node;
+
+    switch (type) {
+        case TT_MINUS:
+        case TT_PLUS:
+        case TT_EXCLAMATION:
+        case TT_ANOT:
+        case TT_STAR:
+        case TT_AND:
+        case TT_INCR:
+        case TT_DECR:
+            tokens_.get();
+
+            if (!(node = unary()))
+                return nullptr;
+            return make_node(type, node, nullptr);
 
-    return l;
-}
+        case TT_SIZEOF:
+            tokens_.get();
 
-gcc::node_t *gcc::parser::bitwise_and()
-{
-    gcc::node_t *l = equality();
+            /* sizeof(type) keeps the type in value, sizeof expr the operand in l */
+            if (tokens_.peek().type == TT_LPAREN && is_type_token(tokens_.peek(1).type)) {
+                tokens_.get();
 
-    if (!tokens_.get(TT_AND))
-        return l;
+                node = make_node(TT_SIZEOF, nullptr, nullptr);
+                node->value = gcc::pack_type(declaration_specifiers());
 
-    DEBUG("parse bitwise and\n");
+                EXPECT(TT_RPAREN, "Missing right parenthesis after sizeof!\n");
+                return node;
+            }
 
-    /* TODO: parse bitwise and */
+            if (!(node = unary()))
+                return nullptr;
+            return make_node(TT_SIZEOF, node, nullptr);
 
-    return l;
-}
+        case TT_LPAREN:
+            /* a parenthesized type name makes it a cast */
+            if (is_type_token(tokens_.peek(1).type)) {
+                tokens_.get();
 
-gcc::node_t *gcc::parser::bitwise_xor()
-{
-    gcc::node_t *l = bitwise_and();
+                gcc::type_t cast = declaration_specifiers();
 
-    if (!tokens_.get(TT_XOR))
-        return l;
+                EXPECT(TT_RPAREN, "Missing right parenthesis after cast!\n");
 
-    DEBUG("parse bitwise xor\n");
+                if (!(node = unary()))
+                    return nullptr;
 
-    /* TODO: parse bitwise xor */
+                node = make_node(TT_CAST, node, nullptr);
+                node->value = gcc::pack_type(cast);
+                return node;
+            }
+            return postfix(primary());
 
-    return l;
+        default:
+            return postfix(primary());
+    }
 }
 
-gcc::node_t *gcc::parser::bitwise_or()
+gcc::node_t *gcc::parser::binary(int min_bp)
 {
-    gcc::node_t *l = bitwise_xor();
+    gcc::node_t *l = unary();
 
-    /* TODO: parse bitwise or */
-    if (!tokens_.get(TT_OR))
-        return l;
+    while (l) {
+        token_type_t type = (token_type_t)tokens_.peek().type;
+        int bp = bindings.power[type];
 
-    DEBUG("parse bitwise or\n");
+        if (bp == BP_NONE || bp < min_bp)
+            return l;
 
-    return l;
-}
+        tokens_.get();
 
-gcc::node_t *gcc::parser::logical_and()
-{
-    gcc::node_t *l = bitwise_or();
+        if (type == TT_QMARK) {
+            gcc::node_t *node = make_node(TT_QMARK, nullptr, nullptr);
 
-    if (!tokens_.get(TT_AND_EXP))
-        return l;
+            node->cond = l;
 
-    DEBUG("parse logical and\n");
+            if (!(node->then = expression()))
+                return nullptr;
 
-    /* TODO: parse logical or */
-    return l;
-}
+            EXPECT(TT_COLON, "Missing ':' in conditional expression!\n");
 
-gcc::node_t *gcc::parser::logical_or()
-{
-    gcc::node_t *l = logical_and();
+            /* right associative */
+            if (!(node->els = binary(BP_TERNARY)))
+                return nullptr;
 
-    if (!tokens_.get(TT_OR_EXP))
-        return l;
+            l = node;
+            continue;
+        }
+
+        /* assignments are right associative, everything else left */
+        gcc::node_t *r = binary(bp == BP_ASSIGN ? bp : bp + 1);
 
-    DEBUG("parse logical or\n");
+        if (!r)
+            return nullptr;
+
+        l = make_node(type, l, r);
+    }
 
-    /* TODO: parse logical or */
     return l;
 }
 
-gcc::node_t *gcc::parser::conditional()
+gcc::node_t *gcc::parser::assignment()
 {
-    gcc::node_t *l = logical_or();
-
-    if (!tokens_.get(TT_QMARK))
-        return l;
+    return binary(BP_ASSIGN);
+}
 
-    DEBUG("parse conditional\n");
+gcc::node_t *gcc::parser::expression()
+{
+    DEBUG("parse expression\n");
 
-    /* TODO: parse ternary operator */
-    return l;
+    return binary(BP_COMMA);
 }
 
-gcc::node_t *gcc::parser::assignment()
+gcc::node_t *gcc::parser::declaration()
 {
-    DEBUG("parse assignment\n");
+    gcc::node_t *node = make_node(TT_DECL, nullptr, nullptr);
+    size_t first = statements_.size();
+    gcc::type_t type = declaration_specifiers();
 
-    gcc::node_t *l = conditional();
+    DEBUG("parse declaration\n");
 
-    /* TODO:  */
-    if (tokens_.get(TT_ASSIGN)) {
+    if (type.type == TT_INVALID)
+        return nullptr;
 
-    } else if (tokens_.get(TT_ADD_ASSIGN)) {
+    do {
+        EXPECT(TT_IDENTIFIER, "Expected identifier in declaration!\n");
 
-    } else if (tokens_.get(TT_SUB_ASSIGN)) {
-    }
+        gcc::node_t *var = make_node(TT_VAR, nullptr, nullptr);
+        var->sym = tokens_.get_current().sym;
 
-    return l;
-}
+        if (tokens_.get(TT_ASSIGN) && !(var->l = assignment()))
+            return nullptr;
 
-gcc::node_t *gcc::parser::expression()
-{
-    DEBUG("parse expression\n");
+        statements_.push_back(var);
+    } while (tokens_.get(TT_COMMA));
 
-    gcc::node_t *l = assignment();
+    EXPECT(TT_SEMICOLON, "Missing semicolon after declaration!\n");
 
-    if (tokens_.get(TT_COMMA))
-        return make_node(TT_COMMA, l, expression());
-    return l;
+    node->value      = gcc::pack_type(type);
+    node->statements = gcc::arena_copy<gcc::node_t *>(arena_, statements_.begin() + first, statements_.end());
+    statements_.resize(first);
+
+    return node;
 }
 
 gcc::node_t *gcc::parser::statement()
 {
     DEBUG("parse statement\n");
 
-    token_t tok = tokens_.get();
+    token_type_t type = (token_type_t)tokens_.peek().type;
+    gcc::node_t *node;
+
+    if (is_type_token(type))
+        return declaration();
+
+    switch (type) {
+        case TT_LCURLY:
+            tokens_.get();
+            return compound_statement();
 
-    switch (tok.type) {
         case TT_IF:
-        {
             DEBUG("parse if\n");
+            tokens_.get();
             EXPECT(TT_LPAREN, "Missing left parenthesis!\n");
-            gcc::node_t *node = new gcc::node_t;
 
-            node->cond = expression();
-            EXPECT(TT_RPAREN, "Missing left parenthesis!\n");
+            node = make_node(TT_IF, nullptr, nullptr);
 
-            ERROR("successfully parsed?\n");
+            if (!(node->cond = expression()))
+                return nullptr;
 
-            if (tokens_.get(TT_ELSE))
-                node->els = expression();
-        }
-        break;
+            EXPECT(TT_RPAREN, "Missing right parenthesis!\n");
+
+            if (!(node->then = statement()))
+                return nullptr;
+
+            if (tokens_.get(TT_ELSE) && !(node->els = statement()))
+                return nullptr;
+            return node;
+
+        case TT_WHILE:
+            DEBUG("parse while\n");
+            tokens_.get();
+            EXPECT(TT_LPAREN, "Missing left parenthesis!\n");
+
+            node = make_node(TT_WHILE, nullptr, nullptr);
+
+            if (!(node->cond = expression()))
+                return nullptr;
+
+            EXPECT(TT_RPAREN, "Missing right parenthesis!\n");
+
+            if (!(node->body = statement()))
+                return nullptr;
+            return node;
+
+        case TT_DO:
+            DEBUG("parse do\n");
+            tokens_.get();
+
+            node = make_node(TT_DO, nullptr, nullptr);
+
+            if (!(node->body = statement()))
+                return nullptr;
+
+            EXPECT(TT_WHILE, "Missing while after do body!\n");
+            EXPECT(TT_LPAREN, "Missing left parenthesis!\n");
+
+            if (!(node->cond = expression()))
+                return nullptr;
+
+            EXPECT(TT_RPAREN, "Missing right parenthesis!\n");
+            EXPECT(TT_SEMICOLON, "Missing semicolon!\n");
+            return node;
 
         case TT_FOR:
-            ERROR("parse for\n");
-            return nullptr;
-            break;
+            DEBUG("parse for\n");
+            tokens_.get();
+            EXPECT(TT_LPAREN, "Missing left parenthesis!\n");
 
-        case TT_IDENTIFIER:
-            /* ERROR("parse function call\n"); */
-            break;
+            node = make_node(TT_FOR, nullptr, nullptr);
+
+            /* init is either a declaration (which eats the semicolon) or an expression */
+            if (is_type_token(tokens_.peek().type)) {
+                if (!(node->l = declaration()))
+                    return nullptr;
+            } else if (!tokens_.get(TT_SEMICOLON)) {
+                if (!(node->l = expression()))
+                    return nullptr;
+                EXPECT(TT_SEMICOLON, "Missing semicolon in for!\n");
+            }
+
+            if (!tokens_.get(TT_SEMICOLON)) {
+                if (!(node->cond = expression()))
+                    return nullptr;
+                EXPECT(TT_SEMICOLON, "Missing semicolon in for!\n");
+            }
+
+            if (!tokens_.get(TT_RPAREN)) {
+                if (!(node->r = expression()))
+                    return nullptr;
+                EXPECT(TT_RPAREN, "Missing right parenthesis!\n");
+            }
+
+            if (!(node->body = statement()))
+                return nullptr;
+            return node;
+
+        case TT_RETURN:
+            DEBUG("parse return\n");
+            tokens_.get();
+
+            node = make_node(TT_RETURN, nullptr, nullptr);
+
+            if (!tokens_.get(TT_SEMICOLON)) {
+                if (!(node->l = expression()))
+                    return nullptr;
+                EXPECT(TT_SEMICOLON, "Missing semicolon!\n");
+            }
+            return node;
+
+        case TT_BREAK:
+        case TT_CONTINUE:
+            tokens_.get();
+            EXPECT(TT_SEMICOLON, "Missing semicolon!\n");
+            return make_node(type, nullptr, nullptr);
+
+        case TT_SEMICOLON:
+            tokens_.get();
+            return make_node(TT_SEMICOLON, nullptr, nullptr);
+
+        case TT_END:
+            ERROR("Unexpected end of input!\n");
+            return nullptr;
 
         default:
-            /* ERROR("NOT SURE WHAT TO DO HERE!\n\n"); */
-            break;
-    }
+            if (!(node = expression()))
+                return nullptr;
 
-    /* TODO: assignments */
-    /* TODO: while */
-    /* TODO: do */
-    /* TODO: identifier (function call) */
-    return nullptr;
+            EXPECT(TT_SEMICOLON, "Missing semicolon!\n");
+            return node;
+    }
 }
 
 gcc::node_t *gcc::parser::compound_statement()
 {
-    ERROR("parse compound statement\n");
+    DEBUG("parse compound statement\n");
 
-    gcc::node_t *node = new gcc::node_t;
+    gcc::node_t *node = make_node(TT_LCURLY, nullptr, nullptr);
+    size_t first = statements_.size();
 
-    while (!tokens_.get(TT_RCURLY))
-        node->statements.push_back(statement());
+    /* nested blocks push on top of the outer block's statements,
+     * only the finished block is copied into the arena */
+    while (!tokens_.get(TT_RCURLY)) {
+        gcc::node_t *stmt = statement();
+
+        if (!stmt) {
+            statements_.resize(first);
+            return nullptr;
+        }
+        statements_.push_back(stmt);
+    }
+
+    node->statements = gcc::arena_copy<gcc::node_t *>(arena_, statements_.begin() + first, statements_.end());
+    statements_.resize(first);
 
     return node;
 }
@@ -315,26 +574,24 @@ gcc::type_t gcc::parser::declaration_specifiers()
 {
     DEBUG("parsing declaration specifiers\n");
 
-    token_t tok = tokens_.get();
-    gcc::type_t ret{TT_INVALID, false, false, false, false};
-
-    if (tok.type == TT_END)
-        return {TT_END, false, false, false, false};
+    gcc::type_t ret = gcc::invalid_type();
+    bool sgnd = false, shrt = false, lng = false;
+    token_type_t type;
 
-    if (tok.type == TT_INVALID) {
-        ERROR("Invalid token stream!\n");
+    if (tokens_.peek().type == TT_END) {
+        ret.type = TT_END;
         return ret;
     }
 
-    while (tok.type == TT_EXTERN || tok.type == TT_VOLATILE ||
-           tok.type == TT_STATIC || tok.type == TT_REGISTER)
-    {
-        switch (tok.type) {
+    while (is_type_token(type = (token_type_t)tokens_.peek().type)) {
+        tokens_.get();
+
+        switch (type) {
             case TT_EXTERN:
                 DEBUG("extern\n");
                 if (ret.xtrn) {
                     ERROR("Extern given more than once\n");
-                    return ret;
+                    return gcc::invalid_type();
                 }
                 ret.xtrn = true;
                 break;
@@ -343,7 +600,7 @@ gcc::type_t gcc::parser::declaration_specifiers()
                 DEBUG("volatile\n");
                 if (ret.vltl) {
                     ERROR("Volatile given more than once\n");
-                    return ret;
+                    return gcc::invalid_type();
                 }
                 ret.vltl = true;
                 break;
@@ -352,7 +609,7 @@ gcc::type_t gcc::parser::declaration_specifiers()
                 DEBUG("static\n");
                 if (ret.sttc) {
                     ERROR("Static given more than once\n");
-                    return ret;
+                    return gcc::invalid_type();
                 }
                 ret.sttc = true;
                 break;
@@ -361,65 +618,98 @@ gcc::type_t gcc::parser::declaration_specifiers()
                 DEBUG("register\n");
                 if (ret.rgstr) {
                     ERROR("Register given more than once\n");
-                    return ret;
+                    return gcc::invalid_type();
                 }
-                ret.sttc = true;
+                ret.rgstr = true;
+                break;
+
+            case TT_CONST:
+                ret.cnst = true;
+                break;
+
+            case TT_INLINE:
+            case TT_RESTRICT:
+                break;
+
+            case TT_SIGNED:
+                sgnd = true;
                 break;
-        }
 
-        tok = tokens_.get();
+            case TT_UNSIGNED:
+                ret.unsgnd = true;
+                break;
+
+            case TT_SHORT:
+                shrt = true;
+                break;
+
+            case TT_LONG:
+                lng = true;
+                break;
+
+            default:
+                if (ret.type != TT_INVALID && !(ret.type == TT_INT || type == TT_INT)) {
+                    ERROR("Two or more data types in declaration specifiers\n");
+                    return gcc::invalid_type();
+                }
+
+                /* "short int" and "long int" are just short and long */
+                if (ret.type == TT_INVALID || type != TT_INT)
+                    ret.type = type;
+                break;
+        }
     }
 
-    switch (tok.type) {
-        case TT_U8:
-            DEBUG("uint8_t\n");
-            ret.type = TT_U8;
-            break;
-        case TT_SIZET:
-            DEBUG("size_t\n");
-            ret.type = TT_SIZET;
-            break;
-        case TT_VOID:
-            DEBUG("void\n");
-            ret.type = TT_VOID;
-            break;
+    if (shrt)
+        ret.type = TT_SHORT;
+    else if (lng)
+        ret.type = TT_LONG;
+    else if (ret.type == TT_INVALID && (sgnd || ret.unsgnd))
+        ret.type = TT_INT;
+
+    if (ret.type == TT_INVALID) {
+        ERROR("Expected type, got token %d\n", tokens_.peek().type);
+        return ret;
     }
 
-    if (tok.type == TT_STRUCT)
-        ret.type = TT_STRUCT;
+    /* "struct name", the tag is consumed by the caller */
+    if (ret.type == TT_STRUCT)
+        return ret;
+
+    while (tokens_.get(TT_STAR)) {
+        ret.ptr = true;
 
-    if (tokens_.get(TT_STAR)) {
-        if (ret.type != TT_INVALID && ret.type != TT_STAR) {
-            ret.ptr = true;
-            return ret;
+        while (tokens_.peek().type == TT_CONST || tokens_.peek().type == TT_RESTRICT) {
+            if (tokens_.get().type == TT_RESTRICT)
+                ret.rstrct = true;
+            else
+                ret.cnst = true;
         }
+    }
 
-        ERROR("Stray * found!\n");
-        return ret;
+    if (ret.rstrct && !ret.ptr) {
+        ERROR("Restrict requires a pointer type\n");
+        return gcc::invalid_type();
     }
 
     return ret;
 }
 
-gcc::prog_t *gcc::parser::build_ast()
+gcc::prog_t *gcc::parser::build_ast(gcc::prog_t *prog, std::vector<deferred_t> *deferred)
 {
-    gcc::prog_t *prog = new gcc::prog_t;
     token_t tok;
 
-    while (!tokens_.get(TT_END)) {
+    while (tokens_.peek().type != TT_END) {
         type_t type = declaration_specifiers();
 
-        if (type.type == TT_END)
-            return prog;
-
         if (type.type == TT_INVALID) {
             WARN("invalid token\n");
             return nullptr;
         }
 
         if ((tok = tokens_.get()).type != TT_IDENTIFIER) {
-            ERROR("invalid token! %d\n", tokens_.get().type);
-            break;
+            ERROR("invalid token! %d\n", tok.type);
+            return nullptr;
         }
 
         /* struct declaration */
@@ -430,86 +720,114 @@ gcc::prog_t *gcc::parser::build_ast()
 
         /* function */
         if (tokens_.get(TT_LPAREN)) {
-            gcc::func_t func;
+            gcc::func_t func(arena_);
+            const gcc::func_t *prev = prog->find_function(tok.sym);
 
-            if (prog->functions.find(tok.str) != prog->functions.end()) {
-                ERROR("Duplicate function %s() found!\n", tok.str.c_str());
+            /* a deferred body isn't parsed yet, only marked */
+            if (prev && prev->defined) {
+                ERROR("Duplicate function %s() found!\n", gcc::symbol_str(tok.sym));
                 return nullptr;
             }
 
-            func.name     = tok.str;
-            func.ret_type = { TT_FUNC };
+            func.name     = tok.sym;
+            func.ret_type = type;
 
-            do {
-                type_t type = declaration_specifiers();
+            /* "()" and "(void)" both mean no parameters */
+            if (tokens_.peek().type == TT_VOID && tokens_.peek(1).type == TT_RPAREN)
+                tokens_.get();
 
-                if (type.type == TT_END)
-                    return prog;
+            if (!tokens_.get(TT_RPAREN)) {
+                do {
+                    type_t type = declaration_specifiers();
 
-                if (type.type == TT_INVALID) {
-                    ERROR("Failed to parse declaration specifiers, invalid token encountered!\n");
-                    return nullptr;
-                }
+                    if (type.type == TT_INVALID) {
+                        ERROR("Failed to parse declaration specifiers, invalid token encountered!\n");
+                        return nullptr;
+                    }
 
-                if ((tok = tokens_.get()).type != TT_IDENTIFIER) {
-                    ERROR("invalid token! %d\n", tokens_.get().type);
-                    return nullptr;
-                }
+                    if ((tok = tokens_.get()).type != TT_IDENTIFIER) {
+                        ERROR("invalid token! %d\n", tok.type);
+                        return nullptr;
+                    }
 
-                if (func.args.find(tok.str) != func.args.end()) {
-                    ERROR("Duplicate variable %s for %s() found!\n", tok.str.c_str(), func.name.c_str());
-                    return nullptr;
-                }
+                    if (func.args.find(tok.sym) != func.args.end()) {
+                        ERROR("Duplicate variable %s for %s() found!\n", gcc::symbol_str(tok.sym), gcc::symbol_str(func.name));
+                        return nullptr;
+                    }
 
-                gcc::var_t var;
-                var.name = tok.str;
-                var.type = { TT_VAR };
+                    gcc::var_t var = { type, tok.sym, nullptr };
 
-                func.args.insert(std::make_pair(tok.str, var));
+                    func.args.insert(std::make_pair(tok.sym, var));
+                    func.params.push_back(tok.sym);
 
-                DEBUG("add parameter %s for %s()\n", tok.str.c_str(), func.name.c_str());
+                    DEBUG("add parameter %s for %s()\n", gcc::symbol_str(tok.sym), gcc::symbol_str(func.name));
 
-                /* consume comma if there are multiple arguments */
-                tokens_.get(TT_COMMA);
+                } while (tokens_.get(TT_COMMA));
 
-            } while (!tokens_.get(TT_RPAREN));
+                EXPECT(TT_RPAREN, "Missing right parenthesis after parameters!\n");
+            }
 
             if (tokens_.get(TT_SEMICOLON)) {
                 DEBUG("function prototype\n");
+
+                /* the first declaration stays until the definition replaces it */
+                if (!prev)
+                    prog->functions.insert(std::make_pair(func.name, func));
                 continue;
             }
             EXPECT(TT_LCURLY, "Expected function body!\n");
 
-            func.node.body = compound_statement();
-            prog->functions.insert(std::make_pair(func.name, func));
+            /* only a prototype is replaced, a definition was refused above */
+            prog->functions.erase(func.name);
+            func.defined = true;
+
+            size_t first = tokens_.mark();
+            size_t count = deferred ? skip_braces(tokens_.pos_, tokens_.end_) : 0;
+
+            /* unbalanced bodies are parsed here so they fail the same way */
+            if (!count) {
+                if (!(func.node.body = compound_statement()))
+                    return nullptr;
+
+                prog->functions.insert(std::make_pair(func.name, func));
+                continue;
+            }
+
+            tokens_.rewind(first + count);
+
+            gcc::func_t *stored = &prog->functions.insert(std::make_pair(func.name, func)).first->second;
+            deferred->push_back({ stored, (uint32_t)first, (uint32_t)(first + count), diagnostics_->size() });
 
             continue;
         }
 
-        /* global variable */
-        if (prog->globals.find(tok.str) != prog->globals.end()) {
-            ERROR("Duplicate global variable '%s'\n", tok.str.c_str());
-            return nullptr;
-        }
+        /* global variables */
+        for (;;) {
+            const gcc::var_t *prev = prog->find_global(tok.sym);
 
-        gcc::var_t var = { { TT_VAR, 0 } , tok.str };
-        prog->globals.insert(std::make_pair(tok.str, var));
+            /* extern declarations may come before or after the definition */
+            if (prev && !prev->type.xtrn && !type.xtrn) {
+                ERROR("Duplicate global variable '%s'\n", gcc::symbol_str(tok.sym));
+                return nullptr;
+            }
 
-        while (tokens_.get(TT_COMMA)) {
-            tok = tokens_.get();
+            gcc::var_t var = { type, tok.sym, nullptr };
 
-            if (tok.type != TT_IDENTIFIER) {
-                ERROR("Expected identifer, got %d\n", tok.type);
+            if (tokens_.get(TT_ASSIGN) && !(var.init = assignment()))
                 return nullptr;
+
+            if (!prev || !type.xtrn) {
+                prog->globals.erase(tok.sym);
+                prog->globals.insert(std::make_pair(tok.sym, var));
             }
 
-            if (prog->globals.find(tok.str) != prog->globals.end()) {
-                ERROR("Duplicate global variable '%s'\n", tok.str.c_str());
+            if (!tokens_.get(TT_COMMA))
+                break;
+
+            if ((tok = tokens_.get()).type != TT_IDENTIFIER) {
+                ERROR("Expected identifer, got %d\n", tok.type);
                 return nullptr;
             }
-
-            gcc::var_t var = { { TT_VAR, 0 }, tok.str };
-            prog->globals.insert(std::make_pair(tok.str, var));
         }
 
         EXPECT(TT_SEMICOLON, "Missing semicolon!\n");
@@ -518,18 +836,235 @@ gcc::prog_t *gcc::parser::build_ast()
     return prog;
 }
 
-gcc_error_t gcc::parser::parse(gcc::token_stream_t& tokens)
+gcc::node_t *gcc::parser::parse_body(const token_cursor_t& tokens)
+{
+    tokens_ = tokens;
+
+    return compound_statement();
+}
+
+bool gcc::parser::parse_deferred(std::vector<deferred_t>& deferred, bool ok)
+{
+    std::vector<std::vector<gcc::log::diagnostic_t>> diagnostics(deferred.size());
+    std::vector<uint8_t> failed(deferred.size());
+    std::atomic<size_t> first_failure(deferred.size());
+    gcc::interner *symbols = &gcc::symbols();
+    const gcc::token_stream_t *stream = tokens_.stream_;
+
+    if (!pool_) {
+        pool_.reset(new gcc::thread_pool(jobs_));
+
+        for (size_t i = 0; i < pool_->size(); ++i)
+            workers_.emplace_back(new gcc::parser());
+    }
+
+    /* contiguous runs of bodies, several per worker so the pool can balance them */
+    size_t total  = deferred.empty() ? 0 : deferred.back().last - deferred.front().first;
+    size_t target = total / (pool_->size() * 8) + 1;
+
+    for (size_t i = 0, j; i < deferred.size(); i = j) {
+        size_t tokens = 0;
+
+        for (j = i; j < deferred.size() && tokens < target; ++j)
+            tokens += deferred[j].last - deferred[j].first;
+
+        pool_->submit([this, &deferred, &diagnostics, &failed, &first_failure, symbols, stream, i, j] {
+            gcc::parser *worker  = workers_[gcc::thread_pool::worker_id()].get();
+            gcc::interner *prev = gcc::bind_symbols(symbols);
+
+            /* nothing after the first failing body is reported */
+            for (size_t k = i; k < j && k < first_failure.load(std::memory_order_relaxed); ++k) {
+                std::vector<gcc::log::diagnostic_t> *sink = gcc::log::capture(&diagnostics[k]);
+                gcc::node_t *body = worker->parse_body(gcc::token_cursor_t(*stream, deferred[k].first, deferred[k].last));
+
+                gcc::log::capture(sink);
+
+                if (!body) {
+                    size_t first = first_failure.load();
+
+                    while (k < first && !first_failure.compare_exchange_weak(first, k))
+                        ;
+
+                    failed[k] = 1;
+                    break;
+                }
+
+                deferred[k].func->node.body = body;
+            }
+
+            gcc::bind_symbols(prev);
+        });
+    }
+
+    pool_->wait();
+
+    for (auto& worker : workers_)
+        nodes_ += worker->nodes_;
+
+    /* replay in source order what a sequential parse would have reported */
+    size_t reported = 0;
+
+    for (size_t k = 0; k < deferred.size(); ++k) {
+        for (; reported < deferred[k].diagnostics; ++reported)
+            gcc::log::report((*diagnostics_)[reported]);
+
+        for (const gcc::log::diagnostic_t& diag : diagnostics[k])
+            gcc::log::report(diag);
+
+        if (failed[k])
+            return false;
+    }
+
+    for (; reported < diagnostics_->size(); ++reported)
+        gcc::log::report((*diagnostics_)[reported]);
+
+    return ok;
+}
+
+/* Top-level declarations are always parsed in order. For large inputs
+ * that are fully tokenized, function bodies are only skipped over by
+ * matching braces at first and parsed afterwards on the worker pool, each
+ * worker into its own arena. Diagnostics of both passes are captured and
+ * replayed in source order up to the first error, so the output is the
+ * same as if everything had been parsed sequentially. */
+gcc::prog_t *gcc::parser::build_ast()
+{
+    gcc::prog_t *prog = arena_.make<gcc::prog_t>(arena_);
+
+    prog->prelude = prelude_;
+
+    if (jobs_ == 1 || tokens_.source_ || tokens_.size() < PARALLEL_MIN_TOKENS)
+        return build_ast(prog, nullptr);
+
+    std::vector<deferred_t> deferred;
+    std::vector<gcc::log::diagnostic_t> diagnostics;
+    std::vector<gcc::log::diagnostic_t> *sink = gcc::log::capture(&diagnostics);
+
+    diagnostics_ = &diagnostics;
+
+    bool ok = build_ast(prog, &deferred) != nullptr;
+
+    gcc::log::capture(sink);
+    ok = parse_deferred(deferred, ok);
+    diagnostics_ = nullptr;
+
+    DEBUG("parsed %zu function bodies on %zu threads\n", deferred.size(), pool_->size());
+
+    return ok ? prog : nullptr;
+}
+
+void gcc::parser::set_jobs(size_t jobs)
+{
+    if (!jobs)
+        jobs = std::thread::hardware_concurrency();
+    if (!jobs)
+        jobs = 1;
+
+    if (jobs != jobs_) {
+        workers_.clear();
+        pool_.reset();
+    }
+
+    jobs_ = jobs;
+}
+
+void gcc::parser::reset()
+{
+    /* the previous translation unit is released in one go */
+    arena_.reset();
+    statements_.clear();
+    prog_  = nullptr;
+    nodes_ = 0;
+
+    for (auto& worker : workers_) {
+        worker->arena_.reset();
+        worker->nodes_ = 0;
+    }
+}
+
+gcc_error_t gcc::parser::load(const gcc::image& image)
+{
+    reset();
+
+    {
+        gcc::scoped_timer timer(gcc::PHASE_LOAD);
+
+        if (!(prog_ = image.load(arena_, nodes_)))
+            return GCC_INVALID_VALUE;
+    }
+
+    gcc::stats::add(gcc::COUNTER_ARENA_BYTES, arena_.get_stats().used);
+
+    return GCC_SUCCESS;
+}
+
+void gcc::parser::set_prelude(const gcc::image *image)
+{
+    if (image == prelude_image_)
+        return;
+
+    prelude_arena_.reset();
+    prelude_image_ = image;
+    prelude_       = nullptr;
+}
+
+gcc_error_t gcc::parser::parse(const gcc::token_stream_t& tokens)
 {
     DEBUG("parsing %zu tokens\n", tokens.size());
 
-    if (!tokens.size()) {
+    /* borrow the stream, the tokenizer owns it until parsing is done */
+    return parse(gcc::token_cursor_t(tokens));
+}
+
+gcc_error_t gcc::parser::parse(gcc::tokenizer& tokenizer)
+{
+    DEBUG("parsing token stream on demand\n");
+
+    return parse(gcc::token_cursor_t(tokenizer.get_token_stream(), tokenizer));
+}
+
+gcc_error_t gcc::parser::parse(const gcc::token_cursor_t& tokens)
+{
+    tokens_ = tokens;
+
+    /* a unit after a precompiled header may have nothing of its own */
+    if (tokens_.peek().type == TT_END && !prelude_image_) {
         ERROR("cannot parse empty token stream!\n");
         return GCC_INVALID_VALUE;
     }
 
-    tokens_ = tokens;
+    reset();
+
+    /* built on the thread that parses, it interns the image's strings */
+    if (prelude_image_ && !prelude_) {
+        gcc::scoped_timer timer(gcc::PHASE_LOAD);
+        size_t nodes;
+
+        if (!(prelude_ = prelude_image_->load(prelude_arena_, nodes))) {
+            ERROR("invalid precompiled header program\n");
+            return GCC_INVALID_VALUE;
+        }
+
+        gcc::stats::add(gcc::COUNTER_ARENA_BYTES, prelude_arena_.get_stats().used);
+    }
+
+    {
+        gcc::scoped_timer timer(gcc::PHASE_PARSE);
+
+        prog_ = build_ast();
+    }
+
+    gcc::stats::add(gcc::COUNTER_NODES, nodes_);
+    gcc::stats::add(gcc::COUNTER_ARENA_BYTES, arena_.get_stats().used);
+
+    for (auto& worker : workers_)
+        gcc::stats::add(gcc::COUNTER_ARENA_BYTES, worker->arena_.get_stats().used);
+
+    DEBUG("%zu bytes in %zu allocations, %zu bytes reserved, peak token window %zu\n",
+          arena_.get_stats().used, arena_.get_stats().allocations,
+          arena_.get_stats().reserved, tokens_.peak_);
 
-    if (!(prog_ = build_ast()))
+    if (!prog_ || tokens_.error_ != GCC_SUCCESS)
         return GCC_INVALID_VALUE;
     return GCC_SUCCESS;
 }
@@ -1,16 +1,25 @@
 #ifndef __PARSER_HH__
 #define __PARSER_HH__
 
+#include <memory>
 #include <vector>
 #include <unordered_map>
 
-#include "ast.hh"
+#include "arena.hh"
+#include "intern.hh"
+#include "pool.hh"
 #include "token.hh"
 #include "tokenizer.hh"
 #include "util/error.hh"
 
 namespace gcc {
 
+    namespace log {
+        struct diagnostic;
+    };
+
+    class image;
+
     /* TODO: create node type enum */
     typedef enum node_type {
         NT_INVALID,
@@ -104,10 +113,29 @@ namespace gcc {
         NT_FUNC,
         NT_ARROW,
         NT_NOT_EQUAL,
+        NT_MOD,
+        NT_MOD_ASSIGN,
+        NT_AND_ASSIGN,
+        NT_OR_ASSIGN,
+        NT_CALL,
+        NT_INDEX,
+        NT_POST_INCR,
+        NT_POST_DECR,
+        NT_CAST,
+        NT_DECL,
     } node_type_t;
 
     typedef struct node node_t;
 
+    /* symbol keyed map whose storage lives in the parser's arena */
+    template <typename T>
+    using symbol_map = std::unordered_map<
+        gcc::symbol_t, T,
+        std::hash<gcc::symbol_t>,
+        std::equal_to<gcc::symbol_t>,
+        gcc::arena_allocator<std::pair<const gcc::symbol_t, T>>
+    >;
+
     typedef struct type {
         token_type_t type; /* int, short, bool etc. */
         bool xtrn;         /* extern  */
@@ -115,15 +143,56 @@ namespace gcc {
         bool sttc;         /* static */
         bool rgstr;        /* register */
         bool ptr;          /* pointer */
+        bool cnst;         /* const */
+        bool rstrct;       /* restrict (pointers only) */
+        bool unsgnd;       /* unsigned */
     } type_t;
 
+    /* type_t in the value of a node, the token type in the low byte */
+    static inline int pack_type(const type_t& type)
+    {
+        return type.type | type.xtrn << 8 | type.vltl << 9 | type.sttc << 10 | type.rgstr << 11 |
+               type.ptr << 12 | type.cnst << 13 | type.rstrct << 14 | type.unsgnd << 15;
+    }
+
+    static inline type_t unpack_type(int value)
+    {
+        return {
+            (token_type_t)(value & 0xff), (value >> 8 & 1) != 0, (value >> 9 & 1) != 0,
+            (value >> 10 & 1) != 0, (value >> 11 & 1) != 0, (value >> 12 & 1) != 0,
+            (value >> 13 & 1) != 0, (value >> 14 & 1) != 0, (value >> 15 & 1) != 0,
+        };
+    }
+
+    /* type_t with no type and no qualifiers, returned on errors */
+    static inline type_t invalid_type()
+    {
+        return { TT_INVALID, false, false, false, false, false, false, false, false };
+    }
+
     typedef struct var {
         type_t type;
-        std::string name;
+        gcc::symbol_t name;
+        node_t *init;      /* initializer, globals only */
     } var_t;
 
+    /* Expression and statement tree.
+     *
+     * Binary operators use l and r, unary operators only l (TT_MINUS with
+     * no r is a negation, TT_STAR a dereference, TT_AND an address-of).
+     * TT_QMARK and TT_IF use cond/then/els, loops cond/body and TT_FOR
+     * also l (init) and r (step). Blocks (TT_LCURLY), declarations
+     * (TT_DECL) and calls (TT_CALL, callee in l) keep their children
+     * in statements. TT_DECL, TT_CAST and sizeof(type) keep the type in
+     * value, see pack_type(). */
     struct node {
         token_type_t type;
+        uint8_t flags;          /* TT_DIGIT: TF_* of the constant, its C type */
+
+        union {
+            int64_t value;      /* TT_DIGIT, packed type_t of TT_DECL, TT_CAST and TT_SIZEOF */
+            gcc::symbol_t sym;  /* TT_IDENTIFIER, TT_VAR, member of TT_DOT/TT_ARROW */
+        };
 
         node_t *l;
         node_t *r;
@@ -132,19 +201,55 @@ namespace gcc {
         node_t *then;
         node_t *els;
 
-        std::vector<node_t *> statements;
+        gcc::arena_array<node_t *> statements;
     };
 
     typedef struct func {
         type_t ret_type;
         node_t node;
-        std::string name;
-        std::unordered_map<std::string, gcc::var_t> args;
+        gcc::symbol_t name;
+        gcc::symbol_map<gcc::var_t> args;
+        std::vector<gcc::symbol_t, gcc::arena_allocator<gcc::symbol_t>> params; /* args in order */
+        bool defined; /* has a body, set before a deferred body is parsed */
+
+        func(gcc::arena& arena):
+            ret_type(), node(), name(SYM_NONE), args(arena), params(arena), defined(false)
+        {
+        }
     } func_t;
 
+    /* Functions without a body are prototypes. A program parsed after a
+     * precompiled header (see gcc::pch) chains to the program built from
+     * the header instead of copying it: prelude is shared by every unit
+     * using the header and holds what the unit didn't declare itself. */
     typedef struct prog {
-        std::unordered_map<std::string, gcc::func_t> functions;
-        std::unordered_map<std::string, gcc::var_t>  globals;
+        gcc::symbol_map<gcc::func_t> functions;
+        gcc::symbol_map<gcc::var_t>  globals;
+        const struct prog *prelude;
+
+        prog(gcc::arena& arena):
+            functions(arena), globals(arena), prelude(nullptr)
+        {
+        }
+
+        /* declaration of a function or global, the unit's own first */
+        const gcc::func_t *find_function(gcc::symbol_t sym) const
+        {
+            auto it = functions.find(sym);
+
+            if (it != functions.end())
+                return &it->second;
+            return prelude ? prelude->find_function(sym) : nullptr;
+        }
+
+        const gcc::var_t *find_global(gcc::symbol_t sym) const
+        {
+            auto it = globals.find(sym);
+
+            if (it != globals.end())
+                return &it->second;
+            return prelude ? prelude->find_global(sym) : nullptr;
+        }
     } prog_t;
 
     class parser {
@@ -153,38 +258,112 @@ namespace gcc {
             ~parser();
 
             /* parse the token stream into an abstract syntax tree */
-            gcc_error_t parse(gcc::token_stream_t& tokens);
+            gcc_error_t parse(const gcc::token_stream_t& tokens);
+
+            /* parse while pulling tokens from an opened tokenizer on demand */
+            gcc_error_t parse(gcc::tokenizer& tokenizer);
 
-            /* return the program built by the parser */
+            /* parse from an eager or a streaming cursor */
+            gcc_error_t parse(const gcc::token_cursor_t& tokens);
+
+            /* build the program of an AST image instead of parsing */
+            gcc_error_t load(const gcc::image& image);
+
+            /* Start the programs of the following parses with the
+             * declarations of image, a precompiled header's program, or
+             * with nothing if image is nullptr. The program of image is
+             * built once, on the next parse, and shared by every program
+             * parsed after it until the prelude changes. image must stay
+             * valid until then. */
+            void set_prelude(const gcc::image *image);
+
+            /* return the program built by the parser,
+             * it's valid until the parser is destroyed or parse() is called again */
             gcc::prog_t *get_prog();
 
+            /* memory used by the nodes of the current translation unit */
+            const gcc::arena::stats_t& get_stats() const;
+
+            /* Parse function bodies of large, fully tokenized inputs on up to
+             * jobs threads (1 by default, 0 means one per core). The result
+             * and the diagnostics are the same as parsing sequentially. */
+            void set_jobs(size_t jobs);
+
         private:
+            /* function body whose parsing was deferred, see build_ast() */
+            typedef struct deferred {
+                gcc::func_t *func;
+                uint32_t first;     /* token after the opening brace */
+                uint32_t last;      /* one past the closing brace */
+                size_t diagnostics; /* diagnostics reported before the body */
+            } deferred_t;
+
+            /* release the previous translation unit */
+            void reset();
+
             gcc::prog_t *build_ast();
+
+            /* parse the top-level declarations into prog, function bodies are
+             * parsed right away or, if deferred isn't nullptr, appended to it */
+            gcc::prog_t *build_ast(gcc::prog_t *prog, std::vector<deferred_t> *deferred);
+
+            /* parse the deferred bodies concurrently and report the diagnostics,
+             * ok is whether the top-level pass itself succeeded */
+            bool parse_deferred(std::vector<deferred_t>& deferred, bool ok);
+
+            /* parse one function body on a worker's parser */
+            gcc::node_t *parse_body(const token_cursor_t& tokens);
+
             gcc::type_t declaration_specifiers();
+            gcc::node_t *declaration();
             gcc::node_t *compound_statement();
             gcc::node_t *statement();
+            gcc::node_t *make_node(token_type_t type, gcc::node_t *l, gcc::node_t *r);
+
+            /* comma expression */
             gcc::node_t *expression();
+
+            /* expression without top-level commas (arguments, initializers) */
             gcc::node_t *assignment();
-            gcc::node_t *conditional();
-            gcc::node_t *make_node(token_type_t type, gcc::node_t *l, gcc::node_t *r);
 
-            gcc::node_t *logical_or();
-            gcc::node_t *logical_and();
-            gcc::node_t *bitwise_or();
-            gcc::node_t *bitwise_xor();
-            gcc::node_t *bitwise_and();
-            gcc::node_t *equality();
-            gcc::node_t *relational();
-            gcc::node_t *bitwise_shift();
-            gcc::node_t *add_sub();
-            gcc::node_t *mul_div();
-            gcc::node_t *prefix();
-            gcc::node_t *postfix();
-            gcc::node_t *types();
-
-            gcc::ast_node *ast_;
+            /* Pratt loop, parses operators that bind at least as tight as min_bp */
+            gcc::node_t *binary(int min_bp);
+
+            /* prefix operators, casts and sizeof */
+            gcc::node_t *unary();
+
+            /* calls, indexing, member access and postfix ++/-- */
+            gcc::node_t *postfix(gcc::node_t *node);
+
+            /* literals, identifiers and parenthesized expressions */
+            gcc::node_t *primary();
+
             gcc::prog_t *prog_;
-            token_stream_t tokens_;
+            token_cursor_t tokens_;
+
+            /* owns every node_t, func_t and prog_t of the translation unit */
+            gcc::arena arena_;
+
+            /* statements of the compound statements being parsed */
+            std::vector<gcc::node_t *> statements_;
+
+            /* nodes created for the current translation unit */
+            size_t nodes_;
+
+            /* parallel parsing of function bodies, workers own the arenas
+             * holding the bodies they parsed until the next parse() */
+            size_t jobs_;
+            std::unique_ptr<gcc::thread_pool> pool_;
+            std::vector<std::unique_ptr<gcc::parser>> workers_;
+
+            /* warnings and errors of the top-level pass while bodies are deferred */
+            std::vector<gcc::log::diagnostic> *diagnostics_;
+
+            /* see set_prelude(), the program is built into its own arena
+             * so it survives reset() */
+            const gcc::image *prelude_image_;
+            gcc::prog_t *prelude_;
+            gcc::arena prelude_arena_;
     };
 };
 
@@ -0,0 +1,1209 @@
+#include <algorithm>
+
+#include "pass.hh"
+#include "stats.hh"
+#include "util/log.hh"
+
+#define CHANNEL "pass"
+
+namespace {
+
+    /* follow forwarded values to the one that replaces them */
+    static gcc::ir::value_t resolve(const std::vector<gcc::ir::value_t>& map, gcc::ir::value_t v)
+    {
+        while (v != gcc::ir::NONE && map[v] != gcc::ir::NONE)
+            v = map[v];
+
+        return v;
+    }
+
+    /* Fold an instruction whose operands are the constants a and b, of
+     * type at, into out. False if the result isn't known at compile time
+     * (division by zero, oversized shifts). */
+    static bool evaluate(const gcc::ir::inst_t& inst, uint8_t at, int64_t a, int64_t b, int64_t& out)
+    {
+        uint64_t ua = gcc::ir::zext(at, a);
+        uint64_t ub = gcc::ir::zext(at, b);
+        unsigned bits = gcc::ir::type_size(inst.type) * 8;
+
+        switch (inst.op) {
+            case gcc::ir::OP_ADD:   out = (int64_t)((uint64_t)a + (uint64_t)b); break;
+            case gcc::ir::OP_SUB:   out = (int64_t)((uint64_t)a - (uint64_t)b); break;
+            case gcc::ir::OP_MUL:   out = (int64_t)((uint64_t)a * (uint64_t)b); break;
+            case gcc::ir::OP_AND:   out = a & b; break;
+            case gcc::ir::OP_OR:    out = a | b; break;
+            case gcc::ir::OP_XOR:   out = a ^ b; break;
+            case gcc::ir::OP_NEG:   out = (int64_t)(0 - (uint64_t)a); break;
+            case gcc::ir::OP_NOT:   out = ~a; break;
+            case gcc::ir::OP_SEXT:  out = a; break;
+            case gcc::ir::OP_ZEXT:  out = (int64_t)ua; break;
+            case gcc::ir::OP_TRUNC: out = a; break;
+            case gcc::ir::OP_EQ:    out = a == b; break;
+            case gcc::ir::OP_NE:    out = a != b; break;
+            case gcc::ir::OP_LT:    out = a < b; break;
+            case gcc::ir::OP_LE:    out = a <= b; break;
+            case gcc::ir::OP_ULT:   out = ua < ub; break;
+            case gcc::ir::OP_ULE:   out = ua <= ub; break;
+
+            case gcc::ir::OP_DIV:
+            case gcc::ir::OP_REM:
+                /* the one overflowing division traps at run time, leave it there */
+                if (b == 0 || (b == -1 && a == gcc::ir::sext(at, (int64_t)(1ull << (bits - 1)))))
+                    return false;
+                out = inst.op == gcc::ir::OP_DIV ? a / b : a % b;
+                break;
+
+            case gcc::ir::OP_UDIV:
+            case gcc::ir::OP_UREM:
+                if (ub == 0)
+                    return false;
+                out = (int64_t)(inst.op == gcc::ir::OP_UDIV ? ua / ub : ua % ub);
+                break;
+
+            case gcc::ir::OP_SHL:
+            case gcc::ir::OP_SHR:
+            case gcc::ir::OP_SAR:
+                if (ub >= bits)
+                    return false;
+
+                if (inst.op == gcc::ir::OP_SHL)
+                    out = (int64_t)(ua << ub);
+                else if (inst.op == gcc::ir::OP_SHR)
+                    out = (int64_t)(ua >> ub);
+                else
+                    out = a >> ub;
+                break;
+
+            default:
+                return false;
+        }
+
+        out = gcc::ir::sext(inst.type, out);
+        return true;
+    }
+
+    class fold : public gcc::ir::pass {
+        public:
+            const char *name() const { return "fold"; }
+
+            bool run(gcc::ir::function& fn)
+            {
+                std::vector<gcc::ir::value_t> map(fn.insts.size(), gcc::ir::NONE);
+                bool changed = false;
+
+                for (uint32_t b = 0; b < fn.blocks.size(); ++b) {
+                    for (gcc::ir::value_t v : fn.blocks[b].code) {
+                        gcc::ir::inst_t& inst = fn.insts[v];
+
+                        if (inst.op == gcc::ir::OP_NOP)
+                            continue;
+
+                        if (inst.op == gcc::ir::OP_PHI) {
+                            gcc::ir::value_t same = trivial(fn, map, v);
+
+                            if (same != gcc::ir::NONE) {
+                                map[v] = same;
+                                fn.remove(v);
+                                changed = true;
+                            }
+                            continue;
+                        }
+
+                        gcc::ir::value_t *ops = fn.operands_of(inst);
+
+                        /* values are defined before their uses, phis aside */
+                        for (uint32_t i = 0, n = fn.num_operands(inst); i < n; ++i)
+                            ops[i] = resolve(map, ops[i]);
+
+                        if (inst.op == gcc::ir::OP_BR)
+                            changed |= branch(fn, b, inst);
+                        else if (!(gcc::ir::info(inst.op).flags & gcc::ir::OPF_VARIADIC))
+                            changed |= simplify(fn, map, v);
+                    }
+                }
+
+                if (changed)
+                    fn.replace(map);
+
+                return changed;
+            }
+
+        private:
+            /* the value a phi merges if it's always the same one, else NONE */
+            static gcc::ir::value_t trivial(const gcc::ir::function& fn, const std::vector<gcc::ir::value_t>& map,
+                                            gcc::ir::value_t phi)
+            {
+                const gcc::ir::inst_t& inst = fn.insts[phi];
+                gcc::ir::value_t same = gcc::ir::NONE;
+
+                for (uint32_t i = 0; i < inst.arg[1]; ++i) {
+                    gcc::ir::value_t op = resolve(map, fn.operand(inst, i));
+
+                    if (op == phi || op == same)
+                        continue;
+                    if (same != gcc::ir::NONE)
+                        return gcc::ir::NONE;
+                    same = op;
+                }
+
+                return same;
+            }
+
+            /* a branch on a constant becomes a jump */
+            static bool branch(gcc::ir::function& fn, uint32_t b, gcc::ir::inst_t& inst)
+            {
+                const gcc::ir::inst_t& cond = fn.insts[inst.arg[0]];
+                gcc::ir::block_t& block     = fn.blocks[b];
+
+                if (cond.op != gcc::ir::OP_CONST)
+                    return false;
+
+                uint32_t keep = cond.imm ? block.succ[0] : block.succ[1];
+                uint32_t drop = cond.imm ? block.succ[1] : block.succ[0];
+
+                fn.remove_pred(drop, b);
+
+                inst.op       = gcc::ir::OP_JMP;
+                inst.arg[0]   = gcc::ir::NONE;
+                block.succ[0] = keep;
+                block.succ[1] = gcc::ir::NONE;
+
+                return true;
+            }
+
+            static void make_const(gcc::ir::inst_t& inst, int64_t value)
+            {
+                inst.op     = gcc::ir::OP_CONST;
+                inst.arg[0] = gcc::ir::NONE;
+                inst.arg[1] = gcc::ir::NONE;
+                inst.imm    = gcc::ir::sext(inst.type, value);
+            }
+
+            static bool simplify(gcc::ir::function& fn, std::vector<gcc::ir::value_t>& map, gcc::ir::value_t v)
+            {
+                gcc::ir::inst_t& inst = fn.insts[v];
+                uint32_t n = gcc::ir::info(inst.op).operands;
+
+                if (n == 0 || inst.op == gcc::ir::OP_LOAD || inst.op == gcc::ir::OP_STORE || inst.op == gcc::ir::OP_RET)
+                    return false;
+
+                /* lanes aren't constants */
+                if (gcc::ir::is_vector(inst.type))
+                    return false;
+
+                const gcc::ir::inst_t *a = &fn.insts[inst.arg[0]];
+                const gcc::ir::inst_t *b = n > 1 ? &fn.insts[inst.arg[1]] : nullptr;
+                int64_t value;
+
+                if (a->op == gcc::ir::OP_CONST && (!b || b->op == gcc::ir::OP_CONST)) {
+                    if (!evaluate(inst, a->type, a->imm, b ? b->imm : 0, value))
+                        return false;
+
+                    make_const(inst, value);
+                    return true;
+                }
+
+                if (!b)
+                    return false;
+
+                /* constants go to the right */
+                if (a->op == gcc::ir::OP_CONST && (gcc::ir::info(inst.op).flags & gcc::ir::OPF_COMMUTATIVE)) {
+                    std::swap(inst.arg[0], inst.arg[1]);
+                    std::swap(a, b);
+                }
+
+                gcc::ir::value_t x = inst.arg[0];
+
+                if (inst.arg[0] == inst.arg[1]) {
+                    switch (inst.op) {
+                        case gcc::ir::OP_SUB:
+                        case gcc::ir::OP_XOR:
+                        case gcc::ir::OP_NE:
+                        case gcc::ir::OP_LT:
+                        case gcc::ir::OP_ULT:
+                            make_const(inst, 0);
+                            return true;
+
+                        case gcc::ir::OP_EQ:
+                        case gcc::ir::OP_LE:
+                        case gcc::ir::OP_ULE:
+                            make_const(inst, 1);
+                            return true;
+
+                        case gcc::ir::OP_AND:
+                        case gcc::ir::OP_OR:
+                            map[v] = x;
+                            fn.remove(v);
+                            return true;
+
+                        default:
+                            return false;
+                    }
+                }
+
+                if (b->op != gcc::ir::OP_CONST)
+                    return false;
+
+                bool identity = false;
+
+                switch (inst.op) {
+                    case gcc::ir::OP_ADD: case gcc::ir::OP_SUB: case gcc::ir::OP_OR:
+                    case gcc::ir::OP_XOR: case gcc::ir::OP_SHL: case gcc::ir::OP_SHR:
+                    case gcc::ir::OP_SAR:
+                        identity = b->imm == 0;
+                        break;
+
+                    case gcc::ir::OP_MUL: case gcc::ir::OP_DIV: case gcc::ir::OP_UDIV:
+                        identity = b->imm == 1;
+                        break;
+
+                    case gcc::ir::OP_AND:
+                        identity = b->imm == -1;
+                        break;
+
+                    default:
+                        break;
+                }
+
+                if (identity) {
+                    map[v] = x;
+                    fn.remove(v);
+                    return true;
+                }
+
+                if ((inst.op == gcc::ir::OP_MUL || inst.op == gcc::ir::OP_AND) && b->imm == 0) {
+                    make_const(inst, 0);
+                    return true;
+                }
+
+                return false;
+            }
+    };
+
+    class dce : public gcc::ir::pass {
+        public:
+            const char *name() const { return "dce"; }
+
+            bool run(gcc::ir::function& fn)
+            {
+                std::vector<uint8_t> live(fn.insts.size(), 0);
+                std::vector<gcc::ir::value_t> work;
+                bool changed = false;
+
+                /* parameters stay, function::params refers to them */
+                for (gcc::ir::value_t v = 0; v < fn.insts.size(); ++v) {
+                    const gcc::ir::inst_t& inst = fn.insts[v];
+
+                    if (inst.op == gcc::ir::OP_PARAM || (gcc::ir::info(inst.op).flags & gcc::ir::OPF_EFFECT)) {
+                        live[v] = 1;
+                        work.push_back(v);
+                    }
+                }
+
+                while (!work.empty()) {
+                    const gcc::ir::inst_t& inst = fn.insts[work.back()];
+                    const gcc::ir::value_t *ops = fn.operands_of(inst);
+
+                    work.pop_back();
+
+                    for (uint32_t i = 0, n = fn.num_operands(inst); i < n; ++i) {
+                        if (ops[i] != gcc::ir::NONE && !live[ops[i]]) {
+                            live[ops[i]] = 1;
+                            work.push_back(ops[i]);
+                        }
+                    }
+                }
+
+                for (gcc::ir::value_t v = 0; v < fn.insts.size(); ++v) {
+                    if (!live[v] && fn.insts[v].op != gcc::ir::OP_NOP) {
+                        fn.remove(v);
+                        changed = true;
+                    }
+                }
+
+                return changed;
+            }
+    };
+
+    class merge : public gcc::ir::pass {
+        public:
+            const char *name() const { return "merge"; }
+
+            bool run(gcc::ir::function& fn)
+            {
+                std::vector<gcc::ir::value_t> map(fn.insts.size(), gcc::ir::NONE);
+                bool changed = false;
+
+                for (uint32_t a = 0; a < fn.blocks.size(); ++a) {
+                    for (;;) {
+                        gcc::ir::block_t& block = fn.blocks[a];
+                        uint32_t b = block.succ[0];
+
+                        if (block.code.empty() || fn.insts[block.code.back()].op != gcc::ir::OP_JMP)
+                            break;
+
+                        if (b == a || b == 0 || fn.blocks[b].preds.size() != 1)
+                            break;
+
+                        gcc::ir::block_t& next = fn.blocks[b];
+
+                        fn.remove(block.code.back());
+                        block.code.pop_back();
+
+                        for (gcc::ir::value_t v : next.code) {
+                            gcc::ir::inst_t& inst = fn.insts[v];
+
+                            /* phis of a single predecessor have one operand */
+                            if (inst.op == gcc::ir::OP_PHI) {
+                                map[v] = fn.operand(inst, 0);
+                                fn.remove(v);
+                                continue;
+                            }
+
+                            inst.block = a;
+                            block.code.push_back(v);
+                        }
+
+                        for (int i = 0; i < 2; ++i) {
+                            uint32_t succ = next.succ[i];
+
+                            block.succ[i] = succ;
+
+                            if (succ != gcc::ir::NONE)
+                                std::replace(fn.blocks[succ].preds.begin(), fn.blocks[succ].preds.end(), b, a);
+                        }
+
+                        next.code.clear();
+                        next.preds.clear();
+                        next.succ[0] = next.succ[1] = gcc::ir::NONE;
+                        changed = true;
+                    }
+                }
+
+                if (changed)
+                    fn.replace(map);
+
+                return changed;
+            }
+    };
+
+    /* how the vectorizer sees a value of a loop */
+    enum {
+        CLASS_NONE,
+        CLASS_INV,      /* the same in every iteration */
+        CLASS_IDX,      /* the induction variable times scale */
+        CLASS_ADDR,     /* an invariant base plus an index */
+        CLASS_VEC,      /* one lane per iteration */
+        CLASS_RED,      /* a sum and its update */
+        CLASS_STEP,     /* the increment of the induction variable */
+    };
+
+    /* Turns innermost loops into SIMD loops of width bytes. A loop is
+     *
+     *   h:  i = phi [i0 p], [i + 1 b]      r = phi [r0 p], [r + e b] ...
+     *       br (i < n), b, exit
+     *   b:  loads and stores at base + i * size, arithmetic on them,
+     *       jmp h
+     *
+     * with n and the bases invariant and every access of the same size.
+     * A guard between p and h checks that a whole vector of iterations
+     * is left and that no two bases, one of them stored through, are
+     * closer than a vector, unless one is a restrict parameter or they
+     * are distinct slots or globals. The vector loop then runs i up to
+     * the last multiple of the vector length and jumps into h, and the
+     * original loop does the rest. Sums are kept per lane and added up
+     * after the vector loop, sums of bytes or 32-bit values into a wider
+     * type are widened along the way (see OP_WSUM). */
+    class vectorize : public gcc::ir::pass {
+        public:
+            vectorize(unsigned width):
+                width_(width)
+            {
+            }
+
+            const char *name() const { return "vectorize"; }
+
+            bool run(gcc::ir::function& fn)
+            {
+                bool changed = false;
+
+                fn.count_uses(uses_);
+
+                /* the blocks a loop gets go to the end and aren't looked at */
+                for (uint32_t h = 0, n = (uint32_t)fn.blocks.size(); h < n; ++h) {
+                    if (!analyze(fn, h))
+                        continue;
+
+                    transform(fn);
+                    fn.count_uses(uses_);
+                    gcc::stats::add(gcc::COUNTER_VECTORIZED, 1);
+                    changed = true;
+                }
+
+                return changed;
+            }
+
+        private:
+            bool inside(const gcc::ir::function& fn, gcc::ir::value_t v) const
+            {
+                return fn.insts[v].block == header_ || fn.insts[v].block == body_;
+            }
+
+            uint8_t kind(const gcc::ir::function& fn, gcc::ir::value_t v) const
+            {
+                return inside(fn, v) ? class_[v] : (uint8_t)CLASS_INV;
+            }
+
+            static bool is_const(const gcc::ir::function& fn, gcc::ir::value_t v)
+            {
+                return fn.insts[v].op == gcc::ir::OP_CONST;
+            }
+
+            /* every access must be of the same size, it's the size of a lane */
+            bool access(unsigned size)
+            {
+                if (size > 8 || (lane_ && lane_ != size))
+                    return false;
+
+                lane_ = size;
+                return true;
+            }
+
+            /* the base of an address, the operand that isn't the index */
+            gcc::ir::value_t base(const gcc::ir::function& fn, gcc::ir::value_t addr) const
+            {
+                const gcc::ir::inst_t& inst = fn.insts[addr];
+
+                return kind(fn, inst.arg[0]) == CLASS_INV ? inst.arg[0] : inst.arg[1];
+            }
+
+            /* the loop never sees the same memory through x and y */
+            static bool disjoint(const gcc::ir::function& fn, gcc::ir::value_t x, gcc::ir::value_t y)
+            {
+                const gcc::ir::inst_t& a = fn.insts[x];
+                const gcc::ir::inst_t& b = fn.insts[y];
+
+                for (const gcc::ir::inst_t *p : { &a, &b }) {
+                    if (p->op == gcc::ir::OP_PARAM && p->imm < 64 && ((fn.noalias >> p->imm) & 1))
+                        return true;
+                }
+
+                if ((a.op == gcc::ir::OP_SLOT || a.op == gcc::ir::OP_GLOBAL) &&
+                    (b.op == gcc::ir::OP_SLOT || b.op == gcc::ir::OP_GLOBAL))
+                    return a.op != b.op || a.imm != b.imm;
+
+                return false;
+            }
+
+            /* classify an index or address computation, false if v is neither */
+            bool index(const gcc::ir::function& fn, gcc::ir::value_t v)
+            {
+                const gcc::ir::inst_t& inst = fn.insts[v];
+                const gcc::ir::inst_t& cmp  = fn.insts[cmp_];
+
+                switch (inst.op) {
+                    /* i < n keeps i and n in the range of the comparison */
+                    case gcc::ir::OP_ZEXT:
+                    case gcc::ir::OP_SEXT:
+                        if (inst.arg[0] != i_ || (inst.op == gcc::ir::OP_ZEXT) != (cmp.op == gcc::ir::OP_ULT))
+                            return false;
+                        scale_[v] = 1;
+                        break;
+
+                    case gcc::ir::OP_MUL:
+                    case gcc::ir::OP_SHL: {
+                        const gcc::ir::inst_t& by = fn.insts[inst.arg[1]];
+
+                        if (kind(fn, inst.arg[0]) != CLASS_IDX || by.op != gcc::ir::OP_CONST || by.imm < 0 || by.imm > 8)
+                            return false;
+                        scale_[v] = inst.op == gcc::ir::OP_MUL ? scale_[inst.arg[0]] * by.imm : scale_[inst.arg[0]] << by.imm;
+                        break;
+                    }
+
+                    case gcc::ir::OP_ADD: {
+                        uint8_t a = kind(fn, inst.arg[0]);
+                        uint8_t b = kind(fn, inst.arg[1]);
+                        gcc::ir::value_t idx = a == CLASS_IDX ? inst.arg[0] : inst.arg[1];
+
+                        if (inst.type != gcc::ir::TYPE_I64 || fn.insts[idx].type != gcc::ir::TYPE_I64 ||
+                            !((a == CLASS_IDX && b == CLASS_INV) || (a == CLASS_INV && b == CLASS_IDX)))
+                            return false;
+
+                        class_[v] = CLASS_ADDR;
+                        scale_[v] = scale_[idx];
+                        return true;
+                    }
+
+                    default:
+                        return false;
+                }
+
+                class_[v] = CLASS_IDX;
+                return true;
+            }
+
+            /* v is a lane zero extended */
+            bool promoted(const gcc::ir::function& fn, gcc::ir::value_t v) const
+            {
+                const gcc::ir::inst_t& inst = fn.insts[v];
+
+                return inst.op == gcc::ir::OP_ZEXT && gcc::ir::type_size(fn.insts[inst.arg[0]].type) == lane_;
+            }
+
+            /* a vector operation on lanes of lane_ bytes computes the low lane_ bytes of v */
+            bool lanewise(const gcc::ir::function& fn, gcc::ir::value_t v) const
+            {
+                const gcc::ir::inst_t& inst = fn.insts[v];
+                unsigned size = gcc::ir::type_size(inst.type);
+                int64_t by = 0;
+
+                if (size < lane_)
+                    return false;
+
+                switch (inst.op) {
+                    case gcc::ir::OP_MUL:
+                        return lane_ == 2 || lane_ == 4;
+
+                    case gcc::ir::OP_SHL:
+                    case gcc::ir::OP_SHR:
+                    case gcc::ir::OP_SAR:
+                        by = fn.insts[inst.arg[1]].imm;
+
+                        if (by < 0 || by >= lane_ * 8 || lane_ < 2)
+                            return false;
+
+                        /* the bits shifted in from above must be the lane's */
+                        if (inst.op == gcc::ir::OP_SHL)
+                            return true;
+
+                        if (size == lane_)
+                            return inst.op == gcc::ir::OP_SHR || lane_ <= 4;
+
+                        /* or zeros, a promoted lane shifts right logically */
+                        return promoted(fn, inst.arg[0]);
+
+                    default:
+                        return true;
+                }
+            }
+
+            bool analyze(const gcc::ir::function& fn, uint32_t h)
+            {
+                const gcc::ir::block_t& header = fn.blocks[h];
+                uint32_t b = header.succ[0];
+
+                if (header.code.empty() || fn.insts[header.code.back()].op != gcc::ir::OP_BR ||
+                    header.preds.size() != 2 || b == h || header.succ[1] == h || header.succ[1] == b)
+                    return false;
+
+                const gcc::ir::block_t& body = fn.blocks[b];
+
+                if (body.preds.size() != 1 || fn.insts[body.code.back()].op != gcc::ir::OP_JMP || body.succ[0] != h)
+                    return false;
+
+                header_ = h;
+                body_   = b;
+                pre_    = header.preds[0] == b ? header.preds[1] : header.preds[0];
+
+                if (pre_ == b || fn.blocks[pre_].succ[0] == fn.blocks[pre_].succ[1])
+                    return false;
+
+                /* the exit condition */
+                uint32_t back = header.preds[0] == b ? 0 : 1;
+
+                cmp_ = fn.insts[header.code.back()].arg[0];
+
+                const gcc::ir::inst_t& cmp = fn.insts[cmp_];
+
+                if ((cmp.op != gcc::ir::OP_ULT && cmp.op != gcc::ir::OP_LT) || cmp.block != h || uses_[cmp_] != 1)
+                    return false;
+
+                i_ = cmp.arg[0];
+                n_ = cmp.arg[1];
+
+                if (fn.insts[i_].op != gcc::ir::OP_PHI || fn.insts[i_].block != h ||
+                    (fn.insts[i_].type != gcc::ir::TYPE_I32 && fn.insts[i_].type != gcc::ir::TYPE_I64))
+                    return false;
+
+                class_.assign(fn.insts.size(), CLASS_NONE);
+                scale_.assign(fn.insts.size(), 0);
+                reductions_.clear();
+                checks_.clear();
+                lane_ = 0;
+
+                /* the induction variable and the sums */
+                for (gcc::ir::value_t v : header.code) {
+                    const gcc::ir::inst_t& phi = fn.insts[v];
+
+                    if (phi.op != gcc::ir::OP_PHI)
+                        break;
+
+                    gcc::ir::value_t next = fn.operand(phi, back);
+                    const gcc::ir::inst_t& update = fn.insts[next];
+
+                    if (update.op != gcc::ir::OP_ADD || update.block != b || uses_[next] != 1 ||
+                        gcc::ir::is_vector(phi.type))
+                        return false;
+
+                    if (v == i_) {
+                        if (update.arg[0] != i_ || !is_const(fn, update.arg[1]) || fn.insts[update.arg[1]].imm != 1)
+                            return false;
+
+                        class_[v]    = CLASS_IDX;
+                        scale_[v]    = 1;
+                        class_[next] = CLASS_STEP;
+                        continue;
+                    }
+
+                    if ((update.arg[0] == v) == (update.arg[1] == v))
+                        return false;
+
+                    class_[v] = class_[next] = CLASS_RED;
+                    reductions_.push_back(v);
+                }
+
+                /* anything else the header computes must be invariant */
+                for (gcc::ir::value_t v : header.code) {
+                    const gcc::ir::inst_t& inst = fn.insts[v];
+
+                    if (inst.op == gcc::ir::OP_PHI || v == cmp_ || inst.op == gcc::ir::OP_BR)
+                        continue;
+
+                    if (!invariant(fn, v))
+                        return false;
+                }
+
+                if (kind(fn, n_) != CLASS_INV)
+                    return false;
+
+                for (size_t k = 0; k + 1 < body.code.size(); ++k) {
+                    gcc::ir::value_t v = body.code[k];
+                    const gcc::ir::inst_t& inst = fn.insts[v];
+
+                    if (class_[v] != CLASS_NONE)
+                        continue;
+
+                    switch (inst.op) {
+                        case gcc::ir::OP_LOAD:
+                            if (kind(fn, inst.arg[0]) != CLASS_ADDR || scale_[inst.arg[0]] != gcc::ir::type_size(inst.type) ||
+                                !access(gcc::ir::type_size(inst.type)))
+                                return false;
+                            class_[v] = CLASS_VEC;
+                            break;
+
+                        case gcc::ir::OP_STORE: {
+                            uint8_t value = kind(fn, inst.arg[1]);
+
+                            if (kind(fn, inst.arg[0]) != CLASS_ADDR || scale_[inst.arg[0]] != gcc::ir::type_size(inst.type) ||
+                                !access(gcc::ir::type_size(inst.type)) || (value != CLASS_VEC && value != CLASS_INV))
+                                return false;
+                            break;
+                        }
+
+                        default:
+                            if (invariant(fn, v) || index(fn, v))
+                                break;
+                            if (!vector(fn, v))
+                                return false;
+                            break;
+                    }
+                }
+
+                if (!lane_)
+                    return false;
+
+                for (size_t k = 0; k + 1 < body.code.size(); ++k) {
+                    if (class_[body.code[k]] == CLASS_VEC && !lanewise(fn, body.code[k]))
+                        return false;
+                }
+
+                for (gcc::ir::value_t r : reductions_) {
+                    const gcc::ir::inst_t& update = fn.insts[fn.operand(fn.insts[r], back)];
+                    gcc::ir::value_t e = update.arg[0] == r ? update.arg[1] : update.arg[0];
+                    unsigned size = gcc::ir::type_size(fn.insts[r].type);
+
+                    if (kind(fn, e) != CLASS_VEC || size < lane_)
+                        return false;
+
+                    /* a wider sum adds lanes zero extended, pairwise first */
+                    if (size > lane_ && ((lane_ != 1 && lane_ != 4) || fn.insts[e].op != gcc::ir::OP_ZEXT ||
+                                         gcc::ir::type_size(fn.insts[fn.insts[e].arg[0]].type) != lane_))
+                        return false;
+                }
+
+                return aliases(fn);
+            }
+
+            /* a pure operation of invariants */
+            bool invariant(const gcc::ir::function& fn, gcc::ir::value_t v)
+            {
+                const gcc::ir::inst_t& inst = fn.insts[v];
+
+                switch (inst.op) {
+                    case gcc::ir::OP_CONST:
+                    case gcc::ir::OP_SLOT:
+                    case gcc::ir::OP_GLOBAL:
+                        break;
+
+                    /* the guard computes it even if the loop doesn't run, it can't trap */
+                    case gcc::ir::OP_DIV: case gcc::ir::OP_UDIV:
+                    case gcc::ir::OP_REM: case gcc::ir::OP_UREM:
+                        if (!is_const(fn, inst.arg[1]) || fn.insts[inst.arg[1]].imm == 0 || fn.insts[inst.arg[1]].imm == -1)
+                            return false;
+                        /* fall through */
+
+                    case gcc::ir::OP_ADD: case gcc::ir::OP_SUB: case gcc::ir::OP_MUL:
+                    case gcc::ir::OP_AND: case gcc::ir::OP_OR:  case gcc::ir::OP_XOR:
+                    case gcc::ir::OP_SHL: case gcc::ir::OP_SHR: case gcc::ir::OP_SAR:
+                    case gcc::ir::OP_NEG: case gcc::ir::OP_NOT: case gcc::ir::OP_EQ:
+                    case gcc::ir::OP_NE:  case gcc::ir::OP_LT:  case gcc::ir::OP_LE:
+                    case gcc::ir::OP_ULT: case gcc::ir::OP_ULE: case gcc::ir::OP_SEXT:
+                    case gcc::ir::OP_ZEXT: case gcc::ir::OP_TRUNC:
+                        for (uint32_t k = 0; k < gcc::ir::info(inst.op).operands; ++k) {
+                            if (kind(fn, inst.arg[k]) != CLASS_INV)
+                                return false;
+                        }
+                        break;
+
+                    default:
+                        return false;
+                }
+
+                class_[v] = CLASS_INV;
+                return true;
+            }
+
+            /* an operation with a lane per iteration */
+            bool vector(const gcc::ir::function& fn, gcc::ir::value_t v)
+            {
+                const gcc::ir::inst_t& inst = fn.insts[v];
+                uint32_t n = gcc::ir::info(inst.op).operands;
+                bool lanes = false;
+
+                switch (inst.op) {
+                    case gcc::ir::OP_SHL:
+                    case gcc::ir::OP_SHR:
+                    case gcc::ir::OP_SAR:
+                        if (!is_const(fn, inst.arg[1]))
+                            return false;
+                        n = 1;
+                        break;
+
+                    case gcc::ir::OP_ADD: case gcc::ir::OP_SUB: case gcc::ir::OP_MUL:
+                    case gcc::ir::OP_AND: case gcc::ir::OP_OR:  case gcc::ir::OP_XOR:
+                    case gcc::ir::OP_NEG: case gcc::ir::OP_NOT: case gcc::ir::OP_SEXT:
+                    case gcc::ir::OP_ZEXT: case gcc::ir::OP_TRUNC:
+                        break;
+
+                    default:
+                        return false;
+                }
+
+                for (uint32_t k = 0; k < n; ++k) {
+                    uint8_t c = kind(fn, inst.arg[k]);
+
+                    if (c != CLASS_VEC && c != CLASS_INV)
+                        return false;
+                    lanes |= c == CLASS_VEC;
+                }
+
+                if (!lanes)
+                    return false;
+
+                class_[v] = CLASS_VEC;
+                return true;
+            }
+
+            /* the pairs of bases to check at run time, false if there are too many */
+            bool aliases(const gcc::ir::function& fn)
+            {
+                std::vector<std::pair<gcc::ir::value_t, bool>> bases;
+                const gcc::ir::block_t& body = fn.blocks[body_];
+
+                for (gcc::ir::value_t v : body.code) {
+                    const gcc::ir::inst_t& inst = fn.insts[v];
+
+                    if (inst.op == gcc::ir::OP_LOAD || inst.op == gcc::ir::OP_STORE)
+                        bases.push_back({ base(fn, inst.arg[0]), inst.op == gcc::ir::OP_STORE });
+                }
+
+                for (size_t x = 0; x < bases.size(); ++x) {
+                    for (size_t y = 0; y < x; ++y) {
+                        std::pair<gcc::ir::value_t, gcc::ir::value_t> pair(bases[y].first, bases[x].first);
+
+                        if (pair.first == pair.second || !(bases[x].second || bases[y].second) ||
+                            disjoint(fn, pair.first, pair.second) ||
+                            std::find(checks_.begin(), checks_.end(), pair) != checks_.end())
+                            continue;
+
+                        if (checks_.size() == 8)
+                            return false;
+                        checks_.push_back(pair);
+                    }
+                }
+
+                return true;
+            }
+
+            /* the value of invariant v in the guard, cloned there if it's computed in the loop */
+            gcc::ir::value_t hoist(gcc::ir::function& fn, gcc::ir::value_t v)
+            {
+                if (v == gcc::ir::NONE || !inside(fn, v))
+                    return v;
+
+                if (map_[v] == gcc::ir::NONE) {
+                    gcc::ir::inst_t inst = fn.insts[v];
+                    gcc::ir::value_t a   = hoist(fn, inst.arg[0]);
+                    gcc::ir::value_t b   = hoist(fn, inst.arg[1]);
+
+                    map_[v] = fn.add(guard_, inst.op, inst.type, a, b, inst.imm);
+                }
+
+                return map_[v];
+            }
+
+            /* v in every lane, made once in the guard */
+            gcc::ir::value_t splat(gcc::ir::function& fn, gcc::ir::value_t v)
+            {
+                if (splat_[v] == gcc::ir::NONE) {
+                    gcc::ir::value_t s = hoist(fn, v);
+
+                    splat_[v] = fn.add(guard_, gcc::ir::OP_SPLAT, vtype_, s);
+                }
+
+                return splat_[v];
+            }
+
+            gcc::ir::value_t splat(gcc::ir::function& fn, uint8_t type, int64_t imm)
+            {
+                gcc::ir::value_t c = fn.add(guard_, gcc::ir::OP_CONST, gcc::ir::lane_type(type), gcc::ir::NONE, gcc::ir::NONE, imm);
+
+                return fn.add(guard_, gcc::ir::OP_SPLAT, type, c);
+            }
+
+            /* operand v of a vector operation */
+            gcc::ir::value_t lanes(gcc::ir::function& fn, gcc::ir::value_t v)
+            {
+                return kind(fn, v) == CLASS_VEC ? map_[v] : splat(fn, v);
+            }
+
+            /* give a phi of h an operand for the edge from a new last predecessor */
+            static void append(gcc::ir::function& fn, gcc::ir::value_t phi, gcc::ir::value_t value)
+            {
+                gcc::ir::value_t first = (gcc::ir::value_t)fn.operands.size();
+                gcc::ir::inst_t inst   = fn.insts[phi];
+
+                for (uint32_t k = 0; k < inst.arg[1]; ++k) {
+                    gcc::ir::value_t op = fn.operands[inst.arg[0] + k];
+                    fn.operands.push_back(op);
+                }
+
+                fn.operands.push_back(value);
+                fn.insts[phi].arg[0] = first;
+                fn.insts[phi].arg[1] = inst.arg[1] + 1;
+            }
+
+            void transform(gcc::ir::function& fn)
+            {
+                uint32_t h   = header_;
+                uint32_t vf  = width_ / lane_;
+                uint8_t type = fn.insts[i_].type;
+                uint8_t op   = fn.insts[cmp_].op;
+                uint8_t wide = gcc::ir::vector_type(gcc::ir::TYPE_I64, width_);
+                std::vector<gcc::ir::value_t> accs, sums;
+
+                vtype_ = gcc::ir::vector_type(gcc::ir::TYPE_I8 + __builtin_ctz(lane_), width_);
+                map_.assign(fn.insts.size(), gcc::ir::NONE);
+                splat_.assign(fn.insts.size(), gcc::ir::NONE);
+
+                guard_ = fn.add_block();
+
+                uint32_t vb = fn.add_block();
+                uint32_t vx = fn.add_block();
+
+                /* p -> guard -> h, the guard takes p's place among the predecessors */
+                for (int k = 0; k < 2; ++k) {
+                    if (fn.blocks[pre_].succ[k] == h)
+                        fn.blocks[pre_].succ[k] = guard_;
+                }
+
+                *std::find(fn.blocks[h].preds.begin(), fn.blocks[h].preds.end(), pre_) = guard_;
+                fn.blocks[guard_].preds.push_back(pre_);
+                fn.blocks[vb].preds.push_back(guard_);
+
+                uint32_t entry = fn.blocks[h].preds[0] == guard_ ? 0 : 1;
+                gcc::ir::value_t i0 = fn.operand(fn.insts[i_], entry);
+                gcc::ir::value_t n  = hoist(fn, n_);
+
+                /* at least a vector to go and no overlap */
+                gcc::ir::value_t count = fn.add(guard_, gcc::ir::OP_SUB, type, n, i0);
+                gcc::ir::value_t step  = fn.add(guard_, gcc::ir::OP_CONST, type, gcc::ir::NONE, gcc::ir::NONE, vf);
+                gcc::ir::value_t ok    = fn.add(guard_, op, gcc::ir::TYPE_I32, i0, n);
+                gcc::ir::value_t cond  = fn.add(guard_, gcc::ir::OP_ULE, gcc::ir::TYPE_I32, step, count);
+
+                cond = fn.add(guard_, gcc::ir::OP_AND, gcc::ir::TYPE_I32, ok, cond);
+
+                for (const std::pair<gcc::ir::value_t, gcc::ir::value_t>& check : checks_) {
+                    gcc::ir::value_t x = hoist(fn, check.first);
+                    gcc::ir::value_t y = hoist(fn, check.second);
+                    gcc::ir::value_t d = fn.add(guard_, gcc::ir::OP_SUB, gcc::ir::TYPE_I64, x, y);
+                    gcc::ir::value_t c = fn.add(guard_, gcc::ir::OP_CONST, gcc::ir::TYPE_I64, gcc::ir::NONE, gcc::ir::NONE, width_ - 1);
+
+                    /* |x - y| >= width as x - y + width - 1 >= 2 * width - 1 unsigned */
+                    d = fn.add(guard_, gcc::ir::OP_ADD, gcc::ir::TYPE_I64, d, c);
+                    c = fn.add(guard_, gcc::ir::OP_CONST, gcc::ir::TYPE_I64, gcc::ir::NONE, gcc::ir::NONE, 2 * width_ - 1);
+                    c = fn.add(guard_, gcc::ir::OP_ULE, gcc::ir::TYPE_I32, c, d);
+                    cond = fn.add(guard_, gcc::ir::OP_AND, gcc::ir::TYPE_I32, cond, c);
+                }
+
+                gcc::ir::value_t mask = fn.add(guard_, gcc::ir::OP_CONST, type, gcc::ir::NONE, gcc::ir::NONE, -(int64_t)vf);
+                gcc::ir::value_t end  = fn.add(guard_, gcc::ir::OP_AND, type, count, mask);
+
+                end = fn.add(guard_, gcc::ir::OP_ADD, type, i0, end);
+
+                /* the vector loop */
+                gcc::ir::value_t iv = fn.add_variadic(vb, gcc::ir::OP_PHI, type, 2);
+
+                map_[i_] = iv;
+
+                for (gcc::ir::value_t r : reductions_) {
+                    bool widen = gcc::ir::type_size(fn.insts[r].type) != lane_;
+                    uint8_t t  = widen ? wide : vtype_;
+                    gcc::ir::value_t acc = fn.add_variadic(vb, gcc::ir::OP_PHI, t, 2);
+
+                    fn.operand(fn.insts[acc], 0) = splat(fn, t, 0);
+                    map_[r] = acc;
+                    accs.push_back(acc);
+                }
+
+                for (size_t k = 0; k + 1 < fn.blocks[body_].code.size(); ++k) {
+                    gcc::ir::value_t v   = fn.blocks[body_].code[k];
+                    gcc::ir::inst_t inst = fn.insts[v];
+
+                    switch (class_[v]) {
+                        case CLASS_IDX:
+                            map_[v] = fn.add(vb, inst.op, inst.type, map_[inst.arg[0]], hoist(fn, inst.arg[1]));
+                            break;
+
+                        case CLASS_ADDR: {
+                            gcc::ir::value_t a = kind(fn, inst.arg[0]) == CLASS_INV ? hoist(fn, inst.arg[0]) : map_[inst.arg[0]];
+                            gcc::ir::value_t b = kind(fn, inst.arg[1]) == CLASS_INV ? hoist(fn, inst.arg[1]) : map_[inst.arg[1]];
+
+                            map_[v] = fn.add(vb, gcc::ir::OP_ADD, inst.type, a, b);
+                            break;
+                        }
+
+                        case CLASS_RED: {
+                            gcc::ir::value_t r = kind(fn, inst.arg[0]) == CLASS_RED ? inst.arg[0] : inst.arg[1];
+                            gcc::ir::value_t e = r == inst.arg[0] ? inst.arg[1] : inst.arg[0];
+                            gcc::ir::value_t acc = map_[r];
+                            uint8_t t = fn.insts[acc].type;
+
+                            if (t == wide && gcc::ir::type_size(fn.insts[r].type) != lane_)
+                                e = fn.add(vb, gcc::ir::OP_WSUM, wide, map_[fn.insts[e].arg[0]]);
+                            else
+                                e = map_[e];
+
+                            map_[v] = fn.add(vb, gcc::ir::OP_ADD, t, acc, e);
+                            break;
+                        }
+
+                        case CLASS_VEC:
+                            switch (inst.op) {
+                                case gcc::ir::OP_LOAD:
+                                    map_[v] = fn.add(vb, gcc::ir::OP_LOAD, vtype_, map_[inst.arg[0]]);
+                                    break;
+
+                                /* lanes are the low bytes already */
+                                case gcc::ir::OP_SEXT:
+                                case gcc::ir::OP_ZEXT:
+                                case gcc::ir::OP_TRUNC:
+                                    map_[v] = map_[inst.arg[0]];
+                                    break;
+
+                                case gcc::ir::OP_NOT:
+                                    map_[v] = fn.add(vb, gcc::ir::OP_XOR, vtype_, lanes(fn, inst.arg[0]), splat(fn, vtype_, -1));
+                                    break;
+
+                                case gcc::ir::OP_NEG:
+                                    map_[v] = fn.add(vb, gcc::ir::OP_SUB, vtype_, splat(fn, vtype_, 0), lanes(fn, inst.arg[0]));
+                                    break;
+
+                                case gcc::ir::OP_SHL:
+                                case gcc::ir::OP_SHR:
+                                case gcc::ir::OP_SAR: {
+                                    uint8_t shift = inst.op;
+
+                                    if (shift == gcc::ir::OP_SAR && gcc::ir::type_size(inst.type) != lane_)
+                                        shift = gcc::ir::OP_SHR;
+
+                                    map_[v] = fn.add(vb, shift, vtype_, map_[inst.arg[0]], hoist(fn, inst.arg[1]));
+                                    break;
+                                }
+
+                                default: {
+                                    gcc::ir::value_t a = lanes(fn, inst.arg[0]);
+                                    gcc::ir::value_t b = lanes(fn, inst.arg[1]);
+
+                                    map_[v] = fn.add(vb, inst.op, vtype_, a, b);
+                                    break;
+                                }
+                            }
+                            break;
+
+                        default:
+                            /* stores, the rest is the step or invariant */
+                            if (inst.op == gcc::ir::OP_STORE) {
+                                gcc::ir::value_t value = lanes(fn, inst.arg[1]);
+
+                                fn.add(vb, gcc::ir::OP_STORE, vtype_, map_[inst.arg[0]], value);
+                            }
+                            break;
+                    }
+                }
+
+                gcc::ir::value_t next = fn.add(vb, gcc::ir::OP_ADD, type, iv, step);
+                gcc::ir::value_t more = fn.add(vb, gcc::ir::OP_NE, gcc::ir::TYPE_I32, next, end);
+
+                fn.branch(vb, more, vb, vx);
+                fn.operand(fn.insts[iv], 0) = i0;
+                fn.operand(fn.insts[iv], 1) = next;
+
+                /* add up the lanes of the sums and carry on with the scalar loop */
+                for (size_t k = 0; k < reductions_.size(); ++k) {
+                    gcc::ir::value_t r   = reductions_[k];
+                    gcc::ir::value_t acc = accs[k];
+                    gcc::ir::value_t out = map_[fn.operand(fn.insts[r], 1 - entry)];
+                    uint8_t type = fn.insts[r].type;
+                    gcc::ir::value_t sum;
+
+                    fn.operand(fn.insts[acc], 1) = out;
+
+                    if (fn.insts[acc].type == wide) {
+                        sum = fn.add(vx, gcc::ir::OP_HSUM, gcc::ir::TYPE_I64, out);
+
+                        if (type != gcc::ir::TYPE_I64)
+                            sum = fn.add(vx, gcc::ir::OP_TRUNC, type, sum);
+                    } else {
+                        sum = fn.add(vx, gcc::ir::OP_HSUM, type, out);
+                    }
+
+                    sums.push_back(fn.add(vx, gcc::ir::OP_ADD, type, fn.operand(fn.insts[r], entry), sum));
+                }
+
+                fn.jump(vx, h);
+                append(fn, i_, end);
+
+                for (size_t k = 0; k < reductions_.size(); ++k)
+                    append(fn, reductions_[k], sums[k]);
+
+                /* the guard goes last, everything it computes is there now */
+                fn.add(guard_, gcc::ir::OP_BR, gcc::ir::TYPE_VOID, cond);
+                fn.blocks[guard_].succ[0] = vb;
+                fn.blocks[guard_].succ[1] = h;
+            }
+
+            unsigned width_;
+            std::vector<uint32_t> uses_;
+            std::vector<uint8_t> class_;
+            std::vector<int64_t> scale_;                 /* bytes per iteration of CLASS_IDX and CLASS_ADDR */
+            std::vector<gcc::ir::value_t> map_;          /* a value's counterpart in the guard or the vector loop */
+            std::vector<gcc::ir::value_t> splat_;
+            std::vector<gcc::ir::value_t> reductions_;   /* the phis of the sums */
+            std::vector<std::pair<gcc::ir::value_t, gcc::ir::value_t>> checks_;
+            uint32_t pre_, header_, body_, guard_;
+            gcc::ir::value_t i_, cmp_, n_;
+            unsigned lane_;                              /* bytes of every access */
+            uint8_t vtype_;
+    };
+};
+
+std::unique_ptr<gcc::ir::pass> gcc::ir::make_fold()
+{
+    return std::unique_ptr<gcc::ir::pass>(new fold());
+}
+
+std::unique_ptr<gcc::ir::pass> gcc::ir::make_dce()
+{
+    return std::unique_ptr<gcc::ir::pass>(new dce());
+}
+
+std::unique_ptr<gcc::ir::pass> gcc::ir::make_merge()
+{
+    return std::unique_ptr<gcc::ir::pass>(new merge());
+}
+
+std::unique_ptr<gcc::ir::pass> gcc::ir::make_vectorize(unsigned width)
+{
+    return std::unique_ptr<gcc::ir::pass>(new vectorize(width));
+}
+
+gcc::ir::pass_manager::pass_manager():
+    passes_(),
+    verify_(false)
+{
+}
+
+gcc::ir::pass_manager::~pass_manager()
+{
+}
+
+void gcc::ir::pass_manager::add(std::unique_ptr<gcc::ir::pass> pass)
+{
+    passes_.push_back(std::move(pass));
+}
+
+void gcc::ir::pass_manager::add_defaults(int level, unsigned vector)
+{
+    if (level < 1)
+        return;
+
+    /* folding branches leaves blocks to merge, merging exposes more to fold */
+    add(make_fold());
+    add(make_merge());
+    add(make_fold());
+    add(make_dce());
+
+    /* last, on loops folding has cleaned up */
+    if (vector)
+        add(make_vectorize(vector));
+}
+
+gcc_error_t gcc::ir::pass_manager::run(gcc::ir::function& fn)
+{
+    if (verify_ && gcc::ir::verify(fn) != GCC_SUCCESS) {
+        ERROR("%s(): invalid IR before optimizing\n", gcc::symbol_str(fn.name));
+        return GCC_INVALID_VALUE;
+    }
+
+    for (auto& pass : passes_) {
+        if (!pass->run(fn))
+            continue;
+
+        fn.compact();
+
+        if (verify_ && gcc::ir::verify(fn) != GCC_SUCCESS) {
+            ERROR("%s(): invalid IR after %s\n", gcc::symbol_str(fn.name), pass->name());
+            return GCC_INVALID_VALUE;
+        }
+    }
+
+    return GCC_SUCCESS;
+}
+
+gcc_error_t gcc::ir::pass_manager::run(gcc::ir::module& module)
+{
+    gcc::scoped_timer timer(gcc::PHASE_OPTIMIZE);
+    size_t instructions = 0;
+
+    for (gcc::ir::function *fn : module.functions) {
+        if (run(*fn) != GCC_SUCCESS)
+            return GCC_INVALID_VALUE;
+
+        instructions += fn->insts.size();
+    }
+
+    gcc::stats::add(gcc::COUNTER_INSTRUCTIONS, instructions);
+
+    return GCC_SUCCESS;
+}
@@ -0,0 +1,71 @@
+#ifndef __PASS_HH__
+#define __PASS_HH__
+
+#include <memory>
+#include <vector>
+
+#include "ir.hh"
+#include "util/error.hh"
+
+namespace gcc {
+
+    namespace ir {
+
+        /* A transformation of one function. Passes see compacted
+         * functions (see function::compact()) and may leave removed
+         * instructions and dead blocks behind for the manager to sweep. */
+        class pass {
+            public:
+                virtual ~pass() {}
+
+                virtual const char *name() const = 0;
+
+                /* true if fn was changed */
+                virtual bool run(gcc::ir::function& fn) = 0;
+        };
+
+        /* Runs a pipeline of passes over every function of a module, one
+         * function at a time so its arrays stay in cache for the whole
+         * pipeline. A function is compacted after each pass that changed
+         * it and, with verification on, checked after every pass. */
+        class pass_manager {
+            public:
+                pass_manager();
+                ~pass_manager();
+
+                void add(std::unique_ptr<gcc::ir::pass> pass);
+
+                /* The pipeline of optimization level (0 runs nothing),
+                 * loops are vectorized to vector bytes (16 for SSE2, 32
+                 * for AVX2, 0 not at all). */
+                void add_defaults(int level, unsigned vector = 16);
+
+                /* check every function after every pass, see ir::verify() */
+                void set_verify(bool verify) { verify_ = verify; }
+
+                gcc_error_t run(gcc::ir::module& module);
+                gcc_error_t run(gcc::ir::function& fn);
+
+            private:
+                pass_manager(const pass_manager&);
+                pass_manager& operator=(const pass_manager&);
+
+                std::vector<std::unique_ptr<gcc::ir::pass>> passes_;
+                bool verify_;
+        };
+
+        /* constant folding, algebraic identities and branches on constants */
+        std::unique_ptr<gcc::ir::pass> make_fold();
+
+        /* removes instructions whose values aren't used, cycles included */
+        std::unique_ptr<gcc::ir::pass> make_dce();
+
+        /* merges blocks into their only predecessor */
+        std::unique_ptr<gcc::ir::pass> make_merge();
+
+        /* turns simple counted loops over arrays into SIMD loops of width bytes */
+        std::unique_ptr<gcc::ir::pass> make_vectorize(unsigned width);
+    };
+};
+
+#endif /* __PASS_HH__ */
@@ -0,0 +1,180 @@
+#include <climits>
+#include <cstring>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "cache.hh"
+#include "pch.hh"
+#include "serialize.hh"
+#include "stats.hh"
+#include "util/log.hh"
+
+#define CHANNEL "pch"
+
+/* "GBPC", bump the version whenever the layout changes */
+#define PCH_MAGIC   0x43504247u
+#define PCH_VERSION 3u
+
+gcc::pch::pch():
+    path_(),
+    hash_(),
+    self_(),
+    deps_(),
+    file_(),
+    state_(0),
+    image_()
+{
+}
+
+gcc::pch::~pch()
+{
+}
+
+bool gcc::pch::unchanged(const dependency_t& dep)
+{
+    struct stat st;
+
+    return stat(dep.path.c_str(), &st) == 0 && (uint64_t)st.st_size == dep.size &&
+           (uint64_t)st.st_mtim.tv_sec * 1000000000ull + st.st_mtim.tv_nsec == dep.mtime;
+}
+
+void gcc::pch::write(std::string& out, const gcc::preprocessor& preprocessor, const gcc::prog_t& prog)
+{
+    std::vector<std::string> files = preprocessor.files();
+    gcc::serialize::symbol_table table;
+    std::string state;
+    header_t header;
+    char cwd[PATH_MAX];
+
+    /* a PCH is used from other directories than the one it was made in */
+    if (getcwd(cwd, sizeof(cwd))) {
+        for (std::string& file : files) {
+            if (file[0] != '/')
+                file = std::string(cwd) + "/" + file;
+        }
+    }
+
+    memset(&header, 0, sizeof(header));
+    header.magic    = PCH_MAGIC;
+    header.version  = PCH_VERSION;
+    header.compiler = gcc::cache::compiler();
+
+    out.assign((const char *)&header, sizeof(header));
+
+    gcc::serialize::put32(out, (uint32_t)files.size());
+
+    for (const std::string& file : files) {
+        struct stat st;
+
+        if (stat(file.c_str(), &st) < 0)
+            memset(&st, 0, sizeof(st));
+
+        gcc::serialize::put32(out, (uint32_t)file.size());
+        out.append(file);
+        gcc::serialize::put64(out, (uint64_t)st.st_size);
+        gcc::serialize::put64(out, (uint64_t)st.st_mtim.tv_sec * 1000000000ull + st.st_mtim.tv_nsec);
+    }
+
+    /* the table has to be complete before it's written */
+    preprocessor.save(state, table);
+    table.write(out);
+    out.append(state);
+
+    /* the image is aligned in out, and so in the mapped file */
+    header.image = (out.size() + 7) & ~(uint64_t)7;
+    gcc::image::write(out, prog);
+
+    header.contents = gcc::hash128(out.data() + sizeof(header), out.size() - sizeof(header));
+    memcpy(&out[0], &header, sizeof(header));
+}
+
+gcc_error_t gcc::pch::map(const char *file)
+{
+    gcc::scoped_timer timer(gcc::PHASE_LOAD);
+    header_t header;
+    struct stat st;
+    gcc_error_t ret;
+
+    path_ = file;
+    deps_.clear();
+
+    if ((ret = file_.open(file)) != GCC_SUCCESS)
+        return ret;
+
+    if (stat(file, &st) < 0)
+        memset(&st, 0, sizeof(st));
+
+    self_ = { path_, (uint64_t)st.st_size, (uint64_t)st.st_mtim.tv_sec * 1000000000ull + st.st_mtim.tv_nsec };
+
+    gcc::serialize::cursor_t in = { file_.data(), file_.data() + file_.size(), true };
+    const char *data = in.take(sizeof(header));
+
+    if (data)
+        memcpy(&header, data, sizeof(header));
+
+    if (!data || header.magic != PCH_MAGIC || header.version != PCH_VERSION ||
+        !(header.compiler == gcc::cache::compiler())) {
+        ERROR("%s: not a precompiled header of this build of the compiler\n", file);
+        return GCC_INVALID_VALUE;
+    }
+
+    hash_ = header.contents;
+
+    uint32_t count = in.u32();
+
+    for (uint32_t i = 0; i < count && in.ok; ++i) {
+        uint32_t len     = in.u32();
+        const char *path = in.take(len);
+        uint64_t size    = in.u64();
+        uint64_t mtime   = in.u64();
+
+        if (path)
+            deps_.push_back({ std::string(path, len), size, mtime });
+    }
+
+    state_ = in.ptr - file_.data();
+
+    if (!in.ok || header.image < state_ || header.image > file_.size()) {
+        ERROR("%s: truncated precompiled header\n", file);
+        return GCC_INVALID_VALUE;
+    }
+
+    for (const dependency_t& dep : deps_) {
+        if (!unchanged(dep)) {
+            ERROR("%s: %s has changed since the precompiled header was written\n", file, dep.path.c_str());
+            return GCC_INVALID_VALUE;
+        }
+    }
+
+    return image_.open(file_.data() + header.image, file_.size() - header.image);
+}
+
+bool gcc::pch::stale() const
+{
+    if (!unchanged(self_))
+        return true;
+
+    for (const dependency_t& dep : deps_) {
+        if (!unchanged(dep))
+            return true;
+    }
+
+    return false;
+}
+
+gcc_error_t gcc::pch::restore(gcc::preprocessor& preprocessor) const
+{
+    gcc::scoped_timer timer(gcc::PHASE_PREPROCESS);
+    gcc::serialize::cursor_t in = { file_.data() + state_, file_.data() + file_.size(), true };
+    std::vector<gcc::symbol_t> symbols;
+
+    gcc::serialize::symbol_table::read(in, symbols);
+
+    if (preprocessor.restore(in, symbols) != GCC_SUCCESS) {
+        ERROR("%s: invalid precompiled header\n", path_.c_str());
+        return GCC_INVALID_VALUE;
+    }
+
+    return GCC_SUCCESS;
+}
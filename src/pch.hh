@@ -0,0 +1,100 @@
+#ifndef __PCH_HH__
+#define __PCH_HH__
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "hash.hh"
+#include "image.hh"
+#include "parser.hh"
+#include "preprocessor.hh"
+#include "source.hh"
+#include "util/error.hh"
+
+namespace gcc {
+
+    /* Precompiled header.
+     *
+     * --emit-pch preprocesses and parses a header once and writes what
+     * that left behind to one file: the state of the preprocessor (macros,
+     * #pragma once and include guards, see preprocessor::save()) with a
+     * table of the symbols it refers to, and the header's declarations as
+     * a gcc::image. A unit compiled with --include-pch starts from there
+     * as if its first line included the header. The file is mapped once
+     * per run and read in place, the image's program is built once per
+     * parser and shared by the units after it (see parser::set_prelude()),
+     * so a unit pays for restoring the macros, not for tokenizing or
+     * parsing the header. Including the header again is skipped by its
+     * guard without opening it.
+     *
+     * The files the header was made of are recorded with their size and
+     * mtime, and a PCH is refused once any of them changed. Like cache
+     * entries a PCH is only valid for the build of the compiler that
+     * wrote it. */
+    class pch {
+        public:
+            pch();
+            ~pch();
+
+            /* Append the PCH of a header to out, preprocessor has run over
+             * the header and prog was parsed from its output. */
+            static void write(std::string& out, const gcc::preprocessor& preprocessor, const gcc::prog_t& prog);
+
+            /* map a PCH file and check that it's valid and up to date */
+            gcc_error_t map(const char *file);
+
+            /* true if the mapped file or a file it was made of changed since map() */
+            bool stale() const;
+
+            /* Restore the state of the preprocessor after the header, its
+             * symbols are interned into the calling thread's interner. */
+            gcc_error_t restore(gcc::preprocessor& preprocessor) const;
+
+            /* the header's declarations, see parser::set_prelude() */
+            const gcc::image& prog() const { return image_; }
+
+            const std::string& path() const { return path_; }
+
+            /* hash of the mapped file, the units after it depend on it.
+             * It's computed by write() and read from the header, map()
+             * doesn't read more of the file than it uses. */
+            const gcc::hash128_t& hash() const { return hash_; }
+
+        private:
+            pch(const pch&);
+            pch& operator=(const pch&);
+
+            /* a file and the identity it had when it was read */
+            typedef struct dependency {
+                std::string path;
+                uint64_t size;
+                uint64_t mtime;
+            } dependency_t;
+
+            /* on-disk header, followed by the dependencies, the symbol
+             * table, the preprocessor state and the image */
+            typedef struct header {
+                uint32_t magic;
+                uint32_t version;
+                gcc::hash128_t compiler;
+                gcc::hash128_t contents;  /* of everything after the header */
+                uint64_t image;           /* offset, 8-byte aligned */
+            } header_t;
+
+            /* false if path doesn't have the identity of dep */
+            static bool unchanged(const dependency_t& dep);
+
+            std::string path_;
+            gcc::hash128_t hash_;
+            dependency_t self_;
+            std::vector<dependency_t> deps_;
+
+            gcc::source_buffer file_;
+            size_t state_;            /* offset of the symbol table */
+            gcc::image image_;
+    };
+};
+
+#endif /* __PCH_HH__ */
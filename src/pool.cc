@@ -0,0 +1,135 @@
+#include "pool.hh"
+
+/* the pool the calling thread works for and its index in it */
+static thread_local gcc::thread_pool *current_pool;
+static thread_local int current_id = -1;
+
+gcc::thread_pool::thread_pool(size_t threads):
+    workers_(),
+    lock_(),
+    work_cv_(),
+    done_cv_(),
+    queued_(0),
+    pending_(0),
+    next_(0),
+    stop_(false)
+{
+    if (!threads)
+        threads = std::thread::hardware_concurrency();
+    if (!threads)
+        threads = 1;
+
+    for (size_t i = 0; i < threads; ++i)
+        workers_.emplace_back(new worker_t());
+
+    /* start the threads only once every deque exists, they steal from each other */
+    for (size_t i = 0; i < threads; ++i)
+        workers_[i]->thread = std::thread(&gcc::thread_pool::run, this, (int)i);
+}
+
+gcc::thread_pool::~thread_pool()
+{
+    wait();
+
+    {
+        std::lock_guard<std::mutex> guard(lock_);
+        stop_ = true;
+    }
+    work_cv_.notify_all();
+
+    for (auto& worker : workers_)
+        worker->thread.join();
+}
+
+int gcc::thread_pool::worker_id()
+{
+    return current_id;
+}
+
+void gcc::thread_pool::submit(gcc::thread_pool::task_t task)
+{
+    size_t id = current_pool == this ? (size_t)current_id : next_++ % workers_.size();
+
+    pending_++;
+
+    /* counted before it's visible so a worker that takes it never sees
+     * queued_ wrap, the lock orders this against workers going to sleep */
+    {
+        std::lock_guard<std::mutex> guard(lock_);
+        queued_++;
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(workers_[id]->lock);
+        workers_[id]->tasks.push_back(std::move(task));
+    }
+
+    work_cv_.notify_one();
+}
+
+void gcc::thread_pool::wait()
+{
+    std::unique_lock<std::mutex> guard(lock_);
+
+    done_cv_.wait(guard, [this] { return pending_ == 0; });
+}
+
+bool gcc::thread_pool::pop(int id, gcc::thread_pool::task_t& task)
+{
+    worker_t& w = *workers_[id];
+    std::lock_guard<std::mutex> guard(w.lock);
+
+    if (w.tasks.empty())
+        return false;
+
+    task = std::move(w.tasks.back());
+    w.tasks.pop_back();
+    return true;
+}
+
+bool gcc::thread_pool::steal(int id, gcc::thread_pool::task_t& task)
+{
+    size_t n = workers_.size();
+
+    for (size_t i = 1; i < n; ++i) {
+        worker_t& victim = *workers_[(id + i) % n];
+        std::lock_guard<std::mutex> guard(victim.lock);
+
+        if (victim.tasks.empty())
+            continue;
+
+        task = std::move(victim.tasks.front());
+        victim.tasks.pop_front();
+        return true;
+    }
+
+    return false;
+}
+
+void gcc::thread_pool::run(int id)
+{
+    current_pool = this;
+    current_id   = id;
+
+    for (;;) {
+        task_t task;
+
+        if (pop(id, task) || steal(id, task)) {
+            queued_--;
+            task();
+
+            if (--pending_ == 0) {
+                std::lock_guard<std::mutex> guard(lock_);
+                done_cv_.notify_all();
+            }
+            continue;
+        }
+
+        std::unique_lock<std::mutex> guard(lock_);
+
+        work_cv_.wait(guard, [this] { return stop_ || queued_ != 0; });
+
+        if (stop_ && queued_ == 0)
+            return;
+    }
+}
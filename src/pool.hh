@@ -0,0 +1,68 @@
+#ifndef __POOL_HH__
+#define __POOL_HH__
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace gcc {
+
+    /* Work-stealing thread pool.
+     *
+     * Every worker owns a deque of tasks: it pops its own work from the
+     * back (most recently pushed, still warm in cache) and, when it runs
+     * dry, steals from the front of the other workers' deques. Tasks
+     * submitted from outside the pool are dealt round-robin, tasks
+     * submitted by a task go to the submitting worker's own deque. */
+    class thread_pool {
+        public:
+            typedef std::function<void()> task_t;
+
+            /* threads == 0 means one worker per hardware thread */
+            thread_pool(size_t threads = 0);
+            ~thread_pool();
+
+            void submit(task_t task);
+
+            /* block until every submitted task has finished */
+            void wait();
+
+            size_t size() const { return workers_.size(); }
+
+            /* index of the calling worker in [0, size()), -1 outside the pool */
+            static int worker_id();
+
+        private:
+            thread_pool(const thread_pool&);
+            thread_pool& operator=(const thread_pool&);
+
+            typedef struct worker {
+                std::mutex lock;
+                std::deque<task_t> tasks;
+                std::thread thread;
+            } worker_t;
+
+            void run(int id);
+            bool pop(int id, task_t& task);
+            bool steal(int id, task_t& task);
+
+            std::vector<std::unique_ptr<worker_t>> workers_;
+
+            /* guards sleeping and waking, not the deques */
+            std::mutex lock_;
+            std::condition_variable work_cv_;
+            std::condition_variable done_cv_;
+
+            std::atomic<size_t> queued_;  /* submitted but not yet picked up */
+            std::atomic<size_t> pending_; /* submitted but not yet finished */
+            std::atomic<size_t> next_;
+            bool stop_;
+    };
+};
+
+#endif /* __POOL_HH__ */
@@ -0,0 +1,1307 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <unordered_map>
+
+#include "charclass.hh"
+#include "keywords.hh"
+#include "preprocessor.hh"
+#include "serialize.hh"
+#include "stats.hh"
+#include "tokenizer.hh"
+#include "util/log.hh"
+
+#define CHANNEL "preprocessor"
+
+/* diagnostics name the file and line of a token in the file being processed */
+#define PP_ERROR(token, fmt, ...) \
+    ERROR("%s:%u: " fmt, file_->path.c_str(), line_of(file_->lines, (token).offset), ##__VA_ARGS__)
+
+#define PP_WARN(token, fmt, ...) \
+    WARN("%s:%u: " fmt, file_->path.c_str(), line_of(file_->lines, (token).offset), ##__VA_ARGS__)
+
+/* searched after the include directories of the command line */
+static const char *system_dirs[] = {
+    "/usr/local/include",
+    "/usr/include",
+};
+
+enum {
+    DIR_NULL,      /* '#' alone on a line */
+    DIR_INCLUDE,
+    DIR_DEFINE,
+    DIR_UNDEF,
+    DIR_IF,
+    DIR_IFDEF,
+    DIR_IFNDEF,
+    DIR_ELIF,
+    DIR_ELSE,
+    DIR_ENDIF,
+    DIR_PRAGMA,
+    DIR_ERROR,
+    DIR_WARNING,
+    DIR_LINE,
+    DIR_UNKNOWN,
+};
+
+static uint32_t line_of(const std::vector<uint32_t>& lines, uint32_t offset)
+{
+    return (uint32_t)(std::upper_bound(lines.begin(), lines.end(), offset) - lines.begin());
+}
+
+static uint64_t mtime_of(const struct stat& st)
+{
+    return (uint64_t)st.st_mtim.tv_sec * 1000000000ull + st.st_mtim.tv_nsec;
+}
+
+/* Values of the preprocessor's TT_DIGIT tokens, whose payload is an index
+ * here so a number can move between files. The cached headers hold such
+ * indices, so like them the table is per thread and kept. A value is
+ * stored once: two numbers are equal if their payloads are. */
+typedef struct literal_table {
+    std::vector<uint64_t> values;
+    std::unordered_map<uint64_t, uint32_t> index;
+} literal_table_t;
+
+static literal_table_t& literals()
+{
+    static thread_local literal_table_t table;
+
+    return table;
+}
+
+static uint32_t add_literal(uint64_t value)
+{
+    literal_table_t& table = literals();
+    auto entry = table.index.emplace(value, (uint32_t)table.values.size());
+
+    if (entry.second)
+        table.values.push_back(value);
+    return entry.first->second;
+}
+
+static uint64_t literal(const gcc::token_t& token)
+{
+    return literals().values[token.payload];
+}
+
+/* text of an identifier, keyword or number, "" for anything else; a
+ * number is spelled in decimal with the suffixes its type needs */
+static std::string spell(const gcc::token_t& token)
+{
+    if (token.type == gcc::TT_IDENTIFIER)
+        return gcc::symbol_str(token.sym);
+
+    if (token.type == gcc::TT_DIGIT) {
+        uint64_t value = literal(token);
+        uint8_t suffix = token.flags & ~gcc::constant_flags(value, 0, true);
+
+        return std::to_string(value) + (suffix & (gcc::TF_UNSIGNED | gcc::TF_SUFFIX_U) ? "u" : "") +
+               (suffix & gcc::TF_LONG ? "l" : "");
+    }
+
+    for (const gcc::keyword_t& keyword : gcc::__keywords) {
+        if (keyword.len && keyword.type == token.type)
+            return keyword.s;
+    }
+
+    return "";
+}
+
+namespace {
+
+    /* Constant expression of #if over tokens that went through macro
+     * expansion, identifiers left over are 0. Operands that aren't
+     * evaluated (the right side of a short-circuit, the other arm of
+     * ?:) are still parsed but can't fail on a division by zero.
+     *
+     * Values are intmax_t or uintmax_t, 64 bits either way. As in gcc a
+     * constant is unsigned if it has a u suffix or doesn't fit intmax_t,
+     * and an operator with an unsigned operand works unsigned as after
+     * the usual arithmetic conversions. */
+    struct evaluator {
+        typedef struct value {
+            int64_t v;
+            bool unsgnd;
+        } value_t;
+
+        const gcc::token_t *ptr;
+        const gcc::token_t *end;
+        const char *error;
+
+        value_t fail(const char *message)
+        {
+            if (!error)
+                error = message;
+
+            ptr = end;
+            return { 0, false };
+        }
+
+        bool next(gcc::token_type_t type)
+        {
+            if (ptr < end && ptr->type == type) {
+                ptr++;
+                return true;
+            }
+
+            return false;
+        }
+
+        static int precedence(uint8_t type)
+        {
+            switch (type) {
+                case gcc::TT_STAR: case gcc::TT_DIV: case gcc::TT_MOD:
+                    return 10;
+                case gcc::TT_PLUS: case gcc::TT_MINUS:
+                    return 9;
+                case gcc::TT_LSHIFT: case gcc::TT_RSHIFT:
+                    return 8;
+                case gcc::TT_LTHAN: case gcc::TT_GTHAN: case gcc::TT_EQ_SMALLER: case gcc::TT_EQ_LARGER:
+                    return 7;
+                case gcc::TT_EQUAL: case gcc::TT_NOT_EQUAL:
+                    return 6;
+                case gcc::TT_AND:
+                    return 5;
+                case gcc::TT_XOR:
+                    return 4;
+                case gcc::TT_OR:
+                    return 3;
+                case gcc::TT_AND_EXP:
+                    return 2;
+                case gcc::TT_OR_EXP:
+                    return 1;
+                default:
+                    return 0;
+            }
+        }
+
+        value_t unary(bool eval)
+        {
+            value_t value;
+
+            if (next(gcc::TT_MINUS)) {
+                value = unary(eval);
+                return { (int64_t)(0 - (uint64_t)value.v), value.unsgnd };
+            }
+            if (next(gcc::TT_PLUS))
+                return unary(eval);
+            if (next(gcc::TT_EXCLAMATION))
+                return { !unary(eval).v, false };
+            if (next(gcc::TT_ANOT)) {
+                value = unary(eval);
+                return { ~value.v, value.unsgnd };
+            }
+
+            if (next(gcc::TT_LPAREN)) {
+                value = conditional(eval);
+
+                if (!next(gcc::TT_RPAREN))
+                    return fail("missing ')' in expression");
+                return value;
+            }
+
+            if (ptr < end && ptr->type == gcc::TT_DIGIT) {
+                value = { (int64_t)literal(*ptr), (ptr->flags & gcc::TF_SUFFIX_U) || literal(*ptr) > INT64_MAX };
+                ptr++;
+                return value;
+            }
+
+            if (ptr < end && ptr->type == gcc::TT_IDENTIFIER) {
+                ptr++;
+                return { 0, false };
+            }
+
+            return fail("expected value in expression");
+        }
+
+        value_t apply(uint8_t op, value_t lhs, value_t rhs, bool eval)
+        {
+            uint64_t l = (uint64_t)lhs.v;
+            uint64_t r = (uint64_t)rhs.v;
+            bool u     = lhs.unsgnd || rhs.unsgnd;
+
+            switch (op) {
+                case gcc::TT_STAR:       return { (int64_t)(l * r), u };
+                case gcc::TT_PLUS:       return { (int64_t)(l + r), u };
+                case gcc::TT_MINUS:      return { (int64_t)(l - r), u };
+                case gcc::TT_AND:        return { (int64_t)(l & r), u };
+                case gcc::TT_XOR:        return { (int64_t)(l ^ r), u };
+                case gcc::TT_OR:         return { (int64_t)(l | r), u };
+                case gcc::TT_LTHAN:      return { u ? l < r : lhs.v < rhs.v, false };
+                case gcc::TT_GTHAN:      return { u ? l > r : lhs.v > rhs.v, false };
+                case gcc::TT_EQ_SMALLER: return { u ? l <= r : lhs.v <= rhs.v, false };
+                case gcc::TT_EQ_LARGER:  return { u ? l >= r : lhs.v >= rhs.v, false };
+                case gcc::TT_EQUAL:      return { l == r, false };
+                case gcc::TT_NOT_EQUAL:  return { l != r, false };
+                case gcc::TT_AND_EXP:    return { l && r, false };
+                case gcc::TT_OR_EXP:     return { l || r, false };
+
+                /* the type of a shift is the type of its left operand */
+                case gcc::TT_LSHIFT:     return { (int64_t)(l << (r & 63)), lhs.unsgnd };
+                case gcc::TT_RSHIFT:     return { lhs.unsgnd ? (int64_t)(l >> (r & 63)) : lhs.v >> (r & 63), lhs.unsgnd };
+            }
+
+            /* TT_DIV and TT_MOD */
+            if (r == 0)
+                return eval ? fail("division by zero in #if") : value_t{ 0, u };
+
+            if (u)
+                return { (int64_t)(op == gcc::TT_DIV ? l / r : l % r), true };
+
+            if (lhs.v == INT64_MIN && rhs.v == -1)
+                return { op == gcc::TT_DIV ? lhs.v : 0, false };
+
+            return { op == gcc::TT_DIV ? lhs.v / rhs.v : lhs.v % rhs.v, false };
+        }
+
+        value_t binary(int min, bool eval)
+        {
+            value_t lhs = unary(eval);
+            int prec;
+
+            while (ptr < end && (prec = precedence(ptr->type)) >= min) {
+                uint8_t op = (ptr++)->type;
+                bool right = eval && !(op == gcc::TT_AND_EXP && !lhs.v) && !(op == gcc::TT_OR_EXP && lhs.v);
+
+                lhs = apply(op, lhs, binary(prec + 1, right), eval);
+            }
+
+            return lhs;
+        }
+
+        value_t conditional(bool eval)
+        {
+            value_t cond = binary(1, eval);
+
+            if (!next(gcc::TT_QMARK))
+                return cond;
+
+            value_t lhs = conditional(eval && cond.v);
+
+            if (!next(gcc::TT_COLON))
+                return fail("expected ':' in expression");
+
+            value_t rhs = conditional(eval && !cond.v);
+
+            /* both arms are converted to their common type */
+            return { cond.v ? lhs.v : rhs.v, lhs.unsgnd || rhs.unsgnd };
+        }
+    };
+};
+
+gcc::preprocessor::preprocessor(const std::vector<std::string>& include_dirs):
+    include_dirs_(include_dirs),
+    symbols_(gcc::symbols()),
+    macros_(),
+    conds_(),
+    once_(),
+    guards_(),
+    visited_(),
+    out_(),
+    file_(nullptr),
+    base_(0),
+    depth_(0),
+    expansions_(0)
+{
+    auto intern = [this](const char *s) { return symbols_.intern(s, strlen(s)); };
+
+    sym_include_ = intern("include");
+    sym_define_  = intern("define");
+    sym_undef_   = intern("undef");
+    sym_ifdef_   = intern("ifdef");
+    sym_ifndef_  = intern("ifndef");
+    sym_elif_    = intern("elif");
+    sym_endif_   = intern("endif");
+    sym_pragma_  = intern("pragma");
+    sym_once_    = intern("once");
+    sym_error_   = intern("error");
+    sym_warning_ = intern("warning");
+    sym_line_    = intern("line");
+    sym_defined_ = intern("defined");
+    sym_va_args_ = intern("__VA_ARGS__");
+
+    gcc::symbol_t stdc = intern("__STDC__");
+
+    macros_.resize(symbols_.size() + 1);
+    macros_[stdc].reset(new macro_t({ false, false, false, {}, { gcc::make_token(TT_DIGIT, add_literal(1)) } }));
+}
+
+gcc::preprocessor::~preprocessor()
+{
+}
+
+bool gcc::preprocessor::has_directives(const gcc::token_stream_t& tokens)
+{
+    return std::any_of(tokens.begin(), tokens.end(), gcc::is_directive);
+}
+
+void gcc::preprocessor::save(std::string& out, gcc::serialize::symbol_table& table) const
+{
+    uint32_t count = 0;
+
+    for (const auto& m : macros_)
+        count += m != nullptr;
+
+    gcc::serialize::put32(out, count);
+
+    for (size_t sym = 0; sym < macros_.size(); ++sym) {
+        const macro_t *m = macros_[sym].get();
+
+        if (!m)
+            continue;
+
+        gcc::serialize::put32(out, table.add((gcc::symbol_t)sym));
+        gcc::serialize::put32(out, (m->function ? 1 : 0) | (m->variadic ? 2 : 0));
+        gcc::serialize::put32(out, (uint32_t)m->params.size());
+
+        for (gcc::symbol_t param : m->params)
+            gcc::serialize::put32(out, table.add(param));
+
+        gcc::serialize::put32(out, (uint32_t)m->body.size());
+
+        for (gcc::token_t token : m->body) {
+            if (gcc::holds_symbol(token))
+                token.sym = table.add(token.sym);
+            out.append((const char *)&token, sizeof(token));
+        }
+
+        /* the values of its numbers follow the body, in order */
+        for (const gcc::token_t& token : m->body) {
+            if (token.type == TT_DIGIT)
+                gcc::serialize::put64(out, literal(token));
+        }
+    }
+
+    gcc::serialize::put32(out, (uint32_t)once_.size());
+
+    for (const auto& id : once_) {
+        gcc::serialize::put64(out, id.first);
+        gcc::serialize::put64(out, id.second);
+    }
+
+    gcc::serialize::put32(out, (uint32_t)visited_.size());
+
+    for (const visited_t& file : visited_) {
+        gcc::serialize::put64(out, file.dev);
+        gcc::serialize::put64(out, file.ino);
+        gcc::serialize::put32(out, table.add(file.guard));
+    }
+}
+
+gcc_error_t gcc::preprocessor::restore(gcc::serialize::cursor_t& in, const std::vector<gcc::symbol_t>& symbols)
+{
+    auto symbol = [&in, &symbols]() -> gcc::symbol_t {
+        uint32_t index = in.u32();
+
+        if (index >= symbols.size())
+            in.ok = false;
+        return in.ok ? symbols[index] : (gcc::symbol_t)gcc::SYM_NONE;
+    };
+
+    uint32_t count = in.u32();
+
+    for (uint32_t i = 0; i < count && in.ok; ++i) {
+        std::unique_ptr<macro_t> m(new macro_t({ false, false, false, {}, {} }));
+        gcc::symbol_t sym = symbol();
+        uint32_t flags    = in.u32();
+        uint32_t nparams  = in.u32();
+
+        m->function = flags & 1;
+        m->variadic = flags & 2;
+
+        for (uint32_t k = 0; k < nparams && in.ok; ++k)
+            m->params.push_back(symbol());
+
+        uint32_t nbody     = in.u32();
+        const char *tokens = in.take(nbody, sizeof(gcc::token_t));
+
+        if (sym == gcc::SYM_NONE)
+            in.ok = false;
+        if (!in.ok)
+            break;
+
+        m->body.resize(nbody);
+        memcpy(m->body.data(), tokens, (size_t)nbody * sizeof(gcc::token_t));
+
+        for (gcc::token_t& token : m->body) {
+            if (token.type >= TT_LAST || (gcc::holds_symbol(token) && token.sym >= symbols.size()))
+                in.ok = false;
+            else if (gcc::holds_symbol(token))
+                token.sym = symbols[token.sym];
+        }
+
+        for (gcc::token_t& token : m->body) {
+            if (token.type == TT_DIGIT)
+                token.payload = add_literal(in.u64());
+        }
+
+        if (sym >= macros_.size())
+            macros_.resize(sym + 1);
+
+        macros_[sym] = std::move(m);
+    }
+
+    count = in.u32();
+
+    for (uint32_t i = 0; i < count && in.ok; ++i) {
+        uint64_t dev = in.u64();
+        once_.insert(std::make_pair(dev, in.u64()));
+    }
+
+    count = in.u32();
+
+    for (uint32_t i = 0; i < count && in.ok; ++i) {
+        uint64_t dev = in.u64();
+        uint64_t ino = in.u64();
+        gcc::symbol_t guard = symbol();
+
+        if (guard != gcc::SYM_NONE)
+            guards_[std::make_pair(dev, ino)] = guard;
+    }
+
+    return in.ok ? GCC_SUCCESS : GCC_INVALID_VALUE;
+}
+
+std::vector<std::string> gcc::preprocessor::files() const
+{
+    std::vector<std::string> paths;
+
+    for (const visited_t& file : visited_)
+        paths.push_back(file.path);
+
+    return paths;
+}
+
+int gcc::preprocessor::kind(const gcc::token_t *ptr, const gcc::token_t *end) const
+{
+    if (ptr == end)
+        return DIR_NULL;
+
+    if (ptr->type == TT_IF)
+        return DIR_IF;
+
+    if (ptr->type == TT_ELSE)
+        return DIR_ELSE;
+
+    if (ptr->type != TT_IDENTIFIER)
+        return DIR_UNKNOWN;
+
+    gcc::symbol_t sym = ptr->sym;
+
+    if (sym == sym_include_) return DIR_INCLUDE;
+    if (sym == sym_define_)  return DIR_DEFINE;
+    if (sym == sym_undef_)   return DIR_UNDEF;
+    if (sym == sym_ifdef_)   return DIR_IFDEF;
+    if (sym == sym_ifndef_)  return DIR_IFNDEF;
+    if (sym == sym_elif_)    return DIR_ELIF;
+    if (sym == sym_endif_)   return DIR_ENDIF;
+    if (sym == sym_pragma_)  return DIR_PRAGMA;
+    if (sym == sym_error_)   return DIR_ERROR;
+    if (sym == sym_warning_) return DIR_WARNING;
+    if (sym == sym_line_)    return DIR_LINE;
+
+    return DIR_UNKNOWN;
+}
+
+void gcc::preprocessor::load(file_t& file, const std::string& path, const struct stat& st,
+                             const gcc::token_stream_t& tokens) const
+{
+    size_t slash = path.rfind('/');
+
+    file.path  = path;
+    file.dir   = slash == std::string::npos ? "" : path.substr(0, slash + 1);
+    file.dev   = (uint64_t)st.st_dev;
+    file.ino   = (uint64_t)st.st_ino;
+    file.size  = (uint64_t)st.st_size;
+    file.mtime = mtime_of(st);
+    file.lines = tokens.lines_;
+    file.guard = gcc::SYM_NONE;
+
+    /* numbers move to the thread's literal table so tokens can move between files */
+    file.tokens.assign(tokens.begin(), tokens.end());
+
+    for (gcc::token_t& token : file.tokens) {
+        if (token.type == TT_DIGIT)
+            token.payload = add_literal(tokens.value(token));
+    }
+
+    const std::vector<gcc::token_t>& list = file.tokens;
+    size_t i = 0;
+
+    while (i < list.size()) {
+        piece_t piece = { (uint32_t)i, 0, gcc::is_directive(list[i]), {} };
+
+        if (piece.directive) {
+            uint32_t end = list[i].payload;
+
+            for (++i; i < list.size() && list[i].offset < end; ++i)
+                ;
+        } else {
+            for (; i < list.size() && !gcc::is_directive(list[i]); ++i) {
+                if (list[i].type == TT_IDENTIFIER)
+                    piece.idents.push_back(list[i].sym);
+            }
+
+            std::sort(piece.idents.begin(), piece.idents.end());
+            piece.idents.erase(std::unique(piece.idents.begin(), piece.idents.end()), piece.idents.end());
+        }
+
+        piece.last = (uint32_t)i;
+        file.pieces.push_back(std::move(piece));
+    }
+
+    /* The include guard idiom: the first directive is #ifndef X or
+     * #if !defined X, its #endif is the last one and there's nothing
+     * outside of them or in an #else branch. */
+    if (file.pieces.size() < 2 || !file.pieces.front().directive || !file.pieces.back().directive)
+        return;
+
+    const gcc::token_t *first = &list[file.pieces.front().first + 1];
+    const gcc::token_t *last  = &list[file.pieces.front().last];
+    gcc::symbol_t guard       = gcc::SYM_NONE;
+
+    if (kind(first, last) == DIR_IFNDEF && last - first == 2 && first[1].type == TT_IDENTIFIER) {
+        guard = first[1].sym;
+    } else if (kind(first, last) == DIR_IF && last - first >= 3 && first[1].type == TT_EXCLAMATION &&
+               first[2].type == TT_IDENTIFIER && first[2].sym == sym_defined_) {
+        if (last - first == 4 && first[3].type == TT_IDENTIFIER)
+            guard = first[3].sym;
+        else if (last - first == 6 && first[3].type == TT_LPAREN && first[4].type == TT_IDENTIFIER &&
+                 first[5].type == TT_RPAREN)
+            guard = first[4].sym;
+    }
+
+    if (guard == gcc::SYM_NONE)
+        return;
+
+    size_t depth = 1;
+
+    for (size_t k = 1; k < file.pieces.size(); ++k) {
+        const piece_t& piece = file.pieces[k];
+
+        if (!piece.directive)
+            continue;
+
+        switch (kind(&list[piece.first + 1], &list[piece.last])) {
+            case DIR_IF:
+            case DIR_IFDEF:
+            case DIR_IFNDEF:
+                depth++;
+                break;
+
+            case DIR_ELIF:
+            case DIR_ELSE:
+                if (depth == 1)
+                    return;
+                break;
+
+            case DIR_ENDIF:
+                if (--depth == 0 && k + 1 != file.pieces.size())
+                    return;
+                break;
+        }
+    }
+
+    if (depth == 0)
+        file.guard = guard;
+}
+
+std::shared_ptr<const gcc::preprocessor::file_t> gcc::preprocessor::header(const std::string& path, const struct stat& st)
+{
+    /* tokens hold symbols of this thread's interner, see the class comment */
+    static thread_local std::unordered_map<std::string, std::shared_ptr<file_t>> headers;
+
+    std::shared_ptr<file_t>& entry = headers[path];
+
+    if (entry && entry->dev == (uint64_t)st.st_dev && entry->ino == (uint64_t)st.st_ino &&
+        entry->size == (uint64_t)st.st_size && entry->mtime == mtime_of(st)) {
+        gcc::stats::add(gcc::COUNTER_HEADER_HITS, 1);
+        return entry;
+    }
+
+    gcc::tokenizer tokenizer;
+
+    if (tokenizer.tokenize(path.c_str()) != GCC_SUCCESS) {
+        headers.erase(path);
+        return nullptr;
+    }
+
+    /* a file being processed keeps its old tokens until it's done */
+    std::shared_ptr<file_t> file(new file_t());
+
+    load(*file, path, st, tokenizer.get_token_stream());
+    entry = file;
+
+    return file;
+}
+
+gcc_error_t gcc::preprocessor::run(const char *file, const gcc::token_stream_t& in, gcc::token_stream_t& out)
+{
+    gcc::scoped_timer timer(gcc::PHASE_PREPROCESS);
+    file_t main;
+    struct stat st;
+    gcc_error_t ret;
+
+    /* stdin has no identity, #pragma once in it has nothing to match */
+    if (stat(file, &st) < 0)
+        memset(&st, 0, sizeof(st));
+
+    load(main, file, st, in);
+
+    if (st.st_ino)
+        visited_.push_back({ file, main.dev, main.ino, main.guard });
+
+    out_.clear();
+    out_.reserve(in.size());
+
+    ret = process(main);
+
+    gcc::stats::add(gcc::COUNTER_EXPANSIONS, expansions_);
+
+    if (ret != GCC_SUCCESS)
+        return ret;
+
+    out.tokens_.swap(out_);
+    out.clear_literals();
+    out.lines_ = in.lines_;
+
+    for (gcc::token_t& token : out.tokens_) {
+        if (token.type == TT_DIGIT)
+            token.literal = out.add_literal(literal(token));
+    }
+
+    return GCC_SUCCESS;
+}
+
+gcc_error_t gcc::preprocessor::process(const file_t& file)
+{
+    const file_t *outer = file_;
+    size_t base         = base_;
+    gcc_error_t ret     = GCC_SUCCESS;
+
+    file_ = &file;
+    base_ = conds_.size();
+
+    for (const piece_t& piece : file.pieces) {
+        const gcc::token_t *first = &file.tokens[piece.first];
+        const gcc::token_t *last  = first + (piece.last - piece.first);
+
+        if (piece.directive) {
+            if ((ret = directive(first + 2, last)) != GCC_SUCCESS)
+                break;
+            continue;
+        }
+
+        if (!active())
+            continue;
+
+        /* nothing to expand, the run is copied as a whole */
+        if (std::none_of(piece.idents.begin(), piece.idents.end(), [this](gcc::symbol_t sym) { return macro(sym); }))
+            out_.insert(out_.end(), first, last);
+        else if ((ret = expand(first, last, out_)) != GCC_SUCCESS)
+            break;
+    }
+
+    if (ret == GCC_SUCCESS && conds_.size() > base_) {
+        ERROR("%s: unterminated conditional directive\n", file.path.c_str());
+        ret = GCC_INVALID_VALUE;
+    }
+
+    conds_.resize(std::min(conds_.size(), base_));
+    file_ = outer;
+    base_ = base;
+
+    return ret;
+}
+
+gcc_error_t gcc::preprocessor::directive(const gcc::token_t *ptr, const gcc::token_t *end)
+{
+    /* ptr is past the name, which may not exist */
+    if (ptr > end)
+        return GCC_SUCCESS;
+
+    const gcc::token_t& name = ptr[-1];
+    int type = kind(&name, end);
+    bool value;
+    gcc_error_t ret;
+
+    switch (type) {
+        case DIR_IF:
+        case DIR_IFDEF:
+        case DIR_IFNDEF:
+            if (!active()) {
+                conds_.push_back({ false, true, false, false });
+                return GCC_SUCCESS;
+            }
+
+            if (type == DIR_IF) {
+                if ((ret = condition(ptr, end, value)) != GCC_SUCCESS)
+                    return ret;
+            } else {
+                if (ptr == end || ptr->type != TT_IDENTIFIER) {
+                    PP_ERROR(name, "macro names must be identifiers\n");
+                    return GCC_INVALID_VALUE;
+                }
+
+                value = (macro(ptr->sym) != nullptr) == (type == DIR_IFDEF);
+            }
+
+            conds_.push_back({ value, value, true, false });
+            return GCC_SUCCESS;
+
+        case DIR_ELIF:
+        case DIR_ELSE:
+        case DIR_ENDIF:
+            if (conds_.size() == base_) {
+                PP_ERROR(name, "#%s without #if\n", spell(name).c_str());
+                return GCC_INVALID_VALUE;
+            }
+
+            if (type == DIR_ENDIF) {
+                conds_.pop_back();
+                return GCC_SUCCESS;
+            }
+
+            if (conds_.back().seen_else) {
+                PP_ERROR(name, "#%s after #else\n", spell(name).c_str());
+                return GCC_INVALID_VALUE;
+            }
+
+            if (type == DIR_ELSE) {
+                conds_.back().active    = conds_.back().parent && !conds_.back().taken;
+                conds_.back().taken     = true;
+                conds_.back().seen_else = true;
+                return GCC_SUCCESS;
+            }
+
+            if (!conds_.back().parent || conds_.back().taken) {
+                conds_.back().active = false;
+                return GCC_SUCCESS;
+            }
+
+            if ((ret = condition(ptr, end, value)) != GCC_SUCCESS)
+                return ret;
+
+            conds_.back().active = value;
+            conds_.back().taken  = value;
+            return GCC_SUCCESS;
+    }
+
+    /* everything else is ignored in skipped groups */
+    if (!active())
+        return GCC_SUCCESS;
+
+    switch (type) {
+        case DIR_NULL:
+        case DIR_LINE:
+            return GCC_SUCCESS;
+
+        case DIR_INCLUDE:
+            return include(ptr, end);
+
+        case DIR_DEFINE:
+            return define(ptr, end);
+
+        case DIR_UNDEF:
+            if (ptr == end || ptr->type != TT_IDENTIFIER) {
+                PP_ERROR(name, "macro names must be identifiers\n");
+                return GCC_INVALID_VALUE;
+            }
+
+            if (ptr->sym < macros_.size())
+                macros_[ptr->sym].reset();
+            return GCC_SUCCESS;
+
+        case DIR_PRAGMA:
+            /* other pragmas are for other compilers */
+            if (ptr != end && ptr->type == TT_IDENTIFIER && ptr->sym == sym_once_)
+                once_.insert(std::make_pair(file_->dev, file_->ino));
+            return GCC_SUCCESS;
+
+        case DIR_ERROR:
+            PP_ERROR(name, "#error\n");
+            return GCC_INVALID_VALUE;
+
+        case DIR_WARNING:
+            PP_WARN(name, "#warning\n");
+            return GCC_SUCCESS;
+    }
+
+    PP_ERROR(name, "invalid preprocessing directive\n");
+    return GCC_INVALID_VALUE;
+}
+
+gcc_error_t gcc::preprocessor::include(const gcc::token_t *ptr, const gcc::token_t *end)
+{
+    const gcc::token_t& name = ptr[-1];
+    std::string path;
+    struct stat st;
+    bool found = false;
+
+    if (ptr == end || ptr->type != TT_HEADER_NAME) {
+        PP_ERROR(name, "#include expects \"FILENAME\" or <FILENAME>\n");
+        return GCC_INVALID_VALUE;
+    }
+
+    /* the spelling keeps its quotes or angle brackets */
+    const char *spelling = gcc::symbol_str(ptr->sym);
+    std::string file(spelling + 1, symbols_.length(ptr->sym) - 2);
+
+    auto lookup = [&](const std::string& candidate) {
+        if (stat(candidate.c_str(), &st) == 0 && S_ISREG(st.st_mode)) {
+            path  = candidate;
+            found = true;
+        }
+        return found;
+    };
+
+    if (file[0] == '/') {
+        lookup(file);
+    } else if (!(spelling[0] == '"' && lookup(file_->dir + file))) {
+        for (size_t i = 0; i < include_dirs_.size() && !found; ++i)
+            lookup(include_dirs_[i] + "/" + file);
+
+        for (size_t i = 0; i < sizeof(system_dirs) / sizeof(system_dirs[0]) && !found; ++i)
+            lookup(std::string(system_dirs[i]) + "/" + file);
+    }
+
+    if (!found) {
+        PP_ERROR(name, "%s: no such file\n", file.c_str());
+        return GCC_INVALID_VALUE;
+    }
+
+    gcc::stats::add(gcc::COUNTER_INCLUDES, 1);
+
+    if (once_.count(std::make_pair((uint64_t)st.st_dev, (uint64_t)st.st_ino))) {
+        gcc::stats::add(gcc::COUNTER_GUARD_SKIPS, 1);
+        return GCC_SUCCESS;
+    }
+
+    /* guarded by a macro of a restored state, not even tokenized */
+    auto known = guards_.find(std::make_pair((uint64_t)st.st_dev, (uint64_t)st.st_ino));
+
+    if (known != guards_.end() && macro(known->second)) {
+        gcc::stats::add(gcc::COUNTER_GUARD_SKIPS, 1);
+        return GCC_SUCCESS;
+    }
+
+    if (depth_ >= MAX_DEPTH) {
+        PP_ERROR(name, "#include nested too deeply\n");
+        return GCC_INVALID_VALUE;
+    }
+
+    std::shared_ptr<const file_t> header = this->header(path, st);
+
+    if (!header) {
+        PP_ERROR(name, "failed to include %s\n", path.c_str());
+        return GCC_INVALID_VALUE;
+    }
+
+    if (header->guard != gcc::SYM_NONE && macro(header->guard)) {
+        gcc::stats::add(gcc::COUNTER_GUARD_SKIPS, 1);
+        return GCC_SUCCESS;
+    }
+
+    visited_.push_back({ path, header->dev, header->ino, header->guard });
+
+    depth_++;
+    gcc_error_t ret = process(*header);
+    depth_--;
+
+    return ret;
+}
+
+gcc_error_t gcc::preprocessor::define(const gcc::token_t *ptr, const gcc::token_t *end)
+{
+    const gcc::token_t& name = ptr[-1];
+    std::unique_ptr<macro_t> m(new macro_t({ false, false, false, {}, {} }));
+
+    if (ptr == end || ptr->type != TT_IDENTIFIER) {
+        PP_ERROR(name, "macro names must be identifiers\n");
+        return GCC_INVALID_VALUE;
+    }
+
+    gcc::symbol_t sym    = ptr->sym;
+    const gcc::token_t *p = ptr + 1;
+
+    /* function-like only if the '(' follows the name without a space */
+    if (p < end && p->type == TT_LPAREN && p->offset == ptr->offset + symbols_.length(sym)) {
+        m->function = true;
+
+        if (++p < end && p->type == TT_RPAREN) {
+            p++;
+        } else {
+            for (;;) {
+                if (p + 2 < end && p[0].type == TT_DOT && p[1].type == TT_DOT && p[2].type == TT_DOT &&
+                    p[1].offset == p[0].offset + 1 && p[2].offset == p[0].offset + 2) {
+                    m->variadic = true;
+                    m->params.push_back(sym_va_args_);
+                    p += 3;
+
+                    if (p == end || p->type != TT_RPAREN) {
+                        PP_ERROR(name, "missing ')' after \"...\" of '%s'\n", gcc::symbol_str(sym));
+                        return GCC_INVALID_VALUE;
+                    }
+
+                    p++;
+                    break;
+                }
+
+                if (p == end || p->type != TT_IDENTIFIER || p->sym == sym_va_args_ ||
+                    std::find(m->params.begin(), m->params.end(), p->sym) != m->params.end()) {
+                    PP_ERROR(name, "invalid parameter list of '%s'\n", gcc::symbol_str(sym));
+                    return GCC_INVALID_VALUE;
+                }
+
+                m->params.push_back((p++)->sym);
+
+                if (p < end && p->type == TT_RPAREN) {
+                    p++;
+                    break;
+                }
+
+                if (p == end || (p++)->type != TT_COMMA) {
+                    PP_ERROR(name, "expected ',' or ')' in parameter list of '%s'\n", gcc::symbol_str(sym));
+                    return GCC_INVALID_VALUE;
+                }
+            }
+        }
+    }
+
+    m->body.assign(p, end);
+
+    if (!m->body.empty() && (m->body.front().type == TT_HASHHASH || m->body.back().type == TT_HASHHASH)) {
+        PP_ERROR(name, "'##' at either end of '%s'\n", gcc::symbol_str(sym));
+        return GCC_INVALID_VALUE;
+    }
+
+    if (m->function && std::any_of(m->body.begin(), m->body.end(), [](const gcc::token_t& t) { return t.type == TT_HASH; })) {
+        PP_ERROR(name, "'#' in '%s': stringification is not supported\n", gcc::symbol_str(sym));
+        return GCC_INVALID_VALUE;
+    }
+
+    if (sym >= macros_.size())
+        macros_.resize(sym + 1);
+
+    if (macros_[sym]) {
+        const macro_t& old = *macros_[sym];
+        bool same = old.function == m->function && old.params == m->params && old.body.size() == m->body.size() &&
+            std::equal(old.body.begin(), old.body.end(), m->body.begin(), [](const gcc::token_t& a, const gcc::token_t& b) {
+                return a.type == b.type && a.flags == b.flags && a.payload == b.payload;
+            });
+
+        if (!same)
+            PP_WARN(name, "'%s' redefined\n", gcc::symbol_str(sym));
+    }
+
+    macros_[sym] = std::move(m);
+    return GCC_SUCCESS;
+}
+
+gcc_error_t gcc::preprocessor::condition(const gcc::token_t *ptr, const gcc::token_t *end, bool& value)
+{
+    const gcc::token_t& name = ptr[-1];
+    std::vector<gcc::token_t> line;
+    std::vector<gcc::token_t> expr;
+    gcc_error_t ret;
+
+    /* defined X is decided before anything is expanded */
+    for (const gcc::token_t *p = ptr; p < end; ++p) {
+        if (p->type != TT_IDENTIFIER || p->sym != sym_defined_) {
+            line.push_back(*p);
+            continue;
+        }
+
+        bool paren = p + 1 < end && p[1].type == TT_LPAREN;
+        const gcc::token_t *id = p + 1 + paren;
+
+        if (id >= end || id->type != TT_IDENTIFIER || (paren && (id + 1 >= end || id[1].type != TT_RPAREN))) {
+            PP_ERROR(name, "operator \"defined\" requires an identifier\n");
+            return GCC_INVALID_VALUE;
+        }
+
+        line.push_back(gcc::make_token(TT_DIGIT, add_literal(macro(id->sym) != nullptr), p->offset));
+        p = id + paren;
+    }
+
+    if ((ret = expand(line.data(), line.data() + line.size(), expr)) != GCC_SUCCESS)
+        return ret;
+
+    if (expr.empty()) {
+        PP_ERROR(name, "#%s with no expression\n", spell(name).c_str());
+        return GCC_INVALID_VALUE;
+    }
+
+    evaluator eval = { expr.data(), expr.data() + expr.size(), nullptr };
+    evaluator::value_t result = eval.conditional(true);
+
+    if (!eval.error && eval.ptr != eval.end)
+        eval.error = "missing binary operator in expression";
+
+    if (eval.error) {
+        PP_ERROR(name, "%s\n", eval.error);
+        return GCC_INVALID_VALUE;
+    }
+
+    value = result.v != 0;
+    return GCC_SUCCESS;
+}
+
+const gcc::token_t *gcc::preprocessor::peek(input_t& in)
+{
+    /* the end of an expansion has been reached, its macro can expand again */
+    while (!in.pending.empty() && in.pending.back().type == TT_END) {
+        macros_[in.pending.back().sym]->disabled = false;
+        in.pending.pop_back();
+    }
+
+    if (!in.pending.empty())
+        return &in.pending.back();
+
+    return in.ptr < in.end ? in.ptr : nullptr;
+}
+
+gcc_error_t gcc::preprocessor::expand(const gcc::token_t *ptr, const gcc::token_t *end, std::vector<gcc::token_t>& out)
+{
+    std::vector<std::vector<gcc::token_t>> args;
+    std::vector<gcc::token_t> body;
+    input_t in = { {}, ptr, end };
+    gcc_error_t ret;
+
+    for (;;) {
+        const gcc::token_t *next = peek(in);
+        gcc::token_t token;
+
+        if (!next)
+            break;
+
+        if (in.pending.empty()) {
+            /* the input is copied up to the next macro name in one go */
+            const gcc::token_t *run = in.ptr;
+
+            while (in.ptr < in.end && !is_macro(*in.ptr))
+                in.ptr++;
+
+            out.insert(out.end(), run, in.ptr);
+
+            if (in.ptr == in.end)
+                break;
+
+            token = *in.ptr++;
+        } else {
+            token = in.pending.back();
+            in.pending.pop_back();
+        }
+
+        macro_t *m = is_macro(token) ? macros_[token.sym].get() : nullptr;
+
+        if (!m || m->disabled) {
+            out.push_back(token);
+            continue;
+        }
+
+        args.clear();
+
+        /* a function-like macro's name without arguments is just a name */
+        if (m->function) {
+            if (!(next = peek(in)) || next->type != TT_LPAREN) {
+                out.push_back(token);
+                continue;
+            }
+
+            if (!in.pending.empty())
+                in.pending.pop_back();
+            else
+                in.ptr++;
+
+            if ((ret = collect(in, token.sym, *m, args)) != GCC_SUCCESS)
+                return ret;
+        }
+
+        body.clear();
+
+        if ((ret = substitute(*m, args, body)) != GCC_SUCCESS)
+            return ret;
+
+        /* the result is rescanned with the rest of the input,
+         * without expanding m again until the end of it */
+        m->disabled = true;
+        in.pending.push_back(gcc::make_token(TT_END, token.sym));
+        in.pending.insert(in.pending.end(), body.rbegin(), body.rend());
+        expansions_++;
+    }
+
+    return GCC_SUCCESS;
+}
+
+gcc_error_t gcc::preprocessor::collect(input_t& in, gcc::symbol_t name, const macro_t& m,
+                                       std::vector<std::vector<gcc::token_t>>& args)
+{
+    size_t depth = 0;
+
+    args.emplace_back();
+
+    for (;;) {
+        const gcc::token_t *next = peek(in);
+
+        if (!next) {
+            ERROR("%s: unterminated argument list invoking '%s'\n", file_->path.c_str(), gcc::symbol_str(name));
+            return GCC_INVALID_VALUE;
+        }
+
+        gcc::token_t token = *next;
+
+        if (!in.pending.empty())
+            in.pending.pop_back();
+        else
+            in.ptr++;
+
+        if (token.type == TT_RPAREN && depth == 0)
+            break;
+
+        if (token.type == TT_LPAREN) {
+            depth++;
+        } else if (token.type == TT_RPAREN) {
+            depth--;
+        } else if (token.type == TT_COMMA && depth == 0 && !(m.variadic && args.size() == m.params.size())) {
+            /* the variadic argument keeps its commas */
+            args.emplace_back();
+            continue;
+        }
+
+        args.back().push_back(token);
+    }
+
+    /* f() passes one empty argument, which is none if f has no parameters */
+    if (m.params.empty() && args.size() == 1 && args[0].empty())
+        args.clear();
+
+    /* the variadic argument may be left out */
+    if (m.variadic && args.size() == m.params.size() - 1)
+        args.emplace_back();
+
+    if (args.size() != m.params.size()) {
+        ERROR("%s: '%s' takes %zu arguments, %zu given\n", file_->path.c_str(),
+              gcc::symbol_str(name), m.params.size(), args.size());
+        return GCC_INVALID_VALUE;
+    }
+
+    return GCC_SUCCESS;
+}
+
+gcc_error_t gcc::preprocessor::substitute(const macro_t& m, std::vector<std::vector<gcc::token_t>>& args,
+                                          std::vector<gcc::token_t>& out)
+{
+    std::vector<std::vector<gcc::token_t>> expanded(args.size());
+    std::vector<bool> done(args.size(), false);
+    size_t operand = 0;  /* start of the left operand of '##' */
+    gcc_error_t ret;
+
+    auto param = [&m](const gcc::token_t& token) {
+        if (token.type != TT_IDENTIFIER)
+            return -1;
+
+        auto it = std::find(m.params.begin(), m.params.end(), token.sym);
+        return it == m.params.end() ? -1 : (int)(it - m.params.begin());
+    };
+
+    for (size_t i = 0; i < m.body.size(); ++i) {
+        const gcc::token_t& token = m.body[i];
+
+        if (token.type == TT_HASHHASH) {
+            /* define() makes sure '##' is never last */
+            const gcc::token_t& right = m.body[++i];
+            int index = param(right);
+            const gcc::token_t *first = index < 0 ? &right : args[index].data();
+            size_t count = index < 0 ? 1 : args[index].size();
+
+            /* an empty operand leaves the other one alone */
+            if (count == 0)
+                continue;
+
+            if (out.size() > operand && (ret = paste(out.back(), *first++, out.back())) != GCC_SUCCESS)
+                return ret;
+            else if (out.size() == operand)
+                out.push_back(*first++);
+
+            out.insert(out.end(), first, first + count - 1);
+            continue;
+        }
+
+        int index = param(token);
+
+        operand = out.size();
+
+        if (index < 0) {
+            out.push_back(token);
+            continue;
+        }
+
+        /* operands of '##' are pasted as written, other arguments are
+         * expanded on their own before they're substituted */
+        if (i + 1 < m.body.size() && m.body[i + 1].type == TT_HASHHASH) {
+            out.insert(out.end(), args[index].begin(), args[index].end());
+            continue;
+        }
+
+        if (!done[index]) {
+            if ((ret = expand(args[index].data(), args[index].data() + args[index].size(), expanded[index])) != GCC_SUCCESS)
+                return ret;
+            done[index] = true;
+        }
+
+        out.insert(out.end(), expanded[index].begin(), expanded[index].end());
+    }
+
+    return GCC_SUCCESS;
+}
+
+gcc_error_t gcc::preprocessor::paste(const gcc::token_t& lhs, const gcc::token_t& rhs, gcc::token_t& out)
+{
+    std::string left  = spell(lhs);
+    std::string right = spell(rhs);
+    std::string text  = left + right;
+    uint32_t offset   = lhs.offset;
+    size_t i;
+
+    if (left.empty() || right.empty())
+        goto invalid;
+
+    if (gcc::char_class(text[0]) == CC_IDENT) {
+        for (i = 1; i < text.size(); ++i) {
+            if (!gcc::is_ident_char(text[i]))
+                goto invalid;
+        }
+
+        token_type_t type = gcc::keyword_lookup(text.data(), text.size());
+
+        out = gcc::make_token(type, type == TT_IDENTIFIER ? symbols_.intern(text.data(), text.size()) : 0, offset);
+        return GCC_SUCCESS;
+    }
+
+    if (gcc::char_class(text[0]) == CC_DIGIT && lhs.type == TT_DIGIT && rhs.type == TT_DIGIT) {
+        uint8_t suffix = 0;
+        uint64_t value;
+        char *p;
+
+        errno = 0;
+        value = strtoull(text.c_str(), &p, 10);
+
+        for (; *p == 'u' || *p == 'l'; ++p)
+            suffix |= *p == 'u' ? TF_UNSIGNED : TF_LONG;
+
+        if (errno || *p)
+            goto invalid;
+
+        out       = gcc::make_token(TT_DIGIT, add_literal(value), offset);
+        out.flags = gcc::constant_flags(value, suffix, true);
+        return GCC_SUCCESS;
+    }
+
+invalid:
+    PP_ERROR(lhs, "pasting \"%s\" and \"%s\" does not give a valid token\n",
+             left.empty() ? "?" : left.c_str(), right.empty() ? "?" : right.c_str());
+    return GCC_INVALID_VALUE;
+}
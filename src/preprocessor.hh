@@ -0,0 +1,218 @@
+#ifndef __PREPROCESSOR_HH__
+#define __PREPROCESSOR_HH__
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <sys/stat.h>
+
+#include "intern.hh"
+#include "token.hh"
+#include "util/error.hh"
+
+namespace gcc {
+
+    namespace serialize {
+        class symbol_table;
+        struct cursor;
+    };
+
+    /* Preprocessor working on token streams.
+     *
+     * The tokenizer marks directives (see gcc::is_directive()) and lexes
+     * the file name of #include as one token, so the preprocessor never
+     * looks at source text and a header's tokens are reusable on their own.
+     *
+     * Headers are tokenized once per thread and kept by path for as long
+     * as their device, inode, size and mtime stay the same. Their tokens
+     * hold the symbols of the thread's interner, so like the interner the
+     * table is per thread, and a daemon or a worker of a parallel build
+     * tokenizes every header at most once. When a header is tokenized it's
+     * split into directives and the runs of tokens between them, and it's
+     * checked for the include guard idiom: everything in the file is inside
+     * one #ifndef X ... #endif. Including a guarded header while X is
+     * defined, or a header that said #pragma once, costs a stat() and
+     * nothing else. A run none of whose identifiers is a macro at that
+     * point is appended to the output as one block.
+     *
+     * Strings aren't tokens in this compiler, so # (stringification)
+     * isn't supported and ## only pastes identifiers and numbers. */
+    class preprocessor {
+        public:
+            /* deepest #include nesting, anything deeper is a loop */
+            enum { MAX_DEPTH = 200 };
+
+            /* include_dirs are searched for #include in order, "file"
+             * is looked up in the includer's directory first */
+            preprocessor(const std::vector<std::string>& include_dirs);
+            ~preprocessor();
+
+            /* preprocess in, the tokens of file, into out */
+            gcc_error_t run(const char *file, const gcc::token_stream_t& in, gcc::token_stream_t& out);
+
+            /* true if tokens contain directives and need preprocessing */
+            static bool has_directives(const gcc::token_stream_t& tokens);
+
+            /* Append what run() left behind for the rest of a translation
+             * unit to out: the macros, the headers that said #pragma once
+             * and the include guards of the files processed. Symbols are
+             * written as their indices in table. See gcc::pch. */
+            void save(std::string& out, gcc::serialize::symbol_table& table) const;
+
+            /* Continue from a state written by save(), as if the files it
+             * came from had been included, before run(). symbols maps the
+             * table indices back. Fails on anything save() couldn't have
+             * written. A file restored with its guard is skipped by the
+             * guard without being tokenized. */
+            gcc_error_t restore(gcc::serialize::cursor& in, const std::vector<gcc::symbol_t>& symbols);
+
+            /* paths of the files processed by run(), the file itself first */
+            std::vector<std::string> files() const;
+
+        private:
+            preprocessor(const preprocessor&);
+            preprocessor& operator=(const preprocessor&);
+
+            /* a directive or a run of tokens between two */
+            typedef struct piece {
+                uint32_t first;                      /* tokens [first, last) */
+                uint32_t last;
+                bool directive;                      /* tokens[first] is the '#' */
+                std::vector<gcc::symbol_t> idents;   /* distinct identifiers of a run */
+            } piece_t;
+
+            /* a tokenized file, the payload of a TT_DIGIT token indexes the
+             * thread's table of literal values */
+            typedef struct file {
+                std::string path;
+                std::string dir;                     /* with a trailing '/', "" for the cwd */
+                uint64_t dev;
+                uint64_t ino;
+                uint64_t size;
+                uint64_t mtime;
+                std::vector<gcc::token_t> tokens;
+                std::vector<uint32_t> lines;         /* offset of each line start */
+                std::vector<piece_t> pieces;
+                gcc::symbol_t guard;                 /* include guard, SYM_NONE if there's none */
+            } file_t;
+
+            typedef struct macro {
+                bool function;
+                bool variadic;                       /* last parameter is __VA_ARGS__ */
+                bool disabled;                       /* being expanded */
+                std::vector<gcc::symbol_t> params;
+                std::vector<gcc::token_t> body;
+            } macro_t;
+
+            typedef struct cond {
+                bool active;                         /* tokens are kept */
+                bool taken;                          /* a branch was active, the rest aren't */
+                bool parent;                         /* the enclosing group is active */
+                bool seen_else;
+            } cond_t;
+
+            /* a file processed and its include guard */
+            typedef struct visited {
+                std::string path;
+                uint64_t dev;
+                uint64_t ino;
+                gcc::symbol_t guard;
+            } visited_t;
+
+            /* tokens left of a macro expansion followed by the rest of the input */
+            typedef struct input {
+                std::vector<gcc::token_t> pending;   /* last token first, TT_END re-enables a macro */
+                const gcc::token_t *ptr;
+                const gcc::token_t *end;
+            } input_t;
+
+            /* Make file from the tokens of path, the pieces are split and
+             * the include guard is detected here, once per tokenization. */
+            void load(file_t& file, const std::string& path, const struct stat& st,
+                      const gcc::token_stream_t& tokens) const;
+
+            /* header at path, tokenized unless it's known and unchanged */
+            std::shared_ptr<const file_t> header(const std::string& path, const struct stat& st);
+
+            /* DIR_* of the directive whose name is at ptr */
+            int kind(const gcc::token_t *ptr, const gcc::token_t *end) const;
+
+            /* The directive handlers get the tokens after the directive's
+             * name, ptr[-1] is the name. */
+            gcc_error_t process(const file_t& file);
+            gcc_error_t directive(const gcc::token_t *ptr, const gcc::token_t *end);
+            gcc_error_t include(const gcc::token_t *ptr, const gcc::token_t *end);
+            gcc_error_t define(const gcc::token_t *ptr, const gcc::token_t *end);
+            gcc_error_t condition(const gcc::token_t *ptr, const gcc::token_t *end, bool& value);
+
+            /* expand the macros in [ptr, end) and append the result to out */
+            gcc_error_t expand(const gcc::token_t *ptr, const gcc::token_t *end, std::vector<gcc::token_t>& out);
+
+            /* next token of in without consuming it, nullptr at the end */
+            const gcc::token_t *peek(input_t& in);
+
+            /* arguments of an invocation of m, in is past the '(' */
+            gcc_error_t collect(input_t& in, gcc::symbol_t name, const macro_t& m,
+                                std::vector<std::vector<gcc::token_t>>& args);
+
+            /* body of m with the arguments substituted */
+            gcc_error_t substitute(const macro_t& m, std::vector<std::vector<gcc::token_t>>& args,
+                                   std::vector<gcc::token_t>& out);
+
+            /* the token spelled by the texts of lhs and rhs */
+            gcc_error_t paste(const gcc::token_t& lhs, const gcc::token_t& rhs, gcc::token_t& out);
+
+            macro_t *macro(gcc::symbol_t sym) const
+            {
+                return sym < macros_.size() ? macros_[sym].get() : nullptr;
+            }
+
+            bool is_macro(const gcc::token_t& token) const
+            {
+                return token.type == TT_IDENTIFIER && token.sym < macros_.size() && macros_[token.sym];
+            }
+
+            bool active() const
+            {
+                return conds_.empty() || conds_.back().active;
+            }
+
+            const std::vector<std::string>& include_dirs_;
+            gcc::interner& symbols_;
+
+            std::vector<std::unique_ptr<macro_t>> macros_;   /* by symbol */
+            std::vector<cond_t> conds_;
+            std::set<std::pair<uint64_t, uint64_t>> once_;  /* device and inode */
+            std::map<std::pair<uint64_t, uint64_t>, gcc::symbol_t> guards_;  /* restored */
+            std::vector<visited_t> visited_;
+            std::vector<gcc::token_t> out_;
+            const file_t *file_;                            /* being processed */
+            size_t base_;                                   /* conds_ of the enclosing files */
+            size_t depth_;
+            size_t expansions_;
+
+            /* directive names, "if" and "else" are keywords */
+            gcc::symbol_t sym_include_;
+            gcc::symbol_t sym_define_;
+            gcc::symbol_t sym_undef_;
+            gcc::symbol_t sym_ifdef_;
+            gcc::symbol_t sym_ifndef_;
+            gcc::symbol_t sym_elif_;
+            gcc::symbol_t sym_endif_;
+            gcc::symbol_t sym_pragma_;
+            gcc::symbol_t sym_once_;
+            gcc::symbol_t sym_error_;
+            gcc::symbol_t sym_warning_;
+            gcc::symbol_t sym_line_;
+            gcc::symbol_t sym_defined_;
+            gcc::symbol_t sym_va_args_;
+    };
+};
+
+#endif /* __PREPROCESSOR_HH__ */
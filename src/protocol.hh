@@ -0,0 +1,114 @@
+#ifndef __PROTOCOL_HH__
+#define __PROTOCOL_HH__
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <string>
+
+#include <unistd.h>
+
+/* Wire format between gabriel --daemon and gabriel-client.
+ *
+ * Every message is a one byte type, a 32-bit little-endian payload
+ * length and the payload. The client sends one request per connection:
+ *
+ *   MSG_COMPILE  working directory and argv, each NUL-terminated
+ *   MSG_STOP     no payload, the daemon exits after replying
+ *
+ * and the daemon answers with any number of MSG_STDOUT and MSG_STDERR
+ * chunks, sent as the output is produced, followed by MSG_EXIT carrying
+ * the exit status as one byte. */
+namespace gcc {
+    namespace protocol {
+
+        enum {
+            MSG_COMPILE = 'C',
+            MSG_STOP    = 'Q',
+            MSG_STDOUT  = 'O',
+            MSG_STDERR  = 'E',
+            MSG_EXIT    = 'X',
+        };
+
+        /* requests larger than this are rejected */
+        enum { MAX_PAYLOAD = 16 * 1024 * 1024 };
+
+        static inline bool write_all(int fd, const void *data, size_t len)
+        {
+            const char *ptr = (const char *)data;
+
+            while (len) {
+                ssize_t n = ::write(fd, ptr, len);
+
+                if (n < 0 && errno == EINTR)
+                    continue;
+                if (n <= 0)
+                    return false;
+
+                ptr += n;
+                len -= n;
+            }
+
+            return true;
+        }
+
+        static inline bool read_all(int fd, void *data, size_t len)
+        {
+            char *ptr = (char *)data;
+
+            while (len) {
+                ssize_t n = ::read(fd, ptr, len);
+
+                if (n < 0 && errno == EINTR)
+                    continue;
+                if (n <= 0)
+                    return false;
+
+                ptr += n;
+                len -= n;
+            }
+
+            return true;
+        }
+
+        static inline bool send(int fd, uint8_t type, const void *data, size_t len)
+        {
+            uint8_t header[5] = {
+                type,
+                (uint8_t)len, (uint8_t)(len >> 8), (uint8_t)(len >> 16), (uint8_t)(len >> 24),
+            };
+
+            return write_all(fd, header, sizeof(header)) && write_all(fd, data, len);
+        }
+
+        static inline bool recv(int fd, uint8_t& type, std::string& data)
+        {
+            uint8_t header[5];
+            uint32_t len;
+
+            if (!read_all(fd, header, sizeof(header)))
+                return false;
+
+            type = header[0];
+            len  = header[1] | header[2] << 8 | header[3] << 16 | (uint32_t)header[4] << 24;
+
+            if (len > MAX_PAYLOAD)
+                return false;
+
+            data.resize(len);
+            return read_all(fd, &data[0], len);
+        }
+
+        /* $GABRIEL_SOCKET or a per-user socket in /tmp */
+        static inline std::string default_socket()
+        {
+            const char *env = getenv("GABRIEL_SOCKET");
+
+            if (env && *env)
+                return env;
+            return "/tmp/gabriel-" + std::to_string(getuid()) + ".sock";
+        }
+    };
+};
+
+#endif /* __PROTOCOL_HH__ */
@@ -0,0 +1,444 @@
+#include <algorithm>
+#include <climits>
+
+#include "regalloc.hh"
+
+using gcc::ir::NONE;
+using gcc::ir::value_t;
+
+/* in order of preference, caller-saved ones are free to use */
+static const uint8_t caller_saved[] = { gcc::x86::RSI, gcc::x86::RDI, gcc::x86::R8, gcc::x86::R9, gcc::x86::R10 };
+static const uint8_t callee_saved[] = { gcc::x86::RBX, gcc::x86::R12, gcc::x86::R13, gcc::x86::R14, gcc::x86::R15 };
+
+/* vector registers, all caller-saved, xmm13 to xmm15 are scratch */
+static const uint8_t vector_regs[] = {
+    gcc::x86::XMM0, gcc::x86::XMM1, gcc::x86::XMM2, gcc::x86::XMM3, gcc::x86::XMM4, gcc::x86::XMM5, gcc::x86::XMM6,
+    gcc::x86::XMM7, gcc::x86::XMM8, gcc::x86::XMM9, gcc::x86::XMM10, gcc::x86::XMM11, gcc::x86::XMM12,
+};
+
+/* registers of the integer parameters, see the System V ABI */
+static const uint8_t param_regs[] = {
+    gcc::x86::RDI, gcc::x86::RSI, gcc::x86::RDX, gcc::x86::RCX, gcc::x86::R8, gcc::x86::R9,
+};
+
+static inline uint64_t bit(uint8_t reg)
+{
+    return 1ull << reg;
+}
+
+static uint64_t mask(const uint8_t *regs, size_t n)
+{
+    uint64_t m = 0;
+
+    for (size_t i = 0; i < n; ++i)
+        m |= bit(regs[i]);
+
+    return m;
+}
+
+gcc::x86::allocator::allocator():
+    fn_(nullptr),
+    kinds_(nullptr),
+    words_(0),
+    block_(0),
+    spills_(0),
+    used_(0)
+{
+}
+
+gcc::x86::allocator::~allocator()
+{
+}
+
+void gcc::x86::allocator::use(value_t value, uint64_t *set)
+{
+    switch ((*kinds_)[value]) {
+        case VALUE_REG:
+            set[value / 64] |= 1ull << (value % 64);
+            break;
+
+        case VALUE_FUSED: {
+            const gcc::ir::inst_t& inst = fn_->insts[value];
+            const value_t *ops = fn_->operands_of(inst);
+
+            for (uint32_t k = 0, n = fn_->num_operands(inst); k < n; ++k)
+                use(ops[k], set);
+            break;
+        }
+    }
+}
+
+void gcc::x86::allocator::use_at(value_t value, int32_t pos)
+{
+    switch ((*kinds_)[value]) {
+        case VALUE_REG:
+            touch(value, pos);
+            break;
+
+        case VALUE_FUSED: {
+            const gcc::ir::inst_t& inst = fn_->insts[value];
+            const value_t *ops = fn_->operands_of(inst);
+
+            for (uint32_t k = 0, n = fn_->num_operands(inst); k < n; ++k)
+                use_at(ops[k], pos);
+            break;
+        }
+    }
+}
+
+/* what the successors of block need, their phis' operands included */
+void gcc::x86::allocator::live_out(uint32_t block)
+{
+    const gcc::ir::function& fn = *fn_;
+    const gcc::ir::block_t& b = fn.blocks[block];
+
+    std::fill(live_.begin(), live_.end(), 0);
+
+    for (int i = 0; i < 2; ++i) {
+        if (b.succ[i] == NONE || (i == 1 && b.succ[1] == b.succ[0]))
+            continue;
+
+        const gcc::ir::block_t& succ = fn.blocks[b.succ[i]];
+        const uint64_t *in = &live_in_[b.succ[i] * words_];
+
+        for (size_t w = 0; w < words_; ++w)
+            live_[w] |= in[w];
+
+        for (uint32_t p = 0; p < succ.preds.size(); ++p) {
+            if (succ.preds[p] != block)
+                continue;
+
+            for (value_t phi : succ.code) {
+                if (fn.insts[phi].op != gcc::ir::OP_PHI)
+                    break;
+                use(fn.operand(fn.insts[phi], p), live_.data());
+            }
+        }
+    }
+}
+
+void gcc::x86::allocator::liveness()
+{
+    const gcc::ir::function& fn = *fn_;
+    bool changed = true;
+
+    words_ = (fn.insts.size() + 63) / 64;
+    live_in_.assign(fn.blocks.size() * words_, 0);
+    live_.assign(words_, 0);
+
+    while (changed) {
+        changed = false;
+
+        for (uint32_t b = fn.blocks.size(); b-- > 0;) {
+            const gcc::ir::block_t& block = fn.blocks[b];
+
+            live_out(b);
+
+            for (size_t i = block.code.size(); i-- > 0;) {
+                value_t v = block.code[i];
+                const gcc::ir::inst_t& inst = fn.insts[v];
+
+                if (inst.op == gcc::ir::OP_PHI) {
+                    live_[v / 64] &= ~(1ull << (v % 64));
+                    continue;
+                }
+
+                if ((*kinds_)[v] == VALUE_FUSED)
+                    continue;
+
+                live_[v / 64] &= ~(1ull << (v % 64));
+
+                const value_t *ops = fn.operands_of(inst);
+
+                for (uint32_t k = 0, n = fn.num_operands(inst); k < n; ++k)
+                    use(ops[k], live_.data());
+            }
+
+            uint64_t *in = &live_in_[b * words_];
+
+            if (!std::equal(live_.begin(), live_.end(), in)) {
+                std::copy(live_.begin(), live_.end(), in);
+                changed = true;
+            }
+        }
+    }
+}
+
+void gcc::x86::allocator::touch(value_t value, int32_t pos)
+{
+    std::vector<range_t>& ranges = ranges_[value];
+
+    if (stamp_[value] != block_ + 1) {
+        stamp_[value] = block_ + 1;
+
+        /* live out of the block before and into this one, no hole */
+        if (ranges.empty() || ranges.back().to + 1 < pos)
+            ranges.push_back({ pos, pos });
+    }
+
+    ranges.back().to = std::max(ranges.back().to, pos);
+}
+
+bool gcc::x86::allocator::overlap(value_t a, value_t b) const
+{
+    const std::vector<range_t>& x = ranges_[a];
+    const std::vector<range_t>& y = ranges_[b];
+
+    /* touching is fine, one ends where the other is defined */
+    for (size_t i = 0, j = 0; i < x.size() && j < y.size();) {
+        if (x[i].from < y[j].to && y[j].from < x[i].to)
+            return true;
+
+        if (x[i].to < y[j].to)
+            ++i;
+        else
+            ++j;
+    }
+
+    return false;
+}
+
+bool gcc::x86::allocator::crosses(value_t value) const
+{
+    const std::vector<range_t>& ranges = ranges_[value];
+    auto call = std::upper_bound(calls_.begin(), calls_.end(), ranges.front().from);
+
+    for (size_t i = 0; call != calls_.end() && i < ranges.size();) {
+        if (*call >= ranges[i].to)
+            ++i;
+        else if (*call <= ranges[i].from)
+            ++call;
+        else
+            return true;
+    }
+
+    return false;
+}
+
+void gcc::x86::allocator::intervals()
+{
+    const gcc::ir::function& fn = *fn_;
+    int32_t pos = 0;
+
+    ranges_.resize(fn.insts.size());
+    stamp_.assign(fn.insts.size(), 0);
+    calls_.clear();
+
+    for (auto& ranges : ranges_)
+        ranges.clear();
+
+    for (block_ = 0; block_ < fn.blocks.size(); ++block_) {
+        const gcc::ir::block_t& block = fn.blocks[block_];
+        const uint64_t *in = &live_in_[block_ * words_];
+        int32_t start = pos;
+
+        for (size_t w = 0; w < words_; ++w) {
+            for (uint64_t bits = in[w]; bits; bits &= bits - 1)
+                touch(w * 64 + __builtin_ctzll(bits), start);
+        }
+
+        for (value_t v : block.code) {
+            const gcc::ir::inst_t& inst = fn.insts[v];
+
+            /* phis and parameters all arrive at once */
+            if (inst.op == gcc::ir::OP_PHI || inst.op == gcc::ir::OP_PARAM) {
+                if ((*kinds_)[v] == VALUE_REG)
+                    touch(v, start);
+
+                if (inst.op == gcc::ir::OP_PHI)
+                    continue;
+            }
+
+            pos += 2;
+
+            if ((*kinds_)[v] == VALUE_FUSED)
+                continue;
+
+            if ((*kinds_)[v] == VALUE_REG)
+                touch(v, pos);
+
+            const value_t *ops = fn.operands_of(inst);
+
+            for (uint32_t k = 0, n = fn.num_operands(inst); k < n; ++k)
+                use_at(ops[k], pos);
+
+            if (inst.op == gcc::ir::OP_CALL)
+                calls_.push_back(pos);
+        }
+
+        /* live out through the terminator and the moves after it */
+        live_out(block_);
+
+        for (size_t w = 0; w < words_; ++w) {
+            for (uint64_t bits = live_[w]; bits; bits &= bits - 1)
+                touch(w * 64 + __builtin_ctzll(bits), pos + 1);
+        }
+
+        pos += 2;
+    }
+}
+
+uint32_t gcc::x86::allocator::slots(value_t value) const
+{
+    return gcc::ir::is_vector(fn_->insts[value].type) ? gcc::ir::type_size(fn_->insts[value].type) / 8 : 1;
+}
+
+void gcc::x86::allocator::scan()
+{
+    const gcc::ir::function& fn = *fn_;
+    const uint64_t callee = mask(callee_saved, sizeof(callee_saved));
+    const uint64_t pool = mask(caller_saved, sizeof(caller_saved)) | callee;
+    const uint64_t vectors = mask(vector_regs, sizeof(vector_regs));
+    std::vector<value_t> order;
+
+    for (value_t v = 0; v < fn.insts.size(); ++v) {
+        if ((*kinds_)[v] == VALUE_REG && !ranges_[v].empty())
+            order.push_back(v);
+    }
+
+    std::sort(order.begin(), order.end(), [this](value_t a, value_t b) {
+        int32_t x = ranges_[a].front().from, y = ranges_[b].front().from;
+        return x != y ? x < y : a < b;
+    });
+
+    for (auto& assigned : assigned_)
+        assigned.clear();
+
+    for (value_t v : order) {
+        int32_t start = ranges_[v].front().from;
+        int32_t end   = ranges_[v].back().to;
+        bool vector   = gcc::ir::is_vector(fn.insts[v].type);
+        uint64_t usable = vector ? vectors : (crosses(v) ? callee : ~0ull) & pool;
+        uint64_t allowed = 0;
+        uint8_t first = vector ? XMM0 : RAX;
+        uint8_t r = REG_NONE;
+
+        for (uint8_t i = first; i < first + 16; ++i) {
+            std::vector<value_t>& assigned = assigned_[i];
+
+            assigned.erase(std::remove_if(assigned.begin(), assigned.end(), [&](value_t other) {
+                return ranges_[other].back().to <= start;
+            }), assigned.end());
+
+            if (!(usable & bit(i)))
+                continue;
+
+            if (std::none_of(assigned.begin(), assigned.end(), [&](value_t other) { return overlap(v, other); }))
+                allowed |= bit(i);
+        }
+
+        if (hint_[v] != NONE && reg_[hint_[v]] != REG_NONE && (allowed & bit(reg_[hint_[v]])))
+            r = reg_[hint_[v]];
+        else if (fn.insts[v].op == gcc::ir::OP_PARAM && fn.insts[v].imm < 6 &&
+                 (allowed & bit(param_regs[fn.insts[v].imm])))
+            r = param_regs[fn.insts[v].imm];
+
+        for (size_t i = 0; r == REG_NONE && i < sizeof(caller_saved); ++i) {
+            if (allowed & bit(caller_saved[i]))
+                r = caller_saved[i];
+        }
+
+        for (size_t i = 0; r == REG_NONE && i < sizeof(vector_regs); ++i) {
+            if (allowed & bit(vector_regs[i]))
+                r = vector_regs[i];
+        }
+
+        for (size_t i = 0; r == REG_NONE && i < sizeof(callee_saved); ++i) {
+            if (allowed & bit(callee_saved[i]))
+                r = callee_saved[i];
+        }
+
+        if (r == REG_NONE) {
+            /* take the register whose intervals in the way all end last, spill them */
+            int32_t best = end;
+
+            for (uint8_t i = first; i < first + 16; ++i) {
+                int32_t soonest = INT32_MAX;
+
+                if (!(usable & bit(i)))
+                    continue;
+
+                for (value_t other : assigned_[i]) {
+                    if (overlap(v, other))
+                        soonest = std::min(soonest, ranges_[other].back().to);
+                }
+
+                if (soonest > best) {
+                    best = soonest;
+                    r = i;
+                }
+            }
+
+            if (r == REG_NONE) {
+                spill_[v] = spills_;
+                spills_  += slots(v);
+                continue;
+            }
+
+            std::vector<value_t>& assigned = assigned_[r];
+
+            for (size_t i = 0; i < assigned.size();) {
+                if (overlap(v, assigned[i])) {
+                    reg_[assigned[i]]   = REG_NONE;
+                    spill_[assigned[i]] = spills_;
+                    spills_ += slots(assigned[i]);
+                    assigned[i] = assigned.back();
+                    assigned.pop_back();
+                } else {
+                    ++i;
+                }
+            }
+        }
+
+        reg_[v] = r;
+        assigned_[r].push_back(v);
+    }
+
+    for (value_t v : order) {
+        if (reg_[v] != REG_NONE && (callee & bit(reg_[v])))
+            used_ |= (uint32_t)bit(reg_[v]);
+    }
+}
+
+void gcc::x86::allocator::run(const gcc::ir::function& fn, const std::vector<uint8_t>& kinds)
+{
+    fn_    = &fn;
+    kinds_ = &kinds;
+    spills_ = 0;
+    used_   = 0;
+
+    reg_.assign(fn.insts.size(), REG_NONE);
+    spill_.assign(fn.insts.size(), NONE);
+    hint_.assign(fn.insts.size(), NONE);
+
+    for (const gcc::ir::block_t& block : fn.blocks) {
+        for (value_t v : block.code) {
+            const gcc::ir::inst_t& inst = fn.insts[v];
+
+            if (kinds[v] != VALUE_REG)
+                continue;
+
+            if (inst.op == gcc::ir::OP_PHI) {
+                /* share a register with the operand coming in first, later ones with the phi */
+                for (uint32_t k = 0; k < inst.arg[1]; ++k) {
+                    value_t op = fn.operand(inst, k);
+
+                    if (kinds[op] != VALUE_REG)
+                        continue;
+
+                    if (op < v && hint_[v] == NONE)
+                        hint_[v] = op;
+                    else if (op > v && hint_[op] == NONE)
+                        hint_[op] = v;
+                }
+            } else if (gcc::ir::info(inst.op).operands == 2 && !(gcc::ir::info(inst.op).flags & gcc::ir::OPF_VARIADIC) &&
+                       inst.op != gcc::ir::OP_STORE && kinds[inst.arg[0]] == VALUE_REG && hint_[v] == NONE) {
+                hint_[v] = inst.arg[0];
+            }
+        }
+    }
+
+    liveness();
+    intervals();
+    scan();
+}
@@ -0,0 +1,123 @@
+#ifndef __REGALLOC_HH__
+#define __REGALLOC_HH__
+
+#include <cstdint>
+#include <vector>
+
+#include "ir.hh"
+#include "x86.hh"
+
+namespace gcc {
+
+    namespace x86 {
+
+        /* how the allocator treats a value, see allocator::run() */
+        enum {
+            VALUE_NONE,    /* needs no register: void, or rematerialized where it's used */
+            VALUE_REG,     /* lives in a register or a spill slot */
+            VALUE_FUSED,   /* folded into its users, its operands are read there */
+        };
+
+        /* Linear scan register allocation, after Poletto and Sarkar,
+         * "Linear Scan Register Allocation", on lifetime intervals with
+         * holes as in Wimmer and Mossenboeck, "Optimized Interval
+         * Splitting in a Linear Scan Register Allocator", without the
+         * splitting.
+         *
+         * Blocks are laid out in the function's order (reverse postorder)
+         * and the live sets of blocks come from the usual backward
+         * dataflow. The interval of a value is the list of ranges where
+         * it's live: from its definition or the start of a block it's
+         * live into, to its last use there or the end of a block it's live
+         * out of. A phi is defined at the start of its block and its
+         * operands are live to the end of the predecessors, where the code
+         * generator moves them in, so a loop-carried value and its phi
+         * don't overlap and can share a register. Intervals are visited in
+         * order of their start and take a register no assigned interval
+         * overlaps, the one of a related value if they can (a phi's
+         * operand, the first operand of an arithmetic instruction). When
+         * none is left the intervals in the way ending last are spilled to
+         * a stack slot for their whole life, or the current one is.
+         *
+         * rax, rcx, rdx and r11 are never allocated, they're the scratch
+         * registers of instruction selection. Values live across a call
+         * only get callee-saved registers. Vectors are allocated the same
+         * from xmm0 to xmm12, xmm13 to xmm15 are scratch, and spill to as
+         * many consecutive slots as they have 8 bytes. The vectorizer
+         * keeps them out of code with calls, so there's no callee-saved
+         * vector register to prefer. */
+        class allocator {
+            public:
+                allocator();
+                ~allocator();
+
+                /* allocate fn, kinds has one VALUE_* per value */
+                void run(const gcc::ir::function& fn, const std::vector<uint8_t>& kinds);
+
+                /* register of value, REG_NONE if it's spilled or VALUE_NONE */
+                uint8_t reg(gcc::ir::value_t value) const { return reg_[value]; }
+
+                /* first spill slot of value, valid if it's VALUE_REG without a register */
+                uint32_t spill(gcc::ir::value_t value) const { return spill_[value]; }
+
+                uint32_t spills() const { return spills_; }
+
+                /* bit r set for every callee-saved general register r in use */
+                uint32_t used() const { return used_; }
+
+            private:
+                allocator(const allocator&);
+                allocator& operator=(const allocator&);
+
+                /* mark the registers read by operand value live in set */
+                void use(gcc::ir::value_t value, uint64_t *set);
+
+                /* extend the intervals of the registers read by operand value to pos */
+                void use_at(gcc::ir::value_t value, int32_t pos);
+
+                /* extend the interval of value to pos, in the block being numbered */
+                void touch(gcc::ir::value_t value, int32_t pos);
+
+                bool overlap(gcc::ir::value_t a, gcc::ir::value_t b) const;
+
+                /* spill slots value takes */
+                uint32_t slots(gcc::ir::value_t value) const;
+
+                /* value is live across a call */
+                bool crosses(gcc::ir::value_t value) const;
+
+                /* the live-out set of block into live_ */
+                void live_out(uint32_t block);
+
+                void liveness();
+                void intervals();
+                void scan();
+
+                const gcc::ir::function *fn_;
+                const std::vector<uint8_t> *kinds_;
+
+                size_t words_;                  /* of a live set */
+                std::vector<uint64_t> live_in_; /* words_ per block */
+                std::vector<uint64_t> live_;    /* scratch set */
+
+                typedef struct range {
+                    int32_t from;
+                    int32_t to;
+                } range_t;
+
+                std::vector<std::vector<range_t>> ranges_;   /* ascending, per value */
+                std::vector<uint32_t> stamp_;   /* 1 + the last block a value was touched in */
+                uint32_t block_;
+                std::vector<gcc::ir::value_t> assigned_[XMM15 + 1];   /* intervals not over yet, per register */
+                std::vector<int32_t> calls_;    /* positions, ascending */
+                std::vector<gcc::ir::value_t> hint_;
+
+                std::vector<uint8_t> reg_;
+                std::vector<uint32_t> spill_;
+                uint32_t spills_;
+                uint32_t used_;
+        };
+    };
+};
+
+#endif /* __REGALLOC_HH__ */
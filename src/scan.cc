@@ -0,0 +1,235 @@
+#include <cstdlib>
+#include <cstring>
+
+#include "charclass.hh"
+#include "scan.hh"
+#include "util/log.hh"
+
+#define CHANNEL "scan"
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define SCAN_X86 1
+#include <immintrin.h>
+#endif
+
+/* portable fallback for targets without the vector kernels */
+static const char *scalar_skip_ws(const char *ptr)
+{
+    while (gcc::char_class(*ptr) == gcc::CC_SPACE)
+        ptr++;
+    return ptr;
+}
+
+static const char *scalar_line_end(const char *ptr)
+{
+    while (*ptr && *ptr != '\n')
+        ptr++;
+    return ptr;
+}
+
+static const char *scalar_comment_end(const char *ptr)
+{
+    while (*ptr && (*ptr != '*' || *(ptr + 1) != '/'))
+        ptr++;
+    return ptr;
+}
+
+static const char *scalar_ident_end(const char *ptr)
+{
+    while (gcc::is_ident_char(*ptr))
+        ptr++;
+    return ptr;
+}
+
+#ifdef SCAN_X86
+
+/* SSE2 is part of the x86-64 baseline so these need no dispatch */
+
+static inline __m128i sse2_ws_mask(__m128i v)
+{
+    /* ' ' or \t..\r, the range check is done as (c - 9) <= 4 unsigned */
+    __m128i t = _mm_sub_epi8(v, _mm_set1_epi8(9));
+    __m128i r = _mm_cmpeq_epi8(_mm_min_epu8(t, _mm_set1_epi8(4)), t);
+
+    return _mm_or_si128(r, _mm_cmpeq_epi8(v, _mm_set1_epi8(' ')));
+}
+
+static inline __m128i sse2_ident_mask(__m128i v)
+{
+    __m128i lower = _mm_sub_epi8(_mm_or_si128(v, _mm_set1_epi8(0x20)), _mm_set1_epi8('a'));
+    __m128i digit = _mm_sub_epi8(v, _mm_set1_epi8('0'));
+    __m128i alpha = _mm_cmpeq_epi8(_mm_min_epu8(lower, _mm_set1_epi8(25)), lower);
+    __m128i num   = _mm_cmpeq_epi8(_mm_min_epu8(digit, _mm_set1_epi8(9)), digit);
+
+    return _mm_or_si128(_mm_or_si128(alpha, num), _mm_cmpeq_epi8(v, _mm_set1_epi8('_')));
+}
+
+static const char *sse2_skip_ws(const char *ptr)
+{
+    for (;; ptr += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)ptr);
+        unsigned mask = ~_mm_movemask_epi8(sse2_ws_mask(v)) & 0xffff;
+
+        if (mask)
+            return ptr + __builtin_ctz(mask);
+    }
+}
+
+static const char *sse2_line_end(const char *ptr)
+{
+    for (;; ptr += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)ptr);
+        __m128i r = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('\n')),
+                                 _mm_cmpeq_epi8(v, _mm_setzero_si128()));
+        unsigned mask = _mm_movemask_epi8(r);
+
+        if (mask)
+            return ptr + __builtin_ctz(mask);
+    }
+}
+
+static const char *sse2_comment_end(const char *ptr)
+{
+    /* compare the block against '*' and the block shifted by one
+     * against '/' so only complete terminators set a bit */
+    for (;; ptr += 16) {
+        __m128i v0 = _mm_loadu_si128((const __m128i *)ptr);
+        __m128i v1 = _mm_loadu_si128((const __m128i *)(ptr + 1));
+        __m128i r  = _mm_and_si128(_mm_cmpeq_epi8(v0, _mm_set1_epi8('*')),
+                                   _mm_cmpeq_epi8(v1, _mm_set1_epi8('/')));
+        unsigned mask = _mm_movemask_epi8(_mm_or_si128(r, _mm_cmpeq_epi8(v0, _mm_setzero_si128())));
+
+        if (mask)
+            return ptr + __builtin_ctz(mask);
+    }
+}
+
+static const char *sse2_ident_end(const char *ptr)
+{
+    for (;; ptr += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)ptr);
+        unsigned mask = ~_mm_movemask_epi8(sse2_ident_mask(v)) & 0xffff;
+
+        if (mask)
+            return ptr + __builtin_ctz(mask);
+    }
+}
+
+#define AVX2 __attribute__((target("avx2")))
+
+static inline AVX2 __m256i avx2_range(__m256i v, char lo, char n)
+{
+    __m256i t = _mm256_sub_epi8(v, _mm256_set1_epi8(lo));
+    return _mm256_cmpeq_epi8(_mm256_min_epu8(t, _mm256_set1_epi8(n)), t);
+}
+
+static AVX2 const char *avx2_skip_ws(const char *ptr)
+{
+    for (;; ptr += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)ptr);
+        __m256i r = _mm256_or_si256(avx2_range(v, 9, 4), _mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')));
+        unsigned mask = ~(unsigned)_mm256_movemask_epi8(r);
+
+        if (mask)
+            return ptr + __builtin_ctz(mask);
+    }
+}
+
+static AVX2 const char *avx2_line_end(const char *ptr)
+{
+    for (;; ptr += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)ptr);
+        __m256i r = _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n')),
+                                    _mm256_cmpeq_epi8(v, _mm256_setzero_si256()));
+        unsigned mask = _mm256_movemask_epi8(r);
+
+        if (mask)
+            return ptr + __builtin_ctz(mask);
+    }
+}
+
+static AVX2 const char *avx2_comment_end(const char *ptr)
+{
+    for (;; ptr += 32) {
+        __m256i v0 = _mm256_loadu_si256((const __m256i *)ptr);
+        __m256i v1 = _mm256_loadu_si256((const __m256i *)(ptr + 1));
+        __m256i r  = _mm256_and_si256(_mm256_cmpeq_epi8(v0, _mm256_set1_epi8('*')),
+                                      _mm256_cmpeq_epi8(v1, _mm256_set1_epi8('/')));
+        r = _mm256_or_si256(r, _mm256_cmpeq_epi8(v0, _mm256_setzero_si256()));
+        unsigned mask = _mm256_movemask_epi8(r);
+
+        if (mask)
+            return ptr + __builtin_ctz(mask);
+    }
+}
+
+static AVX2 const char *avx2_ident_end(const char *ptr)
+{
+    for (;; ptr += 32) {
+        __m256i v     = _mm256_loadu_si256((const __m256i *)ptr);
+        __m256i lower = _mm256_or_si256(v, _mm256_set1_epi8(0x20));
+        __m256i r     = _mm256_or_si256(avx2_range(lower, 'a', 25), avx2_range(v, '0', 9));
+
+        r = _mm256_or_si256(r, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('_')));
+        unsigned mask = ~(unsigned)_mm256_movemask_epi8(r);
+
+        if (mask)
+            return ptr + __builtin_ctz(mask);
+    }
+}
+
+#undef AVX2
+
+#endif /* SCAN_X86 */
+
+static const gcc::scanner_t scanners[] = {
+#ifdef SCAN_X86
+    { "avx2",   avx2_skip_ws,   avx2_line_end,   avx2_comment_end,   avx2_ident_end   },
+    { "sse2",   sse2_skip_ws,   sse2_line_end,   sse2_comment_end,   sse2_ident_end   },
+#endif
+    { "scalar", scalar_skip_ws, scalar_line_end, scalar_comment_end, scalar_ident_end },
+};
+
+static bool supported(const gcc::scanner_t& scanner)
+{
+#ifdef SCAN_X86
+    if (!strcmp(scanner.name, "avx2"))
+        return __builtin_cpu_supports("avx2");
+#endif
+    (void)scanner;
+    return true;
+}
+
+const gcc::scanner_t *gcc::get_scanner(const char *name)
+{
+    for (const gcc::scanner_t& scanner : scanners) {
+        if (!strcmp(scanner.name, name))
+            return supported(scanner) ? &scanner : nullptr;
+    }
+
+    return nullptr;
+}
+
+static const gcc::scanner_t *detect_scanner()
+{
+    const gcc::scanner_t *selected = nullptr;
+    const char *name = getenv("GABRIEL_SCAN");
+
+    if (name && !(selected = gcc::get_scanner(name)))
+        WARN("scanner '%s' is not supported, using autodetection\n", name);
+
+    for (size_t i = 0; !selected; ++i) {
+        if (supported(scanners[i]))
+            selected = &scanners[i];
+    }
+
+    DEBUG("using %s scanner\n", selected->name);
+    return selected;
+}
+
+const gcc::scanner_t *gcc::get_scanner()
+{
+    static const gcc::scanner_t *selected = detect_scanner();
+
+    return selected;
+}
@@ -0,0 +1,38 @@
+#ifndef __SCAN_HH__
+#define __SCAN_HH__
+
+namespace gcc {
+
+    /* Block scanning kernels used by the tokenizer.
+     *
+     * Each kernel returns a pointer to the first byte that ends the run
+     * it was asked to skip. Kernels load up to SCAN_PADDING bytes at a time
+     * so the input must be NUL-terminated and readable for SCAN_PADDING
+     * bytes past the terminator (gcc::source_buffer guarantees this). */
+    enum { SCAN_PADDING = 32 };
+
+    typedef struct scanner {
+        const char *name;
+
+        /* first byte that is not ' ', \t, \n, \v, \f or \r */
+        const char *(*skip_ws)(const char *ptr);
+
+        /* first '\n' or NUL */
+        const char *(*line_end)(const char *ptr);
+
+        /* first "*\/" or NUL */
+        const char *(*comment_end)(const char *ptr);
+
+        /* first byte that is not [A-Za-z0-9_] */
+        const char *(*ident_end)(const char *ptr);
+    } scanner_t;
+
+    /* return the fastest scanner the CPU supports,
+     * GABRIEL_SCAN=scalar|sse2|avx2 overrides the detection */
+    const gcc::scanner_t *get_scanner();
+
+    /* return scanner by name or nullptr if it's not supported */
+    const gcc::scanner_t *get_scanner(const char *name);
+};
+
+#endif /* __SCAN_HH__ */
@@ -0,0 +1,144 @@
+#include <cstring>
+#include <utility>
+
+#include "serialize.hh"
+#include "util/log.hh"
+
+#define CHANNEL "serialize"
+
+void gcc::serialize::symbol_table::write(std::string& out) const
+{
+    gcc::serialize::put32(out, (uint32_t)symbols_.size());
+
+    for (gcc::symbol_t sym : symbols_) {
+        gcc::serialize::put32(out, (uint32_t)gcc::symbols().length(sym));
+        out.append(gcc::symbols().str(sym), gcc::symbols().length(sym));
+    }
+}
+
+void gcc::serialize::symbol_table::read(gcc::serialize::cursor_t& in, std::vector<gcc::symbol_t>& symbols)
+{
+    uint32_t count = in.u32();
+
+    symbols.assign(1, gcc::SYM_NONE);
+
+    for (uint32_t i = 0; i < count && in.ok; ++i) {
+        uint32_t len = in.u32();
+        const char *str = in.take(len);
+
+        if (str)
+            symbols.push_back(gcc::symbols().intern(str, len));
+    }
+}
+
+void gcc::serialize::write(std::string& out, const gcc::token_stream_t& tokens, const gcc::prog_t *prog)
+{
+    std::vector<gcc::token_t> stream(tokens.begin(), tokens.end());
+    gcc::serialize::symbol_table table;
+
+    for (gcc::token_t& token : stream) {
+        if (gcc::holds_symbol(token))
+            token.sym = table.add(token.sym);
+    }
+
+    table.write(out);
+
+    gcc::serialize::put32(out, (uint32_t)stream.size());
+    out.append((const char *)stream.data(), stream.size() * sizeof(gcc::token_t));
+
+    gcc::serialize::put32(out, (uint32_t)tokens.literals_.size());
+    out.append((const char *)tokens.literals_.data(), tokens.literals_.size() * sizeof(uint64_t));
+
+    gcc::serialize::put32(out, (uint32_t)tokens.lines_.size());
+    out.append((const char *)tokens.lines_.data(), tokens.lines_.size() * sizeof(uint32_t));
+
+    gcc::serialize::put32(out, prog ? 1 : 0);
+
+    if (prog)
+        gcc::image::write(out, *prog);
+}
+
+gcc::serialize::reader::reader():
+    data_(nullptr),
+    size_(0),
+    symbols_(),
+    tokens_(0),
+    ntokens_(0),
+    literals_(0),
+    nliterals_(0),
+    lines_(0),
+    nlines_(0),
+    prog_(0)
+{
+}
+
+gcc_error_t gcc::serialize::reader::open(const char *data, size_t size)
+{
+    gcc::serialize::cursor_t in = { data, data + size, true };
+
+    data_ = data;
+    size_ = size;
+
+    gcc::serialize::symbol_table::read(in, symbols_);
+
+    ntokens_   = in.u32();
+    tokens_    = in.ptr - data;
+    in.take(ntokens_, sizeof(gcc::token_t));
+
+    nliterals_ = in.u32();
+    literals_  = in.ptr - data;
+    in.take(nliterals_, sizeof(uint64_t));
+
+    nlines_    = in.u32();
+    lines_     = in.ptr - data;
+    in.take(nlines_, sizeof(uint32_t));
+
+    prog_      = in.u32() ? in.ptr - data : 0;
+
+    if (!in.ok) {
+        WARN("truncated token stream\n");
+        return GCC_INVALID_VALUE;
+    }
+
+    return GCC_SUCCESS;
+}
+
+gcc_error_t gcc::serialize::reader::read_tokens(gcc::token_stream_t& tokens) const
+{
+    gcc::token_stream_t stream;
+
+    stream.tokens_.resize(ntokens_);
+    stream.literals_.resize(nliterals_);
+    stream.lines_.resize(nlines_);
+
+    memcpy(stream.tokens_.data(), data_ + tokens_, (size_t)ntokens_ * sizeof(gcc::token_t));
+    memcpy(stream.literals_.data(), data_ + literals_, (size_t)nliterals_ * sizeof(uint64_t));
+    memcpy(stream.lines_.data(), data_ + lines_, (size_t)nlines_ * sizeof(uint32_t));
+
+    for (gcc::token_t& token : stream.tokens_) {
+        if (token.type >= TT_LAST ||
+            (gcc::holds_symbol(token) && token.sym >= symbols_.size()) ||
+            (token.type == TT_DIGIT && token.literal >= nliterals_)) {
+            WARN("invalid token in stored stream\n");
+            return GCC_INVALID_VALUE;
+        }
+
+        if (gcc::holds_symbol(token))
+            token.sym = symbols_[token.sym];
+    }
+
+    /* tokens is left alone unless everything checks out */
+    std::swap(tokens, stream);
+    return GCC_SUCCESS;
+}
+
+gcc_error_t gcc::serialize::reader::read_prog(gcc::image& image) const
+{
+    /* the image starts at the next 8-byte boundary */
+    size_t offset = (prog_ + 7) & ~(size_t)7;
+
+    if (!prog_ || offset > size_)
+        return GCC_INVALID_VALUE;
+
+    return image.open(data_ + offset, size_ - offset);
+}
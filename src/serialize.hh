@@ -0,0 +1,160 @@
+#ifndef __SERIALIZE_HH__
+#define __SERIALIZE_HH__
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "image.hh"
+#include "intern.hh"
+#include "parser.hh"
+#include "token.hh"
+#include "util/error.hh"
+
+namespace gcc {
+
+    /* Flat encoding of a token stream and the program parsed from it.
+     *
+     * Symbols are written once as text to a table at the front and every
+     * token refers to them by their index in that table, so the encoding
+     * doesn't depend on the interner of the process that wrote it. The
+     * program follows the tokens as a gcc::image.
+     *
+     * The encoding is native-endian, it's meant for caches on the machine
+     * that wrote it, not for exchange. */
+    namespace serialize {
+
+        static inline void put32(std::string& out, uint32_t value)
+        {
+            out.append((const char *)&value, sizeof(value));
+        }
+
+        static inline void put64(std::string& out, uint64_t value)
+        {
+            out.append((const char *)&value, sizeof(value));
+        }
+
+        /* bounds-checked reads from the encoded data, any read past
+         * the end leaves the cursor failed and returns zeros */
+        typedef struct cursor {
+            const char *ptr;
+            const char *end;
+            bool ok;
+
+            const char *take(size_t len)
+            {
+                if (!ok || (size_t)(end - ptr) < len) {
+                    ok = false;
+                    return nullptr;
+                }
+
+                const char *data = ptr;
+                ptr += len;
+                return data;
+            }
+
+            /* skip an array of count elements of size bytes */
+            const char *take(uint32_t count, size_t size)
+            {
+                return take((size_t)count * size);
+            }
+
+            uint32_t u32()
+            {
+                const char *data = take(sizeof(uint32_t));
+                uint32_t value = 0;
+
+                if (data)
+                    memcpy(&value, data, sizeof(value));
+                return value;
+            }
+
+            uint64_t u64()
+            {
+                const char *data = take(sizeof(uint64_t));
+                uint64_t value = 0;
+
+                if (data)
+                    memcpy(&value, data, sizeof(value));
+                return value;
+            }
+        } cursor_t;
+
+        /* symbol table being written, symbols are dense so the
+         * mapping to table indices is a plain array */
+        class symbol_table {
+            public:
+                symbol_table():
+                    index_(gcc::symbols().size() + 1, 0),
+                    symbols_()
+                {
+                }
+
+                /* table index of sym, 0 for SYM_NONE */
+                uint32_t add(gcc::symbol_t sym)
+                {
+                    if (sym == gcc::SYM_NONE)
+                        return 0;
+
+                    if (!index_[sym]) {
+                        symbols_.push_back(sym);
+                        index_[sym] = (uint32_t)symbols_.size();
+                    }
+
+                    return index_[sym];
+                }
+
+                void write(std::string& out) const;
+
+                /* Intern the table written by write() into the calling
+                 * thread's interner, symbols[index] is the symbol of a
+                 * table index. A truncated table fails in. */
+                static void read(gcc::serialize::cursor_t& in, std::vector<gcc::symbol_t>& symbols);
+
+            private:
+                std::vector<uint32_t> index_;
+                std::vector<gcc::symbol_t> symbols_;
+        };
+
+        /* append tokens and, unless prog is nullptr, the program to out */
+        void write(std::string& out, const gcc::token_stream_t& tokens, const gcc::prog_t *prog);
+
+        class reader {
+            public:
+                reader();
+
+                /* Check the layout of data[0..size) and intern its symbols
+                 * into the calling thread's interner. data must outlive the
+                 * reader. Fails on anything write() couldn't have produced. */
+                gcc_error_t open(const char *data, size_t size);
+
+                /* true if a program image was written after the tokens */
+                bool has_prog() const { return prog_ != 0; }
+
+                /* replace the contents of tokens with the stored stream */
+                gcc_error_t read_tokens(gcc::token_stream_t& tokens) const;
+
+                /* view the stored program image, see gcc::parser::load() */
+                gcc_error_t read_prog(gcc::image& image) const;
+
+            private:
+                const char *data_;
+                size_t size_;
+
+                std::vector<gcc::symbol_t> symbols_;  /* table index to symbol */
+
+                /* offset and element count of each section */
+                size_t tokens_;
+                uint32_t ntokens_;
+                size_t literals_;
+                uint32_t nliterals_;
+                size_t lines_;
+                uint32_t nlines_;
+                size_t prog_;
+        };
+    };
+};
+
+#endif /* __SERIALIZE_HH__ */
@@ -0,0 +1,237 @@
+#include <csignal>
+#include <cstring>
+#include <vector>
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "protocol.hh"
+#include "server.hh"
+#include "util/log.hh"
+
+#define CHANNEL "server"
+
+/* Output of a request, sent to the client as frames of type as it's
+ * written. The streams of a reply share failed, once a send fails the
+ * client is gone and the rest of the output is dropped. */
+typedef struct channel {
+    int fd;
+    uint8_t type;
+    bool *failed;
+} channel_t;
+
+static ssize_t write_channel(void *cookie, const char *data, size_t len)
+{
+    channel_t *channel = (channel_t *)cookie;
+
+    if (!*channel->failed && !gcc::protocol::send(channel->fd, channel->type, data, len))
+        *channel->failed = true;
+
+    /* a client that went away doesn't fail the compilation */
+    return len;
+}
+
+/* stream of channel, buffered in mode (_IOLBF or _IOFBF) */
+static FILE *open_channel(channel_t& channel, int mode)
+{
+    cookie_io_functions_t io = { nullptr, write_channel, nullptr, nullptr };
+    FILE *file = fopencookie(&channel, "w", io);
+
+    if (file)
+        setvbuf(file, nullptr, mode, BUFSIZ);
+    return file;
+}
+
+gcc::server::server():
+    driver_(true),
+    path_(),
+    fd_(-1)
+{
+}
+
+gcc::server::~server()
+{
+    if (fd_ >= 0) {
+        ::close(fd_);
+        unlink(path_.c_str());
+    }
+}
+
+gcc_error_t gcc::server::listen(const char *path)
+{
+    struct sockaddr_un addr;
+
+    path_ = path && *path ? path : gcc::protocol::default_socket();
+
+    if (path_.size() >= sizeof(addr.sun_path)) {
+        ERROR("socket path %s is too long\n", path_.c_str());
+        return GCC_INVALID_VALUE;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    memcpy(addr.sun_path, path_.c_str(), path_.size());
+
+    if ((fd_ = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0) {
+        ERROR("failed to create socket: %s\n", strerror(errno));
+        return GCC_INVALID_VALUE;
+    }
+
+    /* a socket left behind by a daemon that died, refuse to steal a live one */
+    if (connect(fd_, (struct sockaddr *)&addr, sizeof(addr)) == 0) {
+        ERROR("a daemon is already serving %s\n", path_.c_str());
+        ::close(fd_);
+        fd_ = -1;
+        return GCC_INVALID_VALUE;
+    }
+    unlink(path_.c_str());
+
+    /* only the owner may connect, the socket is created 0600 */
+    mode_t mask = umask(0077);
+    int bound   = bind(fd_, (struct sockaddr *)&addr, sizeof(addr));
+
+    umask(mask);
+
+    if (bound < 0 || ::listen(fd_, 64) < 0) {
+        ERROR("failed to listen on %s: %s\n", path_.c_str(), strerror(errno));
+        ::close(fd_);
+        fd_ = -1;
+        return GCC_INVALID_VALUE;
+    }
+
+    /* clients that go away mid-reply must not kill the daemon */
+    signal(SIGPIPE, SIG_IGN);
+
+    INFO("listening on %s\n", path_.c_str());
+    return GCC_SUCCESS;
+}
+
+gcc_error_t gcc::server::run()
+{
+    for (;;) {
+        int fd = accept4(fd_, nullptr, nullptr, SOCK_CLOEXEC);
+
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+
+            ERROR("accept failed: %s\n", strerror(errno));
+            return GCC_INVALID_VALUE;
+        }
+
+        bool more = serve(fd);
+        ::close(fd);
+
+        if (!more)
+            return GCC_SUCCESS;
+    }
+}
+
+bool gcc::server::serve(int fd)
+{
+    std::string request;
+    struct ucred cred;
+    socklen_t len = sizeof(cred);
+    uint8_t type;
+
+    /* the daemon compiles with its own permissions, serve only its user */
+    if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) < 0 || cred.uid != getuid()) {
+        WARN("refusing a client that isn't run by the daemon's user\n");
+        return true;
+    }
+
+    /* requests are served one at a time, a stalled client mustn't hold the others */
+    struct timeval timeout = { CLIENT_TIMEOUT, 0 };
+
+    if (setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) < 0 ||
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout)) < 0) {
+        WARN("failed to set a timeout on a client: %s\n", strerror(errno));
+        return true;
+    }
+
+    /* also what a daemon probing for a live socket looks like */
+    if (!gcc::protocol::recv(fd, type, request)) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK)
+            WARN("client sent no request within %d seconds\n", (int)CLIENT_TIMEOUT);
+        else
+            DEBUG("client closed the connection without a request\n");
+        return true;
+    }
+
+    if (type == gcc::protocol::MSG_STOP) {
+        uint8_t status = EXIT_SUCCESS;
+
+        INFO("stopping on client request\n");
+        gcc::protocol::send(fd, gcc::protocol::MSG_EXIT, &status, 1);
+        return false;
+    }
+
+    if (type != gcc::protocol::MSG_COMPILE || request.empty() || request.back() != '\0') {
+        WARN("dropping malformed request\n");
+        return true;
+    }
+
+    /* working directory first, then argv */
+    std::vector<char *> argv;
+    std::string cwd = request.c_str();
+
+    for (size_t i = cwd.size() + 1; i < request.size(); i += strlen(&request[i]) + 1)
+        argv.push_back(&request[i]);
+
+    bool failed        = false;
+    channel_t out_chan = { fd, gcc::protocol::MSG_STDOUT, &failed };
+    channel_t err_chan = { fd, gcc::protocol::MSG_STDERR, &failed };
+    FILE *out          = open_channel(out_chan, _IOFBF);
+    FILE *err          = open_channel(err_chan, _IOLBF);
+    gcc::options_t opts;
+    int status;
+
+    if (!out || !err) {
+        WARN("failed to open the output streams of a request\n");
+
+        if (out)
+            fclose(out);
+        if (err)
+            fclose(err);
+        return true;
+    }
+
+    argv.push_back(nullptr);
+
+    if ((status = gcc::driver::parse_options(argv.size() - 1, argv.data(), opts, err)) < 0) {
+        if (opts.daemon) {
+            fprintf(err, "the daemon can't start another daemon\n");
+            status = EXIT_FAILURE;
+        } else {
+            /* the client's relative paths are relative to its directory, not ours */
+            for (std::string& file : opts.files) {
+                if (file[0] != '/')
+                    file = cwd + "/" + file;
+            }
+
+            for (std::string& dir : opts.include_dirs) {
+                if (dir[0] != '/')
+                    dir = cwd + "/" + dir;
+            }
+
+            if (!opts.include_pch.empty() && opts.include_pch[0] != '/')
+                opts.include_pch = cwd + "/" + opts.include_pch;
+
+            status = driver_.run(opts, out, err);
+        }
+    }
+
+    /* sends what's still buffered */
+    fclose(out);
+    fclose(err);
+
+    uint8_t code = (uint8_t)status;
+
+    if (failed || !gcc::protocol::send(fd, gcc::protocol::MSG_EXIT, &code, 1))
+        WARN("client went away before the reply was sent\n");
+
+    return true;
+}
@@ -0,0 +1,48 @@
+#ifndef __SERVER_HH__
+#define __SERVER_HH__
+
+#include <string>
+
+#include "driver.hh"
+#include "util/error.hh"
+
+namespace gcc {
+
+    /* Compile server behind gabriel --daemon.
+     *
+     * Requests are served one at a time, each one in parallel on the
+     * driver's pool. Everything the driver keeps warm (worker threads,
+     * their interners and arenas, outcomes of unchanged files) is shared by
+     * all requests, so an incremental rebuild only pays for the files that
+     * actually changed. A client has CLIENT_TIMEOUT seconds to send its
+     * request and for every write of the reply, so one that stalls is
+     * dropped instead of blocking the daemon. The output of a request is
+     * sent as it's written, stderr a line at a time, see protocol.hh for
+     * the wire format. */
+    class server {
+        public:
+            enum { CLIENT_TIMEOUT = 5 };
+
+            server();
+            ~server();
+
+            /* bind and listen on path, an empty path means the default */
+            gcc_error_t listen(const char *path);
+
+            /* serve requests until a client asks the daemon to stop */
+            gcc_error_t run();
+
+        private:
+            server(const server&);
+            server& operator=(const server&);
+
+            /* returns false once the daemon should stop */
+            bool serve(int fd);
+
+            gcc::driver driver_;
+            std::string path_;
+            int fd_;
+    };
+};
+
+#endif /* __SERVER_HH__ */
@@ -0,0 +1,161 @@
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "source.hh"
+#include "stats.hh"
+#include "util/log.hh"
+
+#define CHANNEL "source"
+
+gcc::source_buffer::source_buffer():
+    data_(nullptr),
+    size_(0),
+    alloc_(0),
+    mapped_(false)
+{
+}
+
+gcc::source_buffer::~source_buffer()
+{
+    close();
+}
+
+void gcc::source_buffer::close()
+{
+    if (!data_)
+        return;
+
+    if (mapped_)
+        munmap(data_, alloc_);
+    else
+        free(data_);
+
+    data_   = nullptr;
+    size_   = 0;
+    alloc_  = 0;
+    mapped_ = false;
+}
+
+gcc_error_t gcc::source_buffer::map_file(int fd, size_t len)
+{
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t total = ((len + page - 1) & ~(page - 1)) + page;
+    void *base, *file;
+
+    /* reserve the whole range with zero pages first and then map the file
+     * over the head of it, this way the tail of the last file page
+     * (zero-filled by the kernel) and the extra page after it form
+     * the sentinel/padding and reading them never faults */
+    base = mmap(nullptr, total, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (base == MAP_FAILED)
+        return GCC_OUT_OF_MEMORY;
+
+    file = mmap(base, len, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0);
+
+    if (file == MAP_FAILED) {
+        munmap(base, total);
+        return GCC_INVALID_VALUE;
+    }
+
+    /* the advice values are not flags, each needs a call of its own */
+    madvise(base, len, MADV_SEQUENTIAL);
+    madvise(base, len, MADV_WILLNEED);
+
+    data_   = (char *)base;
+    size_   = len;
+    alloc_  = total;
+    mapped_ = true;
+
+    return GCC_SUCCESS;
+}
+
+gcc_error_t gcc::source_buffer::read_stream(int fd)
+{
+    size_t cap = 64 * 1024, len = 0;
+    char *buffer, *tmp;
+    ssize_t nread;
+
+    if (!(buffer = (char *)malloc(cap + SOURCE_PADDING)))
+        return GCC_OUT_OF_MEMORY;
+
+    for (;;) {
+        if (len == cap) {
+            cap *= 2;
+
+            if (!(tmp = (char *)realloc(buffer, cap + SOURCE_PADDING))) {
+                free(buffer);
+                return GCC_OUT_OF_MEMORY;
+            }
+            buffer = tmp;
+        }
+
+        if ((nread = read(fd, buffer + len, cap - len)) < 0) {
+            if (errno == EINTR)
+                continue;
+
+            ERROR("read failed: %s\n", strerror(errno));
+            free(buffer);
+            return GCC_INVALID_VALUE;
+        }
+
+        if (nread == 0)
+            break;
+        len += nread;
+    }
+
+    memset(buffer + len, 0, SOURCE_PADDING);
+
+    data_   = buffer;
+    size_   = len;
+    alloc_  = cap + SOURCE_PADDING;
+    mapped_ = false;
+
+    return GCC_SUCCESS;
+}
+
+gcc_error_t gcc::source_buffer::open(const char *file)
+{
+    gcc::scoped_timer timer(gcc::PHASE_READ);
+    struct stat st;
+    gcc_error_t ret;
+    int fd;
+
+    close();
+
+    if (!file) {
+        ERROR("no input file given\n");
+        return GCC_INVALID_VALUE;
+    }
+
+    if (!strcmp(file, "-")) {
+        DEBUG("reading input from stdin\n");
+        return read_stream(STDIN_FILENO);
+    }
+
+    if ((fd = ::open(file, O_RDONLY)) < 0) {
+        ERROR("failed to open input file %s: %s\n", file, strerror(errno));
+        return GCC_INVALID_VALUE;
+    }
+
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        if ((ret = map_file(fd, (size_t)st.st_size)) == GCC_SUCCESS) {
+            DEBUG("mapped %s (%zu bytes)\n", file, size_);
+            ::close(fd);
+            return GCC_SUCCESS;
+        }
+
+        WARN("failed to map %s, falling back to buffered read\n", file);
+    }
+
+    ret = read_stream(fd);
+    ::close(fd);
+
+    return ret;
+}
@@ -0,0 +1,53 @@
+#ifndef __SOURCE_HH__
+#define __SOURCE_HH__
+
+#include <cstddef>
+
+#include "util/error.hh"
+
+namespace gcc {
+
+    /* Read-only view of an input file.
+     *
+     * Regular files are mmap'd and scanned in place, everything else
+     * (pipes, stdin, character devices) falls back to buffered reads.
+     * In both cases the buffer is followed by at least SOURCE_PADDING
+     * readable NUL bytes so the tokenizer can use '\0' as a sentinel
+     * and read a few bytes past the end without bounds checks. */
+    class source_buffer {
+        public:
+            enum { SOURCE_PADDING = 64 };
+
+            source_buffer();
+            ~source_buffer();
+
+            /* open file for reading, "-" reads from stdin */
+            gcc_error_t open(const char *file);
+
+            /* release the mapping/buffer */
+            void close();
+
+            /* first byte of the input, always NUL-terminated */
+            const char *data() const { return data_; }
+
+            /* input length in bytes, excluding the padding */
+            size_t size() const { return size_; }
+
+            /* true if the input was mapped instead of copied */
+            bool mapped() const { return mapped_; }
+
+        private:
+            source_buffer(const source_buffer&);
+            source_buffer& operator=(const source_buffer&);
+
+            gcc_error_t map_file(int fd, size_t len);
+            gcc_error_t read_stream(int fd);
+
+            char *data_;
+            size_t size_;
+            size_t alloc_;
+            bool mapped_;
+    };
+};
+
+#endif /* __SOURCE_HH__ */
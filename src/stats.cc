@@ -0,0 +1,203 @@
+#include <ctime>
+
+#include <sys/resource.h>
+
+#include "stats.hh"
+
+static const char *__phase_str[] = {
+    "read",
+    "tokenize",
+    "preprocess",
+    "parse",
+    "lower",
+    "optimize",
+    "codegen",
+    "link",
+    "load",
+    "cache",
+};
+
+static const char *__counter_str[] = {
+    "files",
+    "bytes",
+    "lines",
+    "tokens",
+    "nodes",
+    "symbols",
+    "arena_bytes",
+    "cache_hits",
+    "cache_misses",
+    "cache_stores",
+    "evictions",
+    "includes",
+    "guard_skips",
+    "header_hits",
+    "expansions",
+    "instructions",
+    "spills",
+    "vectorized",
+};
+
+static_assert(sizeof(__phase_str) / sizeof(__phase_str[0]) == gcc::PHASE_LAST, "phase name missing");
+static_assert(sizeof(__counter_str) / sizeof(__counter_str[0]) == gcc::COUNTER_LAST, "counter name missing");
+
+std::atomic<bool> gcc::stats::active(false);
+std::atomic<uint64_t> gcc::stats::counters[gcc::COUNTER_LAST];
+
+static std::atomic<uint64_t> phase_ns[gcc::PHASE_LAST];
+static std::atomic<uint64_t> phase_calls[gcc::PHASE_LAST];
+static std::atomic<uint64_t> phase_rss[gcc::PHASE_LAST];
+static std::atomic<uint64_t> start_ns;
+
+/* innermost running timer of this thread */
+static thread_local gcc::scoped_timer *current_timer;
+
+/* peak resident set size of the process in kB */
+static uint64_t peak_rss()
+{
+    struct rusage usage;
+
+    if (getrusage(RUSAGE_SELF, &usage))
+        return 0;
+    return (uint64_t)usage.ru_maxrss;
+}
+
+uint64_t gcc::stats::now()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+void gcc::stats::enable()
+{
+    for (int i = 0; i < COUNTER_LAST; ++i)
+        counters[i].store(0);
+
+    for (int i = 0; i < PHASE_LAST; ++i) {
+        phase_ns[i].store(0);
+        phase_calls[i].store(0);
+        phase_rss[i].store(0);
+    }
+
+    start_ns.store(now());
+    active.store(true);
+}
+
+void gcc::stats::disable()
+{
+    active.store(false);
+}
+
+void gcc::stats::add_time(gcc::phase_t phase, uint64_t ns)
+{
+    uint64_t rss = peak_rss();
+    uint64_t old = phase_rss[phase].load(std::memory_order_relaxed);
+
+    phase_ns[phase].fetch_add(ns, std::memory_order_relaxed);
+    phase_calls[phase].fetch_add(1, std::memory_order_relaxed);
+
+    while (old < rss && !phase_rss[phase].compare_exchange_weak(old, rss, std::memory_order_relaxed))
+        ;
+}
+
+gcc::scoped_timer::scoped_timer(gcc::phase_t phase):
+    phase_(PHASE_LAST),
+    start_(0),
+    children_(0),
+    parent_(nullptr)
+{
+    if (!gcc::stats::enabled())
+        return;
+
+    phase_  = phase;
+    parent_ = current_timer;
+    start_  = gcc::stats::now();
+
+    current_timer = this;
+}
+
+gcc::scoped_timer::~scoped_timer()
+{
+    if (phase_ == PHASE_LAST)
+        return;
+
+    uint64_t elapsed = gcc::stats::now() - start_;
+
+    gcc::stats::add_time(phase_, elapsed - children_);
+
+    if (parent_)
+        parent_->children_ += elapsed;
+    current_timer = parent_;
+}
+
+static double seconds(uint64_t ns)
+{
+    return ns / 1e9;
+}
+
+void gcc::stats::report_table(FILE *out)
+{
+    uint64_t total = now() - start_ns.load();
+    uint64_t other = total;
+
+    fprintf(out, "\nExecution times (seconds)\n");
+
+    for (int i = 0; i < PHASE_LAST; ++i) {
+        uint64_t ns = phase_ns[i].load();
+
+        other -= ns < other ? ns : other;
+
+        fprintf(out, " %-12s: %10.6f (%3.0f%%) %8llu calls %10llu kB peak rss\n",
+                __phase_str[i], seconds(ns), total ? 100.0 * ns / total : 0.0,
+                (unsigned long long)phase_calls[i].load(),
+                (unsigned long long)phase_rss[i].load());
+    }
+
+    fprintf(out, " %-12s: %10.6f (%3.0f%%)\n", "other", seconds(other), total ? 100.0 * other / total : 0.0);
+    fprintf(out, " %-12s: %10.6f\n", "TOTAL", seconds(total));
+    fprintf(out, " %-12s: %10llu kB\n", "peak rss", (unsigned long long)peak_rss());
+
+    fprintf(out, "\nCounters\n");
+
+    for (int i = 0; i < COUNTER_LAST; ++i) {
+        uint64_t value = counters[i].load();
+
+        fprintf(out, " %-12s: %12llu", __counter_str[i], (unsigned long long)value);
+
+        if (i == COUNTER_BYTES || i == COUNTER_TOKENS || i == COUNTER_NODES) {
+            uint64_t ns = phase_ns[i == COUNTER_NODES ? PHASE_PARSE : PHASE_TOKENIZE].load();
+
+            if (ns)
+                fprintf(out, " (%.2f M/s)", value / seconds(ns) / 1e6);
+        }
+
+        fprintf(out, "\n");
+    }
+}
+
+void gcc::stats::report_json(FILE *out)
+{
+    fprintf(out, "{\n  \"total_seconds\": %.9f,\n", seconds(now() - start_ns.load()));
+    fprintf(out, "  \"peak_rss_kb\": %llu,\n", (unsigned long long)peak_rss());
+    fprintf(out, "  \"phases\": {\n");
+
+    for (int i = 0; i < PHASE_LAST; ++i) {
+        fprintf(out, "    \"%s\": { \"seconds\": %.9f, \"calls\": %llu, \"peak_rss_kb\": %llu }%s\n",
+                __phase_str[i], seconds(phase_ns[i].load()),
+                (unsigned long long)phase_calls[i].load(),
+                (unsigned long long)phase_rss[i].load(),
+                i + 1 < PHASE_LAST ? "," : "");
+    }
+
+    fprintf(out, "  },\n  \"counters\": {\n");
+
+    for (int i = 0; i < COUNTER_LAST; ++i) {
+        fprintf(out, "    \"%s\": %llu%s\n", __counter_str[i],
+                (unsigned long long)counters[i].load(),
+                i + 1 < COUNTER_LAST ? "," : "");
+    }
+
+    fprintf(out, "  }\n}\n");
+}
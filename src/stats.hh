@@ -0,0 +1,106 @@
+#ifndef __STATS_HH__
+#define __STATS_HH__
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+
+namespace gcc {
+
+    /* compiler phases timed by gcc::scoped_timer */
+    typedef enum phase {
+        PHASE_READ,     /* opening and mapping the input */
+        PHASE_TOKENIZE,
+        PHASE_PREPROCESS,
+        PHASE_PARSE,
+        PHASE_LOWER,    /* building the IR from programs */
+        PHASE_OPTIMIZE, /* passes over the IR */
+        PHASE_CODEGEN,  /* instruction selection, register allocation and emission */
+        PHASE_LINK,     /* placing and relocating code to run it in process */
+        PHASE_LOAD,     /* building programs from AST images */
+        PHASE_CACHE,    /* looking up, loading and storing cache entries */
+        PHASE_LAST,
+    } phase_t;
+
+    typedef enum counter {
+        COUNTER_FILES,
+        COUNTER_BYTES,
+        COUNTER_LINES,
+        COUNTER_TOKENS,
+        COUNTER_NODES,
+        COUNTER_SYMBOLS,
+        COUNTER_ARENA_BYTES,
+        COUNTER_CACHE_HITS,
+        COUNTER_CACHE_MISSES,
+        COUNTER_CACHE_STORES,
+        COUNTER_CACHE_EVICTIONS,
+        COUNTER_INCLUDES,       /* #include directives in active groups */
+        COUNTER_GUARD_SKIPS,    /* includes skipped for an include guard or #pragma once */
+        COUNTER_HEADER_HITS,    /* headers whose tokens were reused */
+        COUNTER_EXPANSIONS,     /* macro expansions */
+        COUNTER_INSTRUCTIONS,   /* IR instructions after optimizing */
+        COUNTER_SPILLS,         /* values the register allocator put on the stack */
+        COUNTER_VECTORIZED,     /* loops the vectorizer turned into SIMD */
+        COUNTER_LAST,
+    } counter_t;
+
+    /* Phase timing and counters, -ftime-report style.
+     *
+     * Collection is off until enable() is called, until then timers and
+     * counters cost one relaxed load. Phase times are self times: a
+     * timer nested inside another (tokenizing on demand while parsing)
+     * is subtracted from the enclosing phase, so the phases add up to
+     * the time spent in the compiler. All updates are atomic and happen
+     * once per phase, not per token. */
+    namespace stats {
+
+        extern std::atomic<bool> active;
+        extern std::atomic<uint64_t> counters[COUNTER_LAST];
+
+        static inline bool enabled()
+        {
+            return active.load(std::memory_order_relaxed);
+        }
+
+        /* start collecting from zero, the total time is measured from here */
+        void enable();
+
+        void disable();
+
+        /* monotonic clock in nanoseconds */
+        uint64_t now();
+
+        static inline void add(gcc::counter_t counter, uint64_t value)
+        {
+            if (enabled())
+                counters[counter].fetch_add(value, std::memory_order_relaxed);
+        }
+
+        /* record ns of self time for phase and sample the peak RSS */
+        void add_time(gcc::phase_t phase, uint64_t ns);
+
+        /* human readable table, like gcc -ftime-report */
+        void report_table(FILE *out);
+
+        /* one JSON object for CI to diff between builds */
+        void report_json(FILE *out);
+    };
+
+    /* times the enclosing scope as phase */
+    class scoped_timer {
+        public:
+            scoped_timer(gcc::phase_t phase);
+            ~scoped_timer();
+
+        private:
+            scoped_timer(const scoped_timer&);
+            scoped_timer& operator=(const scoped_timer&);
+
+            gcc::phase_t phase_;
+            uint64_t start_;
+            uint64_t children_;
+            gcc::scoped_timer *parent_;
+    };
+};
+
+#endif /* __STATS_HH__ */
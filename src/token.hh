@@ -1,8 +1,13 @@
 #ifndef __TOKEN_HH__
 #define __TOKEN_HH__
 
-#include <deque>
-#include <string>
+#include <algorithm>
+#include <cstdint>
+#include <type_traits>
+#include <vector>
+
+#include "intern.hh"
+#include "util/error.hh"
 
 namespace gcc {
 
@@ -98,15 +103,101 @@ namespace gcc {
         TT_FUNC,
         TT_ARROW,
         TT_NOT_EQUAL,
+        TT_MOD,
+        TT_MOD_ASSIGN,
+        TT_AND_ASSIGN,
+        TT_OR_ASSIGN,
+        TT_CALL,
+        TT_INDEX,
+        TT_POST_INCR,
+        TT_POST_DECR,
+        TT_CAST,
+        TT_DECL,
+        TT_HASH,
+        TT_HASHHASH,
+        TT_HEADER_NAME,
         TT_LAST
     } token_type_t;
 
+    /* Tokens are plain 12-byte values so the stream is one contiguous,
+     * memcpy-able array. Anything that doesn't fit in the payload lives
+     * in the side tables of gcc::token_stream (literal values, line
+     * starts) or in the interner (identifier text). */
     typedef struct token {
-        token_type_t type;
-        int value;
-        std::string str;
+        uint8_t type;            /* token_type_t */
+        uint8_t flags;           /* TT_DIGIT: TF_* */
+        uint8_t unused[2];
+        union {
+            gcc::symbol_t sym;   /* TT_IDENTIFIER, TT_HEADER_NAME: interned text */
+            uint32_t literal;    /* TT_DIGIT: index into token_stream::literals_ */
+            uint32_t payload;
+        };
+        uint32_t offset;         /* byte offset of the token in the source */
     } token_t;
 
+    /* C type of an integer constant (C11 6.4.4.1), neither is int */
+    enum {
+        TF_UNSIGNED = 1 << 0,
+        TF_LONG     = 1 << 1,   /* long and long long are both 64 bits */
+        TF_SUFFIX_U = 1 << 2,   /* written with a u suffix, all #if looks at */
+    };
+
+    static_assert(sizeof(token_t) == 12, "token_t must stay packed");
+    static_assert(std::is_pod<token_t>::value, "token_t must stay trivially copyable");
+
+    /* true if the payload of token is a symbol */
+    static inline bool holds_symbol(const token_t& token)
+    {
+        return token.type == TT_IDENTIFIER || token.type == TT_HEADER_NAME;
+    }
+
+    /* A '#' that starts a line starts a directive, its payload is the
+     * offset where the directive ends (the '\n' of its last line, after
+     * any continuation lines). Other '#' tokens have no payload. */
+    static inline bool is_directive(const token_t& token)
+    {
+        return token.type == TT_HASH && token.payload != 0;
+    }
+
+    /* TF_* of an integer constant whose suffixes gave suffix: the first
+     * of int, unsigned int, long and unsigned long that holds value, a
+     * decimal constant without u skips unsigned int (C11 6.4.4.1). One
+     * too large for long is unsigned long, as in gcc. */
+    static inline uint8_t constant_flags(uint64_t value, uint8_t suffix, bool decimal)
+    {
+        uint8_t flags = suffix | (suffix & TF_UNSIGNED ? TF_SUFFIX_U : 0);
+
+        if (!(flags & TF_LONG) && value > ((flags & TF_UNSIGNED) ? UINT32_MAX : INT32_MAX)) {
+            if (!decimal && !(flags & TF_UNSIGNED) && value <= UINT32_MAX)
+                flags |= TF_UNSIGNED;
+            else
+                flags |= TF_LONG;
+        }
+
+        if (value > INT64_MAX)
+            flags |= TF_UNSIGNED;
+
+        return flags;
+    }
+
+    static inline token_t make_token(token_type_t type, uint32_t payload = 0, uint32_t offset = 0)
+    {
+        token_t token;
+
+        token.type      = (uint8_t)type;
+        token.flags     = 0;
+        token.unused[0] = token.unused[1] = 0;
+        token.payload   = payload;
+        token.offset    = offset;
+
+        return token;
+    }
+
+    typedef struct location {
+        uint32_t line;   /* 1-based */
+        uint32_t column; /* 1-based, in bytes */
+    } location_t;
+
     static inline const char *test_func(token_type_t type)
     {
         static const char *names[] = {
@@ -124,56 +215,282 @@ namespace gcc {
         return names[type];
     }
 
+    /* Tokenizer output: one contiguous token array and its side tables.
+     * In eager mode the stream is not modified after tokenization and
+     * consumers walk it through a gcc::token_cursor which borrows it.
+     * In streaming mode the array only holds a window of the input that
+     * the cursor refills from a gcc::token_source on demand, the literals
+     * of the window are kept with it and no line index is built. */
     typedef struct token_stream {
-        std::deque<token_t> tokens_;
-        token_t curr_;
+        std::vector<token_t> tokens_;
+        std::vector<uint64_t> literals_; /* values of TT_DIGIT tokens */
+        std::vector<uint32_t> lines_;    /* source offset of each line start */
+        size_t literal_base_;            /* literal index of literals_[0] */
+
+        token_stream():
+            tokens_(), literals_(), lines_(), literal_base_(0)
+        {
+        }
 
         void add(token_t token)
         {
             tokens_.push_back(token);
         }
 
-        token_t get()
+        /* store literal value to the side table, return its index */
+        uint32_t add_literal(uint64_t value)
         {
-            if (!tokens_.size())
-                return { TT_END, 0 };
+            literals_.push_back(value);
+            return (uint32_t)(literal_base_ + literals_.size() - 1);
+        }
 
-            token_t token = tokens_.front();
-            tokens_.pop_front();
-            return (curr_ = token);
+        /* forget the count oldest literals, the tokens using them are gone */
+        void drop_literals(size_t count)
+        {
+            literals_.erase(literals_.begin(), literals_.begin() + count);
+            literal_base_ += count;
+        }
+
+        void clear_literals()
+        {
+            literals_.clear();
+            literal_base_ = 0;
         }
 
+        uint64_t value(const token_t& token) const
+        {
+            return token.type == TT_DIGIT ? literals_[token.literal - literal_base_] : 0;
+        }
+
+        /* map token's source offset to line and column */
+        location_t location(const token_t& token) const
+        {
+            if (lines_.empty())
+                return { 0, 0 };
+
+            size_t line = std::upper_bound(lines_.begin(), lines_.end(), token.offset) - lines_.begin();
+            return { (uint32_t)line, token.offset - lines_[line - 1] + 1 };
+        }
+
+        size_t size() const
+        {
+            return tokens_.size();
+        }
+
+        const token_t& at(size_t index) const
+        {
+            return tokens_.at(index);
+        }
+
+        const token_t *begin() const { return tokens_.data(); }
+        const token_t *end() const { return tokens_.data() + tokens_.size(); }
+
+    } token_stream_t;
+
+    /* Producer of tokens for streaming mode (the tokenizer) */
+    class token_source {
+        public:
+            virtual ~token_source() {}
+
+            /* append at most count tokens to the source's stream */
+            virtual gcc_error_t fill(size_t count) = 0;
+
+            /* true once the whole input has been tokenized */
+            virtual bool done() const = 0;
+    };
+
+    /* Read position in a borrowed token stream.
+     *
+     * Lookahead is O(1) at any distance and backtracking is just saving
+     * and restoring the index, so speculative parsing costs nothing.
+     * Reading past the end yields TT_END tokens.
+     *
+     * A cursor created with a token_source streams: tokens are pulled in
+     * chunks as the parser asks for them and everything more than
+     * STREAM_LOOKBEHIND tokens behind the read position is dropped, so
+     * memory is bounded by the lookahead used instead of the file size.
+     * References returned by peek() are valid until the next get()/peek()
+     * and rewind() can't go further back than the window. */
+    typedef struct token_cursor {
+        enum {
+            STREAM_CHUNK      = 512,
+            STREAM_LOOKBEHIND = 256,
+        };
+
+        const token_t *begin_;
+        const token_t *end_;
+        const token_t *pos_;
+        token_t curr_;
+
+        const gcc::token_stream_t *stream_;
+        gcc::token_stream_t *window_;  /* stream being refilled, streaming only */
+        gcc::token_source *source_;
+        size_t base_;                  /* index of begin_ in the whole input */
+        size_t peak_;                  /* largest window seen */
+        gcc_error_t error_;
+
+        token_cursor():
+            begin_(nullptr),
+            end_(nullptr),
+            pos_(nullptr),
+            curr_(make_token(TT_END)),
+            stream_(nullptr),
+            window_(nullptr),
+            source_(nullptr),
+            base_(0),
+            peak_(0),
+            error_(GCC_SUCCESS)
+        {
+        }
+
+        explicit token_cursor(const token_stream_t& stream):
+            begin_(stream.begin()),
+            end_(stream.end()),
+            pos_(stream.begin()),
+            curr_(make_token(TT_END)),
+            stream_(&stream),
+            window_(nullptr),
+            source_(nullptr),
+            base_(0),
+            peak_(stream.size()),
+            error_(GCC_SUCCESS)
+        {
+        }
+
+        /* tokens [first, last) of a complete stream, marks stay stream indices */
+        token_cursor(const token_stream_t& stream, size_t first, size_t last):
+            begin_(stream.begin() + first),
+            end_(stream.begin() + last),
+            pos_(stream.begin() + first),
+            curr_(make_token(TT_END)),
+            stream_(&stream),
+            window_(nullptr),
+            source_(nullptr),
+            base_(first),
+            peak_(last - first),
+            error_(GCC_SUCCESS)
+        {
+        }
+
+        token_cursor(token_stream_t& stream, token_source& source):
+            begin_(stream.begin()),
+            end_(stream.end()),
+            pos_(stream.begin()),
+            curr_(make_token(TT_END)),
+            stream_(&stream),
+            window_(&stream),
+            source_(&source),
+            base_(0),
+            peak_(stream.size()),
+            error_(GCC_SUCCESS)
+        {
+        }
+
+        static const token_t& end_token()
+        {
+            static const token_t token = make_token(TT_END);
+            return token;
+        }
+
+        /* make at least n tokens available after pos_, streaming only */
+        bool refill(size_t n)
+        {
+            if (!source_ || error_ != GCC_SUCCESS)
+                return false;
+
+            std::vector<token_t>& window = window_->tokens_;
+            size_t consumed = pos_ - begin_;
+
+            if (consumed > STREAM_LOOKBEHIND) {
+                size_t drop   = consumed - STREAM_LOOKBEHIND;
+                size_t digits = 0;
+
+                /* literals are added in token order, the first ones go too */
+                for (size_t i = 0; i < drop; ++i)
+                    digits += window[i].type == TT_DIGIT;
+
+                window_->drop_literals(digits);
+                window.erase(window.begin(), window.begin() + drop);
+                base_    += drop;
+                consumed -= drop;
+            }
+
+            while (window.size() - consumed < n && !source_->done()) {
+                if ((error_ = source_->fill(n < (size_t)STREAM_CHUNK ? (size_t)STREAM_CHUNK : n)) != GCC_SUCCESS)
+                    break;
+            }
+
+            begin_ = window.data();
+            end_   = begin_ + window.size();
+            pos_   = begin_ + consumed;
+
+            if (window.size() > peak_)
+                peak_ = window.size();
+
+            return (size_t)(end_ - pos_) >= n;
+        }
+
+        /* value of a TT_DIGIT token */
+        uint64_t value(const token_t& token) const
+        {
+            return stream_->value(token);
+        }
+
+        /* consume and return the next token */
+        const token_t& get()
+        {
+            if (pos_ >= end_ && !refill(1))
+                return (curr_ = error_ ? make_token(TT_INVALID) : end_token());
+            return (curr_ = *pos_++);
+        }
+
+        /* consume the next token if it's of given type */
         bool get(token_type_t type)
         {
-            if (!tokens_.size() || tokens_.front().type != type)
+            if (pos_ >= end_ && !refill(1))
+                return false;
+
+            if (pos_->type != type)
                 return false;
 
-            curr_ = tokens_.front();
-            tokens_.pop_front();
+            curr_ = *pos_++;
             return true;
         }
 
-        token_t get_current()
+        /* last token consumed */
+        const token_t& get_current() const
         {
             return curr_;
         }
 
-        void put(token_t token)
+        /* look k tokens ahead without consuming anything */
+        const token_t& peek(size_t k = 0)
         {
-            tokens_.push_front(token);
+            if ((size_t)(end_ - pos_) <= k && !refill(k + 1))
+                return end_token();
+            return pos_[k];
         }
 
-        size_t size()
+        /* save the read position, see rewind() */
+        size_t mark() const
         {
-            return tokens_.size();
+            return base_ + (pos_ - begin_);
         }
 
-        token_t& at(size_t index)
+        /* return to a position saved with mark() */
+        void rewind(size_t mark)
         {
-            return tokens_.at(index);
+            pos_  = begin_ + (mark - base_);
+            curr_ = pos_ > begin_ ? pos_[-1] : make_token(TT_END);
         }
 
-    } token_stream_t;
+        /* number of tokens left, in streaming mode only the buffered ones */
+        size_t size() const
+        {
+            return end_ - pos_;
+        }
+
+    } token_cursor_t;
 };
 
 #endif /* __TOKEN_HH__ */
@@ -4,12 +4,25 @@
 #include <fstream>
 #include <vector>
 
+#include "charclass.hh"
+#include "keywords.hh"
+#include "stats.hh"
 #include "tokenizer.hh"
 #include "util/log.hh"
 
 #define CHANNEL "tokenizer"
 
-gcc::tokenizer::tokenizer()
+static_assert((int)gcc::source_buffer::SOURCE_PADDING > (int)gcc::SCAN_PADDING,
+              "source buffer padding too small for the block scanners");
+
+gcc::tokenizer::tokenizer():
+    scan_(gcc::get_scanner()),
+    symbols_(gcc::symbols()),
+    source_(),
+    tokens_(),
+    ptr_(nullptr),
+    done_(true),
+    directives_(0)
 {
 }
 
@@ -17,219 +30,477 @@ gcc::tokenizer::~tokenizer()
 {
 }
 
-char *gcc::tokenizer::read_file(char *file)
+const char *gcc::tokenizer::skip_ws(const char *ptr)
 {
-    FILE *fp;
-    size_t len;
-    char *buffer;
+    /* most runs are a single space between two tokens,
+     * don't enter the block scanner for those */
+    if (gcc::char_class(*ptr) != CC_SPACE)
+        return ptr;
+    return scan_->skip_ws(ptr);
+}
 
-    DEBUG("read file %s to buffer\n", file);
+const char *gcc::tokenizer::skip_comments(const char *ptr)
+{
+    if (*ptr == '/' && *(ptr + 1) == '/') {
+        if (*(ptr = scan_->line_end(ptr + 2)))
+            ptr++;
+    } else if (*ptr == '/' && *(ptr + 1) == '*') {
+        ptr = scan_->comment_end(ptr + 2);
 
-    if (!file || !(fp = fopen(file, "r"))) {
-        ERROR("failed to open input file: %s\n", file);
-        gcc_errno = GCC_INVALID_VALUE;
-        return nullptr;
+        if (*ptr)
+            ptr += 2;
+        else
+            WARN("unterminated comment\n");
     }
 
-    fseek(fp, 0, SEEK_END);
-    len = ftell(fp);
-    fseek(fp, 0, SEEK_SET);
+    return ptr;
+}
 
-    if (!(buffer = (char *)malloc(len))) {
-        gcc_errno = GCC_OUT_OF_MEMORY;
-        return nullptr;
-    }
+static inline int hex_value(char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
 
-    fread(buffer, 1, len, fp);
-    fclose(fp);
+    c |= 0x20;
 
-    return buffer;
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    return -1;
 }
 
-char *gcc::tokenizer::skip_ws(char *ptr)
+bool gcc::tokenizer::get_digit(const char **ptr)
 {
-    while (isspace(*ptr))
-        ptr++;
-    return ptr;
+    uint64_t value   = 0;
+    bool overflow    = false;
+    bool decimal     = false;
+    uint8_t suffix   = 0;
+    uint8_t flags;
+    const char *uptr = *ptr;
+    token_t token;
+
+    if (gcc::char_class(*uptr) != CC_DIGIT)
+        return false;
+
+    if (uptr[0] == '0' && (uptr[1] | 0x20) == 'x' && hex_value(uptr[2]) >= 0) {
+        for (uptr += 2; hex_value(*uptr) >= 0; ++uptr) {
+            overflow |= value >> 60 != 0;
+            value = (value << 4) | hex_value(*uptr);
+        }
+    } else if (uptr[0] == '0') {
+        while (*uptr >= '0' && *uptr <= '7') {
+            overflow |= value >> 61 != 0;
+            value = (value << 3) + *uptr++ - '0';
+        }
+    } else {
+        decimal = true;
+
+        while (gcc::char_class(*uptr) == CC_DIGIT) {
+            overflow |= value > (UINT64_MAX - (*uptr - '0')) / 10;
+            value = (value * 10) + *uptr++ - '0';
+        }
+    }
+
+    for (; *uptr == 'u' || *uptr == 'U' || *uptr == 'l' || *uptr == 'L'; ++uptr)
+        suffix |= (*uptr | 0x20) == 'u' ? TF_UNSIGNED : TF_LONG;
+
+    if (gcc::is_ident_char(*uptr)) {
+        ERROR("invalid digit or suffix '%c' in integer constant at offset %u\n", *uptr, offset(*ptr));
+        return false;
+    }
+
+    if (overflow) {
+        ERROR("integer constant at offset %u is too large for 64 bits\n", offset(*ptr));
+        return false;
+    }
+
+    flags = gcc::constant_flags(value, suffix, decimal);
+
+    if (decimal && (flags & ~suffix & TF_UNSIGNED))
+        WARN("integer constant at offset %u is so large that it is unsigned\n", offset(*ptr));
+
+    token       = gcc::make_token(TT_DIGIT, tokens_.add_literal(value), offset(*ptr));
+    token.flags = flags;
+    tokens_.add(token);
+
+    *ptr = uptr;
+    return true;
 }
 
-char *gcc::tokenizer::skip_comments(char *ptr)
+bool gcc::tokenizer::get_operator(const char **ptr)
 {
-    if (*ptr == '/' && *(ptr + 1) == '/') {
-        while (*ptr != '\n')
-            ptr++;
-        ptr++;
-    } else if (*ptr == '/' && *(ptr + 1) == '*') {
-        ptr += 2;
+    const char *p = *ptr;
+    token_type_t type;
+    size_t len = 1;
+
+    /* maximal munch: switch on the first byte and peek
+     * at most two bytes ahead to find the longest operator */
+    switch (p[0]) {
+        case '*':
+            type = p[1] == '=' ? (len = 2, TT_MUL_ASSIGN) : TT_STAR;
+            break;
 
-        while (*ptr != '*' || *(ptr + 1) != '/')
-            ptr++;
+        case '/':
+            type = p[1] == '=' ? (len = 2, TT_DIV_ASSIGN) : TT_DIV;
+            break;
+
+        case '%':
+            type = p[1] == '=' ? (len = 2, TT_MOD_ASSIGN) : TT_MOD;
+            break;
+
+        case '+':
+            if (p[1] == '=')
+                type = TT_ADD_ASSIGN, len = 2;
+            else if (p[1] == '+')
+                type = TT_INCR, len = 2;
+            else
+                type = TT_PLUS;
+            break;
+
+        case '-':
+            if (p[1] == '=')
+                type = TT_SUB_ASSIGN, len = 2;
+            else if (p[1] == '-')
+                type = TT_DECR, len = 2;
+            else if (p[1] == '>')
+                type = TT_ARROW, len = 2;
+            else
+                type = TT_MINUS;
+            break;
+
+        case '&':
+            if (p[1] == '&')
+                type = TT_AND_EXP, len = 2;
+            else if (p[1] == '=')
+                type = TT_AND_ASSIGN, len = 2;
+            else
+                type = TT_AND;
+            break;
+
+        case '|':
+            if (p[1] == '|')
+                type = TT_OR_EXP, len = 2;
+            else if (p[1] == '=')
+                type = TT_OR_ASSIGN, len = 2;
+            else
+                type = TT_OR;
+            break;
+
+        case '^':
+            type = p[1] == '=' ? (len = 2, TT_XOR_ASSIGN) : TT_XOR;
+            break;
+
+        case '=':
+            type = p[1] == '=' ? (len = 2, TT_EQUAL) : TT_ASSIGN;
+            break;
+
+        case '!':
+            type = p[1] == '=' ? (len = 2, TT_NOT_EQUAL) : TT_EXCLAMATION;
+            break;
+
+        case '<':
+            if (p[1] == '<')
+                type = p[2] == '=' ? (len = 3, TT_LSHIFT_ASSIGN) : (len = 2, TT_LSHIFT);
+            else if (p[1] == '=')
+                type = TT_EQ_SMALLER, len = 2;
+            else
+                type = TT_LTHAN;
+            break;
+
+        case '>':
+            if (p[1] == '>')
+                type = p[2] == '=' ? (len = 3, TT_RSHIFT_ASSIGN) : (len = 2, TT_RSHIFT);
+            else if (p[1] == '=')
+                type = TT_EQ_LARGER, len = 2;
+            else
+                type = TT_GTHAN;
+            break;
+
+        case '~':  type = TT_ANOT;        break;
+        case '(':  type = TT_LPAREN;      break;
+        case ')':  type = TT_RPAREN;      break;
+        case '[':  type = TT_LSQUARE;     break;
+        case ']':  type = TT_RSQUARE;     break;
+        case '{':  type = TT_LCURLY;      break;
+        case '}':  type = TT_RCURLY;      break;
+        case '?':  type = TT_QMARK;       break;
+        case ':':  type = TT_COLON;       break;
+        case ';':  type = TT_SEMICOLON;   break;
+        case ',':  type = TT_COMMA;       break;
+        case '.':  type = TT_DOT;         break;
+        case '"':  type = TT_QUOTE;       break;
+        case '\'': type = TT_SQUOTE;      break;
+
+        default:
+            return false;
     }
 
-    return ptr;
+    tokens_.add(gcc::make_token(type, 0, offset(p)));
+    *ptr = p + len;
+    return true;
 }
 
-bool gcc::tokenizer::get_digit(char **ptr)
+bool gcc::tokenizer::get_identifier(const char **ptr)
 {
-    int value  = 0;
-    char *uptr = *ptr;
+    const char *saveptr = *ptr;
+    const char *uptr    = *ptr;
+    token_type_t type;
 
-    if (!isdigit(*uptr))
+    if (gcc::char_class(*uptr) != CC_IDENT)
         return false;
 
-    while (*ptr && isdigit(*uptr))
-        value = (value * 10) + *uptr++ - '0';
+    uptr = scan_->ident_end(uptr + 1);
 
-    token_t tok;
-    tok.type = TT_DIGIT;
-    tok.value = value;
-    tokens_.add(tok);
+    /* the whole word is lexed once and then classified,
+     * keywords carry no payload */
+    if ((type = gcc::keyword_lookup(saveptr, uptr - saveptr)) != TT_IDENTIFIER)
+        tokens_.add(gcc::make_token(type, 0, offset(saveptr)));
+    else
+        tokens_.add(gcc::make_token(TT_IDENTIFIER, symbols_.intern(saveptr, uptr - saveptr), offset(saveptr)));
 
     *ptr = uptr;
     return true;
 }
 
-bool gcc::tokenizer::get_keyword(char **ptr)
-{
-    struct {
-        const char *s;
-        token_type_t type;
-    } keywords[] = {
-        { "break",    TT_BREAK },    { "case",     TT_CASE },
-        { "char",     TT_CHAR },     { "const",    TT_CONST },
-        { "continue", TT_CONTINUE }, { "default",  TT_DEFAULT },
-        { "do",       TT_DO },       { "double",   TT_DOUBLE },
-        { "else",     TT_ELSE },     { "enum",     TT_ENUM },
-        { "extern",   TT_EXTERN },   { "float",    TT_FLOAT },
-        { "for",      TT_FOR },      { "goto",     TT_GOTO },
-        { "if",       TT_IF },       { "inline",   TT_INLINE },
-        { "int",      TT_INT },      { "long",     TT_LONG },
-        { "register", TT_REGISTER }, { "restrict", TT_RESTRICT },
-        { "return",   TT_RETURN },   { "short",    TT_SHORT },
-        { "signed",   TT_SIGNED },   { "sizeof",   TT_SIZEOF },
-        { "static",   TT_STATIC },   { "struct",   TT_STRUCT },
-        { "switch",   TT_SWITCH },   { "typedef",  TT_TYPEDEF },
-        { "union",    TT_UNION },    { "unsigned", TT_UNSIGNED },
-        { "void",     TT_VOID },     { "volatile", TT_VOLATILE },
-        { "while",    TT_WHILE },    { "uint8_t",  TT_U8 },
-        { "uint16_t", TT_U16 },      { "uint32_t", TT_U32 },
-        { "uint64_t", TT_U64 },      { "int8_t",   TT_I8 },
-        { "int16_t",  TT_I16 },      { "int32_t",  TT_I32 },
-        { "int64_t",  TT_I64 },      { "size_t",   TT_SIZET }
-    };
-
-    for (int i = 0; i < 42; ++i) {
-        if (!strncmp(*ptr, keywords[i].s, strlen(keywords[i].s))) {
-            if (!isalnum(*(*ptr + strlen(keywords[i].s))) && *(*ptr + strlen(keywords[i].s)) != '_') {
-                tokens_.add({ keywords[i].type, 0 });
-                *ptr = *ptr + strlen(keywords[i].s);
-                return true;
-            }
-        }
-    }
+bool gcc::tokenizer::line_start(const char *ptr) const
+{
+    const char *start = source_.data();
 
-    return false;
-}
-
-bool gcc::tokenizer::get_operator(char **ptr)
-{
-    struct {
-        const char *s;
-        token_type_t type;
-    } operators[] = {
-        { "*=",  TT_MUL_ASSIGN },    { "-=",  TT_SUB_ASSIGN },
-        { "/=",  TT_DIV_ASSIGN },    { "+=",  TT_ADD_ASSIGN},
-        { "&&",  TT_AND_EXP },       { "||",  TT_OR_EXP },
-        { "==",  TT_EQUAL },         { ">=",  TT_EQ_LARGER },
-        { "<=",  TT_EQ_SMALLER },    { "<<",  TT_LSHIFT },
-        { ">>",  TT_RSHIFT },        { "<<=", TT_LSHIFT_ASSIGN },
-        { ">>=", TT_RSHIFT_ASSIGN }, { "^=",  TT_XOR_ASSIGN },
-        { "++",  TT_INCR },          { "--",  TT_DECR },
-        { "->",  TT_ARROW },         { "!=",  TT_NOT_EQUAL },
-        { "&",   TT_AND },           { "|",   TT_OR },
-        { "^",   TT_XOR },           { "~",   TT_ANOT },
-        { "*",   TT_STAR },          { "-",   TT_MINUS },
-        { "/",   TT_DIV },           { "+",   TT_PLUS },
-        { "(",   TT_LPAREN },        { ")",   TT_RPAREN },
-        { "[",   TT_LSQUARE },       { "]",   TT_RSQUARE },
-        { "{",   TT_LCURLY },        { "}",   TT_RCURLY },
-        { "?",   TT_QMARK },         { ":",   TT_COLON },
-        { "!",   TT_EXCLAMATION },   { ";",   TT_SEMICOLON },
-        { ",",   TT_COMMA },         { ".",   TT_DOT },
-        { "<",   TT_LTHAN },         { ">",   TT_GTHAN },
-        { "=",   TT_ASSIGN },        { "\"",  TT_QUOTE },
-        { "\'",  TT_SQUOTE }
-    };
-
-    for (int i = 0; i < 43; ++i) {
-        if (!strncmp(*ptr, operators[i].s, strlen(operators[i].s))) {
-            tokens_.add({ operators[i].type, 0 });
-            *ptr = *ptr + strlen(operators[i].s);
-            return true;
-        }
-    }
+    while (ptr > start && (ptr[-1] == ' ' || ptr[-1] == '\t'))
+        ptr--;
+
+    if (ptr == start)
+        return true;
+
+    if (ptr[-1] != '\n')
+        return false;
 
-    return false;
+    /* the line before continues onto this one */
+    if (--ptr > start && ptr[-1] == '\r')
+        ptr--;
+    return ptr == start || ptr[-1] != '\\';
 }
 
-bool gcc::tokenizer::get_identifier(char **ptr)
+bool gcc::tokenizer::get_hash(const char **ptr)
 {
-    size_t len    = 0;
-    char *tok     = nullptr;
-    char *saveptr = *ptr;
-    char *uptr    = *ptr;
+    const char *p = *ptr;
+    const char *end;
+    const char *name;
 
-    if (!isalpha(*uptr) && *uptr != '_')
+    if (*p != '#')
         return false;
 
-    while (isalnum(*uptr) || *uptr == '_')
-        len++, (uptr)++;
+    if (p[1] == '#') {
+        tokens_.add(gcc::make_token(TT_HASHHASH, 0, offset(p)));
+        *ptr = p + 2;
+        return true;
+    }
+
+    if (!line_start(p)) {
+        tokens_.add(gcc::make_token(TT_HASH, 0, offset(p)));
+        *ptr = p + 1;
+        return true;
+    }
+
+    /* the directive runs to the first newline that isn't escaped */
+    for (end = p + 1; *(end = scan_->line_end(end)); end++) {
+        if (end[-1] != '\\' && (end[-1] != '\r' || end[-2] != '\\'))
+            break;
+    }
+
+    tokens_.add(gcc::make_token(TT_HASH, offset(end), offset(p)));
+    directives_++;
+    *ptr = p + 1;
 
-    std::string ident(saveptr, len);
+    /* the file name of #include isn't made of tokens, lex it as one */
+    for (name = p + 1; *name == ' ' || *name == '\t'; )
+        name++;
 
-    tokens_.add({ TT_IDENTIFIER, 0, ident });
+    if (strncmp(name, "include", 7) || gcc::is_ident_char(name[7]))
+        return true;
 
-    *ptr = saveptr + len;
+    const char *first = name + 7;
+    const char *last;
+
+    while (*first == ' ' || *first == '\t')
+        first++;
+
+    if (*first != '"' && *first != '<')
+        return true;
+
+    if (!(last = (const char *)memchr(first + 1, *first == '"' ? '"' : '>', end - first - 1)))
+        return true;
+
+    tokens_.add(gcc::make_token(TT_IDENTIFIER, symbols_.intern(name, 7), offset(name)));
+    tokens_.add(gcc::make_token(TT_HEADER_NAME, symbols_.intern(first, last - first + 1), offset(first)));
+
+    *ptr = last + 1;
     return true;
 }
 
-gcc_error_t gcc::tokenizer::tokenize(char *file)
+void gcc::tokenizer::index_lines()
 {
-    char *ptr, *saveptr;
+    const char *start = source_.data();
+    const char *end   = start + source_.size();
+    const char *ptr   = start;
 
-    DEBUG("tokenizing %s\n", file);
+    tokens_.lines_.clear();
+    tokens_.lines_.push_back(0);
+
+    while ((ptr = (const char *)memchr(ptr, '\n', end - ptr)))
+        tokens_.lines_.push_back((uint32_t)(++ptr - start));
+
+    gcc::stats::add(gcc::COUNTER_LINES, tokens_.lines_.size());
+}
+
+size_t gcc::tokenizer::count_lines() const
+{
+    const char *ptr = source_.data();
+    const char *end = ptr + source_.size();
+    size_t lines    = 1;
+
+    for (; (ptr = (const char *)memchr(ptr, '\n', end - ptr)); ++ptr)
+        lines++;
+
+    return lines;
+}
 
-    if (!(ptr = saveptr = read_file(file))) {
+gcc_error_t gcc::tokenizer::open(const char *file)
+{
+    gcc_error_t ret;
+
+    if ((ret = source_.open(file)) != GCC_SUCCESS) {
         ERROR("failed to read file %s\n", file);
-        return gcc_errno;
+        return ret;
     }
 
-    while (*ptr) {
-        if (!*(ptr = skip_ws(ptr)))
-            break;
-        if (!*(ptr = skip_comments(ptr)))
-            break;
+    /* token offsets are 32-bit */
+    if (source_.size() > UINT32_MAX) {
+        ERROR("%s is too large (%zu bytes)\n", file, source_.size());
+        return GCC_INVALID_VALUE;
+    }
+
+    /* lines are indexed by tokenize(), a streamed input doesn't keep them */
+    tokens_.tokens_.clear();
+    tokens_.clear_literals();
+    tokens_.lines_.clear();
+    directives_ = 0;
+
+    gcc::stats::add(gcc::COUNTER_FILES, 1);
+    gcc::stats::add(gcc::COUNTER_BYTES, source_.size());
+
+    /* the source buffer is NUL-terminated and padded so
+     * the input is scanned in place without copying it */
+    ptr_  = source_.data();
+    done_ = false;
+
+    return GCC_SUCCESS;
+}
+
+bool gcc::tokenizer::done() const
+{
+    return done_;
+}
 
-        if (get_digit(&ptr)) {
-            continue;
-        } else if (get_operator(&ptr)) {
-            continue;
-        } else if (get_keyword(&ptr)) {
-            continue;
-        } else if (get_identifier(&ptr)) {
-            continue;
-        } else {
-            ERROR("nothing above!\n");
+gcc_error_t gcc::tokenizer::fill(size_t count)
+{
+    gcc::scoped_timer timer(gcc::PHASE_TOKENIZE);
+    size_t first    = tokens_.size();
+    const char *ptr = ptr_;
+    const char *end = source_.data() + source_.size();
+    size_t limit    = count > SIZE_MAX - tokens_.size() ? SIZE_MAX : tokens_.size() + count;
+
+    while (tokens_.size() < limit) {
+        switch (gcc::char_class(*ptr)) {
+            case CC_SPACE:
+                ptr = skip_ws(ptr + 1);
+                continue;
+
+            case CC_DIGIT:
+                if (get_digit(&ptr))
+                    continue;
+
+                /* get_digit() reported what was wrong with the constant */
+                ptr_  = ptr;
+                done_ = true;
+                return GCC_INVALID_VALUE;
+
+            case CC_IDENT:
+                if (get_identifier(&ptr))
+                    continue;
+                break;
+
+            case CC_PUNCT:
+                if (*ptr == '/' && (*(ptr + 1) == '/' || *(ptr + 1) == '*')) {
+                    ptr = skip_comments(ptr);
+                    continue;
+                }
+
+                if (get_operator(&ptr))
+                    continue;
+                break;
+
+            case CC_END:
+                if (ptr >= end) {
+                    gcc::stats::add(gcc::COUNTER_TOKENS, tokens_.size() - first);
+
+                    /* streamed, so there's no line index to take the count from */
+                    if (tokens_.lines_.empty() && gcc::stats::enabled())
+                        gcc::stats::add(gcc::COUNTER_LINES, count_lines());
+
+                    ptr_  = ptr;
+                    done_ = true;
+                    return GCC_SUCCESS;
+                }
+                break;
+
+            case CC_INVALID:
+                if (get_hash(&ptr))
+                    continue;
+
+                /* a backslash-newline joins two lines */
+                if (*ptr == '\\' && (ptr[1] == '\n' || (ptr[1] == '\r' && ptr[2] == '\n'))) {
+                    ptr += ptr[1] == '\n' ? 2 : 3;
+                    continue;
+                }
+                break;
         }
 
-        ERROR("invalid token stream: '%c' '%s'!\n", *ptr, ptr);
+        ERROR("invalid token stream: '%c' (0x%02x) at offset %zu!\n",
+              *ptr, (unsigned char)*ptr, (size_t)(ptr - source_.data()));
+
+        ptr_  = ptr;
+        done_ = true;
         return GCC_INVALID_VALUE;
     }
 
-    free(saveptr);
+    gcc::stats::add(gcc::COUNTER_TOKENS, tokens_.size() - first);
+
+    ptr_ = ptr;
     return GCC_SUCCESS;
 }
 
+gcc_error_t gcc::tokenizer::tokenize(const char *file)
+{
+    gcc_error_t ret;
+
+    DEBUG("tokenizing %s\n", file);
+
+    if ((ret = open(file)) != GCC_SUCCESS)
+        return ret;
+
+    return tokenize();
+}
+
+gcc_error_t gcc::tokenizer::tokenize()
+{
+    /* plain C averages well above four bytes per token, reserving up front
+     * avoids copying the stream on growth and untouched pages cost nothing */
+    tokens_.tokens_.reserve(source_.size() / 4 + 16);
+    index_lines();
+
+    return fill(SIZE_MAX);
+}
+
 gcc::token_stream_t& gcc::tokenizer::get_token_stream()
 {
     DEBUG("returning tokenizer output\n");
@@ -3,48 +3,87 @@
 
 #include <vector>
 
+#include "intern.hh"
+#include "scan.hh"
+#include "source.hh"
 #include "token.hh"
 #include "util/error.hh"
 
 namespace gcc {
 
-    class tokenizer {
+    class tokenizer : public gcc::token_source {
         public:
             tokenizer();
             ~tokenizer();
 
             /* tokenize the input file into a vector of tokens */
-            gcc_error_t tokenize(char *file);
+            gcc_error_t tokenize(const char *file);
+
+            /* tokenize the rest of a file opened with open() */
+            gcc_error_t tokenize();
+
+            /* open the input file for on-demand tokenization, see fill() */
+            gcc_error_t open(const char *file);
+
+            /* tokenize at most count more tokens into the stream */
+            gcc_error_t fill(size_t count);
+
+            /* true once the whole input has been tokenized */
+            bool done() const;
 
             /* get reference to tokenized stream */
             gcc::token_stream_t& get_token_stream();
 
+            /* contents of the opened file */
+            const gcc::source_buffer& get_source() const { return source_; }
+
+            /* true if the tokens so far contain preprocessing directives */
+            bool has_directives() const { return directives_ != 0; }
+
         private:
             /* extract token from the stream */
             token_t create_token(union TOKEN type, char *ptr);
 
-            /* read file contents to a buffer */
-            char *read_file(char *file);
-
             /* skip whitespace characters */
-            char *skip_ws(char *ptr);
+            const char *skip_ws(const char *ptr);
 
             /* skip comments */
-            char *skip_comments(char *ptr);
+            const char *skip_comments(const char *ptr);
+
+            /* byte offset of ptr in the source buffer */
+            uint32_t offset(const char *ptr) const { return (uint32_t)(ptr - source_.data()); }
+
+            /* record line starts for token locations, eager mode only */
+            void index_lines();
+
+            /* lines of the source for the statistics of a streamed input */
+            size_t count_lines() const;
 
             /* extract number from the stream into a token */
-            bool get_digit(char **ptr);
+            bool get_digit(const char **ptr);
 
             /* extract operand from the stream into a token */
-            bool get_operator(char **ptr);
+            bool get_operator(const char **ptr);
+
+            /* extract identifier or keyword from the stream into a token */
+            bool get_identifier(const char **ptr);
 
-            /* extract keyword from the stream into a token */
-            bool get_keyword(char **ptr);
+            /* extract '#' or '##', a directive's '#' also lexes the
+             * file name of #include into a TT_HEADER_NAME token */
+            bool get_hash(const char **ptr);
 
-            /* extract identifier from the stream into a token */
-            bool get_identifier(char **ptr);
+            /* true if only blanks precede ptr on its line */
+            bool line_start(const char *ptr) const;
 
+            const gcc::scanner_t *scan_;
+            gcc::interner& symbols_;
+            gcc::source_buffer source_;
             gcc::token_stream_t tokens_;
+
+            /* scan position for fill() */
+            const char *ptr_;
+            bool done_;
+            size_t directives_;
     };
 };
 
@@ -3,8 +3,6 @@
 
 typedef int gcc_error_t;
 
-static thread_local int gcc_errno;
-
 enum GCC_ERROR {
     GCC_SUCCESS = 0,
     GCC_INVALID_VALUE = -1,
@@ -0,0 +1,279 @@
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <vector>
+
+#include <strings.h>
+#include <unistd.h>
+
+#include "util/log.hh"
+
+#define LOG_BUFFER_SIZE 8192
+
+static const char *__level_name[] = {
+    "debug",
+    "info",
+    "warn",
+    "error",
+};
+
+static const char *__level_str[] = {
+    "debug",
+    "\x1b[34minfo\x1b[0m",
+    "\x1b[33mwarn\x1b[0m",
+    "\x1b[31merror\x1b[0m",
+};
+
+std::atomic<int> gcc::log::level(LOG_MIN_LEVEL);
+
+namespace {
+
+    typedef struct rule {
+        std::string name;
+        bool enabled;
+    } rule_t;
+
+    /* channels are never removed so pointers into the deque stay valid */
+    struct registry {
+        std::mutex lock;
+        std::deque<gcc::log::channel_t> channels;
+        std::vector<rule_t> rules;
+        bool enabled = true;
+    };
+
+    registry& get_registry()
+    {
+        static registry registry;
+
+        return registry;
+    }
+
+    void write_all(const char *data, size_t len)
+    {
+        while (len) {
+            ssize_t n = ::write(STDERR_FILENO, data, len);
+
+            if (n < 0) {
+                if (errno == EINTR)
+                    continue;
+                return;
+            }
+
+            data += n;
+            len  -= n;
+        }
+    }
+
+    struct buffer {
+        char data[LOG_BUFFER_SIZE];
+        size_t len = 0;
+
+        void flush()
+        {
+            write_all(data, len);
+            len = 0;
+        }
+
+        ~buffer()
+        {
+            flush();
+        }
+    };
+
+    thread_local buffer tls_buffer;
+    thread_local std::vector<gcc::log::diagnostic_t> *tls_sink;
+
+    /* GABRIEL_LOG_LEVEL=debug|info|warn|error
+     * GABRIEL_LOG=parser,tokenizer enables only the listed channels,
+     * GABRIEL_LOG=-parser disables the listed ones */
+    void configure(registry& r)
+    {
+        const char *env;
+
+        if ((env = getenv("GABRIEL_LOG_LEVEL"))) {
+            for (int i = LOG_DEBUG; i <= LOG_ERROR; ++i) {
+                if (!strcasecmp(__level_name[i], env))
+                    gcc::log::set_level(i);
+            }
+        }
+
+        if (!(env = getenv("GABRIEL_LOG")))
+            return;
+
+        for (const char *p = env; *p; ) {
+            size_t len = strcspn(p, ",");
+            bool enabled = *p != '-';
+
+            if (!enabled)
+                ++p, --len;
+
+            if (len)
+                r.rules.push_back({ std::string(p, len), enabled });
+
+            /* any positive entry means everything else is off */
+            if (len && enabled)
+                r.enabled = false;
+
+            p += len;
+            p += *p == ',';
+        }
+    }
+
+    registry& configured_registry()
+    {
+        static std::once_flag once;
+        registry& r = get_registry();
+
+        std::call_once(once, configure, std::ref(r));
+        return r;
+    }
+
+    /* caller holds the registry lock */
+    bool channel_enabled(const registry& r, const char *name)
+    {
+        bool enabled = r.enabled;
+
+        for (const rule_t& rule : r.rules) {
+            if (rule.name == name)
+                enabled = rule.enabled;
+        }
+
+        return enabled;
+    }
+};
+
+/* runs configure() at startup so GABRIEL_LOG_LEVEL applies before the first message */
+static const bool __configured = (configured_registry(), true);
+
+void gcc::log::set_level(int lvl)
+{
+    gcc::log::level.store(lvl, std::memory_order_relaxed);
+}
+
+gcc::log::channel_t *gcc::log::get_channel(const char *name)
+{
+    registry& r = configured_registry();
+    std::lock_guard<std::mutex> guard(r.lock);
+
+    for (gcc::log::channel_t& channel : r.channels) {
+        if (!strcmp(channel.name, name))
+            return &channel;
+    }
+
+    r.channels.emplace_back();
+    r.channels.back().name = name;
+    r.channels.back().enabled.store(channel_enabled(r, name));
+
+    return &r.channels.back();
+}
+
+void gcc::log::set_channel(const char *name, bool enabled)
+{
+    registry& r = configured_registry();
+    std::lock_guard<std::mutex> guard(r.lock);
+
+    r.rules.push_back({ name, enabled });
+
+    for (gcc::log::channel_t& channel : r.channels) {
+        if (!strcmp(channel.name, name))
+            channel.enabled.store(enabled);
+    }
+}
+
+void gcc::log::write(int lvl, const gcc::log::channel_t *channel, const char *func, const char *fmt, ...)
+{
+    buffer& buf = tls_buffer;
+    va_list args;
+
+    (void)__configured;
+
+    if (!gcc::log::enabled(lvl))
+        return;
+
+    if (lvl >= LOG_WARN && tls_sink) {
+        va_start(args, fmt);
+        int n = vsnprintf(nullptr, 0, fmt, args);
+        va_end(args);
+
+        if (n < 0)
+            return;
+
+        std::vector<char> msg(n + 1);
+
+        va_start(args, fmt);
+        vsnprintf(msg.data(), n + 1, fmt, args);
+        va_end(args);
+
+        tls_sink->push_back({ lvl, channel->name, func, std::string(msg.data(), n) });
+        return;
+    }
+
+    for (int attempt = 0; attempt < 2; ++attempt) {
+        size_t left = LOG_BUFFER_SIZE - buf.len;
+        int n = snprintf(buf.data + buf.len, left, "%s:%s:%s: ", __level_str[lvl], channel->name, func);
+
+        if (n >= 0 && (size_t)n < left) {
+            va_start(args, fmt);
+            int m = vsnprintf(buf.data + buf.len + n, left - n, fmt, args);
+            va_end(args);
+
+            if (m >= 0 && (size_t)(n + m) < left) {
+                buf.len += n + m;
+
+                if (lvl >= LOG_WARN)
+                    buf.flush();
+                return;
+            }
+        }
+
+        /* didn't fit, make room and try again */
+        if (!buf.len)
+            break;
+        buf.flush();
+    }
+
+    /* message is larger than the whole buffer, format it on the heap */
+    int n = snprintf(nullptr, 0, "%s:%s:%s: ", __level_str[lvl], channel->name, func);
+
+    va_start(args, fmt);
+    int m = vsnprintf(nullptr, 0, fmt, args);
+    va_end(args);
+
+    if (n < 0 || m < 0)
+        return;
+
+    std::vector<char> msg(n + m + 1);
+
+    snprintf(msg.data(), n + 1, "%s:%s:%s: ", __level_str[lvl], channel->name, func);
+
+    va_start(args, fmt);
+    vsnprintf(msg.data() + n, m + 1, fmt, args);
+    va_end(args);
+
+    write_all(msg.data(), n + m);
+}
+
+void gcc::log::flush()
+{
+    tls_buffer.flush();
+}
+
+std::vector<gcc::log::diagnostic_t> *gcc::log::capture(std::vector<gcc::log::diagnostic_t> *sink)
+{
+    std::vector<gcc::log::diagnostic_t> *prev = tls_sink;
+
+    tls_sink = sink;
+    return prev;
+}
+
+void gcc::log::report(const gcc::log::diagnostic_t& diag)
+{
+    gcc::log::write(diag.level, gcc::log::get_channel(diag.channel), diag.func, "%s", diag.message.c_str());
+}
+
+const char *gcc::log::level_str(int lvl)
+{
+    return __level_str[lvl];
+}
@@ -1,36 +1,108 @@
 #ifndef __LOG_HH__
 #define __LOG_HH__
 
+#include <atomic>
 #include <cstdio>
 #include <cstdarg>
 #include <string>
+#include <vector>
 
-#define LOG_LEVEL_ERROR "\x1b[31merror\x1b[0m"
-#define LOG_LEVEL_WARN  "\x1b[33mwarn\x1b[0m"
-#define LOG_LEVEL_INFO  "\x1b[34minfo\x1b[0m"
-#define LOG_LEVEL_DEBUG "debug"
+/* log levels, from least to most severe */
+#define LOG_DEBUG 0
+#define LOG_INFO  1
+#define LOG_WARN  2
+#define LOG_ERROR 3
 
-#define __gcc_debug(level, fmt, ...) \
-	fprintf(stderr, "%s:%s:%s: " fmt, level, \
-            CHANNEL, __func__, ##__VA_ARGS__)
+/* Messages below LOG_MIN_LEVEL are compiled out entirely: the level test
+ * is a constant so the call, its arguments and the format string all
+ * disappear. The Makefile sets this from LOG_LEVEL (make LOG_LEVEL=DEBUG). */
+#ifndef LOG_MIN_LEVEL
+#define LOG_MIN_LEVEL LOG_INFO
+#endif
 
-#define __gcc_debug_once(level, fmt, ...) \
+namespace gcc {
+    namespace log {
+
+        typedef struct channel {
+            const char *name;
+            std::atomic<bool> enabled;
+        } channel_t;
+
+        /* messages below this level are dropped at runtime,
+         * defaults to LOG_MIN_LEVEL or GABRIEL_LOG_LEVEL if it's set */
+        extern std::atomic<int> level;
+
+        static inline bool enabled(int lvl)
+        {
+            return lvl >= level.load(std::memory_order_relaxed);
+        }
+
+        void set_level(int lvl);
+
+        /* return the channel called name, creating it if needed.
+         * Channels are enabled unless GABRIEL_LOG says otherwise */
+        gcc::log::channel_t *get_channel(const char *name);
+
+        /* enable or disable a channel by name */
+        void set_channel(const char *name, bool enabled);
+
+        /* Format the message into the calling thread's buffer. The buffer is
+         * written out with a single write(2) when it fills up, when a warning
+         * or an error is logged and when the thread exits, so threads never
+         * contend on stderr for debug output. */
+        void write(int lvl, const gcc::log::channel_t *channel, const char *func, const char *fmt, ...)
+            __attribute__((format(printf, 4, 5)));
+
+        /* write out the calling thread's buffer */
+        void flush();
+
+        /* a warning or an error captured for one translation unit */
+        typedef struct diagnostic {
+            int level;
+            const char *channel;
+            const char *func;
+            std::string message;
+        } diagnostic_t;
+
+        /* Collect the calling thread's warnings and errors into sink instead
+         * of writing them out, nullptr goes back to writing. Lets parallel
+         * compilations report diagnostics per file and in input order.
+         * Returns the previous sink so captures can nest. */
+        std::vector<gcc::log::diagnostic_t> *capture(std::vector<gcc::log::diagnostic_t> *sink);
+
+        /* report a captured diagnostic again from the calling thread */
+        void report(const gcc::log::diagnostic_t& diag);
+
+        /* level name as it's printed, colored for warnings and errors */
+        const char *level_str(int lvl);
+    };
+};
+
+/* the channel is looked up once per call site and only if the level is enabled */
+#define __gcc_log(lvl, fmt, ...) \
     do { \
-        static int __dbg_once_##level; \
-        if (!__dbg_once_##level) { \
-            __gcc_debug(level, fmt, ##__VA_ARGS__); \
-            __dbg_once_##level = 1; \
+        if (lvl >= LOG_MIN_LEVEL && gcc::log::enabled(lvl)) { \
+            static gcc::log::channel_t *__log_channel = gcc::log::get_channel(CHANNEL); \
+            if (__log_channel->enabled.load(std::memory_order_relaxed)) \
+                gcc::log::write(lvl, __log_channel, __func__, fmt, ##__VA_ARGS__); \
         } \
     } while (0)
 
-#define DEBUG(fmt,  ...) __gcc_debug(LOG_LEVEL_DEBUG,  fmt, ##__VA_ARGS__)
-#define ERROR(fmt,  ...) __gcc_debug(LOG_LEVEL_ERROR, fmt, ##__VA_ARGS__)
-#define WARN(fmt,   ...) __gcc_debug(LOG_LEVEL_WARN,  fmt, ##__VA_ARGS__)
-#define INFO(fmt,   ...) __gcc_debug(LOG_LEVEL_INFO,  fmt, ##__VA_ARGS__)
+#define __gcc_log_once(lvl, fmt, ...) \
+    do { \
+        static std::atomic<bool> __log_once(false); \
+        if (lvl >= LOG_MIN_LEVEL && !__log_once.exchange(true, std::memory_order_relaxed)) \
+            __gcc_log(lvl, fmt, ##__VA_ARGS__); \
+    } while (0)
+
+#define DEBUG(fmt,  ...) __gcc_log(LOG_DEBUG, fmt, ##__VA_ARGS__)
+#define ERROR(fmt,  ...) __gcc_log(LOG_ERROR, fmt, ##__VA_ARGS__)
+#define WARN(fmt,   ...) __gcc_log(LOG_WARN,  fmt, ##__VA_ARGS__)
+#define INFO(fmt,   ...) __gcc_log(LOG_INFO,  fmt, ##__VA_ARGS__)
 
-#define DEBUG_ONCE(fmt,  ...) __gcc_debug_once(LOG_LEVEL_DEBUG,  fmt, ##__VA_ARGS__)
-#define ERROR_ONCE(fmt,  ...) __gcc_debug_once(LOG_LEVEL_ERROR, fmt, ##__VA_ARGS__)
-#define WARN_ONCE(fmt,   ...) __gcc_debug_once(LOG_LEVEL_WARN,  fmt, ##__VA_ARGS__)
-#define INFO_ONCE(fmt,   ...) __gcc_debug_once(LOG_LEVEL_INFO,  fmt, ##__VA_ARGS__)
+#define DEBUG_ONCE(fmt,  ...) __gcc_log_once(LOG_DEBUG, fmt, ##__VA_ARGS__)
+#define ERROR_ONCE(fmt,  ...) __gcc_log_once(LOG_ERROR, fmt, ##__VA_ARGS__)
+#define WARN_ONCE(fmt,   ...) __gcc_log_once(LOG_WARN,  fmt, ##__VA_ARGS__)
+#define INFO_ONCE(fmt,   ...) __gcc_log_once(LOG_INFO,  fmt, ##__VA_ARGS__)
 
 #endif /* __LOG_HH__ */
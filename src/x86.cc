@@ -0,0 +1,392 @@
+#include <cinttypes>
+#include <cstdio>
+
+#include "x86.hh"
+
+static const char *reg_names[4][17] = {
+    { "al", "cl", "dl", "bl", "spl", "bpl", "sil", "dil",
+      "r8b", "r9b", "r10b", "r11b", "r12b", "r13b", "r14b", "r15b", "rip" },
+    { "ax", "cx", "dx", "bx", "sp", "bp", "si", "di",
+      "r8w", "r9w", "r10w", "r11w", "r12w", "r13w", "r14w", "r15w", "rip" },
+    { "eax", "ecx", "edx", "ebx", "esp", "ebp", "esi", "edi",
+      "r8d", "r9d", "r10d", "r11d", "r12d", "r13d", "r14d", "r15d", "rip" },
+    { "rax", "rcx", "rdx", "rbx", "rsp", "rbp", "rsi", "rdi",
+      "r8", "r9", "r10", "r11", "r12", "r13", "r14", "r15", "rip" },
+};
+
+static const char *cond_names[] = {
+    "o", "no", "b", "ae", "e", "ne", "be", "a",
+    "s", "ns", "p", "np", "l", "ge", "le", "g",
+};
+
+/* AT&T names, without the size suffix if sized is set */
+static const struct {
+    const char *name;
+    bool sized;
+} mnemonics[] = {
+    { "mov",  true },
+    { "movs", false },
+    { "movz", false },
+    { "lea",  true },
+    { "add",  true },
+    { "sub",  true },
+    { "imul", true },
+    { "and",  true },
+    { "or",   true },
+    { "xor",  true },
+    { "cmp",  true },
+    { "test", true },
+    { "neg",  true },
+    { "not",  true },
+    { "shl",  true },
+    { "shr",  true },
+    { "sar",  true },
+    { "cqto", false },
+    { "idiv", true },
+    { "div",  true },
+    { "set",  false },
+    { "jmp",  false },
+    { "j",    false },
+    { "call", false },
+    { "ret",  false },
+    { "push", true },
+    { "pop",  true },
+    { "movd",         false },
+    { "movdqu",       false },
+    { "paddb",        false },
+    { "paddw",        false },
+    { "paddd",        false },
+    { "paddq",        false },
+    { "psubb",        false },
+    { "psubw",        false },
+    { "psubd",        false },
+    { "psubq",        false },
+    { "pmullw",       false },
+    { "pmulld",       false },
+    { "pmuludq",      false },
+    { "pand",         false },
+    { "por",          false },
+    { "pxor",         false },
+    { "psllw",        false },
+    { "pslld",        false },
+    { "psllq",        false },
+    { "psrlw",        false },
+    { "psrld",        false },
+    { "psrlq",        false },
+    { "psraw",        false },
+    { "psrad",        false },
+    { "psrldq",       false },
+    { "pshufd",       false },
+    { "punpcklbw",    false },
+    { "punpcklwd",    false },
+    { "punpckldq",    false },
+    { "punpcklqdq",   false },
+    { "psadbw",       false },
+    { "vpbroadcastb", false },
+    { "vpbroadcastw", false },
+    { "vpbroadcastd", false },
+    { "vpbroadcastq", false },
+    { "vextracti128", false },
+    { "vzeroupper",   false },
+};
+
+static_assert(sizeof(mnemonics) / sizeof(mnemonics[0]) == gcc::x86::I_LAST, "mnemonic table out of date");
+
+static char suffix(unsigned size)
+{
+    switch (size) {
+        case 1:  return 'b';
+        case 2:  return 'w';
+        case 4:  return 'l';
+        default: return 'q';
+    }
+}
+
+static unsigned size_index(unsigned size)
+{
+    switch (size) {
+        case 1:  return 0;
+        case 2:  return 1;
+        case 4:  return 2;
+        default: return 3;
+    }
+}
+
+const char *gcc::x86::reg_str(uint8_t reg, unsigned size)
+{
+    static const char *vector_names[2][16] = {
+        { "xmm0", "xmm1", "xmm2", "xmm3", "xmm4", "xmm5", "xmm6", "xmm7",
+          "xmm8", "xmm9", "xmm10", "xmm11", "xmm12", "xmm13", "xmm14", "xmm15" },
+        { "ymm0", "ymm1", "ymm2", "ymm3", "ymm4", "ymm5", "ymm6", "ymm7",
+          "ymm8", "ymm9", "ymm10", "ymm11", "ymm12", "ymm13", "ymm14", "ymm15" },
+    };
+
+    if (is_vector_reg(reg))
+        return vector_names[size == 32][reg - XMM0];
+
+    return reg <= RIP ? reg_names[size_index(size)][reg] : "?";
+}
+
+const char *gcc::x86::cond_str(uint8_t cc)
+{
+    return cond_names[cc & 0xf];
+}
+
+gcc::x86::asm_writer::asm_writer(std::string& out):
+    out_(out),
+    section_(nullptr),
+    function_(SYM_NONE)
+{
+}
+
+void gcc::x86::asm_writer::section(const char *name)
+{
+    if (section_ == name)
+        return;
+
+    out_.append("\t");
+    out_.append(name);
+    out_.append("\n");
+    section_ = name;
+}
+
+void gcc::x86::asm_writer::begin_function(gcc::symbol_t name, bool local)
+{
+    const char *s = gcc::symbol_str(name);
+
+    section(".text");
+
+    if (!local)
+        out_.append("\t.globl\t").append(s).append("\n");
+
+    out_.append("\t.type\t").append(s).append(", @function\n");
+    out_.append("\t.p2align 4\n");
+    out_.append(s).append(":\n");
+    function_ = name;
+}
+
+void gcc::x86::asm_writer::end_function()
+{
+    const char *s = gcc::symbol_str(function_);
+
+    out_.append("\t.size\t").append(s).append(", .-").append(s).append("\n");
+    function_ = SYM_NONE;
+}
+
+void gcc::x86::asm_writer::label(uint32_t id)
+{
+    char buf[32];
+
+    snprintf(buf, sizeof(buf), ".L%u:\n", id);
+    out_.append(buf);
+}
+
+void gcc::x86::asm_writer::global(const gcc::ir::global_t& global)
+{
+    static const char *directives[] = { ".byte", ".value", ".long", ".quad" };
+    unsigned size = gcc::ir::type_size(global.type);
+    const char *s = gcc::symbol_str(global.name);
+    char buf[64];
+
+    /* references to extern globals go through the GOT, nothing to declare */
+    if (!global.defined)
+        return;
+
+    section(global.init ? ".data" : ".bss");
+
+    if (!global.local)
+        out_.append("\t.globl\t").append(s).append("\n");
+
+    snprintf(buf, sizeof(buf), ", @object\n\t.size\t%s, %u\n\t.align %u\n", s, size, size);
+    out_.append("\t.type\t").append(s).append(buf);
+    out_.append(s).append(":\n");
+
+    if (global.init)
+        snprintf(buf, sizeof(buf), "\t%s\t%" PRId64 "\n", directives[size_index(size)], global.init);
+    else
+        snprintf(buf, sizeof(buf), "\t.zero\t%u\n", size);
+
+    out_.append(buf);
+}
+
+void gcc::x86::asm_writer::operand(const gcc::x86::operand_t& op, unsigned size)
+{
+    char buf[64];
+
+    switch (op.kind) {
+        case OPND_REG:
+            out_.append("%").append(reg_str(op.reg, size));
+            return;
+
+        case OPND_IMM:
+            snprintf(buf, sizeof(buf), "$%" PRId64, op.imm);
+            break;
+
+        case OPND_LABEL:
+            snprintf(buf, sizeof(buf), ".L%" PRId64, op.imm);
+            break;
+
+        case OPND_SYMBOL:
+            out_.append(gcc::symbol_str(op.sym));
+
+            if (op.external)
+                out_.append("@PLT");
+            return;
+
+        case OPND_MEM:
+            if (op.reg == RIP) {
+                out_.append(gcc::symbol_str(op.sym));
+
+                if (op.external)
+                    out_.append("@GOTPCREL");
+                else if (op.disp)
+                    out_.append(op.disp > 0 ? "+" : "").append(std::to_string(op.disp));
+
+                out_.append("(%rip)");
+                return;
+            }
+
+            if (op.disp)
+                out_.append(std::to_string(op.disp));
+
+            out_.append("(");
+
+            if (op.reg != REG_NONE)
+                out_.append("%").append(reg_str(op.reg, 8));
+
+            if (op.index != REG_NONE) {
+                snprintf(buf, sizeof(buf), ",%%%s,%u", reg_str(op.index, 8), op.scale);
+                out_.append(buf);
+            }
+
+            out_.append(")");
+            return;
+
+        default:
+            return;
+    }
+
+    out_.append(buf);
+}
+
+/* AT&T order with the VEX forms' extra source, which is the destination */
+void gcc::x86::asm_writer::vector(const gcc::x86::inst_t& inst)
+{
+    const char *name = mnemonics[inst.op].name;
+    bool avx = inst.size == 32;
+
+    out_.append("\t");
+
+    switch (inst.op) {
+        case I_MOVD:
+            out_.append(inst.size == 8 ? "movq\t" : "movd\t");
+            operand(inst.src, is_vector_reg(inst.src.reg) ? 16 : inst.size);
+            out_.append(", ");
+            operand(inst.dst, is_vector_reg(inst.dst.reg) ? 16 : inst.size);
+            break;
+
+        case I_VZEROUPPER:
+            out_.append(name);
+            break;
+
+        case I_VPBROADCASTB:
+        case I_VPBROADCASTW:
+        case I_VPBROADCASTD:
+        case I_VPBROADCASTQ:
+            out_.append(name).append("\t");
+            operand(inst.src, 16);
+            out_.append(", ");
+            operand(inst.dst, 32);
+            break;
+
+        case I_VEXTRACTI128:
+            out_.append(name).append("\t$1, ");
+            operand(inst.src, 32);
+            out_.append(", ");
+            operand(inst.dst, 16);
+            break;
+
+        default:
+            if (avx)
+                out_.push_back('v');
+
+            out_.append(name).append("\t");
+            operand(inst.src, inst.size);
+
+            if (inst.op == I_PSHUFD || (avx && inst.op != I_MOVDQU)) {
+                out_.append(", ");
+                operand(inst.dst, inst.size);
+            }
+
+            out_.append(", ");
+            operand(inst.dst, inst.size);
+            break;
+    }
+
+    out_.append("\n");
+}
+
+void gcc::x86::asm_writer::emit(const gcc::x86::inst_t& inst)
+{
+    if (is_vector_op(inst.op)) {
+        vector(inst);
+        return;
+    }
+
+    out_.append("\t");
+
+    switch (inst.op) {
+        case I_MOV:
+            if (inst.src.kind == OPND_IMM && inst.size == 8 && !is_imm32(inst.src.imm))
+                out_.append("movabsq");
+            else
+                out_.append("mov").push_back(suffix(inst.size));
+            break;
+
+        case I_MOVSX:
+        case I_MOVZX:
+            if (inst.op == I_MOVSX && inst.src_size == 4) {
+                out_.append("movslq");
+                break;
+            }
+
+            out_.append(mnemonics[inst.op].name).push_back(suffix(inst.src_size));
+            out_.push_back(suffix(inst.size));
+            break;
+
+        case I_CQO:
+            out_.append(inst.size == 8 ? "cqto" : "cltd");
+            break;
+
+        case I_SETCC:
+        case I_JCC:
+            out_.append(mnemonics[inst.op].name).append(cond_str(inst.cc));
+            break;
+
+        default:
+            out_.append(mnemonics[inst.op].name);
+
+            if (mnemonics[inst.op].sized)
+                out_.push_back(suffix(inst.size));
+            break;
+    }
+
+    if (inst.src.kind != OPND_NONE) {
+        unsigned size = inst.size;
+
+        if (inst.op == I_MOVSX || inst.op == I_MOVZX)
+            size = inst.src_size;
+        else if (inst.op == I_SHL || inst.op == I_SHR || inst.op == I_SAR)
+            size = 1;
+
+        out_.append("\t");
+        operand(inst.src, size);
+    }
+
+    if (inst.dst.kind != OPND_NONE) {
+        out_.append(inst.src.kind != OPND_NONE ? ", " : "\t");
+        operand(inst.dst, inst.op == I_SETCC ? 1 : inst.size);
+    }
+
+    out_.append("\n");
+}
@@ -0,0 +1,245 @@
+#ifndef __X86_HH__
+#define __X86_HH__
+
+#include <cstdint>
+#include <string>
+
+#include "intern.hh"
+#include "ir.hh"
+
+namespace gcc {
+
+    /* x86-64 machine code.
+     *
+     * The code generator (see gcc::x86::codegen) selects instructions of
+     * this form with registers already allocated and hands them one at a
+     * time to a sink, which either prints them as GNU assembly or encodes
+     * them. A function is a stream of instructions and labels between
+     * begin_function() and end_function(), branches refer to labels by
+     * number and calls and rip-relative operands to symbols. */
+    namespace x86 {
+
+        /* registers in encoding order, the low four bits of the vector
+         * registers are their number, xmm or ymm depending on the size */
+        typedef enum reg {
+            RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+            R8, R9, R10, R11, R12, R13, R14, R15,
+            RIP,
+            XMM0 = 32, XMM1, XMM2, XMM3, XMM4, XMM5, XMM6, XMM7,
+            XMM8, XMM9, XMM10, XMM11, XMM12, XMM13, XMM14, XMM15,
+            REG_NONE = 0xff,
+        } reg_t;
+
+        static inline bool is_vector_reg(uint8_t reg)
+        {
+            return reg >= XMM0 && reg <= XMM15;
+        }
+
+        /* condition codes in encoding order */
+        typedef enum cond {
+            CC_O, CC_NO, CC_B, CC_AE, CC_E, CC_NE, CC_BE, CC_A,
+            CC_S, CC_NS, CC_P, CC_NP, CC_L, CC_GE, CC_LE, CC_G,
+        } cond_t;
+
+        /* the condition that holds when cc doesn't */
+        static inline uint8_t negate(uint8_t cc)
+        {
+            return cc ^ 1;
+        }
+
+        typedef enum mnemonic {
+            I_MOV,      /* a 64-bit immediate that doesn't sign extend from 32 bits is movabs */
+            I_MOVSX,    /* from src_size bytes */
+            I_MOVZX,    /* from src_size bytes, 1 or 2 */
+            I_LEA,
+            I_ADD,
+            I_SUB,
+            I_IMUL,
+            I_AND,
+            I_OR,
+            I_XOR,
+            I_CMP,
+            I_TEST,
+            I_NEG,
+            I_NOT,
+            I_SHL,      /* count in an immediate or cl */
+            I_SHR,
+            I_SAR,
+            I_CQO,      /* sign extend rax into rdx, cltd at size 4 */
+            I_IDIV,
+            I_DIV,
+            I_SETCC,
+            I_JMP,
+            I_JCC,
+            I_CALL,
+            I_RET,
+            I_PUSH,
+            I_POP,
+
+            /* Vector instructions, SSE2 on xmm registers at size 16 and
+             * AVX2 on ymm registers at size 32, where the destination is
+             * also the first source of the VEX form. Memory operands of the
+             * SSE2 forms other than movdqu must be aligned. */
+            I_MOVD,     /* between a general register of size 4 or 8 (movq) and the low lane of a vector one */
+            I_MOVDQU,
+            I_PADDB,
+            I_PADDW,
+            I_PADDD,
+            I_PADDQ,
+            I_PSUBB,
+            I_PSUBW,
+            I_PSUBD,
+            I_PSUBQ,
+            I_PMULLW,
+            I_PMULLD,   /* AVX2 only, SSE4.1 before */
+            I_PMULUDQ,
+            I_PAND,
+            I_POR,
+            I_PXOR,
+            I_PSLLW,    /* shifts are by an immediate */
+            I_PSLLD,
+            I_PSLLQ,
+            I_PSRLW,
+            I_PSRLD,
+            I_PSRLQ,
+            I_PSRAW,
+            I_PSRAD,
+            I_PSRLDQ,   /* by bytes, within each 16 bytes */
+            I_PSHUFD,   /* dst shuffled in place by the immediate src */
+            I_PUNPCKLBW,
+            I_PUNPCKLWD,
+            I_PUNPCKLDQ,
+            I_PUNPCKLQDQ,
+            I_PSADBW,
+            I_VPBROADCASTB,  /* the low lane of an xmm src to every lane, AVX2 only */
+            I_VPBROADCASTW,
+            I_VPBROADCASTD,
+            I_VPBROADCASTQ,
+            I_VEXTRACTI128,  /* the upper half of a ymm src to an xmm dst */
+            I_VZEROUPPER,
+            I_LAST,
+        } mnemonic_t;
+
+        static inline bool is_vector_op(uint8_t op)
+        {
+            return op >= I_MOVD;
+        }
+
+        enum {
+            OPND_NONE,
+            OPND_REG,
+            OPND_IMM,
+            OPND_MEM,      /* base + index * scale + disp, or sym + disp if base is RIP */
+            OPND_LABEL,    /* imm is the label */
+            OPND_SYMBOL,   /* call target */
+        };
+
+        typedef struct operand {
+            uint8_t kind;
+            uint8_t reg;         /* OPND_REG, or the base of OPND_MEM (REG_NONE for none) */
+            uint8_t index;       /* REG_NONE for none */
+            uint8_t scale;       /* 1, 2, 4 or 8 */
+            bool external;       /* symbol may be in another module: through the GOT or PLT */
+            int32_t disp;
+            int64_t imm;
+            gcc::symbol_t sym;
+        } operand_t;
+
+        static inline operand_t none()
+        {
+            return { OPND_NONE, REG_NONE, REG_NONE, 1, false, 0, 0, SYM_NONE };
+        }
+
+        static inline operand_t reg(uint8_t r)
+        {
+            return { OPND_REG, r, REG_NONE, 1, false, 0, 0, SYM_NONE };
+        }
+
+        static inline operand_t imm(int64_t value)
+        {
+            return { OPND_IMM, REG_NONE, REG_NONE, 1, false, 0, value, SYM_NONE };
+        }
+
+        static inline operand_t mem(uint8_t base, int32_t disp, uint8_t index = REG_NONE, uint8_t scale = 1)
+        {
+            return { OPND_MEM, base, index, scale, false, disp, 0, SYM_NONE };
+        }
+
+        static inline operand_t rip(gcc::symbol_t sym, bool external = false)
+        {
+            return { OPND_MEM, RIP, REG_NONE, 1, external, 0, 0, sym };
+        }
+
+        static inline operand_t label(uint32_t id)
+        {
+            return { OPND_LABEL, REG_NONE, REG_NONE, 1, false, 0, id, SYM_NONE };
+        }
+
+        static inline operand_t symbol(gcc::symbol_t sym, bool external)
+        {
+            return { OPND_SYMBOL, REG_NONE, REG_NONE, 1, external, 0, 0, sym };
+        }
+
+        /* true if value is an immediate of an instruction other than mov */
+        static inline bool is_imm32(int64_t value)
+        {
+            return value == (int32_t)value;
+        }
+
+        /* Operands are in Intel order: dst is written (and read by the
+         * two-operand forms), src is read. One-operand instructions use
+         * dst. */
+        typedef struct inst {
+            uint8_t op;          /* mnemonic_t */
+            uint8_t size;        /* operand size: 1, 2, 4 or 8, 16 or 32 for vectors */
+            uint8_t cc;          /* cond_t of I_JCC and I_SETCC */
+            uint8_t src_size;    /* I_MOVSX and I_MOVZX */
+            operand_t dst;
+            operand_t src;
+        } inst_t;
+
+        const char *reg_str(uint8_t reg, unsigned size);
+        const char *cond_str(uint8_t cc);
+
+        /* Consumer of generated code. Labels are numbered per module and
+         * may be referenced before they're placed. */
+        class sink {
+            public:
+                virtual ~sink() {}
+
+                virtual void begin_function(gcc::symbol_t name, bool local) = 0;
+                virtual void end_function() = 0;
+                virtual void label(uint32_t id) = 0;
+                virtual void emit(const gcc::x86::inst_t& inst) = 0;
+
+                /* storage and initializer of a global variable, extern ones included */
+                virtual void global(const gcc::ir::global_t& global) = 0;
+        };
+
+        /* prints GNU assembler input in AT&T syntax to out */
+        class asm_writer : public sink {
+            public:
+                asm_writer(std::string& out);
+
+                void begin_function(gcc::symbol_t name, bool local);
+                void end_function();
+                void label(uint32_t id);
+                void emit(const gcc::x86::inst_t& inst);
+                void global(const gcc::ir::global_t& global);
+
+            private:
+                asm_writer(const asm_writer&);
+                asm_writer& operator=(const asm_writer&);
+
+                void operand(const gcc::x86::operand_t& op, unsigned size);
+                void vector(const gcc::x86::inst_t& inst);
+                void section(const char *name);
+
+                std::string& out_;
+                const char *section_;
+                gcc::symbol_t function_;
+        };
+    };
+};
+
+#endif /* __X86_HH__ */
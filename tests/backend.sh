@@ -0,0 +1,157 @@
+#!/bin/sh
+# The x86-64 backend against the system compiler: the kernels of
+# bench/kernels.hh built by gabriel with -S, -c and --jit, at -O 0 and
+# -O 1 and with -m scalar, sse2 and avx2 (if the CPU has it), must give
+# the checksums of the same kernels built by cc -O1.
+#
+# -S and -c builds are linked with the benchmark harness and compared
+# line by line with its output. --jit runs each kernel once from an
+# entry point that returns the number of the first kernel whose result
+# isn't what the cc build returned.
+#
+# usage: backend.sh [compiler]
+
+compiler=${1:-./gabriel}
+kernels_hh=$(dirname "$0")/../bench/kernels.hh
+cc=${CC:-cc}
+dir=$(mktemp -d /tmp/gabriel-test-XXXXXX) || exit 1
+trap 'rm -rf "$dir"' EXIT
+
+# the raw string $1 of kernels.hh
+extract() {
+    sed -n "/$1 = R\"(/,/^)\";/p" "$kernels_hh" | sed '1s/.*R"(//; $d'
+}
+
+extract kernels_source > "$dir/kernels.c"
+extract harness_source > "$dir/harness.c"
+
+# each kernel once over a fresh buffer, with the harness's sizes
+cat > "$dir/run.c" <<'EOF'
+void *malloc(size_t n);
+
+static void fill(uint8_t *buf)
+{
+    for (size_t i = 0; i < 65536; ++i)
+        buf[i] = (uint8_t)(i * 131 + 7);
+}
+
+long run_kernel(uint8_t *buf, long k)
+{
+    fill(buf);
+
+    if (k == 0)
+        return sum_u8(buf, 65536);
+    if (k == 1)
+        return copy_u8(buf, 65536);
+    if (k == 2)
+        return dot_u32(buf, 65536);
+    if (k == 3)
+        return saxpy_u32(buf, 65536);
+    if (k == 4)
+        return crc32(buf, 4096);
+    if (k == 5)
+        return collatz(buf, 4096);
+    if (k == 6)
+        return sieve(buf, 65536);
+    if (k == 7)
+        return matmul(buf, 65536);
+    return fib_rec(buf, 22);
+}
+EOF
+
+cat > "$dir/print.c" <<'EOF'
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+long run_kernel(uint8_t *buf, long k);
+
+int main(void)
+{
+    uint8_t *buf = malloc(65536);
+
+    for (long k = 0; k < 9; ++k)
+        printf("%ld\n", run_kernel(buf, k));
+    return 0;
+}
+EOF
+
+cat "$dir/kernels.c" "$dir/run.c" > "$dir/kernels_run.c"
+
+if ! $cc -O1 -w -include stdint.h -include stddef.h -c -o "$dir/ref.o" "$dir/kernels.c" ||
+   ! $cc -O1 -o "$dir/ref" "$dir/harness.c" "$dir/ref.o" ||
+   ! "$dir/ref" 1 1 | awk '{ print $1, $3 }' > "$dir/ref.out" ||
+   ! $cc -O1 -w -include stdint.h -include stddef.h -o "$dir/print" "$dir/print.c" "$dir/kernels_run.c" ||
+   ! "$dir/print" > "$dir/expected"; then
+    echo "FAIL: the reference build with $cc"
+    exit 1
+fi
+
+# the entry point for --jit, k + 1 for a wrong result of kernel k
+{
+    cat "$dir/kernels_run.c"
+    echo "int main(void)"
+    echo "{"
+    echo "    uint8_t *buf = malloc(65536);"
+    k=0
+    while read -r value; do
+        echo "    if (run_kernel(buf, $k) != $value)"
+        echo "        return $((k + 1));"
+        k=$((k + 1))
+    done < "$dir/expected"
+    echo "    return 0;"
+    echo "}"
+} > "$dir/jit.c"
+
+isas="scalar sse2"
+grep -qw avx2 /proc/cpuinfo 2> /dev/null && isas="$isas avx2"
+
+status=0
+
+# compare the harness linked with $dir/$1.o to the reference, wrong code
+# may well not terminate
+check() {
+    if ! $cc -O1 -o "$dir/$1" "$dir/harness.c" "$dir/$1.o" ||
+       ! timeout 60 "$dir/$1" 1 1 | awk '{ print $1, $3 }' > "$dir/$1.out" ||
+       ! cmp -s "$dir/ref.out" "$dir/$1.out"; then
+        echo "FAIL: $2"
+        diff "$dir/ref.out" "$dir/$1.out"
+        status=1
+    fi
+}
+
+for level in 0 1; do
+    for isa in $isas; do
+        flags="-O $level -m $isa"
+
+        if "$compiler" $flags -S "$dir/kernels.c" > "$dir/log" 2>&1 &&
+           $cc -c -o "$dir/asm.o" "$dir/kernels.c.s" >> "$dir/log" 2>&1; then
+            check asm "-S $flags"
+        else
+            echo "FAIL: -S $flags didn't build"
+            cat "$dir/log"
+            status=1
+        fi
+
+        if "$compiler" $flags -c "$dir/kernels.c" > "$dir/log" 2>&1; then
+            mv "$dir/kernels.c.o" "$dir/obj.o"
+            check obj "-c $flags"
+        else
+            echo "FAIL: -c $flags didn't build"
+            cat "$dir/log"
+            status=1
+        fi
+
+        timeout 60 "$compiler" $flags --jit "$dir/jit.c" > "$dir/log" 2>&1
+        result=$?
+
+        if [ $result -ne 0 ]; then
+            echo "FAIL: --jit $flags returned $result"
+            cat "$dir/log"
+            status=1
+        fi
+    done
+done
+
+[ $status -eq 0 ] && echo "ok: backend ($isas)"
+exit $status
@@ -0,0 +1,60 @@
+#!/bin/sh
+# A .ast image whose node references loop back must be refused as invalid,
+# not followed until the stack runs out. Patches a valid image so that a
+# node's l or a statement list entry refers to the node itself.
+#
+# usage: image_cycle.sh [compiler]
+
+compiler=${1:-./gabriel}
+dir=$(mktemp -d /tmp/gabriel-test-XXXXXX) || exit 1
+trap 'rm -rf "$dir"' EXIT
+
+cat > "$dir/prog.c" <<'EOF'
+int main(void)
+{
+    int a = 1;
+    return a + 2;
+}
+EOF
+
+if ! "$compiler" --emit-ast "$dir/prog.c" > "$dir/out" 2>&1; then
+    echo "FAIL: --emit-ast"
+    cat "$dir/out"
+    exit 1
+fi
+
+# u32 at offset $2 of file $1
+u32() {
+    od -An -tu4 -j"$2" -N4 "$1" | tr -d ' '
+}
+
+# store the u32 $3 at offset $2 of file $1, little-endian
+put32() {
+    printf "$(printf '\\%03o\\%03o\\%03o\\%03o' $(($3 & 255)) $(($3 >> 8 & 255)) $(($3 >> 16 & 255)) $(($3 >> 24 & 255)))" |
+        dd of="$1" bs=1 seek="$2" conv=notrunc 2> /dev/null
+}
+
+# the header is 16 bytes followed by an offset and a count per section,
+# nodes are the third section and statement lists the fourth; node 1,
+# the body of main, is the first record and its l is 16 bytes in
+nodes=$(u32 "$dir/prog.c.ast" 32)
+lists=$(u32 "$dir/prog.c.ast" 40)
+status=0
+
+for patch in "node l $((nodes + 16))" "statement list $lists"; do
+    offset=${patch##* }
+    cp "$dir/prog.c.ast" "$dir/bad.ast"
+    put32 "$dir/bad.ast" "$offset" 1
+
+    "$compiler" --emit-ir "$dir/bad.ast" > "$dir/out" 2>&1
+    result=$?
+
+    if [ $result -ne 1 ] || ! grep -q "Invalid AST image" "$dir/out"; then
+        echo "FAIL: a ${patch% *} referring to its own node gave status $result"
+        cat "$dir/out"
+        status=1
+    fi
+done
+
+[ $status -eq 0 ] && echo "ok: image_cycle"
+exit $status
@@ -0,0 +1,50 @@
+#!/bin/sh
+# Integer constants keep all 64 bits and get their C type: an unsuffixed
+# decimal is int, then long; octal and hex may be unsigned int first, and
+# u and l suffixes select unsigned and long. Checked with --jit, main
+# returns a bit for each constant that came out wrong.
+#
+# usage: integer_constants.sh [compiler]
+
+compiler=${1:-./gabriel}
+dir=$(mktemp -d /tmp/gabriel-test-XXXXXX) || exit 1
+trap 'rm -rf "$dir"' EXIT
+
+cat > "$dir/constants.c" <<'EOF'
+long big = 123456789012;
+long x = 4294967296;
+
+int main(void)
+{
+    long a = 123456789012;
+    int r = 0;
+
+    if (a / 1000 != 123456789)
+        r = r + 1;
+    if (x >> 32 != 1)
+        r = r + 2;
+    if (big != a)
+        r = r + 4;
+    if (3000000000 < 0)
+        r = r + 8;
+    if (0xFFFFFFFF < 0)
+        r = r + 16;
+    if (-1 < 0u)
+        r = r + 32;
+    if (sizeof(2147483648) != 8 || sizeof(0xFFFFFFFF) != 4 || sizeof(1l) != 8)
+        r = r + 64;
+    return r;
+}
+EOF
+
+"$compiler" --jit "$dir/constants.c" > "$dir/out" 2>&1
+result=$?
+
+if [ $result -ne 0 ]; then
+    echo "FAIL: integer_constants returned $result"
+    cat "$dir/out"
+    exit 1
+fi
+
+echo "ok: integer_constants"
+exit 0
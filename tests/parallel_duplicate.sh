@@ -0,0 +1,31 @@
+#!/bin/sh
+# A function defined twice in a file large enough for its bodies to be
+# parsed in parallel must be refused the same way as with -j1.
+#
+# usage: parallel_duplicate.sh [compiler]
+
+compiler=${1:-./gabriel}
+dir=$(mktemp -d /tmp/gabriel-test-XXXXXX) || exit 1
+trap 'rm -rf "$dir"' EXIT
+
+i=0
+while [ $i -lt 6000 ]; do
+    echo "long f$i(long a) { long b = a * 3; return b + $i; }"
+    i=$((i + 1))
+done > "$dir/dup.c"
+echo "long f1(long a) { return a; }" >> "$dir/dup.c"
+
+status=0
+
+for jobs in 1 4; do
+    "$compiler" -j$jobs "$dir/dup.c" > "$dir/out" 2>&1
+
+    if [ $? -ne 1 ] || ! grep -q "Duplicate function f1() found!" "$dir/out"; then
+        echo "FAIL: -j$jobs accepted a duplicate definition"
+        cat "$dir/out"
+        status=1
+    fi
+done
+
+[ $status -eq 0 ] && echo "ok: parallel_duplicate"
+exit $status
@@ -0,0 +1,80 @@
+#!/bin/sh
+# #if evaluates in 64 bits with gcc's signed and unsigned rules: a number
+# is unsigned if it has a u suffix or doesn't fit intmax_t, and so is an
+# operation with an unsigned operand. Checked with --jit, main returns a
+# bit for each #if that took the wrong branch, directly and through a
+# precompiled header.
+#
+# usage: preprocessor_if.sh [compiler]
+
+compiler=${1:-./gabriel}
+dir=$(mktemp -d /tmp/gabriel-test-XXXXXX) || exit 1
+trap 'rm -rf "$dir"' EXIT
+
+cat > "$dir/big.h" <<'EOF'
+#define BIG 3000000000
+#define UBIG 18446744073709551615u
+#define PASTE(a, b) a ## b
+
+int f(void);
+EOF
+
+cat > "$dir/if.c" <<'EOF'
+int main(void)
+{
+    int r = 0;
+
+#if 3000000000 > 2 && 4294967295 > 0 && BIG > 2
+#else
+    r = r + 1;
+#endif
+#if -1 < 0u
+    r = r + 2;
+#endif
+#if !(0xFFFFFFFF > -1) || UBIG != -1
+    r = r + 4;
+#endif
+#if (-1 >> 63) != -1 || (UBIG >> 63) != 1 || -1 / 2u != 9223372036854775807
+    r = r + 8;
+#endif
+#if (1 ? -1 : 0u) < 0
+    r = r + 16;
+#endif
+#if PASTE(29999, 99999) + 1 != BIG || PASTE(1, 2u) - 13 < 0
+    r = r + 32;
+#endif
+    if (PASTE(2999, 999999) + 1 != BIG)
+        r = r + 64;
+    return r;
+}
+EOF
+
+status=0
+
+{ echo '#include "big.h"'; cat "$dir/if.c"; } > "$dir/direct.c"
+"$compiler" --jit "$dir/direct.c" > "$dir/out" 2>&1
+result=$?
+
+if [ $result -ne 0 ]; then
+    echo "FAIL: #if with 64-bit numbers returned $result"
+    cat "$dir/out"
+    status=1
+fi
+
+if ! "$compiler" --emit-pch "$dir/big.h" > "$dir/out" 2>&1; then
+    echo "FAIL: --emit-pch"
+    cat "$dir/out"
+    exit 1
+fi
+
+"$compiler" --include-pch="$dir/big.h.pch" --jit "$dir/if.c" > "$dir/out" 2>&1
+result=$?
+
+if [ $result -ne 0 ]; then
+    echo "FAIL: #if with 64-bit numbers from a precompiled header returned $result"
+    cat "$dir/out"
+    status=1
+fi
+
+[ $status -eq 0 ] && echo "ok: preprocessor_if"
+exit $status